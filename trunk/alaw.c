@@ -28,6 +28,7 @@
 ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #include "asterisk/alaw.h"
+#include "asterisk/simd.h"
 
 #define AMI_MASK 0x55
 
@@ -81,6 +82,115 @@ static inline short int alaw2linear (unsigned char alaw)
 unsigned char __ast_lin2a[8192];
 short __ast_alaw[256];
 
+static void alaw_decode_scalar(short *dst, const unsigned char *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_ALAW(*src++);
+}
+
+static void alaw_encode_scalar(unsigned char *dst, const short *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_LIN2A(*src++);
+}
+
+#ifdef AST_X86_SIMD
+/*
+ * The vector kernels compute the same values as the tables rather than
+ * looking them up.  The encode table holds linear2alaw(sample | 7) for each
+ * group of eight samples, since the last of the eight written wins.
+ */
+
+static AST_TARGET_SSE2 void alaw_decode_sse2(short *dst, const unsigned char *src, int samples)
+{
+	__m128i a, seg, has, y, neg;
+
+	for (; samples >= 8; samples -= 8, src += 8, dst += 8) {
+		a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) src), _mm_setzero_si128());
+		a = _mm_xor_si128(a, _mm_set1_epi16(AMI_MASK));
+		seg = _mm_and_si128(_mm_srli_epi16(a, 4), _mm_set1_epi16(7));
+		has = _mm_cmpgt_epi16(seg, _mm_setzero_si128());
+		/* segment 0 is linear, the rest are (i + 0x100) << (seg - 1) */
+		y = _mm_slli_epi16(_mm_and_si128(a, _mm_set1_epi16(0x0f)), 4);
+		y = _mm_add_epi16(y, _mm_and_si128(has, _mm_set1_epi16(0x100)));
+		y = _mm_mullo_epi16(y, ast_pow2_epi16(_mm_add_epi16(seg, has)));
+		neg = _mm_cmpeq_epi16(_mm_and_si128(a, _mm_set1_epi16(0x80)), _mm_setzero_si128());
+		y = _mm_sub_epi16(_mm_xor_si128(y, neg), neg);
+		_mm_storeu_si128((__m128i *) dst, y);
+	}
+	alaw_decode_scalar(dst, src, samples);
+}
+
+static AST_TARGET_SSE2 void alaw_encode_sse2(unsigned char *dst, const short *src, int samples)
+{
+	__m128i x, neg, pcm, seg, shift, mant, b;
+
+	for (; samples >= 8; samples -= 8, src += 8, dst += 8) {
+		x = _mm_or_si128(_mm_loadu_si128((const __m128i *) src), _mm_set1_epi16(7));
+		neg = _mm_srai_epi16(x, 15);
+		pcm = _mm_sub_epi16(_mm_xor_si128(x, neg), neg);
+		seg = ast_segment_epi16(pcm);
+		/* pcm >> (seg ? seg + 3 : 4) */
+		shift = _mm_sub_epi16(_mm_add_epi16(seg, _mm_set1_epi16(3)), _mm_cmpeq_epi16(seg, _mm_setzero_si128()));
+		mant = _mm_mulhi_epu16(pcm, ast_pow2_epi16(_mm_sub_epi16(_mm_set1_epi16(16), shift)));
+		b = _mm_or_si128(_mm_slli_epi16(seg, 4), _mm_and_si128(mant, _mm_set1_epi16(0x0f)));
+		b = _mm_xor_si128(b, _mm_or_si128(_mm_set1_epi16(AMI_MASK), _mm_andnot_si128(neg, _mm_set1_epi16(0x80))));
+		_mm_storel_epi64((__m128i *) dst, _mm_packus_epi16(b, b));
+	}
+	alaw_encode_scalar(dst, src, samples);
+}
+
+static AST_TARGET_AVX2 void alaw_decode_avx2(short *dst, const unsigned char *src, int samples)
+{
+	__m256i a, seg, has, y, neg;
+
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) src));
+		a = _mm256_xor_si256(a, _mm256_set1_epi16(AMI_MASK));
+		seg = _mm256_and_si256(_mm256_srli_epi16(a, 4), _mm256_set1_epi16(7));
+		has = _mm256_cmpgt_epi16(seg, _mm256_setzero_si256());
+		y = _mm256_slli_epi16(_mm256_and_si256(a, _mm256_set1_epi16(0x0f)), 4);
+		y = _mm256_add_epi16(y, _mm256_and_si256(has, _mm256_set1_epi16(0x100)));
+		y = _mm256_mullo_epi16(y, ast_pow2_epi16_avx2(_mm256_add_epi16(seg, has)));
+		neg = _mm256_cmpeq_epi16(_mm256_and_si256(a, _mm256_set1_epi16(0x80)), _mm256_setzero_si256());
+		y = _mm256_sub_epi16(_mm256_xor_si256(y, neg), neg);
+		_mm256_storeu_si256((__m256i *) dst, y);
+	}
+	alaw_decode_sse2(dst, src, samples);
+}
+
+static AST_TARGET_AVX2 void alaw_encode_avx2(unsigned char *dst, const short *src, int samples)
+{
+	__m256i x, neg, pcm, seg, shift, mant, b;
+
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		x = _mm256_or_si256(_mm256_loadu_si256((const __m256i *) src), _mm256_set1_epi16(7));
+		neg = _mm256_srai_epi16(x, 15);
+		pcm = _mm256_sub_epi16(_mm256_xor_si256(x, neg), neg);
+		seg = ast_segment_epi16_avx2(pcm);
+		shift = _mm256_sub_epi16(_mm256_add_epi16(seg, _mm256_set1_epi16(3)), _mm256_cmpeq_epi16(seg, _mm256_setzero_si256()));
+		mant = _mm256_mulhi_epu16(pcm, ast_pow2_epi16_avx2(_mm256_sub_epi16(_mm256_set1_epi16(16), shift)));
+		b = _mm256_or_si256(_mm256_slli_epi16(seg, 4), _mm256_and_si256(mant, _mm256_set1_epi16(0x0f)));
+		b = _mm256_xor_si256(b, _mm256_or_si256(_mm256_set1_epi16(AMI_MASK), _mm256_andnot_si256(neg, _mm256_set1_epi16(0x80))));
+		ast_store_epu8_avx2(dst, b);
+	}
+	alaw_encode_sse2(dst, src, samples);
+}
+#endif /* AST_X86_SIMD */
+
+static void (*alaw_decode)(short *dst, const unsigned char *src, int samples) = alaw_decode_scalar;
+static void (*alaw_encode)(unsigned char *dst, const short *src, int samples) = alaw_encode_scalar;
+
+void ast_alaw_decode(short *dst, const unsigned char *src, int samples)
+{
+	alaw_decode(dst, src, samples);
+}
+
+void ast_alaw_encode(unsigned char *dst, const short *src, int samples)
+{
+	alaw_encode(dst, src, samples);
+}
+
 void ast_alaw_init(void)
 {
 	int i;
@@ -97,5 +207,17 @@ void ast_alaw_init(void)
 		__ast_lin2a[((unsigned short)i) >> 3] = linear2alaw(i);
 	   }
 
+#ifdef AST_X86_SIMD
+	if (ast_cpu_has_avx2()) {
+		alaw_decode = alaw_decode_avx2;
+		if (ast_encoder_faster(alaw_encode_avx2, alaw_encode_scalar))
+			alaw_encode = alaw_encode_avx2;
+	} else if (ast_cpu_has_sse2()) {
+		alaw_decode = alaw_decode_sse2;
+		if (ast_encoder_faster(alaw_encode_sse2, alaw_encode_scalar))
+			alaw_encode = alaw_encode_sse2;
+	}
+#endif
+
 }
 
@@ -581,6 +581,7 @@ static int __ast_play_and_record(struct ast_channel *chan, const char *playfile,
 			ast_dsp_free(sildet);
 			return -1;
 		}
+		ast_dsp_analysis_attach(chan);
 	}
 
 	if (!prepend) {
@@ -625,7 +626,7 @@ static int __ast_play_and_record(struct ast_channel *chan, const char *playfile,
 				/* Silence Detection */
 				if (maxsilence > 0) {
 					int dspsilence = 0;
-					ast_dsp_silence(sildet, f, &dspsilence);
+					ast_dsp_silence_chan(sildet, chan, f, &dspsilence);
 					if (dspsilence)
 						totalsilence = dspsilence;
 					else
@@ -745,8 +746,10 @@ static int __ast_play_and_record(struct ast_channel *chan, const char *playfile,
 	if (outmsg == 2) {
 		ast_stream_and_wait(chan, "auth-thankyou", chan->language, "");
 	}
-	if (sildet)
+	if (sildet) {
+		ast_dsp_analysis_detach(chan);
 		ast_dsp_free(sildet);
+	}
 	return res;
 }
 
@@ -196,6 +196,7 @@ static void isAnsweringMachine(struct ast_channel *chan, void *data)
 		return;
 	}
 	ast_dsp_set_threshold(silenceDetector, silenceThreshold );
+	ast_dsp_analysis_attach(chan);
 
 	while ((ret = ast_waitfor(chan, totalAnalysisTime)))
 	{
@@ -221,7 +222,7 @@ static void isAnsweringMachine(struct ast_channel *chan, void *data)
 				break;
 			}
 			dspsilence = 0;
-			ast_dsp_silence(silenceDetector, f, &dspsilence);
+			ast_dsp_silence_chan(silenceDetector, chan, f, &dspsilence);
 			if (dspsilence ) {
 				silenceDuration = dspsilence;
 				if (silenceDuration >= betweenWordsSilence ) {
@@ -313,6 +314,7 @@ static void isAnsweringMachine(struct ast_channel *chan, void *data)
 	}
 
 	/* Free The Silence Detector DSP */
+	ast_dsp_analysis_detach(chan);
 	ast_dsp_free(silenceDetector );
 
 	return;
@@ -106,6 +106,7 @@ enum recording_state {
 };
 
 #define CONF_SIZE  320
+#define CONF_SAMPLES  (CONF_SIZE / 2)
 
 enum {
 	/*! user has admin access on the conference */
@@ -295,6 +296,14 @@ struct ast_conference {
 	struct ast_frame *origframe;
 	struct ast_trans_pvt *transpath[32];
 	AST_LIST_HEAD_NOLOCK(, ast_conf_user) userlist;
+	unsigned int softmix:1;                 /*!< Mixed in user space instead of by Zaptel */
+	ast_mutex_t mixlock;                    /*!< Software mixer lock (mixlist, user input, announcements) */
+	pthread_t mixthread;                    /*!< Software mixer thread */
+	int mixstop;                            /*!< Tells the software mixer thread to exit */
+	short *announce;                        /*!< Pending announcement audio for the software mixer */
+	int announcelen;                        /*!< Samples in announce */
+	int announcepos;                        /*!< Samples of announce already played */
+	AST_LIST_HEAD_NOLOCK(, ast_conf_user) mixlist;	/*!< Users attached to the software mixer */
 	AST_LIST_ENTRY(ast_conference) list;
 };
 
@@ -317,6 +326,15 @@ struct ast_conf_user {
 	time_t jointime;                        /*!< Time the user joined the conference */
 	struct volume talk;
 	struct volume listen;
+	int mixfds[2];                          /*!< Software mixer output pipe (read, write) */
+	int mixmode;                            /*!< ZT_CONF_* mode as seen by the software mixer */
+	short *mixring;                         /*!< Buffered talker audio for the software mixer */
+	int mixringsize;                        /*!< Size of mixring in samples */
+	int mixhead;                            /*!< Read position in mixring */
+	int mixlen;                             /*!< Samples waiting in mixring */
+	int mixcontrib;                         /*!< Contributed to the current mixing interval */
+	short mixin[CONF_SAMPLES];              /*!< Audio contributed to the current mixing interval */
+	AST_LIST_ENTRY(ast_conf_user) mixentry;
 	AST_LIST_ENTRY(ast_conf_user) list;
 };
 
@@ -324,6 +342,9 @@ struct ast_conf_user {
  *  when in a conference */
 static int audio_buffers;
 
+/*! Mix conferences in user space rather than through Zaptel pseudo channels */
+static int softmix_default;
+
 /*! Map 'volume' levels from -5 through +5 into
  *  decibel (dB) settings for channel drivers
  *  Note: these are not a straight linear-to-dB
@@ -385,6 +406,300 @@ static int careful_write(int fd, unsigned char *data, int len, int block)
 	return 0;
 }
 
+/*! \brief Add one talker's audio into the 32-bit mixing accumulator
+ * \note Kept as a plain loop over fixed-size arrays so the compiler can
+ *       vectorize it.
+ */
+static inline void softmix_accumulate(int *mix, const short *in, int samples)
+{
+	int x;
+
+	for (x = 0; x < samples; x++)
+		mix[x] += in[x];
+}
+
+/*! \brief Saturate the mixing accumulator back to signed linear, optionally
+ *  removing one talker's own contribution (the N-1 mix for that talker)
+ */
+static inline void softmix_saturate(short *out, const int *mix, const short *exclude, int samples)
+{
+	int x;
+	int s;
+
+	if (exclude) {
+		for (x = 0; x < samples; x++) {
+			s = mix[x] - exclude[x];
+			out[x] = (s > 32767) ? 32767 : ((s < -32768) ? -32768 : s);
+		}
+	} else {
+		for (x = 0; x < samples; x++) {
+			s = mix[x];
+			out[x] = (s > 32767) ? 32767 : ((s < -32768) ? -32768 : s);
+		}
+	}
+}
+
+/*! \brief Queue talker audio for the software mixer, dropping the oldest
+ *  audio if the user's buffer is full
+ */
+static void softmix_write(struct ast_conference *conf, struct ast_conf_user *user, short *data, int samples)
+{
+	int pos;
+	int x;
+
+	ast_mutex_lock(&conf->mixlock);
+	if (user->mixring && (user->mixmode & ZT_CONF_TALKER)) {
+		if (samples > user->mixringsize) {
+			data += samples - user->mixringsize;
+			samples = user->mixringsize;
+		}
+		if (user->mixlen + samples > user->mixringsize) {
+			x = user->mixlen + samples - user->mixringsize;
+			user->mixhead = (user->mixhead + x) % user->mixringsize;
+			user->mixlen -= x;
+		}
+		pos = (user->mixhead + user->mixlen) % user->mixringsize;
+		for (x = 0; x < samples; x++) {
+			user->mixring[pos] = data[x];
+			if (++pos == user->mixringsize)
+				pos = 0;
+		}
+		user->mixlen += samples;
+	}
+	ast_mutex_unlock(&conf->mixlock);
+}
+
+/*! \brief Take one mixing interval of audio from a user's buffer
+ *  \note Must be called with conf->mixlock held
+ */
+static void softmix_pull(struct ast_conf_user *user)
+{
+	int samples;
+	int x;
+
+	samples = (user->mixlen < CONF_SAMPLES) ? user->mixlen : CONF_SAMPLES;
+	for (x = 0; x < samples; x++) {
+		user->mixin[x] = user->mixring[user->mixhead];
+		if (++user->mixhead == user->mixringsize)
+			user->mixhead = 0;
+	}
+	if (samples < CONF_SAMPLES)
+		memset(user->mixin + samples, 0, (CONF_SAMPLES - samples) * sizeof(user->mixin[0]));
+	user->mixlen -= samples;
+}
+
+/*! \brief Queue a u-law sound (enter/leave) to be mixed into the conference */
+static void softmix_announce(struct ast_conference *conf, unsigned char *data, int len)
+{
+	short *announce;
+	int remaining;
+	int x;
+
+	ast_mutex_lock(&conf->mixlock);
+	remaining = conf->announcelen - conf->announcepos;
+	if ((announce = ast_malloc((remaining + len) * sizeof(*announce)))) {
+		if (remaining)
+			memcpy(announce, conf->announce + conf->announcepos, remaining * sizeof(*announce));
+		for (x = 0; x < len; x++)
+			announce[remaining + x] = AST_MULAW(data[x]);
+		if (conf->announce)
+			free(conf->announce);
+		conf->announce = announce;
+		conf->announcelen = remaining + len;
+		conf->announcepos = 0;
+	}
+	ast_mutex_unlock(&conf->mixlock);
+}
+
+/*! \brief Mix one interval of a software mixed conference
+ *
+ * Sums the buffered audio of all talkers into a 32-bit accumulator and
+ * hands each listener a saturated copy.  Talkers get the mix minus their
+ * own audio; everybody else shares a single mix, which is also published
+ * as the conference's origframe so listen-only users can share its
+ * translations.
+ */
+static void softmix_mix(struct ast_conference *conf)
+{
+	struct ast_conf_user *user;
+	struct ast_frame fr;
+	static const short silence[CONF_SAMPLES];
+	int mix[CONF_SAMPLES];
+	short shared[CONF_SAMPLES];
+	short out[CONF_SAMPLES];
+	const short *buf;
+	int samples;
+	int x;
+
+	memset(mix, 0, sizeof(mix));
+
+	ast_mutex_lock(&conf->mixlock);
+	AST_LIST_TRAVERSE(&conf->mixlist, user, mixentry) {
+		user->mixcontrib = 0;
+		if (!(user->mixmode & ZT_CONF_TALKER)) {
+			user->mixlen = 0;
+			continue;
+		}
+		if (!user->mixlen)
+			continue;
+		softmix_pull(user);
+		softmix_accumulate(mix, user->mixin, CONF_SAMPLES);
+		user->mixcontrib = 1;
+	}
+	if (conf->announce) {
+		samples = conf->announcelen - conf->announcepos;
+		if (samples > CONF_SAMPLES)
+			samples = CONF_SAMPLES;
+		softmix_accumulate(mix, conf->announce + conf->announcepos, samples);
+		conf->announcepos += samples;
+		if (conf->announcepos >= conf->announcelen) {
+			free(conf->announce);
+			conf->announce = NULL;
+			conf->announcelen = conf->announcepos = 0;
+		}
+	}
+	softmix_saturate(shared, mix, NULL, CONF_SAMPLES);
+	AST_LIST_TRAVERSE(&conf->mixlist, user, mixentry) {
+		if (!(user->mixmode & ZT_CONF_LISTENER))
+			buf = silence;
+		else if (user->mixcontrib) {
+			softmix_saturate(out, mix, user->mixin, CONF_SAMPLES);
+			buf = out;
+		} else
+			buf = shared;
+		/* a full pipe means the user isn't keeping up; drop this interval */
+		if ((write(user->mixfds[1], buf, CONF_SIZE) < 0) && (errno != EAGAIN) && option_debug)
+			ast_log(LOG_DEBUG, "Unable to write conference audio: %s\n", strerror(errno));
+	}
+	ast_mutex_unlock(&conf->mixlock);
+
+	memset(&fr, 0, sizeof(fr));
+	fr.frametype = AST_FRAME_VOICE;
+	fr.subclass = AST_FORMAT_SLINEAR;
+	fr.datalen = CONF_SIZE;
+	fr.samples = CONF_SAMPLES;
+	fr.data = shared;
+	fr.src = "MeetMe";
+
+	ast_mutex_lock(&conf->listenlock);
+	for (x = 0; x < AST_FRAME_BITS; x++) {
+		/* Free any translations of the previous mix */
+		if (conf->transframe[x]) {
+			ast_frfree(conf->transframe[x]);
+			conf->transframe[x] = NULL;
+		}
+	}
+	if (conf->origframe)
+		ast_frfree(conf->origframe);
+	conf->origframe = ast_frdup(&fr);
+	ast_mutex_unlock(&conf->listenlock);
+}
+
+/*! \brief Software mixer thread for one conference, mixes every 20ms */
+static void *softmix_thread(void *data)
+{
+	struct ast_conference *conf = data;
+	struct timeval next;
+	int ms;
+
+	next = ast_tvnow();
+	while (!conf->mixstop) {
+		next = ast_tvadd(next, ast_samp2tv(CONF_SAMPLES, 8000));
+		ms = ast_tvdiff_ms(next, ast_tvnow());
+		if (ms > 0)
+			usleep(ms * 1000);
+		else if (ms < -100)
+			next = ast_tvnow();	/* we fell far behind, don't try to catch up */
+		softmix_mix(conf);
+	}
+
+	return NULL;
+}
+
+static int softmix_start(struct ast_conference *conf)
+{
+	ast_mutex_init(&conf->mixlock);
+	conf->fd = -1;
+	if (ast_pthread_create(&conf->mixthread, NULL, softmix_thread, conf)) {
+		ast_log(LOG_WARNING, "Unable to start software mixer thread\n");
+		ast_mutex_destroy(&conf->mixlock);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void softmix_stop(struct ast_conference *conf)
+{
+	conf->mixstop = 1;
+	pthread_join(conf->mixthread, NULL);
+	if (conf->announce)
+		free(conf->announce);
+	ast_mutex_destroy(&conf->mixlock);
+}
+
+/*! \brief Attach a user to the software mixer; user->mixfds[0] then
+ *  delivers CONF_SIZE byte blocks of conference audio
+ */
+static int softmix_join(struct ast_conference *conf, struct ast_conf_user *user)
+{
+	int flags;
+	int x;
+
+	if (user->mixring)
+		return 0;
+
+	if (pipe(user->mixfds)) {
+		ast_log(LOG_WARNING, "Unable to create conference pipe: %s\n", strerror(errno));
+		return -1;
+	}
+	for (x = 0; x < 2; x++) {
+		flags = fcntl(user->mixfds[x], F_GETFL);
+		fcntl(user->mixfds[x], F_SETFL, flags | O_NONBLOCK);
+	}
+	user->mixringsize = audio_buffers * CONF_SAMPLES;
+	if (!(user->mixring = ast_calloc(user->mixringsize, sizeof(*user->mixring)))) {
+		close(user->mixfds[0]);
+		close(user->mixfds[1]);
+		return -1;
+	}
+	user->mixhead = user->mixlen = user->mixmode = 0;
+
+	ast_mutex_lock(&conf->mixlock);
+	AST_LIST_INSERT_TAIL(&conf->mixlist, user, mixentry);
+	ast_mutex_unlock(&conf->mixlock);
+
+	return 0;
+}
+
+static void softmix_leave(struct ast_conference *conf, struct ast_conf_user *user)
+{
+	if (!user->mixring)
+		return;
+
+	ast_mutex_lock(&conf->mixlock);
+	AST_LIST_REMOVE(&conf->mixlist, user, mixentry);
+	ast_mutex_unlock(&conf->mixlock);
+
+	close(user->mixfds[0]);
+	close(user->mixfds[1]);
+	free(user->mixring);
+	user->mixring = NULL;
+}
+
+/*! \brief Change a user's conference mode, through Zaptel or the software mixer */
+static int conf_setconf(struct ast_conference *conf, struct ast_conf_user *user, int fd, struct zt_confinfo *ztc)
+{
+	if (!conf->softmix)
+		return ioctl(fd, ZT_SETCONF, ztc);
+
+	ast_mutex_lock(&conf->mixlock);
+	user->mixmode = ztc->confmode;
+	ast_mutex_unlock(&conf->mixlock);
+
+	return 0;
+}
+
 static int set_talk_volume(struct ast_conf_user *user, int volume)
 {
 	signed char gain_adjust;
@@ -501,7 +816,10 @@ static void conf_play(struct ast_channel *chan, struct ast_conference *conf, enu
 		len = 0;
 	}
 	if (data) {
-		careful_write(conf->fd, data, len, 1);
+		if (conf->softmix)
+			softmix_announce(conf, data, len);
+		else
+			careful_write(conf->fd, data, len, 1);
 	}
 
 	AST_LIST_UNLOCK(&confs);
@@ -532,54 +850,67 @@ static struct ast_conference *build_conf(char *confno, char *pin, char *pinadmin
 			ast_copy_string(cnf->pinadmin, pinadmin, sizeof(cnf->pinadmin));
 			cnf->refcount = 0;
 			cnf->markedusers = 0;
-			cnf->chan = ast_request("zap", AST_FORMAT_SLINEAR, "pseudo", NULL);
-			if (cnf->chan) {
-				ast_set_read_format(cnf->chan, AST_FORMAT_SLINEAR);
-				ast_set_write_format(cnf->chan, AST_FORMAT_SLINEAR);
-				cnf->fd = cnf->chan->fds[0];	/* for use by conf_play() */
-			} else {
-				ast_log(LOG_WARNING, "Unable to open pseudo channel - trying device\n");
-				cnf->fd = open("/dev/zap/pseudo", O_RDWR);
-				if (cnf->fd < 0) {
-					ast_log(LOG_WARNING, "Unable to open pseudo device\n");
+			cnf->softmix = softmix_default ? 1 : 0;
+			if (!cnf->softmix) {
+				cnf->chan = ast_request("zap", AST_FORMAT_SLINEAR, "pseudo", NULL);
+				if (cnf->chan) {
+					ast_set_read_format(cnf->chan, AST_FORMAT_SLINEAR);
+					ast_set_write_format(cnf->chan, AST_FORMAT_SLINEAR);
+					cnf->fd = cnf->chan->fds[0];	/* for use by conf_play() */
+				} else {
+					ast_log(LOG_WARNING, "Unable to open pseudo channel - trying device\n");
+					cnf->fd = open("/dev/zap/pseudo", O_RDWR);
+					if (cnf->fd < 0) {
+						ast_log(LOG_WARNING, "Unable to open pseudo device - using software mixer\n");
+						cnf->softmix = 1;
+					}
+				}
+			}
+			if (cnf->softmix) {
+				if (softmix_start(cnf)) {
 					free(cnf);
 					cnf = NULL;
 					goto cnfout;
 				}
-			}
-			memset(&ztc, 0, sizeof(ztc));
-			/* Setup a new zap conference */
-			ztc.chan = 0;
-			ztc.confno = -1;
-			ztc.confmode = ZT_CONF_CONFANN | ZT_CONF_CONFANNMON;
-			if (ioctl(cnf->fd, ZT_SETCONF, &ztc)) {
-				ast_log(LOG_WARNING, "Error setting conference\n");
-				if (cnf->chan)
-					ast_hangup(cnf->chan);
-				else
-					close(cnf->fd);
-				free(cnf);
-				cnf = NULL;
-				goto cnfout;
-			}
-			cnf->lchan = ast_request("zap", AST_FORMAT_SLINEAR, "pseudo", NULL);
-			if (cnf->lchan) {
-				ast_set_read_format(cnf->lchan, AST_FORMAT_SLINEAR);
-				ast_set_write_format(cnf->lchan, AST_FORMAT_SLINEAR);
+			} else {
+				memset(&ztc, 0, sizeof(ztc));
+				/* Setup a new zap conference */
 				ztc.chan = 0;
+				ztc.confno = -1;
 				ztc.confmode = ZT_CONF_CONFANN | ZT_CONF_CONFANNMON;
-				if (ioctl(cnf->lchan->fds[0], ZT_SETCONF, &ztc)) {
+				if (ioctl(cnf->fd, ZT_SETCONF, &ztc)) {
 					ast_log(LOG_WARNING, "Error setting conference\n");
-					ast_hangup(cnf->lchan);
-					cnf->lchan = NULL;
+					if (cnf->chan)
+						ast_hangup(cnf->chan);
+					else
+						close(cnf->fd);
+					free(cnf);
+					cnf = NULL;
+					goto cnfout;
 				}
+				cnf->lchan = ast_request("zap", AST_FORMAT_SLINEAR, "pseudo", NULL);
+				if (cnf->lchan) {
+					ast_set_read_format(cnf->lchan, AST_FORMAT_SLINEAR);
+					ast_set_write_format(cnf->lchan, AST_FORMAT_SLINEAR);
+					ztc.chan = 0;
+					ztc.confmode = ZT_CONF_CONFANN | ZT_CONF_CONFANNMON;
+					if (ioctl(cnf->lchan->fds[0], ZT_SETCONF, &ztc)) {
+						ast_log(LOG_WARNING, "Error setting conference\n");
+						ast_hangup(cnf->lchan);
+						cnf->lchan = NULL;
+					}
+				}
+				cnf->zapconf = ztc.confno;
 			}
 			/* Fill the conference struct */
 			cnf->start = time(NULL);
-			cnf->zapconf = ztc.confno;
 			cnf->isdynamic = dynamic ? 1 : 0;
-			if (option_verbose > 2)
-				ast_verbose(VERBOSE_PREFIX_3 "Created MeetMe conference %d for conference '%s'\n", cnf->zapconf, cnf->confno);
+			if (option_verbose > 2) {
+				if (cnf->softmix)
+					ast_verbose(VERBOSE_PREFIX_3 "Created software mixed MeetMe conference '%s'\n", cnf->confno);
+				else
+					ast_verbose(VERBOSE_PREFIX_3 "Created MeetMe conference %d for conference '%s'\n", cnf->zapconf, cnf->confno);
+			}
 			AST_LIST_INSERT_HEAD(&confs, cnf, list);
 		} 
 	}
@@ -803,9 +1134,10 @@ static struct ast_cli_entry cli_conf = {
 	{"meetme", NULL, NULL }, conf_cmd,
 	"Execute a command on a conference or conferee", conf_usage, complete_confcmd};
 
-static void conf_flush(int fd, struct ast_channel *chan)
+static void conf_flush(int fd, struct ast_channel *chan, int softmix)
 {
 	int x;
+	char buf[CONF_SIZE];
 
 	/* read any frames that may be waiting on the channel
 	   and throw them away
@@ -825,6 +1157,12 @@ static void conf_flush(int fd, struct ast_channel *chan)
 		}
 	}
 
+	if (softmix) {
+		/* drain the (non-blocking) software mixer pipe */
+		while (read(fd, buf, sizeof(buf)) > 0);
+		return;
+	}
+
 	/* flush any data sitting in the pseudo channel */
 	x = ZT_FLUSH_ALL;
 	if (ioctl(fd, ZT_FLUSH, &x))
@@ -851,6 +1189,9 @@ static int conf_free(struct ast_conference *conf)
 		}
 	}
 
+	/* The mixer thread replaces the shared frames, so stop it first */
+	if (conf->softmix)
+		softmix_stop(conf);
 	for (x=0;x<AST_FRAME_BITS;x++) {
 		if (conf->transframe[x])
 			ast_frfree(conf->transframe[x]);
@@ -863,7 +1204,7 @@ static int conf_free(struct ast_conference *conf)
 		ast_hangup(conf->lchan);
 	if (conf->chan)
 		ast_hangup(conf->chan);
-	else
+	else if (!conf->softmix)
 		close(conf->fd);
 	
 	free(conf);
@@ -1060,7 +1401,12 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 
  zapretry:
 	origfd = chan->fds[0];
-	if (retryzap) {
+	if (conf->softmix) {
+		if (softmix_join(conf, user))
+			goto outrun;
+		fd = user->mixfds[0];
+		nfds = 1;
+	} else if (retryzap) {
 		fd = open("/dev/zap/pseudo", O_RDWR);
 		if (fd < 0) {
 			ast_log(LOG_WARNING, "Unable to open pseudo channel: %s\n", strerror(errno));
@@ -1106,7 +1452,7 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 	memset(&ztc_empty, 0, sizeof(ztc_empty));
 	/* Check to see if we're in a conference... */
 	ztc.chan = 0;	
-	if (ioctl(fd, ZT_GETCONF, &ztc)) {
+	if (!conf->softmix && ioctl(fd, ZT_GETCONF, &ztc)) {
 		ast_log(LOG_WARNING, "Error getting conference\n");
 		close(fd);
 		goto outrun;
@@ -1142,13 +1488,16 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 	else 
 		ztc.confmode = ZT_CONF_CONF | ZT_CONF_TALKER | ZT_CONF_LISTENER;
 
-	if (ioctl(fd, ZT_SETCONF, &ztc)) {
+	if (conf_setconf(conf, user, fd, &ztc)) {
 		ast_log(LOG_WARNING, "Error setting conference\n");
 		close(fd);
 		ast_mutex_unlock(&conf->playlock);
 		goto outrun;
 	}
-	ast_log(LOG_DEBUG, "Placed channel %s in ZAP conf %d\n", chan->name, conf->zapconf);
+	if (conf->softmix)
+		ast_log(LOG_DEBUG, "Placed channel %s in software mixed conf %s\n", chan->name, conf->confno);
+	else
+		ast_log(LOG_DEBUG, "Placed channel %s in ZAP conf %d\n", chan->name, conf->zapconf);
 
 	if (!sent_event) {
 		manager_event(EVENT_FLAG_CALL, "MeetmeJoin", 
@@ -1169,7 +1518,7 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 
 	ast_mutex_unlock(&conf->playlock);
 
-	conf_flush(fd, chan);
+	conf_flush(fd, chan, conf->softmix);
 
 	if (confflags & CONFFLAG_AGI) {
 		/* Get name of AGI file to run from $(MEETME_AGI_BACKGROUND)
@@ -1207,7 +1556,8 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 		if (confflags & (CONFFLAG_MONITORTALKER | CONFFLAG_OPTIMIZETALKER) && !(dsp = ast_dsp_new())) {
 			ast_log(LOG_WARNING, "Unable to allocate DSP!\n");
 			res = -1;
-		}
+		} else if (dsp)
+			ast_dsp_analysis_attach(chan);
 		for(;;) {
 			int menu_was_active = 0;
 
@@ -1258,7 +1608,7 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 							break;
 						else {
 							ztc.confmode = ZT_CONF_CONF;
-							if (ioctl(fd, ZT_SETCONF, &ztc)) {
+							if (conf_setconf(conf, user, fd, &ztc)) {
 								ast_log(LOG_WARNING, "Error setting conference\n");
 								close(fd);
 								goto outrun;
@@ -1270,7 +1620,7 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 						musiconhold = 1;
 					} else {
 						ztc.confmode = ZT_CONF_CONF;
-						if (ioctl(fd, ZT_SETCONF, &ztc)) {
+						if (conf_setconf(conf, user, fd, &ztc)) {
 							ast_log(LOG_WARNING, "Error setting conference\n");
 							close(fd);
 							goto outrun;
@@ -1283,7 +1633,7 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 						ztc.confmode = ZT_CONF_CONF | ZT_CONF_TALKER;
 					else
 						ztc.confmode = ZT_CONF_CONF | ZT_CONF_TALKER | ZT_CONF_LISTENER;
-					if (ioctl(fd, ZT_SETCONF, &ztc)) {
+					if (conf_setconf(conf, user, fd, &ztc)) {
 						ast_log(LOG_WARNING, "Error setting conference\n");
 						close(fd);
 						goto outrun;
@@ -1326,7 +1676,7 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 			/* If I should be muted but am still talker, mute me */
 			if ((user->adminflags & (ADMINFLAG_MUTED | ADMINFLAG_SELFMUTED)) && (ztc.confmode & ZT_CONF_TALKER)) {
 				ztc.confmode ^= ZT_CONF_TALKER;
-				if (ioctl(fd, ZT_SETCONF, &ztc)) {
+				if (conf_setconf(conf, user, fd, &ztc)) {
 					ast_log(LOG_WARNING, "Error setting conference - Un/Mute \n");
 					ret = -1;
 					break;
@@ -1344,7 +1694,7 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 			/* If I should be un-muted but am not talker, un-mute me */
 			if (!(user->adminflags & (ADMINFLAG_MUTED | ADMINFLAG_SELFMUTED)) && !(confflags & CONFFLAG_MONITOR) && !(ztc.confmode & ZT_CONF_TALKER)) {
 				ztc.confmode |= ZT_CONF_TALKER;
-				if (ioctl(fd, ZT_SETCONF, &ztc)) {
+				if (conf_setconf(conf, user, fd, &ztc)) {
 					ast_log(LOG_WARNING, "Error setting conference - Un/Mute \n");
 					ret = -1;
 					break;
@@ -1369,7 +1719,7 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 			}
 
 			if (c) {
-				if (c->fds[0] != origfd) {
+				if (!conf->softmix && (c->fds[0] != origfd)) {
 					if (using_pseudo) {
 						/* Kill old pseudo */
 						close(fd);
@@ -1396,7 +1746,11 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 						if (user->talking == -1)
 							user->talking = 0;
 
-						res = ast_dsp_silence(dsp, f, &totalsilence);
+						/* the shared analysis saw the frame before the volume change */
+						if (user->talk.actual)
+							res = ast_dsp_silence(dsp, f, &totalsilence);
+						else
+							res = ast_dsp_silence_chan(dsp, c, f, &totalsilence);
 						if (!user->talking && totalsilence < MEETME_DELAYDETECTTALK) {
 							user->talking = 1;
 							if (confflags & CONFFLAG_MONITORTALKER)
@@ -1420,7 +1774,10 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 								      chan->name, chan->uniqueid, conf->confno, user->user_no);
 						}
 					}
-					if (using_pseudo) {
+					if (conf->softmix) {
+						if (user->talking || !(confflags & CONFFLAG_OPTIMIZETALKER))
+							softmix_write(conf, user, f->data, f->samples);
+					} else if (using_pseudo) {
 						/* Absolutely do _not_ use careful_write here...
 						   it is important that we read data from the channel
 						   as fast as it arrives, and feed it into the conference.
@@ -1453,7 +1810,7 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 					ast_frfree(f);
 					break;
 				} else if (((f->frametype == AST_FRAME_DTMF) && (f->subclass == '*') && (confflags & CONFFLAG_STARMENU)) || ((f->frametype == AST_FRAME_DTMF) && menu_active)) {
-					if (ioctl(fd, ZT_SETCONF, &ztc_empty)) {
+					if (conf_setconf(conf, user, fd, &ztc_empty)) {
 						ast_log(LOG_WARNING, "Error setting conference\n");
 						close(fd);
 						ast_frfree(f);
@@ -1599,14 +1956,14 @@ static int conf_run(struct ast_channel *chan, struct ast_conference *conf, int c
 					if (musiconhold)
 			   			ast_moh_start(chan, NULL);
 
-					if (ioctl(fd, ZT_SETCONF, &ztc)) {
+					if (conf_setconf(conf, user, fd, &ztc)) {
 						ast_log(LOG_WARNING, "Error setting conference\n");
 						close(fd);
 						ast_frfree(f);
 						goto outrun;
 					}
 
-					conf_flush(fd, chan);
+					conf_flush(fd, chan, conf->softmix);
 				} else if (option_debug) {
 					ast_log(LOG_DEBUG,
 						"Got unrecognized frame on channel %s, f->frametype=%d,f->subclass=%d\n",
@@ -1674,7 +2031,9 @@ bailoutandtrynormal:
 	if (musiconhold)
 		ast_moh_stop(chan);
 	
-	if (using_pseudo)
+	if (conf->softmix)
+		softmix_leave(conf, user);
+	else if (using_pseudo)
 		close(fd);
 	else {
 		/* Take out of conference */
@@ -1706,10 +2065,15 @@ bailoutandtrynormal:
 	AST_LIST_UNLOCK(&confs);
 
  outrun:
+	if (conf->softmix)
+		softmix_leave(conf, user);
+
 	AST_LIST_LOCK(&confs);
 
-	if (dsp)
+	if (dsp) {
+		ast_dsp_analysis_detach(chan);
 		ast_dsp_free(dsp);
+	}
 	
 	if (user->user_no) { /* Only cleanup users who really joined! */
 		now = time(NULL);
@@ -2524,6 +2888,7 @@ static void load_config(void)
 	char *val;
 
 	audio_buffers = DEFAULT_AUDIO_BUFFERS;
+	softmix_default = 0;
 
 	if (!(cfg = ast_config_load(CONFIG_FILE_NAME)))
 		return;
@@ -2541,6 +2906,9 @@ static void load_config(void)
 			ast_log(LOG_NOTICE, "Audio buffers per channel set to %d\n", audio_buffers);
 	}
 
+	if ((val = ast_variable_retrieve(cfg, "general", "softmix")))
+		softmix_default = ast_true(val);
+
 	ast_config_destroy(cfg);
 }
 
@@ -284,6 +284,7 @@ static void launch_monitor_thread(struct ast_channel *chan, const char *filename
 		free(mixmonitor);
 		return;
 	}
+	ast_filestream_set_async(mixmonitor->fs);
 
 	/* Setup the actual spy before creating our thread */
 	ast_set_flag(&mixmonitor->spy, CHANSPY_FORMAT_AUDIO);
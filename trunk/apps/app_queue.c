@@ -63,8 +63,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <sys/time.h>
 #include <sys/signal.h>
@@ -121,6 +123,7 @@ static struct strategy {
 #define DEFAULT_RETRY		5
 #define DEFAULT_TIMEOUT		15
 #define RECHECK			1		/* Recheck every second to see we we're at the top yet */
+#define RECHECK_IDLE		10		/* Longest a waiting caller sleeps when the dispatcher can wake it */
 #define MAX_PERIODIC_ANNOUNCEMENTS 10 /* The maximum periodic announcements we can have */
 
 #define	RES_OKAY	0		/* Action completed */
@@ -242,6 +245,9 @@ static int queue_persistent_members = 0;
 /*! \brief queues.conf per-queue weight option */
 static int use_weight = 0;
 
+/*! \brief queues.conf as of the last reload, to spot unchanged queues */
+static struct ast_config *queues_cfg;
+
 /*! \brief queues.conf [general] option */
 static int autofill_default = 0;
 
@@ -306,6 +312,8 @@ struct queue_ent {
 	time_t start;			/*!< When we started holding */
 	time_t expire;			/*!< When this entry should expire (time out of queue) */
 	struct ast_channel *chan;	/*!< Our channel */
+	int wakefd[2];			/*!< Pipe the dispatcher uses to wake us up */
+	int wakepending;		/*!< A wakeup has been written and not yet consumed */
 	struct queue_ent *next;		/*!< The next queue entry */
 };
 
@@ -319,15 +327,41 @@ struct member {
 	time_t lastcall;		/*!< When last successful call was hungup */
 	unsigned int dead:1;			/*!< Used to detect members deleted in realtime */
 	unsigned int delme:1;		/*!< Flag to delete entry on reload */
+	struct call_queue *parent;	/*!< Queue this member belongs to */
+	struct member_interface *device;	/*!< Device index entry, if linked */
+	AST_LIST_ENTRY(member) devlist;	/*!< Next member sharing this device */
+	AST_LIST_ENTRY(member) qhash;	/*!< Next member in the same queue bucket */
 	struct member *next;		/*!< Next member */
 };
 
+/*! \brief One entry per device used by any queue member.
+
+    Each entry lists every member (across all queues) that uses the device,
+    so a device state change only touches the affected members.  Entries
+    are also queued here for the member status worker; a device already
+    waiting for the worker just has its state replaced. */
 struct member_interface {
 	char interface[80];
+	int state;				/*!< Latest device state, for the worker */
+	unsigned int pending:1;			/*!< Waiting on the status worker */
+	AST_LIST_HEAD_NOLOCK(, member) members;	/*!< Members using this device */
 	AST_LIST_ENTRY(member_interface) list;    /*!< Next call queue */
+	AST_LIST_ENTRY(member_interface) hash;	/*!< Next entry in the same bucket */
+	AST_LIST_ENTRY(member_interface) change;	/*!< Next entry waiting on the worker */
 };
 
+#define INTERFACE_BUCKETS 127
+#define QUEUE_BUCKETS 509
+#define MEMBER_BUCKETS 37
+
+/*! \brief All member devices.  This lock also protects the device buckets,
+    the pending change list and every entry's member list. */
 static AST_LIST_HEAD_STATIC(interfaces, member_interface);
+static AST_LIST_HEAD_NOLOCK(, member_interface) interface_buckets[INTERFACE_BUCKETS];
+static AST_LIST_HEAD_NOLOCK(, member_interface) interface_changes;
+static ast_cond_t statuscond;
+static pthread_t statusthread = AST_PTHREADT_NULL;
+static int statusthread_stop;
 
 /* values used in multi-bit flags in call_queue */
 #define QUEUE_EMPTY_NORMAL 1
@@ -392,12 +426,54 @@ struct call_queue {
 	int autofill;			/*!< Ignore the head call status and ring an available agent */
 	
 	struct member *members;		/*!< Head of the list of members */
+	AST_LIST_HEAD_NOLOCK(, member) memberbuckets[MEMBER_BUCKETS];	/*!< Members by interface */
 	struct queue_ent *head;		/*!< Head of the list of callers */
 	AST_LIST_ENTRY(call_queue) list;	/*!< Next call queue */
+	AST_LIST_ENTRY(call_queue) hash;	/*!< Next queue in the same bucket */
 };
 
 static AST_LIST_HEAD_STATIC(queues, call_queue);
 
+/*! \brief Queues by name, protected by the queues lock */
+static AST_LIST_HEAD_NOLOCK(, call_queue) queue_buckets[QUEUE_BUCKETS];
+
+/*! \brief Hash a queue name or interface.  Both compare case-insensitively. */
+static unsigned int name_hash(const char *name)
+{
+	unsigned int hash = 0;
+
+	for (; *name; name++)
+		hash = hash * 31 + tolower(*name);
+
+	return hash;
+}
+
+/*! \brief Find a queue by name.  Must be called with the queues lock held. */
+static struct call_queue *find_queue(const char *queuename)
+{
+	struct call_queue *q;
+
+	AST_LIST_TRAVERSE(&queue_buckets[name_hash(queuename) % QUEUE_BUCKETS], q, hash) {
+		if (!strcasecmp(q->name, queuename))
+			break;
+	}
+
+	return q;
+}
+
+/*! \brief Add a queue to the global list and the name index */
+static void link_queue(struct call_queue *q)
+{
+	AST_LIST_INSERT_HEAD(&queues, q, list);
+	AST_LIST_INSERT_HEAD(&queue_buckets[name_hash(q->name) % QUEUE_BUCKETS], q, hash);
+}
+
+/*! \brief Remove a queue from the name index.  The caller removes it from the global list. */
+static void unhash_queue(struct call_queue *q)
+{
+	AST_LIST_REMOVE(&queue_buckets[name_hash(q->name) % QUEUE_BUCKETS], q, hash);
+}
+
 static int set_member_paused(char *queuename, char *interface, int paused);
 
 static void rr_dep_warning(void)
@@ -498,100 +574,211 @@ static enum queue_member_status get_member_status(const struct call_queue *q, in
 	return result;
 }
 
-struct statechange {
-	int state;
-	char dev[0];
-};
-
-static void *changethread(void *data)
+/*! \brief Count the members that could take a call right now
+ * \param wrapup also count the members that are only waiting out their wrapup time
+ * \note Must be called with the queue lock held
+ */
+static int queue_available_members(struct call_queue *q, int wrapup)
 {
-	struct call_queue *q;
-	struct statechange *sc = data;
 	struct member *cur;
-	struct member_interface *curint;
-	char *loc;
-	char *technology;
+	time_t now = time(NULL);
+	int avl = 0;
 
-	technology = ast_strdupa(sc->dev);
-	loc = strchr(technology, '/');
-	if (loc) {
-		*loc++ = '\0';
-	} else {
-		free(sc);
-		return NULL;
+	for (cur = q->members; cur; cur = cur->next) {
+		if (cur->paused)
+			continue;
+		if (!wrapup && q->wrapuptime && ((now - cur->lastcall) < q->wrapuptime))
+			continue;
+		switch (cur->status) {
+		case AST_DEVICE_NOT_INUSE:
+		case AST_DEVICE_UNKNOWN:
+			avl++;
+			break;
+		}
 	}
 
-	AST_LIST_LOCK(&interfaces);
-	AST_LIST_TRAVERSE(&interfaces, curint, list) {
-		if (!strcasecmp(curint->interface, sc->dev))
-			break; 
+	return avl;
+}
+
+/*! \brief Wake a waiting caller so it re-evaluates whether it is its turn
+ * \note Must be called with the queue lock held
+ */
+static void queue_wake(struct queue_ent *qe)
+{
+	if ((qe->wakefd[1] < 0) || qe->wakepending)
+		return;
+
+	qe->wakepending = 1;
+	if ((write(qe->wakefd[1], "", 1) < 0) && option_debug)
+		ast_log(LOG_DEBUG, "Unable to wake up %s: %s\n", qe->chan->name, strerror(errno));
+}
+
+/*! \brief Queue dispatcher
+ *
+ * Called whenever something happens that may let a waiting caller
+ * through: a caller joins or leaves, a member changes state, is added,
+ * removed or (un)paused, or a call completes.  Wakes only the callers
+ * is_our_turn() would now let ring, instead of having every caller poll
+ * the queue every second.  When members changed on a queue that makes
+ * callers leave when empty, everybody is woken to re-check that too.
+ *
+ * \note Must be called with the queue lock held
+ */
+static void queue_dispatch(struct call_queue *q, int members_changed)
+{
+	struct queue_ent *ch;
+	int avl;
+	int idx;
+
+	if (!q->head)
+		return;
+
+	if (members_changed && q->leavewhenempty) {
+		for (ch = q->head; ch; ch = ch->next)
+			queue_wake(ch);
+		return;
 	}
-	AST_LIST_UNLOCK(&interfaces);
 
-	if (!curint) {
-		if (option_debug)
-			ast_log(LOG_DEBUG, "Device '%s/%s' changed to state '%d' (%s) but we don't care because they're not a member of any queue.\n", technology, loc, sc->state, devstate2str(sc->state));
-		free(sc);
-		return NULL;
-        }
+	/* Members in wrapup count too: the callers that will get them have
+	   to know when to wake up, see queue_wait_time() */
+	if (!(avl = queue_available_members(q, 1)))
+		return;
+	if (!q->autofill || (q->strategy == QUEUE_STRATEGY_RINGALL))
+		avl = 1;
+
+	for (idx = 0, ch = q->head; ch && (idx < avl); idx++, ch = ch->next)
+		queue_wake(ch);
+}
+
+/*! \brief Find the index entry for a device.  Must be called with the interfaces lock held. */
+static struct member_interface *find_interface(const char *interface)
+{
+	struct member_interface *curint;
+
+	AST_LIST_TRAVERSE(&interface_buckets[name_hash(interface) % INTERFACE_BUCKETS], curint, hash) {
+		if (!strcasecmp(curint->interface, interface))
+			break;
+	}
+
+	return curint;
+}
+
+/*! \brief Apply a device's latest state to every member using it.
+    Must be called with the queues and interfaces locks held. */
+static void update_interface_members(struct member_interface *curint)
+{
+	struct call_queue *q;
+	struct member *cur;
 
 	if (option_debug)
-		ast_log(LOG_DEBUG, "Device '%s/%s' changed to state '%d' (%s)\n", technology, loc, sc->state, devstate2str(sc->state));
-	AST_LIST_LOCK(&queues);
-	AST_LIST_TRAVERSE(&queues, q, list) {
-		ast_mutex_lock(&q->lock);
-		for (cur = q->members; cur; cur = cur->next) {
-			if (strcasecmp(sc->dev, cur->interface))
-				continue;
+		ast_log(LOG_DEBUG, "Device '%s' changed to state '%d' (%s)\n", curint->interface, curint->state, devstate2str(curint->state));
 
-			if (cur->status != sc->state) {
-				cur->status = sc->state;
-				if (q->maskmemberstatus)
-					continue;
+	AST_LIST_TRAVERSE(&curint->members, cur, devlist) {
+		if (cur->status == curint->state)
+			continue;
 
-				manager_event(EVENT_FLAG_AGENT, "QueueMemberStatus",
-					      "Queue: %s\r\n"
-					      "Location: %s\r\n"
-					      "Membership: %s\r\n"
-					      "Penalty: %d\r\n"
-					      "CallsTaken: %d\r\n"
-					      "LastCall: %d\r\n"
-					      "Status: %d\r\n"
-					      "Paused: %d\r\n",
-					      q->name, cur->interface, cur->dynamic ? "dynamic" : "static",
-					      cur->penalty, cur->calls, (int)cur->lastcall, cur->status, cur->paused);
-			}
+		q = cur->parent;
+		ast_mutex_lock(&q->lock);
+		cur->status = curint->state;
+		if (!q->maskmemberstatus) {
+			manager_event(EVENT_FLAG_AGENT, "QueueMemberStatus",
+				      "Queue: %s\r\n"
+				      "Location: %s\r\n"
+				      "Membership: %s\r\n"
+				      "Penalty: %d\r\n"
+				      "CallsTaken: %d\r\n"
+				      "LastCall: %d\r\n"
+				      "Status: %d\r\n"
+				      "Paused: %d\r\n",
+				      q->name, cur->interface, cur->dynamic ? "dynamic" : "static",
+				      cur->penalty, cur->calls, (int)cur->lastcall, cur->status, cur->paused);
 		}
+		queue_dispatch(q, 1);
 		ast_mutex_unlock(&q->lock);
 	}
-	AST_LIST_UNLOCK(&queues);
+}
+
+/*! \brief Member status worker.  Drains the pending device changes queued
+    by statechange_queue(). */
+static void *status_thread(void *data)
+{
+	struct member_interface *curint;
+	int stop;
+
+	for (;;) {
+		AST_LIST_LOCK(&interfaces);
+		while (AST_LIST_EMPTY(&interface_changes) && !statusthread_stop)
+			ast_cond_wait(&statuscond, &interfaces.lock);
+		stop = statusthread_stop;
+		AST_LIST_UNLOCK(&interfaces);
+		if (stop)
+			break;
+
+		/* The queues lock must be taken before the interfaces lock, since
+		   members are added to the index with it (and a queue lock) held */
+		AST_LIST_LOCK(&queues);
+		AST_LIST_LOCK(&interfaces);
+		while ((curint = AST_LIST_REMOVE_HEAD(&interface_changes, change))) {
+			curint->pending = 0;
+			update_interface_members(curint);
+		}
+		AST_LIST_UNLOCK(&interfaces);
+		AST_LIST_UNLOCK(&queues);
+	}
 
 	return NULL;
 }
 
 static int statechange_queue(const char *dev, int state, void *ign)
 {
-	/* Avoid potential for deadlocks by spawning a new thread to handle
-	   the event */
-	struct statechange *sc;
-	pthread_t t;
-	pthread_attr_t attr;
+	/* Avoid potential for deadlocks by handing the event to the
+	   status worker */
+	struct member_interface *curint;
 
-	if (!(sc = ast_calloc(1, sizeof(*sc) + strlen(dev) + 1)))
+	AST_LIST_LOCK(&interfaces);
+	if (!(curint = find_interface(dev))) {
+		AST_LIST_UNLOCK(&interfaces);
+		if (option_debug)
+			ast_log(LOG_DEBUG, "Device '%s' changed to state '%d' (%s) but we don't care because they're not a member of any queue.\n", dev, state, devstate2str(state));
 		return 0;
+	}
 
-	sc->state = state;
-	strcpy(sc->dev, dev);
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	if (ast_pthread_create(&t, &attr, changethread, sc)) {
-		ast_log(LOG_WARNING, "Failed to create update thread!\n");
-		free(sc);
+	curint->state = state;
+	if (!curint->pending) {
+		curint->pending = 1;
+		AST_LIST_INSERT_TAIL(&interface_changes, curint, change);
+		ast_cond_signal(&statuscond);
 	}
+	AST_LIST_UNLOCK(&interfaces);
 
 	return 0;
 }
 
+static int start_status_thread(void)
+{
+	statusthread_stop = 0;
+	if (ast_pthread_create(&statusthread, NULL, status_thread, NULL)) {
+		ast_log(LOG_WARNING, "Failed to create member status thread!\n");
+		statusthread = AST_PTHREADT_NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void stop_status_thread(void)
+{
+	if (statusthread == AST_PTHREADT_NULL)
+		return;
+
+	AST_LIST_LOCK(&interfaces);
+	statusthread_stop = 1;
+	ast_cond_signal(&statuscond);
+	AST_LIST_UNLOCK(&interfaces);
+	pthread_join(statusthread, NULL);
+	statusthread = AST_PTHREADT_NULL;
+}
+
 static struct member *create_queue_member(char *interface, int penalty, int paused)
 {
 	struct member *cur;
@@ -664,72 +851,76 @@ static void clear_queue(struct call_queue *q)
 	q->wrapuptime = 0;
 }
 
-static int add_to_interfaces(char *interface) 
+static struct member *interface_exists(struct call_queue *q, char *interface)
 {
-	struct member_interface *curint;
-
-	AST_LIST_LOCK(&interfaces);
-	AST_LIST_TRAVERSE(&interfaces, curint, list) {
-		if (!strcasecmp(curint->interface, interface))
-			break; 
-	}
+	struct member *mem;
 
-	if (curint) {
-		AST_LIST_UNLOCK(&interfaces);
-		return 0;
-	}
+	if (!q)
+		return NULL;
 
-	if (option_debug)
-		ast_log(LOG_DEBUG, "Adding %s to the list of interfaces that make up all of our queue members.\n", interface);
-	
-	if ((curint = ast_calloc(1, sizeof(*curint)))) {
-		ast_copy_string(curint->interface, interface, sizeof(curint->interface));
-		AST_LIST_INSERT_HEAD(&interfaces, curint, list);
+	AST_LIST_TRAVERSE(&q->memberbuckets[name_hash(interface) % MEMBER_BUCKETS], mem, qhash) {
+		if (!strcasecmp(interface, mem->interface))
+			return mem;
 	}
-	AST_LIST_UNLOCK(&interfaces);
 
-	return 0;
+	return NULL;
 }
 
-static int interface_exists_global(char *interface)
+/*! \brief Index a member just added to q->members, by interface within its
+    queue and by device across all queues */
+static int add_to_interfaces(struct call_queue *q, struct member *m)
 {
-	struct call_queue *q;
-	struct member *mem;
-	int ret = 0;
+	struct member_interface *curint;
 
-	AST_LIST_LOCK(&queues);
-	AST_LIST_TRAVERSE(&queues, q, list) {
-		ast_mutex_lock(&q->lock);
-		for (mem = q->members; mem && !ret; mem = mem->next) {
-			if (!strcasecmp(interface, mem->interface))
-				ret = 1;
+	m->parent = q;
+	AST_LIST_INSERT_HEAD(&q->memberbuckets[name_hash(m->interface) % MEMBER_BUCKETS], m, qhash);
+
+	AST_LIST_LOCK(&interfaces);
+	if (!(curint = find_interface(m->interface))) {
+		if (option_debug)
+			ast_log(LOG_DEBUG, "Adding %s to the list of interfaces that make up all of our queue members.\n", m->interface);
+
+		if (!(curint = ast_calloc(1, sizeof(*curint)))) {
+			AST_LIST_UNLOCK(&interfaces);
+			return -1;
 		}
-		ast_mutex_unlock(&q->lock);
-		if (ret)
-			break;
+		ast_copy_string(curint->interface, m->interface, sizeof(curint->interface));
+		AST_LIST_INSERT_HEAD(&interfaces, curint, list);
+		AST_LIST_INSERT_HEAD(&interface_buckets[name_hash(curint->interface) % INTERFACE_BUCKETS], curint, hash);
 	}
-	AST_LIST_UNLOCK(&queues);
 
-	return ret;
+	m->device = curint;
+	AST_LIST_INSERT_TAIL(&curint->members, m, devlist);
+	AST_LIST_UNLOCK(&interfaces);
+
+	return 0;
 }
 
-static int remove_from_interfaces(char *interface)
+/*! \brief Unindex a member about to be freed, dropping its device once no member uses it */
+static int remove_from_interfaces(struct member *m)
 {
 	struct member_interface *curint;
 
+	if (m->parent)
+		AST_LIST_REMOVE(&m->parent->memberbuckets[name_hash(m->interface) % MEMBER_BUCKETS], m, qhash);
+
 	AST_LIST_LOCK(&interfaces);
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&interfaces, curint, list) {
-		if (!strcasecmp(curint->interface, interface)) {
-			if (!interface_exists_global(interface)) {
-				if (option_debug)
-					ast_log(LOG_DEBUG, "Removing %s from the list of interfaces that make up all of our queue members.\n", interface);
-				AST_LIST_REMOVE_CURRENT(&interfaces, list);
-				free(curint);
-			}
-			break;
-		}
+	if (!(curint = m->device)) {
+		AST_LIST_UNLOCK(&interfaces);
+		return 0;
+	}
+
+	AST_LIST_REMOVE(&curint->members, m, devlist);
+	m->device = NULL;
+	if (AST_LIST_EMPTY(&curint->members)) {
+		if (option_debug)
+			ast_log(LOG_DEBUG, "Removing %s from the list of interfaces that make up all of our queue members.\n", curint->interface);
+		AST_LIST_REMOVE(&interfaces, curint, list);
+		AST_LIST_REMOVE(&interface_buckets[name_hash(curint->interface) % INTERFACE_BUCKETS], curint, hash);
+		if (curint->pending)
+			AST_LIST_REMOVE(&interface_changes, curint, change);
+		free(curint);
 	}
-	AST_LIST_TRAVERSE_SAFE_END;
 	AST_LIST_UNLOCK(&interfaces);
 
  	return 0;
@@ -738,10 +929,18 @@ static int remove_from_interfaces(char *interface)
 static void clear_and_free_interfaces(void)
 {
 	struct member_interface *curint;
+	struct member *m;
+	int i;
 
 	AST_LIST_LOCK(&interfaces);
-	while ((curint = AST_LIST_REMOVE_HEAD(&interfaces, list)))
+	while ((curint = AST_LIST_REMOVE_HEAD(&interfaces, list))) {
+		while ((m = AST_LIST_REMOVE_HEAD(&curint->members, devlist)))
+			m->device = NULL;
 		free(curint);
+	}
+	for (i = 0; i < INTERFACE_BUCKETS; i++)
+		AST_LIST_HEAD_INIT_NOLOCK(&interface_buckets[i]);
+	AST_LIST_HEAD_INIT_NOLOCK(&interface_changes);
 	AST_LIST_UNLOCK(&interfaces);
 }
 
@@ -917,16 +1116,13 @@ static void rt_handle_member_record(struct call_queue *q, char *interface, const
 			penalty = 0;
 	}
 
-	/* Find the member, or the place to put a new one. */
-	for (m = q->members, prev_m = NULL;
-	     m && strcmp(m->interface, interface);
-	     prev_m = m, m = m->next);
-
 	/* Create a new one if not found, else update penalty */
-	if (!m) {
+	if (!(m = interface_exists(q, interface))) {
 		if ((m = create_queue_member(interface, penalty, 0))) {
 			m->dead = 0;
-			add_to_interfaces(interface);
+			add_to_interfaces(q, m);
+			/* Keep the realtime order; only new members walk to the tail */
+			for (prev_m = q->members; prev_m && prev_m->next; prev_m = prev_m->next);
 			if (prev_m) {
 				prev_m->next = m;
 			} else {
@@ -951,7 +1147,7 @@ static void free_members(struct call_queue *q, int all)
 				prev->next = next;
 			else
 				q->members = next;
-			remove_from_interfaces(curm->interface);
+			remove_from_interfaces(curm);
 			free(curm);
 		} else 
 			prev = curm;
@@ -978,10 +1174,7 @@ static struct call_queue *find_queue_by_name_rt(const char *queuename, struct as
 	char tmpbuf[64];	/* Must be longer than the longest queue param name. */
 
 	/* Find the queue in the in-core list (we will create a new one if not found). */
-	AST_LIST_TRAVERSE(&queues, q, list) {
-		if (!strcasecmp(q->name, queuename))
-			break;
-	}
+	q = find_queue(queuename);
 
 	/* Static queues override realtime. */
 	if (q) {
@@ -1013,6 +1206,7 @@ static struct call_queue *find_queue_by_name_rt(const char *queuename, struct as
 			if (!q->count) {
 				/* Delete. */
 				AST_LIST_REMOVE(&queues, q, list);
+				unhash_queue(q);
 				ast_mutex_unlock(&q->lock);
 				destroy_queue(q);
 			} else
@@ -1028,7 +1222,7 @@ static struct call_queue *find_queue_by_name_rt(const char *queuename, struct as
 		ast_mutex_lock(&q->lock);
 		clear_queue(q);
 		q->realtime = 1;
-		AST_LIST_INSERT_HEAD(&queues, q, list);
+		link_queue(q);
 	}
 	init_queue(q);		/* Ensure defaults for all parameters not set explicitly. */
 
@@ -1069,7 +1263,7 @@ static struct call_queue *find_queue_by_name_rt(const char *queuename, struct as
 			} else {
 				q->members = next_m;
 			}
-			remove_from_interfaces(m->interface);
+			remove_from_interfaces(m);
 			free(m);
 		} else {
 			prev_m = m;
@@ -1090,11 +1284,7 @@ static struct call_queue *load_realtime_queue(char *queuename)
 
 	/* Find the queue in the in-core list first. */
 	AST_LIST_LOCK(&queues);
-	AST_LIST_TRAVERSE(&queues, q, list) {
-		if (!strcasecmp(q->name, queuename)) {
-			break;
-		}
-	}
+	q = find_queue(queuename);
 	AST_LIST_UNLOCK(&queues);
 
 	if (!q || q->realtime) {
@@ -1187,6 +1377,7 @@ static int join_queue(char *queuename, struct queue_ent *qe, enum queue_result *
 			      q->name, qe->pos, q->count, qe->chan->uniqueid );
 		if (option_debug)
 			ast_log(LOG_DEBUG, "Queue '%s' Join, Channel '%s', Position '%d'\n", q->name, qe->chan->name, qe->pos );
+		queue_dispatch(q, 0);
 	}
 	ast_mutex_unlock(&q->lock);
 	AST_LIST_UNLOCK(&queues);
@@ -1396,12 +1587,14 @@ static void leave_queue(struct queue_ent *qe)
 			prev = cur;
 		}
 	}
+	queue_dispatch(q, 0);
 	ast_mutex_unlock(&q->lock);
 
 	if (q->dead && !q->count) {	
 		/* It's dead and nobody is in it, so kill it */
 		AST_LIST_LOCK(&queues);
 		AST_LIST_REMOVE(&queues, q, list);
+		unhash_queue(q);
 		AST_LIST_UNLOCK(&queues);
 		destroy_queue(q);
 	}
@@ -1447,6 +1640,7 @@ static int update_status(struct call_queue *q, struct member *member, int status
 				      q->name, cur->interface, cur->dynamic ? "dynamic" : "static",
 				      cur->penalty, cur->calls, (int)cur->lastcall, cur->status, cur->paused);
 		}
+		queue_dispatch(q, 1);
 	}
 	ast_mutex_unlock(&q->lock);
 	return 0;
@@ -2052,7 +2246,6 @@ static struct callattempt *wait_for_answer(struct queue_ent *qe, struct callatte
 static int is_our_turn(struct queue_ent *qe)
 {
 	struct queue_ent *ch;
-	struct member *cur;
 	int avl = 0;
 	int idx = 0;
 	int res;
@@ -2081,16 +2274,8 @@ static int is_our_turn(struct queue_ent *qe)
 			if (option_debug)
 				ast_log(LOG_DEBUG, "Even though there are %d available members, the strategy is ringall so only the head call is allowed in\n", avl);
 			avl = 1;
-		} else {
-			for (cur = qe->parent->members; cur; cur = cur->next) {
-				switch (cur->status) {
-				case AST_DEVICE_NOT_INUSE:
-				case AST_DEVICE_UNKNOWN:
-					avl++;
-					break;
-				}
-			}
-		}
+		} else
+			avl = queue_available_members(qe->parent, 0);
 
 		if (option_debug)
 			ast_log(LOG_DEBUG, "There are %d available members.\n", avl);
@@ -2117,6 +2302,75 @@ static int is_our_turn(struct queue_ent *qe)
 	return res;
 }
 
+/*! \brief How long a waiting caller may sleep before it has to re-check
+ *  something on its own (timeout, announcements, members leaving wrapup);
+ *  everything else wakes it through the dispatcher
+ */
+static int queue_wait_time(struct queue_ent *qe)
+{
+	struct call_queue *q = qe->parent;
+	struct member *cur;
+	struct timeval tv;
+	time_t now;
+	time_t next;
+	int ms;
+
+	if (qe->wakefd[0] < 0)
+		return RECHECK * 1000;
+
+	/* The same clock is_our_turn() and the wrapup checks use */
+	time(&now);
+	next = now + RECHECK_IDLE;
+
+	if (qe->expire && (qe->expire + 1 < next))
+		next = qe->expire + 1;
+	if (q->announcefrequency && (qe->last_pos + q->announcefrequency < next))
+		next = qe->last_pos + q->announcefrequency;
+	if (q->periodicannouncefrequency && (qe->last_periodic_announce_time + q->periodicannouncefrequency < next))
+		next = qe->last_periodic_announce_time + q->periodicannouncefrequency;
+	if (q->wrapuptime) {
+		ast_mutex_lock(&q->lock);
+		for (cur = q->members; cur; cur = cur->next) {
+			if ((cur->lastcall + q->wrapuptime > now) && (cur->lastcall + q->wrapuptime < next))
+				next = cur->lastcall + q->wrapuptime;
+		}
+		ast_mutex_unlock(&q->lock);
+	}
+
+	if (next - now < RECHECK)
+		return RECHECK * 1000;
+
+	/* Wake up just after the second we wait for starts.  time() can lag
+	   the exact time by a clock tick, so allow a little more than that. */
+	tv = ast_tvnow();
+	ms = (next - tv.tv_sec) * 1000 - tv.tv_usec / 1000 + 20;
+
+	return (ms < 20) ? 20 : ms;
+}
+
+/*! \brief Wait for a digit, a wakeup from the dispatcher, or the timeout
+ *  \return the digit, 0 on timeout or wakeup, -1 on hangup
+ */
+static int queue_wait(struct queue_ent *qe, int ms)
+{
+	char buf[16];
+	int res;
+
+	if (qe->wakefd[0] < 0)
+		return ast_waitfordigit(qe->chan, ms);
+
+	if ((res = ast_waitfordigit_full(qe->chan, ms, -1, qe->wakefd[0])) == 1) {
+		/* Clear the flag first, so a wakeup sent while we drain is not lost */
+		ast_mutex_lock(&qe->parent->lock);
+		qe->wakepending = 0;
+		ast_mutex_unlock(&qe->parent->lock);
+		while (read(qe->wakefd[0], buf, sizeof(buf)) > 0);
+		res = 0;
+	}
+
+	return res;
+}
+
 static int wait_our_turn(struct queue_ent *qe, int ringing, enum queue_result *reason)
 {
 	int res = 0;
@@ -2163,8 +2417,8 @@ static int wait_our_turn(struct queue_ent *qe, int ringing, enum queue_result *r
 		    (res = say_periodic_announcement(qe)))
 			break;
 
-		/* Wait a second before checking again */
-		if ((res = ast_waitfordigit(qe->chan, RECHECK * 1000)))
+		/* Wait until the dispatcher wakes us, or we have to check again */
+		if ((res = queue_wait(qe, queue_wait_time(qe))))
 			break;
 	}
 
@@ -2188,6 +2442,7 @@ static int update_queue(struct call_queue *q, struct member *member)
 		cur = cur->next;
 	}
 	q->callscompleted++;
+	queue_dispatch(q, 0);
 	ast_mutex_unlock(&q->lock);
 	return 0;
 }
@@ -2643,25 +2898,10 @@ static int wait_a_bit(struct queue_ent *qe)
 	/* Don't need to hold the lock while we setup the outgoing calls */
 	int retrywait = qe->parent->retry * 1000;
 
-	return ast_waitfordigit(qe->chan, retrywait);
-}
-
-static struct member *interface_exists(struct call_queue *q, char *interface)
-{
-	struct member *mem;
-
-	if (!q)
-		return NULL;
-
-	for (mem = q->members; mem; mem = mem->next) {
-		if (!strcasecmp(interface, mem->interface))
-			return mem;
-	}
-
-	return NULL;
+	/* The dispatcher wakes us early if a member becomes available */
+	return queue_wait(qe, retrywait);
 }
 
-
 /* Dump all members in a specific queue to the database
  *
  * <pm_family>/<queuename> = <interface>;<penalty>;<paused>[|...]
@@ -2708,13 +2948,8 @@ static int remove_from_queue(char *queuename, char *interface)
 	int res = RES_NOSUCHQUEUE;
 
 	AST_LIST_LOCK(&queues);
-	AST_LIST_TRAVERSE(&queues, q, list) {
+	if ((q = find_queue(queuename))) {
 		ast_mutex_lock(&q->lock);
-		if (strcmp(q->name, queuename)) {
-			ast_mutex_unlock(&q->lock);
-			continue;
-		}
-
 		if ((last_member = interface_exists(q, interface))) {
 			if ((look = q->members) == last_member) {
 				q->members = last_member->next;
@@ -2732,22 +2967,20 @@ static int remove_from_queue(char *queuename, char *interface)
 				      "Queue: %s\r\n"
 				      "Location: %s\r\n",
 				      q->name, last_member->interface);
+			remove_from_interfaces(last_member);
 			free(last_member);
 			
 			if (queue_persistent_members)
 				dump_queue_members(q);
-			
+
+			queue_dispatch(q, 1);
 			res = RES_OKAY;
 		} else {
 			res = RES_EXISTS;
 		}
 		ast_mutex_unlock(&q->lock);
-		break;
 	}
 
-	if (res == RES_OKAY)
-		remove_from_interfaces(interface);
-
 	AST_LIST_UNLOCK(&queues);
 
 	return res;
@@ -2769,9 +3002,9 @@ static int add_to_queue(char *queuename, char *interface, int penalty, int pause
 
 	ast_mutex_lock(&q->lock);
 	if (interface_exists(q, interface) == NULL) {
-		add_to_interfaces(interface);
 		if ((new_member = create_queue_member(interface, penalty, paused))) {
 			new_member->dynamic = 1;
+			add_to_interfaces(q, new_member);
 			new_member->next = q->members;
 			q->members = new_member;
 			manager_event(EVENT_FLAG_AGENT, "QueueMemberAdded",
@@ -2789,7 +3022,8 @@ static int add_to_queue(char *queuename, char *interface, int penalty, int pause
 			
 			if (dump)
 				dump_queue_members(q);
-			
+
+			queue_dispatch(q, 1);
 			res = RES_OKAY;
 		} else {
 			res = RES_OUTOFMEMORY;
@@ -2803,11 +3037,32 @@ static int add_to_queue(char *queuename, char *interface, int penalty, int pause
 	return res;
 }
 
+/*! \brief Pause or unpause one member.  Must be called with q->lock held. */
+static void update_member_paused(struct call_queue *q, struct member *mem, int paused)
+{
+	if (mem->paused == paused)
+		ast_log(LOG_DEBUG, "%spausing already-%spaused queue member %s:%s\n", (paused ? "" : "un"), (paused ? "" : "un"), q->name, mem->interface);
+	mem->paused = paused;
+
+	if (queue_persistent_members)
+		dump_queue_members(q);
+
+	ast_queue_log(q->name, "NONE", mem->interface, (paused ? "PAUSE" : "UNPAUSE"), "%s", "");
+
+	manager_event(EVENT_FLAG_AGENT, "QueueMemberPaused",
+		"Queue: %s\r\n"
+		"Location: %s\r\n"
+		"Paused: %d\r\n",
+			q->name, mem->interface, paused);
+	queue_dispatch(q, 1);
+}
+
 static int set_member_paused(char *queuename, char *interface, int paused)
 {
 	int found = 0;
 	struct call_queue *q;
 	struct member *mem;
+	struct member_interface *curint;
 
 	/* Special event for when all queues are paused - individual events still generated */
 
@@ -2815,28 +3070,30 @@ static int set_member_paused(char *queuename, char *interface, int paused)
 		ast_queue_log("NONE", "NONE", interface, (paused ? "PAUSEALL" : "UNPAUSEALL"), "%s", "");
 
 	AST_LIST_LOCK(&queues);
-	AST_LIST_TRAVERSE(&queues, q, list) {
-		ast_mutex_lock(&q->lock);
-		if (ast_strlen_zero(queuename) || !strcasecmp(q->name, queuename)) {
+	if (!ast_strlen_zero(queuename)) {
+		if ((q = find_queue(queuename))) {
+			ast_mutex_lock(&q->lock);
 			if ((mem = interface_exists(q, interface))) {
 				found++;
-				if (mem->paused == paused)
-					ast_log(LOG_DEBUG, "%spausing already-%spaused queue member %s:%s\n", (paused ? "" : "un"), (paused ? "" : "un"), q->name, interface);
-				mem->paused = paused;
-
-				if (queue_persistent_members)
-					dump_queue_members(q);
-
-				ast_queue_log(q->name, "NONE", interface, (paused ? "PAUSE" : "UNPAUSE"), "%s", "");
-
-				manager_event(EVENT_FLAG_AGENT, "QueueMemberPaused",
-					"Queue: %s\r\n"
-					"Location: %s\r\n"
-					"Paused: %d\r\n",
-						q->name, mem->interface, paused);
+				update_member_paused(q, mem, paused);
 			}
+			ast_mutex_unlock(&q->lock);
 		}
-		ast_mutex_unlock(&q->lock);
+	} else {
+		/* The device index already knows every queue this interface is in */
+		AST_LIST_LOCK(&interfaces);
+		if ((curint = find_interface(interface))) {
+			AST_LIST_TRAVERSE(&curint->members, mem, devlist) {
+				q = mem->parent;
+				ast_mutex_lock(&q->lock);
+				if (!q->dead) {
+					found++;
+					update_member_paused(q, mem, paused);
+				}
+				ast_mutex_unlock(&q->lock);
+			}
+		}
+		AST_LIST_UNLOCK(&interfaces);
 	}
 	AST_LIST_UNLOCK(&queues);
 
@@ -2867,20 +3124,12 @@ static void reload_queue_members(void)
 
 		queue_name = entry->key + strlen(pm_family) + 2;
 
-		AST_LIST_TRAVERSE(&queues, cur_queue, list) {
-			ast_mutex_lock(&cur_queue->lock);
-			if (!strcmp(queue_name, cur_queue->name))
-				break;
-			ast_mutex_unlock(&cur_queue->lock);
-		}
-
-		if (!cur_queue) {
+		if (!(cur_queue = find_queue(queue_name))) {
 			/* If the queue no longer exists, remove it from the
 			 * database */
 			ast_db_del(pm_family, queue_name);
 			continue;
-		} else
-			ast_mutex_unlock(&cur_queue->lock);
+		}
 
 		if (ast_db_get(pm_family, queue_name, queue_data, PM_MAX_LEN))
 			continue;
@@ -3265,6 +3514,13 @@ static int queue_exec(struct ast_channel *chan, void *data)
 	qe.last_pos = 0;
 	qe.last_periodic_announce_time = time(NULL);
 	qe.last_periodic_announce_sound = 0;
+	if (pipe(qe.wakefd)) {
+		ast_log(LOG_WARNING, "Unable to create queue wakeup pipe, falling back to polling: %s\n", strerror(errno));
+		qe.wakefd[0] = qe.wakefd[1] = -1;
+	} else {
+		fcntl(qe.wakefd[0], F_SETFL, fcntl(qe.wakefd[0], F_GETFL) | O_NONBLOCK);
+		fcntl(qe.wakefd[1], F_SETFL, fcntl(qe.wakefd[1], F_GETFL) | O_NONBLOCK);
+	}
 	if (!join_queue(args.queuename, &qe, &reason)) {
 		ast_queue_log(args.queuename, chan->uniqueid, "NONE", "ENTERQUEUE", "%s|%s", S_OR(args.url, ""),
 			      S_OR(chan->cid.cid_num, ""));
@@ -3434,6 +3690,10 @@ check_turns:
 		set_queue_result(chan, reason);
 		res = 0;
 	}
+	if (qe.wakefd[0] > -1) {
+		close(qe.wakefd[0]);
+		close(qe.wakefd[1]);
+	}
 	LOCAL_USER_REMOVE(lu);
 
 	return res;
@@ -3456,12 +3716,8 @@ static int queue_function_qac(struct ast_channel *chan, char *cmd, char *data, c
 	LOCAL_USER_ADD(lu);
 	
 	AST_LIST_LOCK(&queues);
-	AST_LIST_TRAVERSE(&queues, q, list) {
-		if (!strcasecmp(q->name, data)) {
-			ast_mutex_lock(&q->lock);
-			break;
-		}
-	}
+	if ((q = find_queue(data)))
+		ast_mutex_lock(&q->lock);
 	AST_LIST_UNLOCK(&queues);
 
 	if (q) {
@@ -3497,12 +3753,8 @@ static int queue_function_queuewaitingcount(struct ast_channel *chan, char *cmd,
 	LOCAL_USER_ADD(lu);
 	
 	AST_LIST_LOCK(&queues);
-	AST_LIST_TRAVERSE(&queues, q, list) {
-		if (!strcasecmp(q->name, data)) {
-			ast_mutex_lock(&q->lock);
-			break;
-		}
-	}
+	if ((q = find_queue(data)))
+		ast_mutex_lock(&q->lock);
 	AST_LIST_UNLOCK(&queues);
 
 	if (q) {
@@ -3533,12 +3785,8 @@ static int queue_function_queuememberlist(struct ast_channel *chan, char *cmd, c
 	LOCAL_USER_ADD(u);
 
 	AST_LIST_LOCK(&queues);
-	AST_LIST_TRAVERSE(&queues, q, list) {
-		if (!strcasecmp(q->name, data)) {
-			ast_mutex_lock(&q->lock);
-			break;
-		}
-	}
+	if ((q = find_queue(data)))
+		ast_mutex_lock(&q->lock);
 	AST_LIST_UNLOCK(&queues);
 
 	if (q) {
@@ -3617,6 +3865,7 @@ static void reload_queues(void)
 	char *general_val = NULL;
 	char interface[80];
 	int penalty;
+	int incremental;
 	
 	if (!(cfg = ast_config_load("queues.conf"))) {
 		ast_log(LOG_NOTICE, "No call queueing config file (queues.conf), so no call queues\n");
@@ -3624,6 +3873,9 @@ static void reload_queues(void)
 	}
 	memset(interface, 0, sizeof(interface));
 	AST_LIST_LOCK(&queues);
+	/* Queues whose section did not change are left alone, statistics and
+	   all, unless [general] changed since its defaults apply to every queue */
+	incremental = queues_cfg && !ast_category_changed(queues_cfg, cfg, "general");
 	use_weight=0;
 	/* Mark all queues as dead for the moment */
 	AST_LIST_TRAVERSE(&queues, q, list)
@@ -3646,9 +3898,12 @@ static void reload_queues(void)
 					montype_default = 1;
 		} else {	/* Define queue */
 			/* Look for an existing one */
-			AST_LIST_TRAVERSE(&queues, q, list) {
-				if (!strcmp(q->name, cat))
-					break;
+			q = find_queue(cat);
+			if (q && incremental && !q->realtime && !ast_category_changed(queues_cfg, cfg, cat)) {
+				q->dead = 0;
+				if (q->weight)
+					use_weight++;
+				continue;
 			}
 			if (!q) {
 				/* Make one then */
@@ -3683,27 +3938,17 @@ static void reload_queues(void)
 						} else
 							penalty = 0;
 
-						/* Find the old position in the list */
-						for (prev = NULL, cur = q->members; cur; prev = cur, cur = cur->next) {
-							if (!strcmp(cur->interface, interface)) {
-								break;
-							}
-						}
-
-						newm = create_queue_member(interface, penalty, cur ? cur->paused : 0);
-
-						if (cur) {
-							/* Delete it now */
-							newm->next = cur->next;
-							if (prev) {
-								prev->next = newm;
-							} else {
-								q->members = newm;
-							}
-							free(cur);
-						} else {
-							/* Add them to the master int list if necessary */
-							add_to_interfaces(interface);
+						if ((cur = interface_exists(q, interface))) {
+							/* Re-initialize it in place, keeping its pause state and position */
+							cur->penalty = penalty;
+							cur->calls = 0;
+							cur->lastcall = 0;
+							cur->dynamic = 0;
+							cur->dead = 0;
+							cur->delme = 0;
+							cur->status = ast_device_state(cur->interface);
+						} else if ((newm = create_queue_member(interface, penalty, 0))) {
+							add_to_interfaces(q, newm);
 							newm->next = q->members;
 							q->members = newm;
 						}
@@ -3713,38 +3958,36 @@ static void reload_queues(void)
 				}
 
 				/* Free remaining members marked as delme */
-				for (prev = NULL, newm = NULL, cur = q->members; cur; prev = cur, cur = cur->next) {
-					if (newm) {
-						free(newm);
-						newm = NULL;
-					}
-
+				for (prev = NULL, cur = q->members; cur; cur = newm) {
+					newm = cur->next;
 					if (cur->delme) {
-						if (prev) {
-							prev->next = cur->next;
-							newm = cur;
-						} else {
-							q->members = cur->next;
-							newm = cur;
-						}
-						remove_from_interfaces(cur->interface);
-					}
+						if (prev)
+							prev->next = newm;
+						else
+							q->members = newm;
+						remove_from_interfaces(cur);
+						free(cur);
+					} else
+						prev = cur;
 				}
 
 				if (q->strategy == QUEUE_STRATEGY_ROUNDROBIN)
 					rr_dep_warning();
 
 				if (new) {
-					AST_LIST_INSERT_HEAD(&queues, q, list);
+					link_queue(q);
 				} else
 					ast_mutex_unlock(&q->lock);
 			}
 		}
 	}
-	ast_config_destroy(cfg);
+	if (queues_cfg)
+		ast_config_destroy(queues_cfg);
+	queues_cfg = cfg;
 	AST_LIST_TRAVERSE_SAFE_BEGIN(&queues, q, list) {
 		if (q->dead) {
 			AST_LIST_REMOVE_CURRENT(&queues, list);
+			unhash_queue(q);
 			if (!q->count)
 				destroy_queue(q);
 			else
@@ -3753,6 +3996,7 @@ static void reload_queues(void)
 			ast_mutex_lock(&q->lock);
 			for (cur = q->members; cur; cur = cur->next)
 				cur->status = ast_device_state(cur->interface);
+			queue_dispatch(q, 1);
 			ast_mutex_unlock(&q->lock);
 		}
 	}
@@ -4312,7 +4556,15 @@ static int unload_module(void *mod)
 	res |= ast_custom_function_unregister(&queuewaitingcount_function);
 	res |= ast_unregister_application(app);
 
+	ast_devstate_del(statechange_queue, NULL);
+	stop_status_thread();
 	clear_and_free_interfaces();
+	ast_cond_destroy(&statuscond);
+
+	if (queues_cfg) {
+		ast_config_destroy(queues_cfg);
+		queues_cfg = NULL;
+	}
 
 	STANDARD_HANGUP_LOCALUSERS;
 
@@ -4323,6 +4575,10 @@ static int load_module(void *mod)
 {
 	int res;
 	
+	ast_cond_init(&statuscond, NULL);
+	if (start_status_thread())
+		return -1;
+
 	res = ast_register_application(app, queue_exec, synopsis, descrip);
 	res |= ast_cli_register(&cli_show_queue);
 	res |= ast_cli_register(&cli_show_queues);
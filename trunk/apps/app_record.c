@@ -235,6 +235,7 @@ static int record_exec(struct ast_channel *chan, void *data)
 			return -1;
 		}
 		ast_dsp_set_threshold(sildet, 256);
+		ast_dsp_analysis_attach(chan);
 	} 
 		
 		
@@ -245,6 +246,7 @@ static int record_exec(struct ast_channel *chan, void *data)
 		ast_log(LOG_WARNING, "Could not create file %s\n", filename);
 		goto out;
 	}
+	ast_filestream_set_async(s);
 
 	if (ast_opt_transmit_silence)
 		silgen = ast_channel_start_silence_generator(chan);
@@ -280,7 +282,7 @@ static int record_exec(struct ast_channel *chan, void *data)
 			
 			if (silence > 0) {
 				dspsilence = 0;
-				ast_dsp_silence(sildet, f, &dspsilence);
+				ast_dsp_silence_chan(sildet, chan, f, &dspsilence);
 				if (dspsilence) {
 					totalsilence = dspsilence;
 				} else {
@@ -327,6 +329,8 @@ static int record_exec(struct ast_channel *chan, void *data)
 		ast_channel_stop_silence_generator(chan, silgen);
 	
  out:
+	if (sildet)
+		ast_dsp_analysis_detach(chan);
 	if ((silence > 0) && rfmt) {
 		res = ast_set_read_format(chan, rfmt);
 		if (res)
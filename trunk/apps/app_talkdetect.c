@@ -119,7 +119,8 @@ static int background_detect_exec(struct ast_channel *chan, void *data)
 	if (!(dsp = ast_dsp_new())) {
 		ast_log(LOG_WARNING, "Unable to allocate DSP!\n");
 		res = -1;
-	}
+	} else
+		ast_dsp_analysis_attach(chan);
 	if (!res) {
 		ast_stopstream(chan);
 		res = ast_streamfile(chan, tmp, chan->language);
@@ -154,7 +155,7 @@ static int background_detect_exec(struct ast_channel *chan, void *data)
 					} else if ((fr->frametype == AST_FRAME_VOICE) && (fr->subclass == AST_FORMAT_SLINEAR)) {
 						int totalsilence;
 						int ms;
-						res = ast_dsp_silence(dsp, fr, &totalsilence);
+						res = ast_dsp_silence_chan(dsp, chan, fr, &totalsilence);
 						if (res && (totalsilence > sil)) {
 							/* We've been quiet a little while */
 							if (notsilent) {
@@ -205,8 +206,10 @@ static int background_detect_exec(struct ast_channel *chan, void *data)
 				chan->name, ast_getformatname(origrformat));
 		}
 	}
-	if (dsp)
+	if (dsp) {
+		ast_dsp_analysis_detach(chan);
 		ast_dsp_free(dsp);
+	}
 	LOCAL_USER_REMOVE(u);
 	return res;
 }
@@ -70,6 +70,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <sys/mman.h>
 #include <time.h>
 #include <dirent.h>
+#include <ctype.h>
 
 #include "asterisk.h"
 
@@ -1150,6 +1151,18 @@ static int count_messages(struct ast_vm_user *vmu, char *dir)
 	return last_message_index(vmu, dir) + 1;
 }
 
+/*! \brief Lowest free message number in a folder, or max if there is none */
+static int next_message(char *dir, int max)
+{
+	int x;
+
+	for (x = 0; x < max; x++) {
+		if (!message_exists(dir, x))
+			break;
+	}
+	return x;
+}
+
 static void delete_file(char *sdir, int smsg)
 {
 	int res;
@@ -1440,24 +1453,211 @@ yuck:
 
 #else
 
+/*! \brief The messages of one folder directory.
+ * Built from a single directory scan and reused for as long as the
+ * directory's modification time stays the same, so message counts for MWI
+ * and the manager do not walk the spool.  Checking the time, rather than
+ * trusting our own updates, keeps it right when other programs change
+ * the spool.
+ */
+struct vm_index {
+	struct vm_index *next;
+	time_t mtime;			/*!< directory modification time when scanned */
+	int racy;			/*!< scanned too close to a change to trust mtime */
+	int count;			/*!< messages, as msgNNNN.txt files */
+	int size;			/*!< message numbers msgs has room for */
+	unsigned char *msgs;		/*!< VM_INDEX_* flags of each message number */
+	char dir[1];
+};
+
+#define VM_INDEX_TXT	(1 << 0)	/*!< msgNNNN.txt exists, counted as a message */
+#define VM_INDEX_SOUND	(1 << 1)	/*!< msgNNNN has a sound file, the number is taken */
+
+#define VM_INDEX_BUCKETS 8192
+
+static struct vm_index *vm_indexes[VM_INDEX_BUCKETS];
+AST_MUTEX_DEFINE_STATIC(vm_index_lock);
+
+static unsigned int vm_index_hash(const char *dir)
+{
+	unsigned int hash = 0;
+
+	while (*dir)
+		hash = hash * 33 + (unsigned char) *dir++;
+	return hash % VM_INDEX_BUCKETS;
+}
+
+static int vm_index_test(struct vm_index *idx, int num, int flag)
+{
+	return (num < idx->size) && (idx->msgs[num] & flag);
+}
+
+static void vm_index_set(struct vm_index *idx, int num, int flag)
+{
+	unsigned char *msgs;
+	int size;
+
+	if (num >= idx->size) {
+		for (size = idx->size ? idx->size : 64; size <= num; size *= 2)
+			;
+		if (!(msgs = ast_realloc(idx->msgs, size)))
+			return;
+		memset(msgs + idx->size, 0, size - idx->size);
+		idx->msgs = msgs;
+		idx->size = size;
+	}
+	if ((flag & VM_INDEX_TXT) && !(idx->msgs[num] & VM_INDEX_TXT))
+		idx->count++;
+	idx->msgs[num] |= flag;
+}
+
+static void vm_index_scan(struct vm_index *idx)
+{
+	DIR *vmdir;
+	struct dirent *vment;
+	char fn[256];
+	int num;
+
+	idx->count = 0;
+	if (idx->msgs)
+		memset(idx->msgs, 0, idx->size);
+	if (!(vmdir = opendir(idx->dir)))
+		return;
+	while ((vment = readdir(vmdir))) {
+		/* msgNNNN.ext */
+		if (strlen(vment->d_name) < 9 || strncmp(vment->d_name, "msg", 3) || (vment->d_name[7] != '.') ||
+		    !isdigit(vment->d_name[3]) || !isdigit(vment->d_name[4]) || !isdigit(vment->d_name[5]) || !isdigit(vment->d_name[6]))
+			continue;
+		num = atoi(vment->d_name + 3);
+		if (!strcmp(vment->d_name + 8, "txt"))
+			vm_index_set(idx, num, VM_INDEX_TXT);
+		else if (!vm_index_test(idx, num, VM_INDEX_SOUND)) {
+			/* only a file in a format Asterisk knows takes the number,
+			   as the ast_fileexists() probing this replaces had it */
+			snprintf(fn, sizeof(fn), "%s/msg%04d", idx->dir, num);
+			if (ast_fileexists(fn, vment->d_name + 8, NULL) > 0)
+				vm_index_set(idx, num, VM_INDEX_SOUND);
+		}
+	}
+	closedir(vmdir);
+}
+
+/*! \brief Find the up to date index of a folder directory, vm_index_lock held */
+static struct vm_index *vm_index_get(const char *dir)
+{
+	struct vm_index *idx;
+	struct stat st;
+	unsigned int hash = vm_index_hash(dir);
+
+	for (idx = vm_indexes[hash]; idx; idx = idx->next) {
+		if (!strcmp(idx->dir, dir))
+			break;
+	}
+	if (stat(dir, &st)) {
+		/* no folder, no messages */
+		if (idx) {
+			idx->racy = 1;
+			idx->count = 0;
+			if (idx->msgs)
+				memset(idx->msgs, 0, idx->size);
+		}
+		return idx;
+	}
+	if (!idx) {
+		if (!(idx = ast_calloc(1, sizeof(*idx) + strlen(dir))))
+			return NULL;
+		strcpy(idx->dir, dir);
+		idx->racy = 1;
+		idx->next = vm_indexes[hash];
+		vm_indexes[hash] = idx;
+	}
+	if (idx->racy || (idx->mtime != st.st_mtime)) {
+		idx->mtime = st.st_mtime;
+		/* a change later within the same second would not move mtime */
+		idx->racy = (st.st_mtime >= time(NULL) - 1);
+		vm_index_scan(idx);
+	}
+	return idx;
+}
+
+/*! \brief Number of messages in a folder directory */
+static int vm_index_count(const char *dir)
+{
+	struct vm_index *idx;
+	int count = 0;
+
+	ast_mutex_lock(&vm_index_lock);
+	if ((idx = vm_index_get(dir)))
+		count = idx->count;
+	ast_mutex_unlock(&vm_index_lock);
+	return count;
+}
+
+/*! \brief Lowest message number without a sound file in a folder directory, at most max */
+static int next_message(char *dir, int max)
+{
+	struct vm_index *idx;
+	int x = 0;
+
+	ast_mutex_lock(&vm_index_lock);
+	if ((idx = vm_index_get(dir))) {
+		for (x = 0; x < max; x++) {
+			if (!vm_index_test(idx, x, VM_INDEX_SOUND))
+				break;
+		}
+	}
+	ast_mutex_unlock(&vm_index_lock);
+	return x;
+}
+
+/*! \brief Rescan the folder of a message file we just changed on next use */
+static void vm_index_changed(const char *fn)
+{
+	struct vm_index *idx;
+	char dir[256];
+	char *slash;
+
+	ast_copy_string(dir, fn, sizeof(dir));
+	if (!(slash = strrchr(dir, '/')))
+		return;
+	*slash = '\0';
+	ast_mutex_lock(&vm_index_lock);
+	for (idx = vm_indexes[vm_index_hash(dir)]; idx; idx = idx->next) {
+		if (!strcmp(idx->dir, dir)) {
+			idx->racy = 1;
+			break;
+		}
+	}
+	ast_mutex_unlock(&vm_index_lock);
+}
+
+static void vm_index_free_all(void)
+{
+	struct vm_index *idx;
+	int x;
+
+	ast_mutex_lock(&vm_index_lock);
+	for (x = 0; x < VM_INDEX_BUCKETS; x++) {
+		while ((idx = vm_indexes[x])) {
+			vm_indexes[x] = idx->next;
+			if (idx->msgs)
+				free(idx->msgs);
+			free(idx);
+		}
+	}
+	ast_mutex_unlock(&vm_index_lock);
+}
+
 static int count_messages(struct ast_vm_user *vmu, char *dir)
 {
 	/* Find all .txt files - even if they are not in sequence from 0000 */
 
-	int vmcount = 0;
-	DIR *vmdir = NULL;
-	struct dirent *vment = NULL;
+	int vmcount;
 
 	if (vm_lock_path(dir))
 		return ERROR_LOCK_PATH;
 
-	if ((vmdir = opendir(dir))) {
-		while ((vment = readdir(vmdir))) {
-			if (strlen(vment->d_name) > 7 && !strncmp(vment->d_name + 7, ".txt", 4)) 
-				vmcount++;
-		}
-		closedir(vmdir);
-	}
+	vmcount = vm_index_count(dir);
 	ast_unlock_path(dir);
 	
 	return vmcount;
@@ -1471,6 +1671,8 @@ static void rename_file(char *sfn, char *dfn)
 	snprintf(stxt, sizeof(stxt), "%s.txt", sfn);
 	snprintf(dtxt, sizeof(dtxt), "%s.txt", dfn);
 	rename(stxt, dtxt);
+	vm_index_changed(sfn);
+	vm_index_changed(dfn);
 }
 
 static int copy(char *infile, char *outfile)
@@ -1530,6 +1732,7 @@ static void copy_file(char *frompath, char *topath)
 	snprintf(frompath2, sizeof(frompath2), "%s.txt", frompath);
 	snprintf(topath2, sizeof(topath2), "%s.txt", topath);
 	copy(frompath2, topath2);
+	vm_index_changed(topath);
 }
 
 /*
@@ -1538,16 +1741,11 @@ static void copy_file(char *frompath, char *topath)
 static int last_message_index(struct ast_vm_user *vmu, char *dir)
 {
 	int x;
-	char fn[256];
 
 	if (vm_lock_path(dir))
 		return ERROR_LOCK_PATH;
 
-	for (x = 0; x < vmu->maxmsg; x++) {
-		make_file(fn, sizeof(fn), dir, x);
-		if (ast_fileexists(fn, NULL, NULL) < 1)
-			break;
-	}
+	x = next_message(dir, vmu->maxmsg);
 	ast_unlock_path(dir);
 
 	return x - 1;
@@ -1565,6 +1763,7 @@ static int vm_delete(char *file)
 	 */
 	snprintf(txt, txtsize, "%s.txt", file);
 	unlink(txt);
+	vm_index_changed(file);
 	return ast_filedelete(file, NULL);
 }
 
@@ -2226,10 +2425,8 @@ static int has_voicemail(const char *mailbox, const char *folder)
 
 static int __has_voicemail(const char *context, const char *mailbox, const char *folder, int shortcircuit)
 {
-	DIR *dir;
-	struct dirent *de;
 	char fn[256];
-	int ret = 0;
+	int ret;
 	if (!folder)
 		folder = "INBOX";
 	/* If no mailbox, return immediately */
@@ -2238,19 +2435,9 @@ static int __has_voicemail(const char *context, const char *mailbox, const char
 	if (!context)
 		context = "default";
 	snprintf(fn, sizeof(fn), "%s%s/%s/%s", VM_SPOOL_DIR, context, mailbox, folder);
-	dir = opendir(fn);
-	if (!dir)
-		return 0;
-	while ((de = readdir(dir))) {
-		if (!strncasecmp(de->d_name, "msg", 3)) {
-			if (shortcircuit) {
-				ret = 1;
-				break;
-			} else if (!strncasecmp(de->d_name + 8, "txt", 3))
-				ret++;
-		}
-	}
-	closedir(dir);
+	ret = vm_index_count(fn);
+	if (shortcircuit && ret)
+		ret = 1;
 	return ret;
 }
 
@@ -2340,13 +2527,8 @@ static int copy_message(struct ast_channel *chan, struct ast_vm_user *vmu, int i
 	if (vm_lock_path(todir))
 		return ERROR_LOCK_PATH;
 
-	recipmsgnum = 0;
-	do {
-		make_file(topath, sizeof(topath), todir, recipmsgnum);
-		if (!EXISTS(todir, recipmsgnum, topath, chan->language))
-			break;
-		recipmsgnum++;
-	} while (recipmsgnum < recip->maxmsg);
+	recipmsgnum = next_message(todir, recip->maxmsg);
+	make_file(topath, sizeof(topath), todir, recipmsgnum);
 	if (recipmsgnum < recip->maxmsg) {
 		COPY(fromdir, msgnum, todir, recipmsgnum, recip->mailbox, recip->context, frompath, topath);
 	} else {
@@ -2650,12 +2832,8 @@ static int leave_voicemail(struct ast_channel *chan, char *ext, struct leave_vm_
 						ast_log(LOG_DEBUG, "The recorded media file is gone, so we should remove the .txt file too!\n");
 					unlink(tmptxtfile);	
 				} else {
-					for (;;) {
-						make_file(fn, sizeof(fn), dir, msgnum);
-						if (!EXISTS(dir, msgnum, fn, NULL))
-							break;
-						msgnum++;
-					}
+					msgnum = next_message(dir, MAXMSGLIMIT);
+					make_file(fn, sizeof(fn), dir, msgnum);
 
 					/* assign a variable with the name of the voicemail file */	  
 					pbx_builtin_setvar_helper(chan, "VM_MESSAGEFILE", fn);
@@ -2758,11 +2936,8 @@ static int save_to_folder(struct ast_vm_user *vmu, char *dir, int msg, char *con
 	if (vm_lock_path(ddir))
 		return ERROR_LOCK_PATH;
 
-	for (x = 0; x < vmu->maxmsg; x++) {
-		make_file(dfn, sizeof(dfn), ddir, x);
-		if (!EXISTS(ddir, x, dfn, NULL))
-			break;
-	}
+	x = next_message(ddir, vmu->maxmsg);
+	make_file(dfn, sizeof(dfn), ddir, x);
 	if (x >= vmu->maxmsg) {
 		ast_unlock_path(ddir);
 		return -1;
@@ -6612,6 +6787,9 @@ static int unload_module(void *mod)
 	ast_uninstall_vm_functions();
 	
 	STANDARD_HANGUP_LOCALUSERS;
+#ifndef ODBC_STORAGE
+	vm_index_free_all();
+#endif
 
 	return res;
 }
@@ -89,6 +89,7 @@ static int do_waiting(struct ast_channel *chan, int maxsilence) {
 		return -1;
 	}
 	ast_dsp_set_threshold(sildet, silencethreshold);
+	ast_dsp_analysis_attach(chan);
 
 	/* Await silence... */
 	f = NULL;
@@ -113,7 +114,7 @@ static int do_waiting(struct ast_channel *chan, int maxsilence) {
 			break;
 		if (f->frametype == AST_FRAME_VOICE) {
 			dspsilence = 0;
-			ast_dsp_silence(sildet, f, &dspsilence);
+			ast_dsp_silence_chan(sildet, chan, f, &dspsilence);
 			if (dspsilence) {
 				totalsilence = dspsilence;
 				time(&start);
@@ -142,6 +143,7 @@ static int do_waiting(struct ast_channel *chan, int maxsilence) {
 	if (rfmt && ast_set_read_format(chan, rfmt)) {
 		ast_log(LOG_WARNING, "Unable to restore format %s to channel '%s'\n", ast_getformatname(rfmt), chan->name);
 	}
+	ast_dsp_analysis_detach(chan);
 	ast_dsp_free(sildet);
 	return gotsilence;
 }
@@ -165,6 +165,8 @@ int option_debug = 0;				/*!< Debug level */
 
 double option_maxload = 0.0;			/*!< Max load avg on system */
 int option_maxcalls = 0;			/*!< Max number of active calls */
+int option_pbxpool = 8;				/*!< Max PBX pool workers, 0 for a thread per call */
+int option_pbxstacksize = AST_STACKSIZE;	/*!< Stack size of PBX threads */
 
 /*! @} */
 
@@ -2288,6 +2290,17 @@ static void ast_readconfig(void)
 			if ((sscanf(v->value, "%d", &option_maxcalls) != 1) || (option_maxcalls < 0)) {
 				option_maxcalls = 0;
 			}
+		} else if (!strcasecmp(v->name, "pbxpool")) {
+			if ((sscanf(v->value, "%d", &option_pbxpool) != 1) || (option_pbxpool < 0)) {
+				option_pbxpool = 8;
+			}
+		} else if (!strcasecmp(v->name, "pbxstacksize")) {
+			if ((sscanf(v->value, "%d", &option_pbxstacksize) != 1) || (option_pbxstacksize <= 0)) {
+				option_pbxstacksize = AST_STACKSIZE;
+			} else if ((option_pbxstacksize *= 1024) < PBX_STACKSIZE_MIN) {
+				ast_log(LOG_WARNING, "pbxstacksize of %d KB is below the %d KB default, using that\n", option_pbxstacksize / 1024, PBX_STACKSIZE_MIN / 1024);
+				option_pbxstacksize = PBX_STACKSIZE_MIN;
+			}
 		} else if (!strcasecmp(v->name, "maxload")) {
 			double test[1];
 
@@ -2648,6 +2661,10 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 	ast_http_init();
+	if (ast_timing_init()) {
+		printf(term_quit());
+		exit(1);
+	}
 	ast_channels_init();
 	if (init_manager()) {
 		printf(term_quit());
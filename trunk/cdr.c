@@ -63,6 +63,13 @@ struct ast_cdr_beitem {
 	char name[20];
 	char desc[80];
 	ast_cdrbe be;
+	ast_cdrbe_batch batch_be;
+	/*! Posting statistics, protected by the be_list lock */
+	unsigned long rows;
+	unsigned long batches;
+	int64_t busy_usec;
+	int last_batch_ms;
+	int max_batch_ms;
 	AST_LIST_ENTRY(ast_cdr_beitem) list;
 };
 
@@ -105,7 +112,7 @@ static ast_cond_t cdr_pending_cond;
 /*! Register a CDR driver. Each registered CDR driver generates a CDR 
 	\return 0 on success, -1 on failure 
 */
-int ast_cdr_register(char *name, char *desc, ast_cdrbe be)
+int ast_cdr_register_batch(char *name, char *desc, ast_cdrbe be, ast_cdrbe_batch batch_be)
 {
 	struct ast_cdr_beitem *i;
 
@@ -132,6 +139,7 @@ int ast_cdr_register(char *name, char *desc, ast_cdrbe be)
 		return -1;
 
 	i->be = be;
+	i->batch_be = batch_be;
 	ast_copy_string(i->name, name, sizeof(i->name));
 	ast_copy_string(i->desc, desc, sizeof(i->desc));
 
@@ -142,6 +150,11 @@ int ast_cdr_register(char *name, char *desc, ast_cdrbe be)
 	return 0;
 }
 
+int ast_cdr_register(char *name, char *desc, ast_cdrbe be)
+{
+	return ast_cdr_register_batch(name, desc, be, NULL);
+}
+
 /*! unregister a CDR driver */
 void ast_cdr_unregister(char *name)
 {
@@ -714,27 +727,74 @@ int ast_cdr_amaflags2int(const char *flag)
 	return -1;
 }
 
+/*! \brief Sanity check a single CDR (not its chain) and mark it posted */
+static void prepare_post(struct ast_cdr *cdr)
+{
+	char *chan = S_OR(cdr->channel, "<unknown>");
+
+	check_post(cdr);
+	if (ast_tvzero(cdr->end))
+		ast_log(LOG_WARNING, "CDR on channel '%s' lacks end\n", chan);
+	if (ast_tvzero(cdr->start))
+		ast_log(LOG_WARNING, "CDR on channel '%s' lacks start\n", chan);
+	ast_set_flag(cdr, AST_CDR_FLAG_POSTED);
+}
+
+/*! \note Don't call without the be_list lock */
+static void update_be_stats(struct ast_cdr_beitem *i, int rows, struct timeval start)
+{
+	struct timeval elapsed = ast_tvsub(ast_tvnow(), start);
+	int ms = elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000;
+
+	i->rows += rows;
+	i->batches++;
+	i->busy_usec += (int64_t) elapsed.tv_sec * 1000000 + elapsed.tv_usec;
+	i->last_batch_ms = ms;
+	if (ms > i->max_batch_ms)
+		i->max_batch_ms = ms;
+}
+
 static void post_cdr(struct ast_cdr *cdr)
 {
-	char *chan;
 	struct ast_cdr_beitem *i;
+	struct timeval start;
 
 	for ( ; cdr ; cdr = cdr->next) {
-		chan = S_OR(cdr->channel, "<unknown>");
-		check_post(cdr);
-		if (ast_tvzero(cdr->end))
-			ast_log(LOG_WARNING, "CDR on channel '%s' lacks end\n", chan);
-		if (ast_tvzero(cdr->start))
-			ast_log(LOG_WARNING, "CDR on channel '%s' lacks start\n", chan);
-		ast_set_flag(cdr, AST_CDR_FLAG_POSTED);
+		prepare_post(cdr);
 		AST_LIST_LOCK(&be_list);
 		AST_LIST_TRAVERSE(&be_list, i, list) {
+			start = ast_tvnow();
 			i->be(cdr);
+			update_be_stats(i, 1, start);
 		}
 		AST_LIST_UNLOCK(&be_list);
 	}
 }
 
+/*! \brief Hand a flattened batch to every backend, in one call where the backend supports it */
+static void post_cdr_batch(struct ast_cdr **cdrs, int count)
+{
+	struct ast_cdr_beitem *i;
+	struct timeval start;
+	int x;
+
+	for (x = 0; x < count; x++)
+		prepare_post(cdrs[x]);
+
+	AST_LIST_LOCK(&be_list);
+	AST_LIST_TRAVERSE(&be_list, i, list) {
+		start = ast_tvnow();
+		if (i->batch_be) {
+			i->batch_be(cdrs, count);
+		} else {
+			for (x = 0; x < count; x++)
+				i->be(cdrs[x]);
+		}
+		update_be_stats(i, count, start);
+	}
+	AST_LIST_UNLOCK(&be_list);
+}
+
 void ast_cdr_reset(struct ast_cdr *cdr, struct ast_flags *_flags)
 {
 	struct ast_cdr *dup;
@@ -813,10 +873,32 @@ static void *do_batch_backend_process(void *data)
 {
 	struct ast_cdr_batch_item *processeditem;
 	struct ast_cdr_batch_item *batchitem = data;
+	struct ast_cdr **cdrs;
+	struct ast_cdr *cdr;
+	int count = 0;
 
-	/* Push each CDR into storage mechanism(s) and free all the memory */
+	/* Flatten the batch, including chained CDRs, so each backend sees it in one go */
+	for (processeditem = batchitem; processeditem; processeditem = processeditem->next) {
+		for (cdr = processeditem->cdr; cdr; cdr = cdr->next)
+			count++;
+	}
+
+	if (count && (cdrs = ast_calloc(count, sizeof(*cdrs)))) {
+		count = 0;
+		for (processeditem = batchitem; processeditem; processeditem = processeditem->next) {
+			for (cdr = processeditem->cdr; cdr; cdr = cdr->next)
+				cdrs[count++] = cdr;
+		}
+		post_cdr_batch(cdrs, count);
+		free(cdrs);
+	} else {
+		/* Fall back to pushing records one at a time */
+		for (processeditem = batchitem; processeditem; processeditem = processeditem->next)
+			post_cdr(processeditem->cdr);
+	}
+
+	/* Free all the memory */
 	while (batchitem) {
-		post_cdr(batchitem->cdr);
 		ast_cdr_free(batchitem->cdr);
 		processeditem = batchitem;
 		batchitem = batchitem->next;
@@ -988,7 +1070,14 @@ static int handle_cli_status(int fd, int argc, char *argv[])
 		}
 		AST_LIST_LOCK(&be_list);
 		AST_LIST_TRAVERSE(&be_list, beitem, list) {
-			ast_cli(fd, "CDR registered backend: %s\n", beitem->name);
+			ast_cli(fd, "CDR registered backend: %s%s\n", beitem->name, beitem->batch_be ? " (batch capable)" : "");
+			if (!beitem->batches)
+				continue;
+			ast_cli(fd, "    %lu record%s in %lu post%s, %.1f records/sec, latency last %d ms, avg %d ms, max %d ms\n",
+				beitem->rows, (beitem->rows != 1) ? "s" : "",
+				beitem->batches, (beitem->batches != 1) ? "s" : "",
+				beitem->busy_usec ? (double) beitem->rows * 1000000.0 / beitem->busy_usec : 0.0,
+				beitem->last_batch_ms, (int) (beitem->busy_usec / 1000 / beitem->batches), beitem->max_batch_ms);
 		}
 		AST_LIST_UNLOCK(&be_list);
 	}
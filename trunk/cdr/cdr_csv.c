@@ -33,6 +33,7 @@
 ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -50,16 +51,23 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/cdr.h"
 #include "asterisk/module.h"
 #include "asterisk/logger.h"
+#include "asterisk/options.h"
 #include "asterisk/utils.h"
+#include "asterisk/lock.h"
+#include "asterisk/linkedlists.h"
 
 #define CSV_LOG_DIR "/cdr-csv"
 #define CSV_MASTER  "/Master.csv"
 
 #define DATE_FORMAT "%Y-%m-%d %T"
 
+#define MAX_ACCOUNT_FILES_DEFAULT 64
+
 static int usegmtime = 0;
 static int loguniqueid = 0;
 static int loguserfield = 0;
+static int flushinterval = 0;
+static int maxaccountfiles = MAX_ACCOUNT_FILES_DEFAULT;
 static char *config = "cdr.conf";
 
 /* #define CSV_LOGUNIQUEID 1 */
@@ -97,7 +105,30 @@ static char *desc = "Comma Separated Values CDR Backend";
 
 static char *name = "csv";
 
-static FILE *mf = NULL;
+/*! \brief A CSV file kept open between records */
+struct csv_file {
+	FILE *f;
+	/*! Identity of the file we opened, to notice it being rotated away */
+	dev_t dev;
+	ino_t ino;
+	int dirty;
+	char path[PATH_MAX];
+	AST_LIST_ENTRY(csv_file) list;
+};
+
+/*! Master.csv, always open while records are being written */
+static struct csv_file master_file;
+
+/*! Per-account files, most recently used first */
+static AST_LIST_HEAD_NOLOCK_STATIC(account_files, csv_file);
+static int account_file_count = 0;
+
+/*! Protects all of the open files above */
+AST_MUTEX_DEFINE_STATIC(csv_lock);
+
+static pthread_t flush_thread = AST_PTHREADT_NULL;
+static ast_cond_t flush_cond;
+static int flush_thread_stop = 0;
 
 
 static int load_config(void)
@@ -109,6 +140,8 @@ static int load_config(void)
 	usegmtime = 0;
 	loguniqueid = 0;
 	loguserfield = 0;
+	flushinterval = 0;
+	maxaccountfiles = MAX_ACCOUNT_FILES_DEFAULT;
 	
 	cfg = ast_config_load(config);
 	
@@ -147,6 +180,22 @@ static int load_config(void)
 		}
 	}
 
+	tmp = ast_variable_retrieve(cfg, "csv", "flushinterval");
+	if (tmp) {
+		if (sscanf(tmp, "%d", &flushinterval) != 1 || flushinterval < 0) {
+			ast_log(LOG_WARNING, "Invalid flushinterval '%s', flushing after every record\n", tmp);
+			flushinterval = 0;
+		}
+	}
+
+	tmp = ast_variable_retrieve(cfg, "csv", "maxaccountfiles");
+	if (tmp) {
+		if (sscanf(tmp, "%d", &maxaccountfiles) != 1 || maxaccountfiles < 1) {
+			ast_log(LOG_WARNING, "Invalid maxaccountfiles '%s', using %d\n", tmp, MAX_ACCOUNT_FILES_DEFAULT);
+			maxaccountfiles = MAX_ACCOUNT_FILES_DEFAULT;
+		}
+	}
+
 	ast_config_destroy(cfg);
 	return 0;
 }
@@ -263,56 +312,215 @@ static int build_csv_record(char *buf, size_t bufsize, struct ast_cdr *cdr)
 	return -1;
 }
 
+/*! \note Don't call without csv_lock */
+static void csv_file_close(struct csv_file *cf)
+{
+	if (!cf->f)
+		return;
+	fclose(cf->f);
+	cf->f = NULL;
+	cf->dirty = 0;
+}
+
+/*! \note Don't call without csv_lock */
+static void csv_file_flush(struct csv_file *cf)
+{
+	if (cf->f && cf->dirty) {
+		fflush(cf->f);
+		cf->dirty = 0;
+	}
+}
+
+/*! \brief Close the file if it has been moved or removed under us (log rotation)
+ * \note Don't call without csv_lock
+ */
+static void csv_file_check_rotated(struct csv_file *cf)
+{
+	struct stat st;
+
+	if (!cf->f)
+		return;
+	if (stat(cf->path, &st) || st.st_dev != cf->dev || st.st_ino != cf->ino) {
+		if (option_debug)
+			ast_log(LOG_DEBUG, "CSV file '%s' was rotated, reopening\n", cf->path);
+		csv_file_close(cf);
+	}
+}
+
+/*! \note Don't call without csv_lock */
+static int csv_file_write(struct csv_file *cf, const char *s)
+{
+	struct stat st;
+
+	if (!cf->f) {
+		if (!(cf->f = fopen(cf->path, "a")))
+			return -1;
+		if (!fstat(fileno(cf->f), &st)) {
+			cf->dev = st.st_dev;
+			cf->ino = st.st_ino;
+		}
+	}
+	if (fputs(s, cf->f) == EOF) {
+		csv_file_close(cf);
+		return -1;
+	}
+	cf->dirty = 1;
+	/* without a flush interval, be particularly anal and flush every record */
+	if (!flushinterval)
+		csv_file_flush(cf);
+	return 0;
+}
+
+/*! \brief Close every open file, they are reopened on the next record
+ * \note Don't call without csv_lock
+ */
+static void csv_close_all(void)
+{
+	struct csv_file *cf;
+
+	csv_file_close(&master_file);
+	while ((cf = AST_LIST_REMOVE_HEAD(&account_files, list))) {
+		csv_file_close(cf);
+		free(cf);
+	}
+	account_file_count = 0;
+}
+
+/*! \note Don't call without csv_lock */
+static void csv_flush_all(void)
+{
+	struct csv_file *cf;
+
+	csv_file_flush(&master_file);
+	AST_LIST_TRAVERSE(&account_files, cf, list)
+		csv_file_flush(cf);
+}
+
+/*! \brief Find or create the file for an account, keeping the list in LRU order
+ * \note Don't call without csv_lock
+ */
+static struct csv_file *get_account_file(const char *acc)
+{
+	char path[PATH_MAX];
+	struct csv_file *cf;
+
+	snprintf(path, sizeof(path), "%s/%s/%s.csv", (char *)ast_config_AST_LOG_DIR, CSV_LOG_DIR, acc);
+
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&account_files, cf, list) {
+		if (!strcmp(cf->path, path)) {
+			AST_LIST_REMOVE_CURRENT(&account_files, list);
+			break;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+
+	if (!cf) {
+		if (!(cf = ast_calloc(1, sizeof(*cf))))
+			return NULL;
+		ast_copy_string(cf->path, path, sizeof(cf->path));
+		account_file_count++;
+	}
+	AST_LIST_INSERT_HEAD(&account_files, cf, list);
+
+	/* Keep at most maxaccountfiles descriptors open */
+	if (account_file_count > maxaccountfiles) {
+		struct csv_file *lru = account_files.last;
+
+		if (lru != cf) {
+			AST_LIST_REMOVE(&account_files, lru, list);
+			csv_file_close(lru);
+			free(lru);
+			account_file_count--;
+		}
+	}
+
+	return cf;
+}
+
+/*! \note Don't call without csv_lock */
 static int writefile(char *s, char *acc)
 {
-	char tmp[PATH_MAX];
-	FILE *f;
+	struct csv_file *cf;
+
 	if (strchr(acc, '/') || (acc[0] == '.')) {
 		ast_log(LOG_WARNING, "Account code '%s' insecure for writing file\n", acc);
 		return -1;
 	}
-	snprintf(tmp, sizeof(tmp), "%s/%s/%s.csv", (char *)ast_config_AST_LOG_DIR,CSV_LOG_DIR, acc);
-	f = fopen(tmp, "a");
-	if (!f)
+	if (!(cf = get_account_file(acc)))
 		return -1;
-	fputs(s, f);
-	fflush(f);
-	fclose(f);
-	return 0;
+	return csv_file_write(cf, s);
 }
 
-
-static int csv_log(struct ast_cdr *cdr)
+/*! \note Don't call without csv_lock */
+static void csv_write_record(struct ast_cdr *cdr)
 {
 	/* Make sure we have a big enough buf */
 	char buf[1024];
-	char csvmaster[PATH_MAX];
-	snprintf(csvmaster, sizeof(csvmaster),"%s/%s/%s", ast_config_AST_LOG_DIR, CSV_LOG_DIR, CSV_MASTER);
+
+	if (build_csv_record(buf, sizeof(buf), cdr)) {
+		ast_log(LOG_WARNING, "Unable to create CSV record in %d bytes.  CDR not recorded!\n", (int)sizeof(buf));
+		return;
+	}
+
+	/* The files stay open between records; they are flushed after every
+	   record, or every flushinterval seconds and at the end of each batch,
+	   and reopened when rotated away or on reload */
+	if (csv_file_write(&master_file, buf))
+		ast_log(LOG_ERROR, "Unable to write master file %s : %s\n", master_file.path, strerror(errno));
+	if (!ast_strlen_zero(cdr->accountcode)) {
+		if (writefile(buf, cdr->accountcode))
+			ast_log(LOG_WARNING, "Unable to write CSV record to account file '%s' : %s\n", cdr->accountcode, strerror(errno));
+	}
+}
+
+static int csv_log(struct ast_cdr *cdr)
+{
 #if 0
 	printf("[CDR] %s ('%s' -> '%s') Dur: %ds Bill: %ds Disp: %s Flags: %s Account: [%s]\n", cdr->channel, cdr->src, cdr->dst, cdr->duration, cdr->billsec, ast_cdr_disp2str(cdr->disposition), ast_cdr_flags2str(cdr->amaflags), cdr->accountcode);
 #endif
-	if (build_csv_record(buf, sizeof(buf), cdr)) {
-		ast_log(LOG_WARNING, "Unable to create CSV record in %d bytes.  CDR not recorded!\n", (int)sizeof(buf));
-	} else {
-		/* because of the absolutely unconditional need for the
-		   highest reliability possible in writing billing records,
-		   we open write and close the log file each time */
-		mf = fopen(csvmaster, "a");
-		if (!mf) {
-			ast_log(LOG_ERROR, "Unable to re-open master file %s : %s\n", csvmaster, strerror(errno));
-		}
-		if (mf) {
-			fputs(buf, mf);
-			fflush(mf); /* be particularly anal here */
-			fclose(mf);
-			mf = NULL;
-		}
-		if (!ast_strlen_zero(cdr->accountcode)) {
-			if (writefile(buf, cdr->accountcode))
-				ast_log(LOG_WARNING, "Unable to write CSV record to account file '%s' : %s\n", cdr->accountcode, strerror(errno));
+	ast_mutex_lock(&csv_lock);
+	csv_write_record(cdr);
+	ast_mutex_unlock(&csv_lock);
+	return 0;
+}
+
+static int csv_log_batch(struct ast_cdr **cdrs, int count)
+{
+	int x;
+
+	ast_mutex_lock(&csv_lock);
+	for (x = 0; x < count; x++)
+		csv_write_record(cdrs[x]);
+	csv_flush_all();
+	ast_mutex_unlock(&csv_lock);
+	return 0;
+}
+
+/*! \brief Flush buffered records on the configured interval, and notice rotated files */
+static void *do_flush(void *data)
+{
+	struct csv_file *cf;
+	struct timespec ts;
+	time_t lastflush = time(NULL);
+
+	ast_mutex_lock(&csv_lock);
+	while (!flush_thread_stop) {
+		ts.tv_sec = time(NULL) + 1;
+		ts.tv_nsec = 0;
+		ast_cond_timedwait(&flush_cond, &csv_lock, &ts);
+		if (flush_thread_stop)
+			break;
+		if (flushinterval && (time(NULL) - lastflush >= flushinterval)) {
+			csv_flush_all();
+			lastflush = time(NULL);
 		}
+		csv_file_check_rotated(&master_file);
+		AST_LIST_TRAVERSE(&account_files, cf, list)
+			csv_file_check_rotated(cf);
 	}
-	return 0;
+	ast_mutex_unlock(&csv_lock);
+
+	return NULL;
 }
 
 static const char *description(void)
@@ -322,9 +530,18 @@ static const char *description(void)
 
 static int unload_module(void *mod)
 {
-	if (mf)
-		fclose(mf);
 	ast_cdr_unregister(name);
+	if (flush_thread != AST_PTHREADT_NULL) {
+		ast_mutex_lock(&csv_lock);
+		flush_thread_stop = 1;
+		ast_cond_signal(&flush_cond);
+		ast_mutex_unlock(&csv_lock);
+		pthread_join(flush_thread, NULL);
+		flush_thread = AST_PTHREADT_NULL;
+	}
+	ast_mutex_lock(&csv_lock);
+	csv_close_all();
+	ast_mutex_unlock(&csv_lock);
 	return 0;
 }
 
@@ -334,18 +551,31 @@ static int load_module(void *mod)
 	
 	load_config();
 
-	res = ast_cdr_register(name, desc, csv_log);
+	snprintf(master_file.path, sizeof(master_file.path), "%s/%s/%s", ast_config_AST_LOG_DIR, CSV_LOG_DIR, CSV_MASTER);
+	ast_cond_init(&flush_cond, NULL);
+	flush_thread_stop = 0;
+	if (ast_pthread_create(&flush_thread, NULL, do_flush, NULL)) {
+		ast_log(LOG_WARNING, "Unable to start CSV flush thread, flushing after every record\n");
+		flush_thread = AST_PTHREADT_NULL;
+		flushinterval = 0;
+	}
+
+	res = ast_cdr_register_batch(name, desc, csv_log, csv_log_batch);
 	if (res) {
 		ast_log(LOG_ERROR, "Unable to register CSV CDR handling\n");
-		if (mf)
-			fclose(mf);
+		unload_module(mod);
 	}
 	return res;
 }
 
 static int reload(void *mod)
 {
+	ast_mutex_lock(&csv_lock);
+	csv_close_all();
 	load_config();
+	if (flush_thread == AST_PTHREADT_NULL)
+		flushinterval = 0;
+	ast_mutex_unlock(&csv_lock);
 	return 0;
 }
 
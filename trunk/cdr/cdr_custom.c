@@ -35,6 +35,7 @@
 ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -53,6 +54,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/config.h"
 #include "asterisk/pbx.h"
 #include "asterisk/logger.h"
+#include "asterisk/options.h"
 #include "asterisk/utils.h"
 
 #define CUSTOM_LOG_DIR "/cdr_custom"
@@ -65,10 +67,39 @@ static char *desc = "Customizable Comma Separated Values CDR Backend";
 
 static char *name = "cdr-custom";
 
+/*! The master file is kept open between records, protected by lock */
 static FILE *mf = NULL;
+/*! Identity of the file we opened, to notice it being rotated away */
+static dev_t mf_dev;
+static ino_t mf_ino;
+static int mf_dirty = 0;
 
 static char master[PATH_MAX];
 static char format[1024]="";
+static int flushinterval = 0;
+
+static pthread_t flush_thread = AST_PTHREADT_NULL;
+static ast_cond_t flush_cond;
+static int flush_thread_stop = 0;
+
+/*! \note Don't call without lock */
+static void master_close(void)
+{
+	if (mf) {
+		fclose(mf);
+		mf = NULL;
+	}
+	mf_dirty = 0;
+}
+
+/*! \note Don't call without lock */
+static void master_flush(void)
+{
+	if (mf && mf_dirty) {
+		fflush(mf);
+		mf_dirty = 0;
+	}
+}
 
 static int load_config(int reload) 
 {
@@ -76,9 +107,24 @@ static int load_config(int reload)
 	struct ast_variable *var;
 	int res = -1;
 
+	const char *tmp;
+
+	ast_mutex_lock(&lock);
+	/* the mapping may change, reopen the file on the next record */
+	master_close();
 	strcpy(format, "");
 	strcpy(master, "");
+	flushinterval = 0;
+	ast_mutex_unlock(&lock);
 	if((cfg = ast_config_load("cdr_custom.conf"))) {
+		if ((tmp = ast_variable_retrieve(cfg, "general", "flushinterval"))) {
+			if (sscanf(tmp, "%d", &flushinterval) != 1 || flushinterval < 0) {
+				ast_log(LOG_WARNING, "Invalid flushinterval '%s', flushing after every record\n", tmp);
+				flushinterval = 0;
+			}
+			if (flush_thread == AST_PTHREADT_NULL && reload)
+				flushinterval = 0;
+		}
 		var = ast_variable_browse(cfg, "mappings");
 		while(var) {
 			ast_mutex_lock(&lock);
@@ -125,22 +171,76 @@ static int custom_log(struct ast_cdr *cdr)
 	dummy.cdr = cdr;
 	pbx_substitute_variables_helper(&dummy, format, buf, sizeof(buf) - 1);
 
-	/* because of the absolutely unconditional need for the
-	   highest reliability possible in writing billing records,
-	   we open write and close the log file each time */
-	mf = fopen(master, "a");
+	/* The file stays open between records; it is flushed after every record,
+	   or every flushinterval seconds and at the end of each batch, and
+	   reopened when rotated away or on reload */
+	ast_mutex_lock(&lock);
 	if (!mf) {
-		ast_log(LOG_ERROR, "Unable to re-open master file %s : %s\n", master, strerror(errno));
+		struct stat st;
+
+		if (!(mf = fopen(master, "a"))) {
+			ast_log(LOG_ERROR, "Unable to re-open master file %s : %s\n", master, strerror(errno));
+			ast_mutex_unlock(&lock);
+			return 0;
+		}
+		if (!fstat(fileno(mf), &st)) {
+			mf_dev = st.st_dev;
+			mf_ino = st.st_ino;
+		}
 	}
-	if (mf) {
-		fputs(buf, mf);
-		fflush(mf); /* be particularly anal here */
-		fclose(mf);
-		mf = NULL;
+	if (fputs(buf, mf) == EOF) {
+		ast_log(LOG_ERROR, "Unable to write master file %s : %s\n", master, strerror(errno));
+		master_close();
+	} else {
+		mf_dirty = 1;
+		if (!flushinterval)
+			master_flush(); /* be particularly anal here */
 	}
+	ast_mutex_unlock(&lock);
+	return 0;
+}
+
+static int custom_log_batch(struct ast_cdr **cdrs, int count)
+{
+	int x;
+
+	for (x = 0; x < count; x++)
+		custom_log(cdrs[x]);
+	ast_mutex_lock(&lock);
+	master_flush();
+	ast_mutex_unlock(&lock);
 	return 0;
 }
 
+/*! \brief Flush buffered records on the configured interval, and notice a rotated file */
+static void *do_flush(void *data)
+{
+	struct timespec ts;
+	struct stat st;
+	time_t lastflush = time(NULL);
+
+	ast_mutex_lock(&lock);
+	while (!flush_thread_stop) {
+		ts.tv_sec = time(NULL) + 1;
+		ts.tv_nsec = 0;
+		ast_cond_timedwait(&flush_cond, &lock, &ts);
+		if (flush_thread_stop)
+			break;
+		if (flushinterval && (time(NULL) - lastflush >= flushinterval)) {
+			master_flush();
+			lastflush = time(NULL);
+		}
+		if (mf && (stat(master, &st) || st.st_dev != mf_dev || st.st_ino != mf_ino)) {
+			if (option_debug)
+				ast_log(LOG_DEBUG, "Custom CDR file '%s' was rotated, reopening\n", master);
+			master_close();
+		}
+	}
+	ast_mutex_unlock(&lock);
+
+	return NULL;
+}
+
 static const char *description(void)
 {
 	return desc;
@@ -148,9 +248,18 @@ static const char *description(void)
 
 static int unload_module(void *mod)
 {
-	if (mf)
-		fclose(mf);
 	ast_cdr_unregister(name);
+	if (flush_thread != AST_PTHREADT_NULL) {
+		ast_mutex_lock(&lock);
+		flush_thread_stop = 1;
+		ast_cond_signal(&flush_cond);
+		ast_mutex_unlock(&lock);
+		pthread_join(flush_thread, NULL);
+		flush_thread = AST_PTHREADT_NULL;
+	}
+	ast_mutex_lock(&lock);
+	master_close();
+	ast_mutex_unlock(&lock);
 	return 0;
 }
 
@@ -159,11 +268,18 @@ static int load_module(void *mod)
 	int res = 0;
 
 	if (!load_config(0)) {
-		res = ast_cdr_register(name, desc, custom_log);
-		if (res)
+		ast_cond_init(&flush_cond, NULL);
+		flush_thread_stop = 0;
+		if (ast_pthread_create(&flush_thread, NULL, do_flush, NULL)) {
+			ast_log(LOG_WARNING, "Unable to start custom CDR flush thread, flushing after every record\n");
+			flush_thread = AST_PTHREADT_NULL;
+			flushinterval = 0;
+		}
+		res = ast_cdr_register_batch(name, desc, custom_log, custom_log_batch);
+		if (res) {
 			ast_log(LOG_ERROR, "Unable to register custom CDR handling\n");
-		if (mf)
-			fclose(mf);
+			unload_module(mod);
+		}
 	}
 	return res;
 }
@@ -94,39 +94,68 @@ static void odbc_disconnect(void)
 	connected = 0;
 }
 
-static int odbc_log(struct ast_cdr *cdr)
+/*! \brief One row of parameters for row-wise array binding */
+struct odbc_batch_row {
+	char timestr[128];
+	char clid[AST_MAX_EXTENSION];
+	char src[AST_MAX_EXTENSION];
+	char dst[AST_MAX_EXTENSION];
+	char dcontext[AST_MAX_EXTENSION];
+	char channel[AST_MAX_EXTENSION];
+	char dstchannel[AST_MAX_EXTENSION];
+	char lastapp[AST_MAX_EXTENSION];
+	char lastdata[AST_MAX_EXTENSION];
+	SQLINTEGER duration;
+	SQLINTEGER billsec;
+	SQLINTEGER disposition;
+	char dispstr[16];
+	SQLINTEGER amaflags;
+	char accountcode[AST_MAX_ACCOUNT_CODE];
+	char uniqueid[32];
+	char userfield[AST_MAX_USER_FIELD];
+};
+
+/*! Maximum number of rows handed to the driver in one SQLExecute() */
+#define ODBC_BATCH_ROWS 128
+
+static void odbc_build_query(char *sqlcmd, size_t size)
 {
-	int ODBC_res;
-	char sqlcmd[2048] = "", timestr[128];
-	int res = 0;
-	struct tm tm;
-
-	if (usegmtime) 
-		gmtime_r(&cdr->start.tv_sec,&tm);
-	else
-		localtime_r(&cdr->start.tv_sec,&tm);
-
-	ast_mutex_lock(&odbc_lock);
-	strftime(timestr, sizeof(timestr), DATE_FORMAT, &tm);
-	memset(sqlcmd,0,2048);
 	if (loguniqueid) {
-		snprintf(sqlcmd,sizeof(sqlcmd),"INSERT INTO %s "
+		snprintf(sqlcmd,size,"INSERT INTO %s "
 		"(calldate,clid,src,dst,dcontext,channel,dstchannel,lastapp,"
 		"lastdata,duration,billsec,disposition,amaflags,accountcode,uniqueid,userfield) "
 		"VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)", table);
 	} else {
-		snprintf(sqlcmd,sizeof(sqlcmd),"INSERT INTO %s "
+		snprintf(sqlcmd,size,"INSERT INTO %s "
 		"(calldate,clid,src,dst,dcontext,channel,dstchannel,lastapp,lastdata,"
 		"duration,billsec,disposition,amaflags,accountcode) "
 		"VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?,?)", table);
 	}
+}
+
+static void odbc_format_time(struct ast_cdr *cdr, char *timestr, size_t size)
+{
+	struct tm tm;
+
+	if (usegmtime) 
+		gmtime_r(&cdr->start.tv_sec,&tm);
+	else
+		localtime_r(&cdr->start.tv_sec,&tm);
+	strftime(timestr, size, DATE_FORMAT, &tm);
+}
+
+/*! \brief Connect if needed, then allocate and prepare ODBC_stmt
+ * \note Don't call without odbc_lock
+ * \return 0 on success, -1 on failure (the connection is torn down)
+ */
+static int odbc_prepare(const char *sqlcmd)
+{
+	int ODBC_res;
 
 	if (!connected) {
-		res = odbc_init();
-		if (res < 0) {
+		if (odbc_init() < 0) {
 			odbc_disconnect();
-			ast_mutex_unlock(&odbc_lock);
-			return 0;
+			return -1;
 		}				
 	}
 
@@ -137,8 +166,7 @@ static int odbc_log(struct ast_cdr *cdr)
 			ast_verbose( VERBOSE_PREFIX_4 "cdr_odbc: Failure in AllocStatement %d\n", ODBC_res);
 		SQLFreeHandle(SQL_HANDLE_STMT, ODBC_stmt);
 		odbc_disconnect();
-		ast_mutex_unlock(&odbc_lock);
-		return 0;
+		return -1;
 	}
 
 	/* We really should only have to do this once.  But for some
@@ -152,6 +180,23 @@ static int odbc_log(struct ast_cdr *cdr)
 			ast_verbose( VERBOSE_PREFIX_4 "cdr_odbc: Error in PREPARE %d\n", ODBC_res);
 		SQLFreeHandle(SQL_HANDLE_STMT, ODBC_stmt);
 		odbc_disconnect();
+		return -1;
+	}
+
+	return 0;
+}
+
+static int odbc_log(struct ast_cdr *cdr)
+{
+	char sqlcmd[2048] = "", timestr[128];
+	int res = 0;
+
+	odbc_format_time(cdr, timestr, sizeof(timestr));
+
+	ast_mutex_lock(&odbc_lock);
+	odbc_build_query(sqlcmd, sizeof(sqlcmd));
+
+	if (odbc_prepare(sqlcmd)) {
 		ast_mutex_unlock(&odbc_lock);
 		return 0;
 	}
@@ -211,6 +256,121 @@ static int odbc_log(struct ast_cdr *cdr)
 	return 0;
 }
 
+/*! \brief Insert a whole batch with one prepared statement and array binding
+ * Parameters are bound row-wise once, and up to ODBC_BATCH_ROWS rows are sent
+ * per SQLExecute(), instead of preparing and binding once per record.
+ */
+static int odbc_log_batch(struct ast_cdr **cdrs, int count)
+{
+	struct odbc_batch_row *rows, *row;
+	char sqlcmd[2048] = "";
+	int ODBC_res, x, chunk, done = 0;
+
+	if (!(rows = ast_calloc(ODBC_BATCH_ROWS, sizeof(*rows))))
+		goto fallback;
+
+	ast_mutex_lock(&odbc_lock);
+	odbc_build_query(sqlcmd, sizeof(sqlcmd));
+
+	if (odbc_prepare(sqlcmd)) {
+		ast_mutex_unlock(&odbc_lock);
+		free(rows);
+		return 0;
+	}
+
+	ODBC_res = SQLSetStmtAttr(ODBC_stmt, SQL_ATTR_PARAM_BIND_TYPE, (SQLPOINTER) sizeof(*rows), 0);
+	if ((ODBC_res != SQL_SUCCESS) && (ODBC_res != SQL_SUCCESS_WITH_INFO)) {
+		if (option_verbose > 10)
+			ast_verbose( VERBOSE_PREFIX_4 "cdr_odbc: Driver does not support parameter arrays\n");
+		SQLFreeHandle(SQL_HANDLE_STMT, ODBC_stmt);
+		ast_mutex_unlock(&odbc_lock);
+		free(rows);
+		goto fallback;
+	}
+
+	row = rows;
+	SQLBindParameter(ODBC_stmt, 1, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->timestr), 0, row->timestr, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 2, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->clid), 0, row->clid, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 3, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->src), 0, row->src, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 4, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->dst), 0, row->dst, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 5, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->dcontext), 0, row->dcontext, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 6, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->channel), 0, row->channel, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 7, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->dstchannel), 0, row->dstchannel, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 8, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->lastapp), 0, row->lastapp, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 9, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->lastdata), 0, row->lastdata, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 10, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, &row->duration, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 11, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, &row->billsec, 0, NULL);
+	if (dispositionstring)
+		SQLBindParameter(ODBC_stmt, 12, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->dispstr), 0, row->dispstr, 0, NULL);
+	else
+		SQLBindParameter(ODBC_stmt, 12, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, &row->disposition, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 13, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0, &row->amaflags, 0, NULL);
+	SQLBindParameter(ODBC_stmt, 14, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->accountcode), 0, row->accountcode, 0, NULL);
+	if (loguniqueid) {
+		SQLBindParameter(ODBC_stmt, 15, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->uniqueid), 0, row->uniqueid, 0, NULL);
+		SQLBindParameter(ODBC_stmt, 16, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_CHAR, sizeof(row->userfield), 0, row->userfield, 0, NULL);
+	}
+
+	for (done = 0; done < count; done += chunk) {
+		chunk = count - done;
+		if (chunk > ODBC_BATCH_ROWS)
+			chunk = ODBC_BATCH_ROWS;
+
+		for (x = 0; x < chunk; x++) {
+			struct ast_cdr *cdr = cdrs[done + x];
+
+			row = &rows[x];
+			odbc_format_time(cdr, row->timestr, sizeof(row->timestr));
+			ast_copy_string(row->clid, cdr->clid, sizeof(row->clid));
+			ast_copy_string(row->src, cdr->src, sizeof(row->src));
+			ast_copy_string(row->dst, cdr->dst, sizeof(row->dst));
+			ast_copy_string(row->dcontext, cdr->dcontext, sizeof(row->dcontext));
+			ast_copy_string(row->channel, cdr->channel, sizeof(row->channel));
+			ast_copy_string(row->dstchannel, cdr->dstchannel, sizeof(row->dstchannel));
+			ast_copy_string(row->lastapp, cdr->lastapp, sizeof(row->lastapp));
+			ast_copy_string(row->lastdata, cdr->lastdata, sizeof(row->lastdata));
+			row->duration = cdr->duration;
+			row->billsec = cdr->billsec;
+			row->disposition = cdr->disposition;
+			ast_copy_string(row->dispstr, ast_cdr_disp2str(cdr->disposition), sizeof(row->dispstr));
+			row->amaflags = cdr->amaflags;
+			ast_copy_string(row->accountcode, cdr->accountcode, sizeof(row->accountcode));
+			ast_copy_string(row->uniqueid, cdr->uniqueid, sizeof(row->uniqueid));
+			ast_copy_string(row->userfield, cdr->userfield, sizeof(row->userfield));
+		}
+
+		ODBC_res = SQLSetStmtAttr(ODBC_stmt, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER) (long) chunk, 0);
+		if ((ODBC_res != SQL_SUCCESS) && (ODBC_res != SQL_SUCCESS_WITH_INFO)) {
+			if (option_verbose > 10)
+				ast_verbose( VERBOSE_PREFIX_4 "cdr_odbc: Driver does not support parameter arrays\n");
+			SQLFreeHandle(SQL_HANDLE_STMT, ODBC_stmt);
+			ast_mutex_unlock(&odbc_lock);
+			free(rows);
+			goto fallback;
+		}
+
+		/* odbc_do_query() releases the statement and the connection on failure */
+		if (odbc_do_query() < 0) {
+			if (option_verbose > 10)
+				ast_verbose( VERBOSE_PREFIX_4 "cdr_odbc: Batch query FAILED, retrying %d calls one by one\n", count - done);
+			ast_mutex_unlock(&odbc_lock);
+			free(rows);
+			goto fallback;
+		}
+	}
+
+	SQLFreeHandle(SQL_HANDLE_STMT, ODBC_stmt);
+	ast_mutex_unlock(&odbc_lock);
+	free(rows);
+	return 0;
+
+fallback:
+	/* odbc_log() reconnects as needed */
+	for (; done < count; done++)
+		odbc_log(cdrs[done]);
+	return 0;
+}
+
 static const char *description(void)
 {
 	return desc;
@@ -369,7 +529,7 @@ static int odbc_load_module(void)
 			ast_verbose( VERBOSE_PREFIX_3 "cdr_odbc: Unable to connect to datasource: %s\n", dsn);
 		}
 	}
-	res = ast_cdr_register(name, desc, odbc_log);
+	res = ast_cdr_register_batch(name, desc, odbc_log, odbc_log_batch);
 	if (res) {
 		ast_log(LOG_ERROR, "cdr_odbc: Unable to register ODBC CDR handling\n");
 	}
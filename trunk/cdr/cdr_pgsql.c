@@ -71,16 +71,21 @@ AST_MUTEX_DEFINE_STATIC(pgsql_lock);
 static PGconn	*conn;
 static PGresult	*result;
 
-static int pgsql_log(struct ast_cdr *cdr)
-{
-	struct tm tm;
-	char sqlcmd[2048] = "", timestr[128];
-	char *pgerror;
+#define PGSQL_COLUMNS "calldate,clid,src,dst,dcontext,channel,dstchannel," \
+	"lastapp,lastdata,duration,billsec,disposition,amaflags,accountcode,uniqueid,userfield"
 
-	ast_mutex_lock(&pgsql_lock);
+/*! Maximum number of rows sent in a single multi-row INSERT */
+#define PGSQL_BATCH_ROWS 500
+/*! Worst case length of one escaped VALUES tuple */
+#define PGSQL_ROW_MAX 2560
 
-	localtime_r(&cdr->start.tv_sec,&tm);
-	strftime(timestr, sizeof(timestr), DATE_FORMAT, &tm);
+/*! \brief Make sure we have a working connection
+ * \note Don't call without pgsql_lock
+ * \return 0 if connected, -1 otherwise
+ */
+static int pgsql_check_connection(void)
+{
+	char *pgerror;
 
 	if ((!connected) && pghostname && pgdbuser && pgpassword && pgdbname) {
 		conn = PQsetdbLogin(pghostname, pgdbport, NULL, NULL, pgdbname, pgdbuser, pgpassword);
@@ -93,91 +98,188 @@ static int pgsql_log(struct ast_cdr *cdr)
 		}
 	}
 
-	if (connected) {
-		char *clid=NULL, *dcontext=NULL, *channel=NULL, *dstchannel=NULL, *lastapp=NULL, *lastdata=NULL;
-		char *uniqueid=NULL, *userfield=NULL;
-
-		/* Maximum space needed would be if all characters needed to be escaped, plus a trailing NULL */
-		if ((clid = alloca(strlen(cdr->clid) * 2 + 1)) != NULL)
-			PQescapeString(clid, cdr->clid, strlen(cdr->clid));
-		if ((dcontext = alloca(strlen(cdr->dcontext) * 2 + 1)) != NULL)
-			PQescapeString(dcontext, cdr->dcontext, strlen(cdr->dcontext));
-		if ((channel = alloca(strlen(cdr->channel) * 2 + 1)) != NULL)
-			PQescapeString(channel, cdr->channel, strlen(cdr->channel));
-		if ((dstchannel = alloca(strlen(cdr->dstchannel) * 2 + 1)) != NULL)
-			PQescapeString(dstchannel, cdr->dstchannel, strlen(cdr->dstchannel));
-		if ((lastapp = alloca(strlen(cdr->lastapp) * 2 + 1)) != NULL)
-			PQescapeString(lastapp, cdr->lastapp, strlen(cdr->lastapp));
-		if ((lastdata = alloca(strlen(cdr->lastdata) * 2 + 1)) != NULL)
-			PQescapeString(lastdata, cdr->lastdata, strlen(cdr->lastdata));
-		if ((uniqueid = alloca(strlen(cdr->uniqueid) * 2 + 1)) != NULL)
-			PQescapeString(uniqueid, cdr->uniqueid, strlen(cdr->uniqueid));
-		if ((userfield = alloca(strlen(cdr->userfield) * 2 + 1)) != NULL)
-			PQescapeString(userfield, cdr->userfield, strlen(cdr->userfield));
-
-		/* Check for all alloca failures above at once */
-		if ((!clid) || (!dcontext) || (!channel) || (!dstchannel) || (!lastapp) || (!lastdata) || (!uniqueid) || (!userfield)) {
-			ast_log(LOG_ERROR, "cdr_pgsql:  Out of memory error (insert fails)\n");
-			ast_mutex_unlock(&pgsql_lock);
+	if (!connected)
+		return -1;
+
+	/* Test to be sure we're still connected... */
+	/* If we're connected, and connection is working, good. */
+	/* Otherwise, attempt reconnect.  If it fails... sorry... */
+	if (PQstatus(conn) == CONNECTION_OK) {
+		connected = 1;
+	} else {
+		ast_log(LOG_ERROR, "cdr_pgsql: Connection was lost... attempting to reconnect.\n");
+		PQreset(conn);
+		if (PQstatus(conn) == CONNECTION_OK) {
+			ast_log(LOG_ERROR, "cdr_pgsql: Connection reestablished.\n");
+			connected = 1;
+		} else {
+			pgerror = PQerrorMessage(conn);
+			ast_log(LOG_ERROR, "cdr_pgsql: Unable to reconnect to database server %s. Calls will not be logged!\n", pghostname);
+			ast_log(LOG_ERROR, "cdr_pgsql: Reason: %s\n", pgerror);
+			connected = 0;
 			return -1;
 		}
+	}
+
+	return 0;
+}
+
+/*! \brief Format the escaped VALUES tuple for one record
+ * \return number of characters written, or -1 if it did not fit
+ */
+static int pgsql_format_values(struct ast_cdr *cdr, char *buf, size_t size)
+{
+	struct tm tm;
+	char timestr[128];
+	/* Maximum space needed would be if all characters needed to be escaped, plus a trailing NULL */
+	char clid[sizeof(cdr->clid) * 2 + 1], src[sizeof(cdr->src) * 2 + 1], dst[sizeof(cdr->dst) * 2 + 1];
+	char dcontext[sizeof(cdr->dcontext) * 2 + 1], channel[sizeof(cdr->channel) * 2 + 1];
+	char dstchannel[sizeof(cdr->dstchannel) * 2 + 1], lastapp[sizeof(cdr->lastapp) * 2 + 1];
+	char lastdata[sizeof(cdr->lastdata) * 2 + 1], accountcode[sizeof(cdr->accountcode) * 2 + 1];
+	char uniqueid[sizeof(cdr->uniqueid) * 2 + 1], userfield[sizeof(cdr->userfield) * 2 + 1];
+	int len;
+
+	localtime_r(&cdr->start.tv_sec, &tm);
+	strftime(timestr, sizeof(timestr), DATE_FORMAT, &tm);
 
-		if (option_debug > 1)
-			ast_log(LOG_DEBUG, "cdr_pgsql: inserting a CDR record.\n");
-
-		snprintf(sqlcmd,sizeof(sqlcmd),"INSERT INTO %s (calldate,clid,src,dst,dcontext,channel,dstchannel,"
-				 "lastapp,lastdata,duration,billsec,disposition,amaflags,accountcode,uniqueid,userfield) VALUES"
-				 " ('%s','%s','%s','%s','%s', '%s','%s','%s','%s',%ld,%ld,'%s',%ld,'%s','%s','%s')",
-				 table,timestr,clid,cdr->src, cdr->dst, dcontext,channel, dstchannel, lastapp, lastdata,
-				 cdr->duration,cdr->billsec,ast_cdr_disp2str(cdr->disposition),cdr->amaflags, cdr->accountcode, uniqueid, userfield);
-		
-		if (option_debug > 2)
-			ast_log(LOG_DEBUG, "cdr_pgsql: SQL command executed:  %s\n",sqlcmd);
-		
-		/* Test to be sure we're still connected... */
-		/* If we're connected, and connection is working, good. */
-		/* Otherwise, attempt reconnect.  If it fails... sorry... */
+	PQescapeString(clid, cdr->clid, strlen(cdr->clid));
+	PQescapeString(src, cdr->src, strlen(cdr->src));
+	PQescapeString(dst, cdr->dst, strlen(cdr->dst));
+	PQescapeString(dcontext, cdr->dcontext, strlen(cdr->dcontext));
+	PQescapeString(channel, cdr->channel, strlen(cdr->channel));
+	PQescapeString(dstchannel, cdr->dstchannel, strlen(cdr->dstchannel));
+	PQescapeString(lastapp, cdr->lastapp, strlen(cdr->lastapp));
+	PQescapeString(lastdata, cdr->lastdata, strlen(cdr->lastdata));
+	PQescapeString(accountcode, cdr->accountcode, strlen(cdr->accountcode));
+	PQescapeString(uniqueid, cdr->uniqueid, strlen(cdr->uniqueid));
+	PQescapeString(userfield, cdr->userfield, strlen(cdr->userfield));
+
+	len = snprintf(buf, size, "('%s','%s','%s','%s','%s', '%s','%s','%s','%s',%ld,%ld,'%s',%ld,'%s','%s','%s')",
+		 timestr, clid, src, dst, dcontext, channel, dstchannel, lastapp, lastdata,
+		 cdr->duration, cdr->billsec, ast_cdr_disp2str(cdr->disposition), cdr->amaflags, accountcode, uniqueid, userfield);
+
+	return (len < 0 || len >= size) ? -1 : len;
+}
+
+/*! \brief Run an INSERT, retrying once after a reconnect
+ * \note Don't call without pgsql_lock
+ */
+static int pgsql_exec(const char *sqlcmd, int rows)
+{
+	char *pgerror;
+
+	if (option_debug > 2)
+		ast_log(LOG_DEBUG, "cdr_pgsql: SQL command executed:  %s\n", sqlcmd);
+
+	result = PQexec(conn, sqlcmd);
+	if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+                pgerror = PQresultErrorMessage(result);
+		ast_log(LOG_ERROR,"cdr_pgsql: Failed to insert %d call detail record%s into database!\n", rows, rows != 1 ? "s" : "");
+                ast_log(LOG_ERROR,"cdr_pgsql: Reason: %s\n", pgerror);
+		ast_log(LOG_ERROR,"cdr_pgsql: Connection may have been lost... attempting to reconnect.\n");
+		PQclear(result);
+		PQreset(conn);
 		if (PQstatus(conn) == CONNECTION_OK) {
+			ast_log(LOG_ERROR, "cdr_pgsql: Connection reestablished.\n");
 			connected = 1;
-		} else {
-			ast_log(LOG_ERROR, "cdr_pgsql: Connection was lost... attempting to reconnect.\n");
-			PQreset(conn);
-			if (PQstatus(conn) == CONNECTION_OK) {
-				ast_log(LOG_ERROR, "cdr_pgsql: Connection reestablished.\n");
-				connected = 1;
-			} else {
-				pgerror = PQerrorMessage(conn);
-				ast_log(LOG_ERROR, "cdr_pgsql: Unable to reconnect to database server %s. Calls will not be logged!\n", pghostname);
-				ast_log(LOG_ERROR, "cdr_pgsql: Reason: %s\n", pgerror);
-				connected = 0;
-				ast_mutex_unlock(&pgsql_lock);
-				return -1;
+			result = PQexec(conn, sqlcmd);
+			if ( PQresultStatus(result) != PGRES_COMMAND_OK)
+			{
+				pgerror = PQresultErrorMessage(result);
+				ast_log(LOG_ERROR,"cdr_pgsql: HARD ERROR!  Attempted reconnection failed.  DROPPING %d CALL RECORD%s!\n", rows, rows != 1 ? "S" : "");
+				ast_log(LOG_ERROR,"cdr_pgsql: Reason: %s\n", pgerror);
 			}
+			PQclear(result);
 		}
-		result = PQexec(conn, sqlcmd);
-		if ( PQresultStatus(result) != PGRES_COMMAND_OK) {
-                        pgerror = PQresultErrorMessage(result);
-			ast_log(LOG_ERROR,"cdr_pgsql: Failed to insert call detail record into database!\n");
-                        ast_log(LOG_ERROR,"cdr_pgsql: Reason: %s\n", pgerror);
-			ast_log(LOG_ERROR,"cdr_pgsql: Connection may have been lost... attempting to reconnect.\n");
-			PQreset(conn);
-			if (PQstatus(conn) == CONNECTION_OK) {
-				ast_log(LOG_ERROR, "cdr_pgsql: Connection reestablished.\n");
-				connected = 1;
-				result = PQexec(conn, sqlcmd);
-				if ( PQresultStatus(result) != PGRES_COMMAND_OK)
-				{
-					pgerror = PQresultErrorMessage(result);
-					ast_log(LOG_ERROR,"cdr_pgsql: HARD ERROR!  Attempted reconnection failed.  DROPPING CALL RECORD!\n");
-					ast_log(LOG_ERROR,"cdr_pgsql: Reason: %s\n", pgerror);
-				}
-			}
-			ast_mutex_unlock(&pgsql_lock);
-			return -1;
+		return -1;
+	}
+	PQclear(result);
+
+	return 0;
+}
+
+static int pgsql_log(struct ast_cdr *cdr)
+{
+	char sqlcmd[PGSQL_ROW_MAX + 512] = "", values[PGSQL_ROW_MAX];
+	int res;
+
+	ast_mutex_lock(&pgsql_lock);
+
+	if (pgsql_check_connection()) {
+		ast_mutex_unlock(&pgsql_lock);
+		return -1;
+	}
+
+	if (pgsql_format_values(cdr, values, sizeof(values)) < 0) {
+		ast_log(LOG_ERROR, "cdr_pgsql: Call detail record too large (insert fails)\n");
+		ast_mutex_unlock(&pgsql_lock);
+		return -1;
+	}
+
+	if (option_debug > 1)
+		ast_log(LOG_DEBUG, "cdr_pgsql: inserting a CDR record.\n");
+
+	snprintf(sqlcmd, sizeof(sqlcmd), "INSERT INTO %s (" PGSQL_COLUMNS ") VALUES %s", table, values);
+
+	res = pgsql_exec(sqlcmd, 1);
+	ast_mutex_unlock(&pgsql_lock);
+	return res;
+}
+
+/*! \brief Insert a whole batch using multi-row INSERT statements
+ * Rows are grouped into statements of at most PGSQL_BATCH_ROWS tuples, so a
+ * batch costs one connection check and a handful of round trips instead of
+ * one of each per record.
+ */
+static int pgsql_log_batch(struct ast_cdr **cdrs, int count)
+{
+	char *sqlcmd;
+	size_t size, used, header;
+	int x, len, rows = 0, res = 0;
+
+	ast_mutex_lock(&pgsql_lock);
+
+	if (pgsql_check_connection()) {
+		ast_mutex_unlock(&pgsql_lock);
+		return -1;
+	}
+
+	size = strlen(table) + sizeof(PGSQL_COLUMNS) + 64 + (size_t) PGSQL_BATCH_ROWS * PGSQL_ROW_MAX;
+	if (!(sqlcmd = ast_malloc(size))) {
+		ast_mutex_unlock(&pgsql_lock);
+		return -1;
+	}
+
+	header = snprintf(sqlcmd, size, "INSERT INTO %s (" PGSQL_COLUMNS ") VALUES ", table);
+	used = header;
+
+	if (option_debug > 1)
+		ast_log(LOG_DEBUG, "cdr_pgsql: inserting a batch of %d CDR records.\n", count);
+
+	for (x = 0; x < count; x++) {
+		if (rows)
+			sqlcmd[used++] = ',';
+		if ((len = pgsql_format_values(cdrs[x], sqlcmd + used, size - used)) < 0) {
+			ast_log(LOG_ERROR, "cdr_pgsql: Call detail record on channel '%s' too large (insert fails)\n", cdrs[x]->channel);
+			if (rows)
+				used--;
+			sqlcmd[used] = '\0';
+			res = -1;
+		} else {
+			used += len;
+			rows++;
+		}
+		if (rows && (rows == PGSQL_BATCH_ROWS || x == count - 1)) {
+			if (pgsql_exec(sqlcmd, rows))
+				res = -1;
+			rows = 0;
+			used = header;
 		}
 	}
+
+	free(sqlcmd);
 	ast_mutex_unlock(&pgsql_lock);
-	return 0;
+	return res;
 }
 
 static const char *description(void)
@@ -286,7 +388,7 @@ static int process_my_load_module(struct ast_config *cfg)
 		connected = 0;
 	}
 
-	return ast_cdr_register(name, desc, pgsql_log);
+	return ast_cdr_register_batch(name, desc, pgsql_log, pgsql_log_batch);
 }
 
 static int my_load_module(void)
@@ -91,7 +91,38 @@ static char sql_create_table[] = "CREATE TABLE cdr ("
 #endif
 ");";
 
-static int sqlite_log(struct ast_cdr *cdr)
+/*! \brief Execute a statement, retrying while the database is busy
+ * \note Don't call without sqlite_lock
+ */
+static int sqlite_exec_retry(const char *sql)
+{
+	int res = 0;
+	char *zErr = 0;
+	int count;
+
+	for (count = 0; count < 5; count++) {
+		res = sqlite_exec(db, sql, NULL, NULL, &zErr);
+		if (res != SQLITE_BUSY && res != SQLITE_LOCKED)
+			break;
+		if (zErr) {
+			free(zErr);
+			zErr = NULL;
+		}
+		usleep(200);
+	}
+
+	if (zErr) {
+		ast_log(LOG_ERROR, "cdr_sqlite: %s\n", zErr);
+		free(zErr);
+	}
+
+	return res;
+}
+
+/*! \brief Insert one record
+ * \note Don't call without sqlite_lock
+ */
+static int sqlite_insert(struct ast_cdr *cdr)
 {
 	int res = 0;
 	char *zErr = 0;
@@ -100,8 +131,6 @@ static int sqlite_log(struct ast_cdr *cdr)
 	char startstr[80], answerstr[80], endstr[80];
 	int count;
 
-	ast_mutex_lock(&sqlite_lock);
-
 	t = cdr->start.tv_sec;
 	localtime_r(&t, &tm);
 	strftime(startstr, sizeof(startstr), DATE_FORMAT, &tm);
@@ -163,6 +192,45 @@ static int sqlite_log(struct ast_cdr *cdr)
 		free(zErr);
 	}
 
+	return res;
+}
+
+static int sqlite_log(struct ast_cdr *cdr)
+{
+	int res;
+
+	ast_mutex_lock(&sqlite_lock);
+	res = sqlite_insert(cdr);
+	ast_mutex_unlock(&sqlite_lock);
+
+	return res;
+}
+
+/*! \brief Insert a whole batch inside a single transaction
+ * SQLite syncs the database file on every implicit commit, so wrapping the
+ * batch in one transaction turns N journal syncs into one.
+ */
+static int sqlite_log_batch(struct ast_cdr **cdrs, int count)
+{
+	int res = 0;
+	int x, transaction;
+
+	ast_mutex_lock(&sqlite_lock);
+
+	/* If we can't open a transaction the records still go in one by one */
+	transaction = !sqlite_exec_retry("BEGIN TRANSACTION;");
+
+	for (x = 0; x < count; x++) {
+		if (sqlite_insert(cdrs[x]))
+			res = -1;
+	}
+
+	if (transaction && sqlite_exec_retry("COMMIT TRANSACTION;")) {
+		ast_log(LOG_ERROR, "cdr_sqlite: Unable to commit batch of %d records\n", count);
+		sqlite_exec_retry("ROLLBACK TRANSACTION;");
+		res = -1;
+	}
+
 	ast_mutex_unlock(&sqlite_lock);
 	return res;
 }
@@ -209,7 +277,7 @@ static int load_module(void *mod)
 		/* TODO: here we should probably create an index */
 	}
 	
-	res = ast_cdr_register(name, desc, sqlite_log);
+	res = ast_cdr_register_batch(name, desc, sqlite_log, sqlite_log_batch);
 	if (res) {
 		ast_log(LOG_ERROR, "Unable to register SQLite CDR handling\n");
 		return -1;
@@ -75,6 +75,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/transcap.h"
 #include "asterisk/devicestate.h"
 #include "asterisk/sha1.h"
+#include "asterisk/dsp.h"
+#include "asterisk/timing.h"
 
 struct channel_spy_trans {
 	int last_format;
@@ -101,6 +103,11 @@ static int uniqueint = 0;
 
 unsigned long global_fin = 0, global_fout = 0;
 
+/*! Frames the generic bridge passed straight between drivers and through
+    ast_read()/ast_write(), added up as each bridge pass ends */
+static unsigned long long bridge_direct_total, bridge_full_total;
+AST_MUTEX_DEFINE_STATIC(bridge_stats_lock);
+
 /* XXX Lock appropriately in more functions XXX */
 
 struct chanlist {
@@ -262,6 +269,24 @@ static int show_channeltype(int fd, int argc, char *argv[])
 	return RESULT_SUCCESS;
 }
 
+static int show_bridge_stats(int fd, int argc, char *argv[])
+{
+	unsigned long long direct, full;
+
+	if (argc != 3)
+		return RESULT_SHOWUSAGE;
+
+	ast_mutex_lock(&bridge_stats_lock);
+	direct = bridge_direct_total;
+	full = bridge_full_total;
+	ast_mutex_unlock(&bridge_stats_lock);
+
+	ast_cli(fd, "Generic bridge frames passed directly: %llu (%.1f%%)\n", direct,
+		(direct + full) ? 100.0 * direct / (direct + full) : 0.0);
+	ast_cli(fd, "Generic bridge frames passed through ast_read()/ast_write(): %llu\n", full);
+	return RESULT_SUCCESS;
+}
+
 static char *complete_channeltypes(const char *line, const char *word, int pos, int state)
 {
 	struct chanlist *cl;
@@ -292,12 +317,22 @@ static char show_channeltype_usage[] =
 "Usage: show channeltype <name>\n"
 "	Show details about the specified channel type, <name>.\n";
 
+static char show_bridge_stats_usage[] =
+"Usage: show bridge stats\n"
+"       Shows how many frames generically bridged calls passed straight from one\n"
+"       channel driver to the other, and how many went through the full read and\n"
+"       write path.  A call is counted when its bridge ends, or is interrupted for\n"
+"       a feature or a time limit warning.\n";
+
 static struct ast_cli_entry cli_show_channeltypes =
 	{ { "show", "channeltypes", NULL }, show_channeltypes, "Show available channel types", show_channeltypes_usage };
 
 static struct ast_cli_entry cli_show_channeltype =
 	{ { "show", "channeltype", NULL }, show_channeltype, "Give more details on that channel type", show_channeltype_usage, complete_channeltypes };
 
+static struct ast_cli_entry cli_show_bridge_stats =
+	{ { "show", "bridge", "stats", NULL }, show_bridge_stats, "Show generic bridge frame counts", show_bridge_stats_usage };
+
 /*! \brief Checks to see if a channel is needing hang up */
 int ast_check_hangup(struct ast_channel *chan)
 {
@@ -985,11 +1020,14 @@ void ast_channel_free(struct ast_channel *chan)
 		ast_translator_free_path(chan->readtrans);
 	if (chan->writetrans)
 		ast_translator_free_path(chan->writetrans);
+	if (chan->analysis)
+		free(chan->analysis);
 	if (chan->pbx)
 		ast_log(LOG_WARNING, "PBX may not have been terminated properly on '%s'\n", chan->name);
 	free_cid(&chan->cid);
 	ast_mutex_destroy(&chan->lock);
 	/* Close pipes if appropriate */
+	ast_timing_set(chan, 0);
 	if ((fd = chan->alertpipe[0]) > -1)
 		close(fd);
 	if ((fd = chan->alertpipe[1]) > -1)
@@ -1123,6 +1161,101 @@ struct ast_datastore *ast_channel_datastore_find(struct ast_channel *chan, const
 	return datastore;
 }
 
+#define SPY_QUEUE_SAMPLE_LIMIT 4000			/* half of one second */
+#define SPY_RING_SAMPLES 8192				/* room for the limit plus plenty of frames */
+
+/*! \brief samples waiting in a spy ring */
+static unsigned int spy_ring_filled(struct ast_channel_spy_ring *ring)
+{
+	return (unsigned int) ast_atomic_fetchadd_int(&ring->tail, 0) - (unsigned int) ast_atomic_fetchadd_int(&ring->head, 0);
+}
+
+/*! \brief append samples to a spy ring, called only by the channel's thread.
+ * Samples that do not fit are dropped, so make room first with
+ * spy_ring_drop() where the newest audio matters more.
+ */
+static void spy_ring_write(struct ast_channel_spy_ring *ring, const short *data, unsigned int samples)
+{
+	unsigned int tail = ring->tail;
+	unsigned int space = ring->size - (tail - (unsigned int) ast_atomic_fetchadd_int(&ring->head, 0));
+	unsigned int pos, first;
+
+	if (samples > space) {
+		ring->overruns += samples - space;
+		samples = space;
+	}
+	pos = tail & (ring->size - 1);
+	first = (samples > ring->size - pos) ? ring->size - pos : samples;
+	memcpy(ring->buf + pos, data, first * sizeof(*data));
+	memcpy(ring->buf, data + first, (samples - first) * sizeof(*data));
+	/* the atomic add also orders the copy before the new tail is visible */
+	ast_atomic_fetchadd_int(&ring->tail, samples);
+}
+
+/*! \brief drop the oldest samples of a spy ring to make room for \a samples more.
+ * This moves head, so the channel's thread must hold the spy's lock to call it.
+ */
+static void spy_ring_drop(struct ast_channel_spy_ring *ring, unsigned int samples)
+{
+	unsigned int filled = spy_ring_filled(ring);
+	unsigned int drop;
+
+	if (samples <= ring->size - filled)
+		return;
+	drop = samples - (ring->size - filled);
+	if (drop > filled)
+		drop = filled;
+	ring->overruns += drop;
+	ast_atomic_fetchadd_int(&ring->head, drop);
+}
+
+/*! \brief take samples from a spy ring, called only with the spy's lock held */
+static void spy_ring_read(struct ast_channel_spy_ring *ring, short *buf, unsigned int samples)
+{
+	unsigned int pos = (unsigned int) ring->head & (ring->size - 1);
+	unsigned int first = (samples > ring->size - pos) ? ring->size - pos : samples;
+
+	memcpy(buf, ring->buf + pos, first * sizeof(*buf));
+	memcpy(buf + first, ring->buf, (samples - first) * sizeof(*buf));
+	ast_atomic_fetchadd_int(&ring->head, samples);
+}
+
+/*! \brief drop the oldest samples of a spy ring beyond the queue limit */
+static void spy_ring_trim(struct ast_channel_spy_ring *ring)
+{
+	unsigned int filled = spy_ring_filled(ring);
+
+	if (filled > SPY_QUEUE_SAMPLE_LIMIT)
+		ast_atomic_fetchadd_int(&ring->head, filled - SPY_QUEUE_SAMPLE_LIMIT);
+}
+
+static int spy_ring_alloc(struct ast_channel_spy_queue *queue)
+{
+	if (queue->format != AST_FORMAT_SLINEAR)
+		return 0;
+	if (!(queue->ring.buf = ast_calloc(SPY_RING_SAMPLES, sizeof(*queue->ring.buf))))
+		return -1;
+	queue->ring.size = SPY_RING_SAMPLES;
+	queue->ring.head = queue->ring.tail = 0;
+	queue->ring.overruns = 0;
+	return 0;
+}
+
+static void spy_ring_free(struct ast_channel_spy_queue *queue)
+{
+	if (queue->ring.buf) {
+		free(queue->ring.buf);
+		queue->ring.buf = NULL;
+	}
+	queue->ring.head = queue->ring.tail = 0;
+}
+
+/*! \brief samples waiting in a spy queue */
+static unsigned int spy_queue_samples(struct ast_channel_spy_queue *queue)
+{
+	return queue->ring.buf ? spy_ring_filled(&queue->ring) : queue->samples;
+}
+
 int ast_channel_spy_add(struct ast_channel *chan, struct ast_channel_spy *spy)
 {
 	/* Link the owner channel to the spy */
@@ -1154,8 +1287,17 @@ int ast_channel_spy_add(struct ast_channel *chan, struct ast_channel_spy *spy)
 		return -1;
 	}
 
+	/* signed linear spies are fed through rings, without taking their lock */
+	if (spy_ring_alloc(&spy->read_queue) || spy_ring_alloc(&spy->write_queue)) {
+		spy_ring_free(&spy->read_queue);
+		spy_ring_free(&spy->write_queue);
+		return -1;
+	}
+
 	if (!chan->spies) {
 		if (!(chan->spies = ast_calloc(1, sizeof(*chan->spies)))) {
+			spy_ring_free(&spy->read_queue);
+			spy_ring_free(&spy->write_queue);
 			return -1;
 		}
 
@@ -1228,6 +1370,11 @@ void ast_channel_spy_remove(struct ast_channel *chan, struct ast_channel_spy *sp
 		spy->write_queue.head = f->next;
 		ast_frfree(f);
 	}
+	if (option_debug && (spy->read_queue.ring.overruns || spy->write_queue.ring.overruns))
+		ast_log(LOG_DEBUG, "Spy %s on %s dropped %u read and %u write samples\n",
+			spy->type, chan->name, spy->read_queue.ring.overruns, spy->write_queue.ring.overruns);
+	spy_ring_free(&spy->read_queue);
+	spy_ring_free(&spy->write_queue);
 
 	if (ast_test_flag(spy, CHANSPY_TRIGGER_MODE) != CHANSPY_TRIGGER_NONE)
 		ast_cond_destroy(&spy->trigger);
@@ -1299,7 +1446,36 @@ enum spy_direction {
 	SPY_WRITE,
 };
 
-#define SPY_QUEUE_SAMPLE_LIMIT 4000			/* half of one second */
+/*! \brief wake up a ring fed spy, or ask it to flush when it falls behind.
+ * Only the flag changes need the spy's lock, so they are skipped while the
+ * spy holds it and retried on the next frame.
+ */
+static void spy_ring_notify(struct ast_channel *chan, struct ast_channel_spy *spy, struct ast_channel_spy_queue *queue, enum spy_direction dir)
+{
+	if (ast_test_flag(spy, CHANSPY_TRIGGER_MODE) == CHANSPY_TRIGGER_NONE)
+		return;
+
+	if (spy_ring_filled(&queue->ring) > SPY_QUEUE_SAMPLE_LIMIT) {
+		if (ast_mutex_trylock(&spy->lock))
+			return;
+		if (ast_test_flag(spy, CHANSPY_TRIGGER_READ) && dir == SPY_WRITE) {
+			ast_set_flag(spy, CHANSPY_TRIGGER_WRITE);
+			ast_clear_flag(spy, CHANSPY_TRIGGER_READ);
+		} else if (ast_test_flag(spy, CHANSPY_TRIGGER_WRITE) && dir == SPY_READ) {
+			ast_set_flag(spy, CHANSPY_TRIGGER_READ);
+			ast_clear_flag(spy, CHANSPY_TRIGGER_WRITE);
+		}
+		if (option_debug)
+			ast_log(LOG_DEBUG, "Triggering queue flush for spy '%s' on '%s'\n",
+				spy->type, chan->name);
+		ast_set_flag(spy, CHANSPY_TRIGGER_FLUSH);
+		ast_cond_signal(&spy->trigger);
+		ast_mutex_unlock(&spy->lock);
+	} else if ((ast_test_flag(spy, CHANSPY_TRIGGER_MODE) == CHANSPY_TRIGGER_READ) == (dir == SPY_READ)) {
+		/* a missed wakeup only costs the spy its 50ms wait timeout */
+		ast_cond_signal(&spy->trigger);
+	}
+}
 
 static void queue_frame_to_spies(struct ast_channel *chan, struct ast_frame *f, enum spy_direction dir)
 {
@@ -1314,10 +1490,12 @@ static void queue_frame_to_spies(struct ast_channel *chan, struct ast_frame *f,
 		struct ast_frame *f1;	/* the frame to append */
 		struct ast_channel_spy_queue *queue;
 
-		ast_mutex_lock(&spy->lock);
-
 		queue = (dir == SPY_READ) ? &spy->read_queue : &spy->write_queue;
 
+		/* rings are only changed with the channel locked, as we are */
+		if (!queue->ring.buf)
+			ast_mutex_lock(&spy->lock);
+
 		if ((queue->format == AST_FORMAT_SLINEAR) && (f->subclass != AST_FORMAT_SLINEAR)) {
 			if (!translated_frame) {
 				if (trans->path && (trans->last_format != f->subclass)) {
@@ -1330,7 +1508,8 @@ static void queue_frame_to_spies(struct ast_channel *chan, struct ast_frame *f,
 					if ((trans->path = ast_translator_build_path(AST_FORMAT_SLINEAR, f->subclass)) == NULL) {
 						ast_log(LOG_WARNING, "Cannot build a path from %s to %s\n",
 							ast_getformatname(f->subclass), ast_getformatname(AST_FORMAT_SLINEAR));
-						ast_mutex_unlock(&spy->lock);
+						if (!queue->ring.buf)
+							ast_mutex_unlock(&spy->lock);
 						continue;
 					} else {
 						trans->last_format = f->subclass;
@@ -1339,7 +1518,8 @@ static void queue_frame_to_spies(struct ast_channel *chan, struct ast_frame *f,
 				if (!(translated_frame = ast_translate(trans->path, f, 0))) {
 					ast_log(LOG_ERROR, "Translation to %s failed, dropping frame for spies\n",
 						ast_getformatname(AST_FORMAT_SLINEAR));
-					ast_mutex_unlock(&spy->lock);
+					if (!queue->ring.buf)
+						ast_mutex_unlock(&spy->lock);
 					break;
 				}
 			}
@@ -1349,11 +1529,27 @@ static void queue_frame_to_spies(struct ast_channel *chan, struct ast_frame *f,
 				ast_log(LOG_WARNING, "Spy '%s' on channel '%s' wants format '%s', but frame is '%s', dropping\n",
 					spy->type, chan->name,
 					ast_getformatname(queue->format), ast_getformatname(f->subclass));
-				ast_mutex_unlock(&spy->lock);
+				if (!queue->ring.buf)
+					ast_mutex_unlock(&spy->lock);
 				continue;
 			}
 			f1 = f;
 		}
+
+		if (queue->ring.buf) {
+			/* without a trigger nobody flushes a full ring, so keep the new
+			   audio and lose the oldest instead */
+			if ((ast_test_flag(spy, CHANSPY_TRIGGER_MODE) == CHANSPY_TRIGGER_NONE) &&
+			    (f1->samples > queue->ring.size - spy_ring_filled(&queue->ring))) {
+				ast_mutex_lock(&spy->lock);
+				spy_ring_drop(&queue->ring, f1->samples);
+				ast_mutex_unlock(&spy->lock);
+			}
+			spy_ring_write(&queue->ring, f1->data, f1->samples);
+			spy_ring_notify(chan, spy, queue, dir);
+			continue;
+		}
+
 		/* duplicate and append f1 to the tail */
 		f1 = ast_frdup(f1);
 
@@ -1796,8 +1992,18 @@ int ast_settimeout(struct ast_channel *c, int samples, int (*func)(void *data),
 		res = ioctl(c->timingfd, ZT_TIMERCONFIG, &samples);
 		c->timingfunc = func;
 		c->timingdata = data;
+		return res;
 	}
 #endif	
+	/* No timer of our own, so have the core timing service wake us */
+	if (!func) {
+		samples = 0;
+		data = 0;
+	}
+	if (!(res = ast_timing_set(c, samples))) {
+		c->timingfunc = func;
+		c->timingdata = data;
+	}
 	return res;
 }
 
@@ -1857,6 +2063,8 @@ int ast_waitfordigit_full(struct ast_channel *c, int ms, int audiofd, int cmdfd)
 	return 0; /* Time is up */
 }
 
+static struct ast_frame *read_frame_process(struct ast_channel *chan, struct ast_frame *f, int prestate, int dropaudio);
+
 static struct ast_frame *__ast_read(struct ast_channel *chan, int dropaudio)
 {
 	struct ast_frame *f = NULL;	/* the return value */
@@ -1937,6 +2145,21 @@ static struct ast_frame *__ast_read(struct ast_channel *chan, int dropaudio)
 			ast_log(LOG_NOTICE, "No/unknown event '%d' on timer for '%s'?\n", blah, chan->name);
 	} else
 #endif
+	if (chan->timingentry && (blah = ast_timing_ack(chan))) {
+		/* The core timing service woke us up, once per expiration */
+		int (*func)(void *);
+
+		while (blah-- && (func = chan->timingfunc)) {
+			void *data = chan->timingdata;
+			ast_channel_unlock(chan);
+			func(data);
+			ast_channel_lock(chan);
+		}
+		if (!chan->timingfunc)
+			ast_timing_set(chan, 0);
+		f = &ast_null_frame;
+		goto done;
+	} else
 	if (chan->fds[AST_GENERATOR_FD] > -1 && chan->fdno == AST_GENERATOR_FD) {
 		/* if the AST_GENERATOR_FD is set, call the generator with args
 		 * set to -1 so it can do whatever it needs to.
@@ -1977,6 +2200,17 @@ static struct ast_frame *__ast_read(struct ast_channel *chan, int dropaudio)
 			ast_log(LOG_WARNING, "No read routine on channel %s\n", chan->name);
 	}
 
+	f = read_frame_process(chan, f, prestate, dropaudio);
+
+done:
+	ast_channel_unlock(chan);
+	return f;
+}
+
+/*! \brief Everything ast_read() does with a frame once it has it from the
+ * read queue or the driver.  Call with the channel locked. */
+static struct ast_frame *read_frame_process(struct ast_channel *chan, struct ast_frame *f, int prestate, int dropaudio)
+{
 	if (f) {
 		/* if the channel driver returned more than one frame, stuff the excess
 		   into the readq for the next ast_read call
@@ -2064,6 +2298,10 @@ static struct ast_frame *__ast_read(struct ast_channel *chan, int dropaudio)
 				if (chan->readtrans && (f = ast_translate(chan->readtrans, f, 1)) == NULL)
 					f = &ast_null_frame;
 
+				/* Shared silence/talk analysis, done once for all consumers */
+				if (chan->analysis && chan->analysis->users && f->frametype == AST_FRAME_VOICE)
+					ast_dsp_analyze_frame(chan->analysis, f);
+
 				/* Run generator sitting on the line if timing device not available
 				* and synchronous generation of outgoing frames is necessary       */
 				if (chan->generatordata &&  !ast_internal_timing_enabled(chan)) {
@@ -2086,7 +2324,7 @@ static struct ast_frame *__ast_read(struct ast_channel *chan, int dropaudio)
 					}
 
 				} else if (f->frametype == AST_FRAME_CNG) {
-					if (chan->generator && !chan->timingfunc && (chan->timingfd > -1)) {
+					if (chan->generator && !chan->timingfunc && ((chan->timingfd > -1) || ast_timing_available(chan))) {
 						if (option_debug > 1)
 							ast_log(LOG_DEBUG, "Generator got CNG, switching to timed mode\n");
 						ast_settimeout(chan, 160, generator_force, chan);
@@ -2109,14 +2347,12 @@ static struct ast_frame *__ast_read(struct ast_channel *chan, int dropaudio)
 		ast_frame_dump(chan->name, f, "<<");
 	chan->fin = FRAMECOUNT_INC(chan->fin);
 
-done:
-	ast_channel_unlock(chan);
 	return f;
 }
 
 int ast_internal_timing_enabled(struct ast_channel *chan)
 {
-	int ret = ast_opt_internal_timing && chan->timingfd > -1;
+	int ret = ast_opt_internal_timing && ((chan->timingfd > -1) || ast_timing_available(chan));
 	if (option_debug > 4)
 		ast_log(LOG_DEBUG, "Internal timing is %s (option_internal_timing=%d chan->timingfd=%d)\n", ret? "enabled": "disabled", ast_opt_internal_timing, chan->timingfd);
 	return ret;
@@ -3326,6 +3562,83 @@ static void bridge_playfile(struct ast_channel *chan, struct ast_channel *peer,
 	ast_autoservice_stop(peer);
 }
 
+/*! \brief Whether ast_generic_bridge() can take the next frame on \a chan
+ * straight from its driver.  Anything that ast_read() would have to act on
+ * before the driver is asked for a frame rules it out.  Call with the
+ * channel locked. */
+static int bridge_direct_read_ok(struct ast_channel *chan)
+{
+	return !chan->masq && !chan->readq && !chan->generator && !chan->timingfunc &&
+		!chan->timingentry && !chan->spies && !chan->monitor && !chan->analysis &&
+		!(chan->fin & DEBUGCHAN_FLAG) && ast_strlen_zero(chan->dtmfq) &&
+		!ast_test_flag(chan, AST_FLAG_ZOMBIE | AST_FLAG_EXCEPTION) &&
+		(chan->fdno != AST_ALERT_FD) && (chan->fdno != AST_TIMING_FD) &&
+		(chan->fdno != AST_GENERATOR_FD) && chan->tech->read && !ast_check_hangup(chan);
+}
+
+/*!
+ * \brief Read the next frame for ast_generic_bridge()
+ * \param chan the channel with something to read
+ * \param peer the channel the frame is going to
+ * \param direct set if the frame can go to \a peer's driver as it is
+ *
+ * A voice or video frame straight from the driver that \a peer can send
+ * without translation skips ast_read()'s translation and checks.  Any other
+ * frame gets the full ast_read() treatment.
+ */
+static struct ast_frame *bridge_read(struct ast_channel *chan, struct ast_channel *peer, int *direct)
+{
+	struct ast_frame *f;
+	int prestate;
+
+	*direct = 0;
+	ast_channel_lock(chan);
+	if (!bridge_direct_read_ok(chan)) {
+		ast_channel_unlock(chan);
+		return ast_read(chan);
+	}
+	prestate = chan->_state;
+	chan->blocker = pthread_self();
+	f = chan->tech->read(chan);
+	if (f && !f->next &&
+	    (((f->frametype == AST_FRAME_VOICE) && (f->subclass & chan->nativeformats) && (f->subclass == peer->rawwriteformat)) ||
+	     (f->frametype == AST_FRAME_VIDEO))) {
+		chan->fin = FRAMECOUNT_INC(chan->fin);
+		*direct = 1;
+	} else
+		f = read_frame_process(chan, f, prestate, 0);
+	ast_channel_unlock(chan);
+	return f;
+}
+
+/*! \brief Hand a frame from bridge_read() to \a chan's driver, unless
+ * ast_write() has something to do with it first */
+static int bridge_write(struct ast_channel *chan, struct ast_frame *f)
+{
+	int res;
+
+	ast_channel_lock(chan);
+	if (chan->masq || chan->masqr || chan->generatordata || chan->spies || chan->monitor ||
+	    (chan->fout & DEBUGCHAN_FLAG) || ast_test_flag(chan, AST_FLAG_ZOMBIE) || ast_check_hangup(chan) ||
+	    ((f->frametype == AST_FRAME_VOICE) ? (!chan->tech->write || (f->subclass != chan->rawwriteformat)) : !chan->tech->write_video)) {
+		ast_channel_unlock(chan);
+		return ast_write(chan, f);
+	}
+	CHECK_BLOCKING(chan);
+	if (f->frametype == AST_FRAME_VOICE)
+		res = chan->tech->write(chan, f);
+	else
+		res = chan->tech->write_video(chan, f);
+	ast_clear_flag(chan, AST_FLAG_BLOCKING);
+	/* Consider a write failure to force a soft hangup */
+	if (res < 0)
+		chan->_softhangup |= AST_SOFTHANGUP_DEV;
+	else
+		chan->fout = FRAMECOUNT_INC(chan->fout);
+	ast_channel_unlock(chan);
+	return res;
+}
+
 static enum ast_bridge_result ast_generic_bridge(struct ast_channel *c0, struct ast_channel *c1,
 						 struct ast_bridge_config *config, struct ast_frame **fo,
 						 struct ast_channel **rc, struct timeval bridge_end)
@@ -3342,6 +3655,10 @@ static enum ast_bridge_result ast_generic_bridge(struct ast_channel *c0, struct
 	/* Indicates whether a frame was queued into a jitterbuffer */
 	int frame_put_in_jb = 0;
 	int jb_in_use;
+	int direct;
+	/* counts at the start of this pass, for the totals */
+	unsigned int start_direct = c0->bridge_direct + c1->bridge_direct;
+	unsigned int start_full = c0->bridge_full + c1->bridge_full;
 	int to;
 	
 	cs[0] = c0;
@@ -3393,15 +3710,32 @@ static enum ast_bridge_result ast_generic_bridge(struct ast_channel *c0, struct
 			}
 			continue;
 		}
-		f = ast_read(who);
+		other = (who == c0) ? c1 : c0; /* the 'other' channel */
+		/* Without a jitterbuffer in the way, media the other side can send
+		   as it is goes straight from one driver to the other */
+		if (jb_in_use) {
+			f = ast_read(who);
+			direct = 0;
+		} else
+			f = bridge_read(who, other, &direct);
 		if (!f) {
 			*fo = NULL;
 			*rc = who;
 			ast_log(LOG_DEBUG, "Didn't get a frame from channel: %s\n",who->name);
 			break;
 		}
+		if (direct) {
+			who->bridge_direct++;
+			bridge_write(other, f);
+			ast_frfree(f);
+			/* Swap who gets priority */
+			cs[2] = cs[0];
+			cs[0] = cs[1];
+			cs[1] = cs[2];
+			continue;
+		}
+		who->bridge_full++;
 
-		other = (who == c0) ? c1 : c0; /* the 'other' channel */
 		/* Try add the frame info the who's bridged channel jitterbuff */
 		if (jb_in_use)
 			frame_put_in_jb = !ast_jb_put(other, f);
@@ -3457,6 +3791,13 @@ static enum ast_bridge_result ast_generic_bridge(struct ast_channel *c0, struct
 		cs[0] = cs[1];
 		cs[1] = cs[2];
 	}
+	if (option_debug > 1)
+		ast_log(LOG_DEBUG, "Generic bridge %s/%s: %u/%u frames direct, %u/%u through ast_read()/ast_write()\n",
+			c0->name, c1->name, c0->bridge_direct, c1->bridge_direct, c0->bridge_full, c1->bridge_full);
+	ast_mutex_lock(&bridge_stats_lock);
+	bridge_direct_total += c0->bridge_direct + c1->bridge_direct - start_direct;
+	bridge_full_total += c0->bridge_full + c1->bridge_full - start_full;
+	ast_mutex_unlock(&bridge_stats_lock);
 	return res;
 }
 
@@ -3514,6 +3855,11 @@ enum ast_bridge_result ast_channel_bridge(struct ast_channel *c0, struct ast_cha
 	c0->_bridge = c1;
 	c1->_bridge = c0;
 
+	if (firstpass) {
+		c0->bridge_direct = c0->bridge_full = 0;
+		c1->bridge_direct = c1->bridge_full = 0;
+	}
+
 	/* \todo  XXX here should check that cid_num is not NULL */
 	manager_event(EVENT_FLAG_CALL, "Link",
 		      "Channel1: %s\r\n"
@@ -3917,6 +4263,7 @@ void ast_channels_init(void)
 {
 	ast_cli_register(&cli_show_channeltypes);
 	ast_cli_register(&cli_show_channeltype);
+	ast_cli_register(&cli_show_bridge_stats);
 }
 
 /*! \brief Print call group and pickup group ---*/
@@ -3984,6 +4331,48 @@ static void copy_data_from_queue(struct ast_channel_spy_queue *queue, short *buf
 	}
 }
 
+/*! \brief take samples from the head of a spy queue */
+static void spy_queue_take(struct ast_channel_spy_queue *queue, short *buf, unsigned int samples)
+{
+	if (queue->ring.buf)
+		spy_ring_read(&queue->ring, buf, samples);
+	else
+		copy_data_from_queue(queue, buf, samples);
+}
+
+/*! \brief empty a spy queue, returning its contents as a frame chain */
+static struct ast_frame *spy_queue_flush(struct ast_channel_spy_queue *queue, int voladjust, int adjustment)
+{
+	struct ast_frame *result;
+
+	if (queue->ring.buf) {
+		unsigned int samples = spy_ring_filled(&queue->ring);
+		short buf[samples ? samples : 1];
+		struct ast_frame frame = { .frametype = AST_FRAME_VOICE,
+					   .subclass = AST_FORMAT_SLINEAR,
+					   .data = buf,
+					   .samples = samples,
+					   .datalen = samples * sizeof(short),
+		};
+
+		if (!samples)
+			return NULL;
+		spy_ring_read(&queue->ring, buf, samples);
+		if (voladjust)
+			ast_frame_adjust_volume(&frame, adjustment);
+		return ast_frdup(&frame);
+	}
+
+	if (voladjust) {
+		for (result = queue->head; result; result = result->next)
+			ast_frame_adjust_volume(result, adjustment);
+	}
+	result = queue->head;
+	queue->head = NULL;
+	queue->samples = 0;
+	return result;
+}
+
 struct ast_frame *ast_channel_spy_read_frame(struct ast_channel_spy *spy, unsigned int samples)
 {
 	struct ast_frame *result;
@@ -4006,34 +4395,30 @@ struct ast_frame *ast_channel_spy_read_frame(struct ast_channel_spy *spy, unsign
 					       .datalen = ast_codec_get_len(spy->write_queue.format, samples),
 	};
 
+	/* without a trigger nobody flushes the rings, so drop stale audio here */
+	if (ast_test_flag(spy, CHANSPY_TRIGGER_MODE) == CHANSPY_TRIGGER_NONE) {
+		if (spy->read_queue.ring.buf)
+			spy_ring_trim(&spy->read_queue.ring);
+		if (spy->write_queue.ring.buf)
+			spy_ring_trim(&spy->write_queue.ring);
+	}
+
 	/* if a flush has been requested, dump everything in whichever queue is larger */
 	if (ast_test_flag(spy, CHANSPY_TRIGGER_FLUSH)) {
-		if (spy->read_queue.samples > spy->write_queue.samples) {
-			if (ast_test_flag(spy, CHANSPY_READ_VOLADJUST)) {
-				for (result = spy->read_queue.head; result; result = result->next)
-					ast_frame_adjust_volume(result, spy->read_vol_adjustment);
-			}
-			result = spy->read_queue.head;
-			spy->read_queue.head = NULL;
-			spy->read_queue.samples = 0;
-		} else {
-			if (ast_test_flag(spy, CHANSPY_WRITE_VOLADJUST)) {
-				for (result = spy->write_queue.head; result; result = result->next)
-					ast_frame_adjust_volume(result, spy->write_vol_adjustment);
-			}
-			result = spy->write_queue.head;
-			spy->write_queue.head = NULL;
-			spy->write_queue.samples = 0;
-		}
+		if (spy_queue_samples(&spy->read_queue) > spy_queue_samples(&spy->write_queue))
+			result = spy_queue_flush(&spy->read_queue, ast_test_flag(spy, CHANSPY_READ_VOLADJUST), spy->read_vol_adjustment);
+		else
+			result = spy_queue_flush(&spy->write_queue, ast_test_flag(spy, CHANSPY_WRITE_VOLADJUST), spy->write_vol_adjustment);
 		ast_clear_flag(spy, CHANSPY_TRIGGER_FLUSH);
 		return result;
 	}
 
-	if ((spy->read_queue.samples < samples) || (spy->write_queue.samples < samples))
+	if ((spy_queue_samples(&spy->read_queue) < samples) || (spy_queue_samples(&spy->write_queue) < samples))
 		return NULL;
 
 	/* short-circuit if both head frames have exactly what we want */
-	if ((spy->read_queue.head->samples == samples) &&
+	if (!spy->read_queue.ring.buf && !spy->write_queue.ring.buf &&
+	    (spy->read_queue.head->samples == samples) &&
 	    (spy->write_queue.head->samples == samples)) {
 		read_frame = spy->read_queue.head;
 		spy->read_queue.head = read_frame->next;
@@ -4048,8 +4433,8 @@ struct ast_frame *ast_channel_spy_read_frame(struct ast_channel_spy *spy, unsign
 
 		need_dup = 0;
 	} else {
-		copy_data_from_queue(&spy->read_queue, read_buf, samples);
-		copy_data_from_queue(&spy->write_queue, write_buf, samples);
+		spy_queue_take(&spy->read_queue, read_buf, samples);
+		spy_queue_take(&spy->write_queue, write_buf, samples);
 
 		read_frame = &stack_read_frame;
 		write_frame = &stack_write_frame;
@@ -114,6 +114,8 @@ struct local_pvt {
 	int alreadymasqed;			/* Already masqueraded */
 	int launchedpbx;			/* Did we launch the PBX */
 	int nooptimization;			/* Don't leave masq state */
+	unsigned int direct;			/* Frames handed straight to the bridged peer */
+	unsigned int relayed;			/* Frames queued on the other half */
 	struct ast_channel *owner;		/* Master Channel */
 	struct ast_channel *chan;		/* Outbound channel */
 	AST_LIST_ENTRY(local_pvt) list;		/* Next entity */
@@ -121,6 +123,11 @@ struct local_pvt {
 
 static AST_LIST_HEAD_STATIC(locals, local_pvt);
 
+/* Totals over all local channels, for "local show channels" */
+static int local_direct_frames;
+static int local_relayed_frames;
+static int local_optimized;
+
 /*! \brief Adds devicestate to local channels */
 static int local_devicestate(void *data)
 {
@@ -216,6 +223,51 @@ static int local_answer(struct ast_channel *ast)
 	return res;
 }
 
+/*! \brief Pass a voice or video frame straight to the channel the other half
+ * is bridged to, instead of queueing it for the bridge to read and write.
+ * Only done when reading it from the other half would not have done anything
+ * to it on the way through.
+ * \return 0 if the frame was handed off, -1 if it has to be queued
+ * \note Called with p and the writing channel locked.  The other channels
+ * are only trylocked, so this never waits for a lock.
+ */
+static int local_direct_frame(struct local_pvt *p, int isoutbound, struct ast_frame *f)
+{
+	struct ast_channel *other = isoutbound ? p->owner : p->chan;
+	struct ast_channel *peer;
+	int res = -1;
+
+	if (!other || ast_mutex_trylock(&other->lock))
+		return -1;
+	peer = other->_bridge;
+	/* Reading would have translated the frame for other, and writing it
+	   to peer is only the same if peer translates it the same way */
+	if (peer && (peer->_bridge == other) && !other->readq && !other->_softhangup &&
+	    !other->spies && !other->monitor && !other->generatordata && !other->timingfunc &&
+	    !other->readtrans && (f->subclass & other->nativeformats) &&
+	    ((f->frametype != AST_FRAME_VOICE) || (f->subclass == peer->rawwriteformat) || !peer->writetrans) &&
+	    !(peer->jb && ast_test_flag(&peer->jb->conf, AST_JB_ENABLED)) &&
+	    !ast_mutex_trylock(&peer->lock)) {
+		ast_write(peer, f);
+		ast_mutex_unlock(&peer->lock);
+		res = 0;
+	}
+	ast_mutex_unlock(&other->lock);
+	return res;
+}
+
+/*! \brief Nothing but audio and video is waiting to be read from \a chan */
+static int local_readq_media_only(struct ast_channel *chan)
+{
+	struct ast_frame *f;
+
+	for (f = chan->readq; f; f = f->next) {
+		if ((f->frametype != AST_FRAME_VOICE) && (f->frametype != AST_FRAME_VIDEO))
+			return 0;
+	}
+	return 1;
+}
+
 static void check_bridge(struct local_pvt *p, int isoutbound)
 {
 	if (p->alreadymasqed || p->nooptimization)
@@ -223,12 +275,14 @@ static void check_bridge(struct local_pvt *p, int isoutbound)
 	if (!p->chan || !p->owner)
 		return;
 
-	/* only do the masquerade if we are being called on the outbound channel,
-	   if it has been bridged to another channel and if there are no pending
-	   frames on the owner channel (because they would be transferred to the
-	   outbound channel during the masquerade)
+	/* only do the masquerade if the outbound channel has been bridged to
+	   another channel and if there are no pending control frames on the owner
+	   channel (because they would be transferred to the outbound channel
+	   during the masquerade).  Pending audio is harmless, it ends up being
+	   read from the owner as it would have been anyway.  Either side writing
+	   anything is a chance to try.
 	*/
-	if (isoutbound && p->chan->_bridge /* Not ast_bridged_channel!  Only go one step! */ && !p->owner->readq) {
+	if (p->chan->_bridge /* Not ast_bridged_channel!  Only go one step! */ && local_readq_media_only(p->owner)) {
 		/* Masquerade bridged channel into owner */
 		/* Lock everything we need, one by one, and give up if
 		   we can't get everything.  Remember, we'll get another
@@ -239,6 +293,7 @@ static void check_bridge(struct local_pvt *p, int isoutbound)
 					if (!p->owner->_softhangup) {
 						ast_channel_masquerade(p->owner, p->chan->_bridge);
 						p->alreadymasqed = 1;
+						ast_atomic_fetchadd_int(&local_optimized, 1);
 					}
 					ast_mutex_unlock(&p->owner->lock);
 				}
@@ -279,14 +334,24 @@ static int local_write(struct ast_channel *ast, struct ast_frame *f)
 	int res = -1;
 	int isoutbound;
 
-	/* Just queue for delivery to the other side */
+	/* Hand straight to whoever the other side is bridged to, or just queue
+	   for delivery to the other side */
 	ast_mutex_lock(&p->lock);
 	isoutbound = IS_OUTBOUND(ast, p);
-	if (f && (f->frametype == AST_FRAME_VOICE || f->frametype == AST_FRAME_VIDEO))
+	if (f)
 		check_bridge(p, isoutbound);
-	if (!p->alreadymasqed)
-		res = local_queue_frame(p, isoutbound, f, ast);
-	else {
+	if (!p->alreadymasqed) {
+		if (f && ((f->frametype == AST_FRAME_VOICE) || (f->frametype == AST_FRAME_VIDEO)) &&
+		    !local_direct_frame(p, isoutbound, f)) {
+			p->direct++;
+			ast_atomic_fetchadd_int(&local_direct_frames, 1);
+			res = 0;
+		} else {
+			p->relayed++;
+			ast_atomic_fetchadd_int(&local_relayed_frames, 1);
+			res = local_queue_frame(p, isoutbound, f, ast);
+		}
+	} else {
 		if (option_debug)
 			ast_log(LOG_DEBUG, "Not posting to queue since already masked on '%s'\n", ast->name);
 		res = 0;
@@ -604,10 +669,12 @@ static int locals_show(int fd, int argc, char **argv)
 	AST_LIST_LOCK(&locals);
 	AST_LIST_TRAVERSE(&locals, p, list) {
 		ast_mutex_lock(&p->lock);
-		ast_cli(fd, "%s -- %s@%s\n", p->owner ? p->owner->name : "<unowned>", p->exten, p->context);
+		ast_cli(fd, "%s -- %s@%s (%u direct, %u relayed frames)\n", p->owner ? p->owner->name : "<unowned>", p->exten, p->context, p->direct, p->relayed);
 		ast_mutex_unlock(&p->lock);
 	}
 	AST_LIST_UNLOCK(&locals);
+	ast_cli(fd, "Frames handed directly to the bridged peer: %d, relayed through the queue: %d\n", local_direct_frames, local_relayed_frames);
+	ast_cli(fd, "Local channel pairs optimized away: %d\n", local_optimized);
 	return RESULT_SUCCESS;
 }
 
@@ -709,6 +709,7 @@ static int handle_showchan(int fd, int argc, char *argv[])
 		"1st File Descriptor: %d\n"
 		"      Frames in: %d%s\n"
 		"     Frames out: %d%s\n"
+		"  Bridge Frames: %u direct, %u full\n"
 		" Time to Hangup: %ld\n"
 		"   Elapsed Time: %s\n"
 		"  Direct Bridge: %s\n"
@@ -734,6 +735,7 @@ static int handle_showchan(int fd, int argc, char *argv[])
 		c->fds[0],
 		c->fin & ~DEBUGCHAN_FLAG, (c->fin & DEBUGCHAN_FLAG) ? " (DEBUGGED)" : "",
 		c->fout & ~DEBUGCHAN_FLAG, (c->fout & DEBUGCHAN_FLAG) ? " (DEBUGGED)" : "",
+		c->bridge_direct, c->bridge_full,
 		(long)c->whentohangup,
 		cdrtime, c->_bridge ? c->_bridge->name : "<none>", ast_bridged_channel(c) ? ast_bridged_channel(c)->name : "<none>", 
 		c->context, c->exten, c->priority, c->callgroup, c->pickupgroup, ( c->appl ? c->appl : "(N/A)" ),
@@ -94,6 +94,24 @@ static void *lpc10_dec_new(struct ast_trans_pvt *pvt)
 	return tmp;
 }
 
+/*! \brief reinitialize a pooled encoder without reallocating its state */
+static void lpc10_enc_reset(struct ast_trans_pvt *pvt)
+{
+	struct lpc10_coder_pvt *tmp = pvt->pvt;
+
+	init_lpc10_encoder_state(tmp->lpc10.enc);
+	tmp->longer = 0;
+}
+
+/*! \brief reinitialize a pooled decoder without reallocating its state */
+static void lpc10_dec_reset(struct ast_trans_pvt *pvt)
+{
+	struct lpc10_coder_pvt *tmp = pvt->pvt;
+
+	init_lpc10_decoder_state(tmp->lpc10.dec);
+	tmp->longer = 0;
+}
+
 static struct ast_frame *lintolpc10_sample(void)
 {
 	static struct ast_frame f;
@@ -251,6 +269,7 @@ static struct ast_translator lpc10tolin = {
 	.newpvt = lpc10_dec_new,
 	.framein = lpc10tolin_framein,
 	.destroy = lpc10_destroy,
+	.reset = lpc10_dec_reset,
 	.sample = lpc10tolin_sample,
 	.desc_size = sizeof(struct lpc10_coder_pvt),
 	.buffer_samples = BUFFER_SAMPLES,
@@ -266,6 +285,7 @@ static struct ast_translator lintolpc10 = {
 	.framein = lintolpc10_framein,
 	.frameout = lintolpc10_frameout,
 	.destroy = lpc10_destroy,
+	.reset = lpc10_enc_reset,
 	.sample = lintolpc10_sample,
 	.desc_size = sizeof(struct lpc10_coder_pvt),
 	.buffer_samples = BUFFER_SAMPLES,
@@ -34,6 +34,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/stat.h>
@@ -80,17 +81,57 @@ static struct ast_config_engine *config_engine_list;
 
 #define MAX_INCLUDE_LEVEL 10
 
+/*! \brief Category and variable lists shorter than this are searched
+    linearly; longer ones get a hash index on first lookup */
+#ifndef CONFIG_INDEX_MIN
+#define CONFIG_INDEX_MIN 32
+#endif
+
 struct ast_comment {
 	struct ast_comment *next;
 	char cmt[0];
 };
 
+/*! \brief A file (or glob directory) a config was read from, so the
+    config cache can tell when it changes */
+struct config_stamp {
+	struct config_stamp *next;
+	int exists;
+	time_t mtime;
+	off_t size;
+	ino_t ino;
+	char path[0];
+};
+
+/*! \brief A parsed config kept for reuse by ast_config_load() */
+struct config_cache {
+	struct config_cache *next;
+	struct ast_config *cfg;		/*!< Pristine snapshot, only ever copied out */
+	time_t loaded;			/*!< When the files were read */
+	int mapsversion;		/*!< config_maps_version at load time */
+	int parsetime;			/*!< Milliseconds spent loading */
+	int files;			/*!< Number of stamps */
+	unsigned int hits;
+	char filename[0];
+};
+
+AST_MUTEX_DEFINE_STATIC(config_cache_lock);
+static struct config_cache *config_cache_list;
+
+/*! \brief Bumped whenever realtime mappings or engines change, since they
+    decide whether a file is read from disk at all */
+static int config_maps_version;
+
 struct ast_category {
 	char name[80];
 	int ignored;			/* do not let user of the config see this category */
 	struct ast_variable *root;
 	struct ast_variable *last;
 	struct ast_category *next;
+	struct ast_config *config;	/* config this category was appended to */
+	int varcount;			/* number of variables in the list */
+	struct ast_variable **varindex;	/* open hash of the first variable of each name, built on demand */
+	unsigned int varmask;		/* varindex size - 1 */
 };
 
 struct ast_config {
@@ -100,8 +141,129 @@ struct ast_config {
 	struct ast_category *last_browse;		/* used to cache the last category supplied via category_browse */
 	int include_level;
 	int max_include_level;
+	int catcount;			/* number of categories in the list */
+	struct ast_category **catindex;	/* open hash of all categories, built on demand */
+	unsigned int catmask;		/* catindex size - 1 */
+	struct config_stamp *stamps;	/* files read while loading */
+	int nocache;			/* loaded from something other than plain files */
 };
 
+/*! \brief Category and variable names compare case-insensitively */
+static unsigned int config_hash(const char *name)
+{
+	unsigned int hash = 0;
+
+	for (; *name; name++)
+		hash = hash * 31 + tolower(*name);
+
+	return hash;
+}
+
+static unsigned int config_index_size(int count)
+{
+	unsigned int size = 32;
+
+	/* Keep the table at most half full */
+	while (size < count * 2)
+		size <<= 1;
+
+	return size;
+}
+
+/*! \brief Add a variable to its category's index, unless an earlier
+    variable of the same name is already there */
+static void varindex_add(struct ast_category *cat, struct ast_variable *var)
+{
+	unsigned int i;
+
+	for (i = config_hash(var->name) & cat->varmask; cat->varindex[i]; i = (i + 1) & cat->varmask) {
+		if (!strcasecmp(cat->varindex[i]->name, var->name))
+			return;
+	}
+	cat->varindex[i] = var;
+}
+
+static void varindex_drop(struct ast_category *cat)
+{
+	free(cat->varindex);
+	cat->varindex = NULL;
+	cat->varmask = 0;
+}
+
+static int varindex_build(struct ast_category *cat)
+{
+	struct ast_variable *var;
+	unsigned int size = config_index_size(cat->varcount);
+
+	varindex_drop(cat);
+	if (!(cat->varindex = ast_calloc(size, sizeof(*cat->varindex))))
+		return -1;
+	cat->varmask = size - 1;
+	for (var = cat->root; var; var = var->next)
+		varindex_add(cat, var);
+
+	return 0;
+}
+
+/*! \brief Add a category to its config's index.  Categories sharing a name
+    end up along the probe sequence in the order they were appended. */
+static void catindex_add(struct ast_config *cfg, struct ast_category *cat)
+{
+	unsigned int i;
+
+	for (i = config_hash(cat->name) & cfg->catmask; cfg->catindex[i]; i = (i + 1) & cfg->catmask);
+	cfg->catindex[i] = cat;
+}
+
+static void catindex_drop(struct ast_config *cfg)
+{
+	free(cfg->catindex);
+	cfg->catindex = NULL;
+	cfg->catmask = 0;
+}
+
+static int catindex_build(struct ast_config *cfg)
+{
+	struct ast_category *cat;
+	unsigned int size = config_index_size(cfg->catcount);
+
+	catindex_drop(cfg);
+	if (!(cfg->catindex = ast_calloc(size, sizeof(*cfg->catindex))))
+		return -1;
+	cfg->catmask = size - 1;
+	for (cat = cfg->root; cat; cat = cat->next)
+		catindex_add(cfg, cat);
+
+	return 0;
+}
+
+/*! \brief Find the first variable of a name in a category */
+static struct ast_variable *variable_get(const struct ast_category *category, const char *name)
+{
+	/* The index is only a cache, so it is built even through a const config */
+	struct ast_category *cat = (struct ast_category *) category;
+	struct ast_variable *v;
+	unsigned int i;
+
+	if (!cat->varindex && cat->varcount >= CONFIG_INDEX_MIN)
+		varindex_build(cat);
+
+	if (cat->varindex) {
+		for (i = config_hash(name) & cat->varmask; (v = cat->varindex[i]); i = (i + 1) & cat->varmask) {
+			if (!strcasecmp(name, v->name))
+				return v;
+		}
+		return NULL;
+	}
+
+	for (v = cat->root; v; v = v->next) {
+		if (!strcasecmp(name, v->name))
+			return v;
+	}
+
+	return NULL;
+}
+
 struct ast_variable *ast_variable_new(const char *name, const char *value) 
 {
 	struct ast_variable *variable;
@@ -125,6 +287,19 @@ void ast_variable_append(struct ast_category *category, struct ast_variable *var
 		category->last->next = variable;
 	else
 		category->root = variable;
+	/* A whole list may be appended at once */
+	for (;;) {
+		category->varcount++;
+		if (category->varindex) {
+			if (category->varcount * 2 > category->varmask + 1)
+				varindex_build(category);
+			else
+				varindex_add(category, variable);
+		}
+		if (!variable->next)
+			break;
+		variable = variable->next;
+	}
 	category->last = variable;
 }
 
@@ -156,10 +331,15 @@ char *ast_variable_retrieve(const struct ast_config *config, const char *categor
 	struct ast_variable *v;
 
 	if (category) {
-		for (v = ast_variable_browse(config, category); v; v = v->next) {
-			if (!strcasecmp(variable, v->name))
-				return v->value;
-		}
+		struct ast_category *cat;
+
+		if (config->last_browse && (config->last_browse->name == category))
+			cat = config->last_browse;
+		else
+			cat = ast_category_get(config, category);
+
+		if (cat && (v = variable_get(cat, variable)))
+			return v->value;
 	} else {
 		struct ast_category *cat;
 
@@ -190,6 +370,9 @@ static void move_variables(struct ast_category *old, struct ast_category *new)
 {
 	struct ast_variable *var = old->root;
 	old->root = NULL;
+	old->last = NULL;
+	old->varcount = 0;
+	varindex_drop(old);
 #if 1
 	/* we can just move the entire list in a single op */
 	ast_variable_append(new, var);
@@ -214,7 +397,25 @@ struct ast_category *ast_category_new(const char *name)
 
 static struct ast_category *category_get(const struct ast_config *config, const char *category_name, int ignored)
 {
-	struct ast_category *cat;
+	struct ast_category *cat, *match = NULL;
+	unsigned int i;
+
+	/* The index is only a cache, so it is built even through a const config */
+	if (!config->catindex && config->catcount >= CONFIG_INDEX_MIN)
+		catindex_build((struct ast_config *) config);
+
+	if (config->catindex) {
+		/* same precedence as below: an exact match anywhere, else the first case-insensitive one */
+		for (i = config_hash(category_name) & config->catmask; (cat = config->catindex[i]); i = (i + 1) & config->catmask) {
+			if (!ignored && cat->ignored)
+				continue;
+			if (cat->name == category_name)
+				return cat;
+			if (!match && !strcasecmp(cat->name, category_name))
+				match = cat;
+		}
+		return match;
+	}
 
 	/* try exact match first, then case-insensitive match */
 	for (cat = config->root; cat; cat = cat->next) {
@@ -248,11 +449,20 @@ void ast_category_append(struct ast_config *config, struct ast_category *categor
 		config->root = category;
 	config->last = category;
 	config->current = category;
+	category->config = config;
+	config->catcount++;
+	if (config->catindex) {
+		if (config->catcount * 2 > config->catmask + 1)
+			catindex_build(config);
+		else
+			catindex_add(config, category);
+	}
 }
 
 void ast_category_destroy(struct ast_category *cat)
 {
 	ast_variables_destroy(cat->root);
+	varindex_drop(cat);
 	free(cat);
 }
 
@@ -272,20 +482,8 @@ char *ast_category_browse(struct ast_config *config, const char *prev)
 	else if (!prev && config->root)
 		cat = config->root;
 	else if (prev) {
-		for (cat = config->root; cat; cat = cat->next) {
-			if (cat->name == prev) {
-				cat = cat->next;
-				break;
-			}
-		}
-		if (!cat) {
-			for (cat = config->root; cat; cat = cat->next) {
-				if (!strcasecmp(cat->name, prev)) {
-					cat = cat->next;
-					break;
-				}
-			}
-		}
+		if ((cat = category_get(config, prev, 1)))
+			cat = cat->next;
 	}
 	
 	if (cat)
@@ -301,6 +499,9 @@ struct ast_variable *ast_category_detach_variables(struct ast_category *cat)
 
 	v = cat->root;
 	cat->root = NULL;
+	cat->last = NULL;
+	cat->varcount = 0;
+	varindex_drop(cat);
 
 	return v;
 }
@@ -308,6 +509,9 @@ struct ast_variable *ast_category_detach_variables(struct ast_category *cat)
 void ast_category_rename(struct ast_category *cat, const char *name)
 {
 	ast_copy_string(cat->name, name, sizeof(cat->name));
+	/* The category is filed under its old name */
+	if (cat->config)
+		catindex_drop(cat->config);
 }
 
 static void inherit_category(struct ast_category *new, const struct ast_category *base)
@@ -318,6 +522,53 @@ static void inherit_category(struct ast_category *new, const struct ast_category
 		ast_variable_append(new, variable_clone(var));
 }
 
+static void config_stamps_destroy(struct config_stamp *stamp)
+{
+	struct config_stamp *next;
+
+	for (; stamp; stamp = next) {
+		next = stamp->next;
+		free(stamp);
+	}
+}
+
+/*! \brief Note a path a config was read from; st is NULL if it did not exist */
+static void config_stamp(struct ast_config *cfg, const char *path, const struct stat *st)
+{
+	struct config_stamp *stamp;
+
+	if (!(stamp = ast_calloc(1, sizeof(*stamp) + strlen(path) + 1))) {
+		cfg->nocache = 1;
+		return;
+	}
+	strcpy(stamp->path, path);
+	if (st) {
+		stamp->exists = 1;
+		stamp->mtime = st->st_mtime;
+		stamp->size = st->st_size;
+		stamp->ino = st->st_ino;
+	}
+	stamp->next = cfg->stamps;
+	cfg->stamps = stamp;
+}
+
+/*! \brief Note the directory a glob pattern expands in, so new matches are noticed */
+static void config_stamp_glob(struct ast_config *cfg, const char *pattern)
+{
+	char dir[256];
+	char *slash;
+	struct stat st;
+
+	ast_copy_string(dir, pattern, sizeof(dir));
+	if (!(slash = strrchr(dir, '/')) || (strpbrk(dir, "*?[{") && strpbrk(dir, "*?[{") < slash)) {
+		/* wildcards in the directory part; too much to track */
+		cfg->nocache = 1;
+		return;
+	}
+	*slash = '\0';
+	config_stamp(cfg, dir, stat(dir, &st) ? NULL : &st);
+}
+
 struct ast_config *ast_config_new(void) 
 {
 	struct ast_config *config;
@@ -337,10 +588,13 @@ void ast_config_destroy(struct ast_config *cfg)
 	cat = cfg->root;
 	while(cat) {
 		ast_variables_destroy(cat->root);
+		varindex_drop(cat);
 		catn = cat;
 		cat = cat->next;
 		free(catn);
 	}
+	catindex_drop(cfg);
+	config_stamps_destroy(cfg->stamps);
 	free(cfg);
 }
 
@@ -458,6 +712,8 @@ static int process_text_line(struct ast_config *cfg, struct ast_category **cat,
 				/* #exec </path/to/executable>
 				   We create a tmp file, then we #include it, then we delete it. */
 				if (do_exec) { 
+					/* the output can change at any time */
+					cfg->nocache = 1;
 					snprintf(exec_file, sizeof(exec_file), "/var/tmp/exec.%d.%ld", (int)time(NULL), (long)pthread_self());
 					snprintf(cmd, sizeof(cmd), "%s > %s 2>&1", cur, exec_file);
 					ast_safe_system(cmd);
@@ -536,6 +792,8 @@ static struct ast_config *config_text_file_load(const char *database, const char
 	}
 
 #ifdef AST_INCLUDE_GLOB
+	if (strpbrk(fn, "*?[{"))
+		config_stamp_glob(cfg, fn);
 	{
 		int glob_ret;
 		glob_t globbuf;
@@ -558,9 +816,13 @@ static struct ast_config *config_text_file_load(const char *database, const char
 				ast_copy_string(fn, globbuf.gl_pathv[i], sizeof(fn));
 #endif
 	do {
-		if (stat(fn, &statbuf))
+		if (stat(fn, &statbuf)) {
+			/* it may appear later */
+			config_stamp(cfg, fn, NULL);
 			continue;
+		}
 
+		config_stamp(cfg, fn, &statbuf);
 		if (!S_ISREG(statbuf.st_mode)) {
 			ast_log(LOG_WARNING, "'%s' is not a regular file, ignoring\n", fn);
 			continue;
@@ -732,6 +994,7 @@ static void clear_config_maps(void)
 
 	ast_mutex_lock(&config_lock);
 
+	config_maps_version++;
 	while (config_maps) {
 		map = config_maps;
 		config_maps = config_maps->next;
@@ -767,6 +1030,7 @@ static int append_mapping(char *name, char *driver, char *database, char *table)
 		strcpy(map->table, table);
 	}
 	map->next = config_maps;
+	config_maps_version++;
 
 	if (option_verbose > 1)
 		ast_verbose(VERBOSE_PREFIX_2 "Binding %s to %s/%s/%s\n",
@@ -853,6 +1117,7 @@ int ast_config_engine_register(struct ast_config_engine *new)
 		for (ptr = config_engine_list; ptr->next; ptr=ptr->next);
 		ptr->next = new;
 	}
+	config_maps_version++;
 
 	ast_mutex_unlock(&config_lock);
 	ast_log(LOG_NOTICE,"Registered Config Engine %s\n", new->name);
@@ -876,6 +1141,7 @@ int ast_config_engine_deregister(struct ast_config_engine *del)
 		}
 		last = ptr;
 	}
+	config_maps_version++;
 
 	ast_mutex_unlock(&config_lock);
 
@@ -951,6 +1217,9 @@ struct ast_config *ast_config_internal_load(const char *filename, struct ast_con
 		}
 	}
 
+	if (loader != &text_file_engine)
+		cfg->nocache = 1;
+
 	result = loader->load_func(db, table, filename, cfg);
 
 	if (result)
@@ -959,22 +1228,223 @@ struct ast_config *ast_config_internal_load(const char *filename, struct ast_con
 	return result;
 }
 
+/*! \brief Deep copy of a config's categories and variables */
+static struct ast_config *config_copy(const struct ast_config *old)
+{
+	struct ast_config *new;
+	struct ast_category *cat, *newcat;
+	struct ast_variable *var;
+
+	if (!(new = ast_config_new()))
+		return NULL;
+
+	new->max_include_level = old->max_include_level;
+	for (cat = old->root; cat; cat = cat->next) {
+		if (!(newcat = ast_category_new(cat->name))) {
+			ast_config_destroy(new);
+			return NULL;
+		}
+		newcat->ignored = cat->ignored;
+		ast_category_append(new, newcat);
+		for (var = cat->root; var; var = var->next)
+			ast_variable_append(newcat, variable_clone(var));
+	}
+
+	return new;
+}
+
+/*! \brief Check that none of the files a cached config came from changed.
+    Must be called with config_cache_lock held. */
+static int config_cache_valid(const struct config_cache *entry)
+{
+	struct config_stamp *stamp;
+	struct stat st;
+	int maps;
+
+	ast_mutex_lock(&config_lock);
+	maps = config_maps_version;
+	ast_mutex_unlock(&config_lock);
+	if (maps != entry->mapsversion)
+		return 0;
+
+	for (stamp = entry->cfg->stamps; stamp; stamp = stamp->next) {
+		if (stat(stamp->path, &st)) {
+			if (stamp->exists)
+				return 0;
+			continue;
+		}
+		if (!stamp->exists || (st.st_mtime != stamp->mtime) || (st.st_size != stamp->size) || (st.st_ino != stamp->ino))
+			return 0;
+		/* a file written in the same second it was read may have changed again unnoticed */
+		if (stamp->mtime >= entry->loaded)
+			return 0;
+	}
+
+	return 1;
+}
+
+static struct ast_config *config_cache_get(const char *filename)
+{
+	struct config_cache *entry;
+	struct ast_config *result = NULL;
+
+	ast_mutex_lock(&config_cache_lock);
+	for (entry = config_cache_list; entry; entry = entry->next) {
+		if (!strcmp(entry->filename, filename))
+			break;
+	}
+	if (entry && config_cache_valid(entry) && (result = config_copy(entry->cfg))) {
+		entry->hits++;
+		if (option_debug)
+			ast_log(LOG_DEBUG, "Using cached copy of '%s'\n", filename);
+	}
+	ast_mutex_unlock(&config_cache_lock);
+
+	return result;
+}
+
+/*! \brief Keep a snapshot of a freshly loaded config, replacing any older one */
+static void config_cache_put(const char *filename, struct ast_config *cfg, time_t loaded, int mapsversion, int parsetime)
+{
+	struct config_cache *entry, *prev = NULL;
+	struct config_stamp *stamp;
+	struct ast_config *snapshot = NULL;
+
+	if (!cfg->nocache && (snapshot = config_copy(cfg))) {
+		/* the caller's copy has no further use for the stamps */
+		snapshot->stamps = cfg->stamps;
+		cfg->stamps = NULL;
+	}
+
+	ast_mutex_lock(&config_cache_lock);
+	for (entry = config_cache_list; entry; prev = entry, entry = entry->next) {
+		if (!strcmp(entry->filename, filename))
+			break;
+	}
+	if (!entry && snapshot && (entry = ast_calloc(1, sizeof(*entry) + strlen(filename) + 1))) {
+		strcpy(entry->filename, filename);
+		entry->next = config_cache_list;
+		config_cache_list = entry;
+		prev = NULL;
+	}
+	if (entry && !snapshot) {
+		/* not cacheable (any more) */
+		if (prev)
+			prev->next = entry->next;
+		else
+			config_cache_list = entry->next;
+		ast_config_destroy(entry->cfg);
+		free(entry);
+	} else if (entry) {
+		ast_config_destroy(entry->cfg);
+		entry->cfg = snapshot;
+		snapshot = NULL;
+		entry->loaded = loaded;
+		entry->mapsversion = mapsversion;
+		entry->parsetime = parsetime;
+		for (entry->files = 0, stamp = entry->cfg->stamps; stamp; stamp = stamp->next)
+			entry->files++;
+	}
+	ast_mutex_unlock(&config_cache_lock);
+
+	if (snapshot)
+		ast_config_destroy(snapshot);
+}
+
 struct ast_config *ast_config_load(const char *filename)
 {
 	struct ast_config *cfg;
 	struct ast_config *result;
+	struct timeval start;
+	int maps;
+
+	if ((result = config_cache_get(filename)))
+		return result;
 
 	cfg = ast_config_new();
 	if (!cfg)
 		return NULL;
 
+	ast_mutex_lock(&config_lock);
+	maps = config_maps_version;
+	ast_mutex_unlock(&config_lock);
+	start = ast_tvnow();
+
 	result = ast_config_internal_load(filename, cfg);
 	if (!result)
 		ast_config_destroy(cfg);
+	else
+		config_cache_put(filename, result, start.tv_sec, maps, ast_tvdiff_ms(ast_tvnow(), start));
 
 	return result;
 }
 
+/*! \brief The first category of a name, ignoring the exact-pointer preference of category_get() */
+static struct ast_category *category_first(const struct ast_config *config, const char *category_name)
+{
+	char name[80];
+
+	/* a private copy of the name can never be pointer-equal to a category's */
+	ast_copy_string(name, category_name, sizeof(name));
+	return category_get(config, name, 1);
+}
+
+static int category_differs(const struct ast_category *a, const struct ast_category *b)
+{
+	struct ast_variable *va, *vb;
+
+	if ((a->ignored != b->ignored) || (a->varcount != b->varcount))
+		return 1;
+
+	for (va = a->root, vb = b->root; va && vb; va = va->next, vb = vb->next) {
+		if ((va->object != vb->object) || strcmp(va->name, vb->name) || strcmp(va->value, vb->value))
+			return 1;
+	}
+
+	return va || vb;
+}
+
+int ast_category_changed(const struct ast_config *oldcfg, const struct ast_config *newcfg, const char *category)
+{
+	struct ast_category *a, *b;
+
+	a = category_first(oldcfg, category);
+	b = category_first(newcfg, category);
+	if (!a || !b)
+		return a != b;
+
+	return category_differs(a, b);
+}
+
+int ast_config_diff(const struct ast_config *oldcfg, const struct ast_config *newcfg, ast_config_diff_cb *cb, void *data)
+{
+	struct ast_category *cat, *other;
+	int changes = 0;
+
+	for (cat = newcfg->root; cat; cat = cat->next) {
+		if (category_first(newcfg, cat->name) != cat)
+			continue;
+		if (!(other = category_first(oldcfg, cat->name))) {
+			cb(cat->name, AST_CONFIG_CATEGORY_ADDED, data);
+			changes++;
+		} else if (category_differs(other, cat)) {
+			cb(cat->name, AST_CONFIG_CATEGORY_CHANGED, data);
+			changes++;
+		}
+	}
+
+	for (cat = oldcfg->root; cat; cat = cat->next) {
+		if (category_first(oldcfg, cat->name) != cat)
+			continue;
+		if (!category_first(newcfg, cat->name)) {
+			cb(cat->name, AST_CONFIG_CATEGORY_REMOVED, data);
+			changes++;
+		}
+	}
+
+	return changes;
+}
+
 struct ast_variable *ast_load_realtime(const char *family, ...)
 {
 	struct ast_config_engine *eng;
@@ -1061,15 +1531,40 @@ static int config_command(int fd, int argc, char **argv)
 	return 0;
 }
 
+static int config_cache_command(int fd, int argc, char **argv)
+{
+	struct config_cache *entry;
+	int count = 0;
+
+	ast_mutex_lock(&config_cache_lock);
+	ast_cli(fd, "%-40s %6s %9s %8s\n", "File", "Files", "Load (ms)", "Hits");
+	for (entry = config_cache_list; entry; entry = entry->next, count++)
+		ast_cli(fd, "%-40s %6d %9d %8u\n", entry->filename, entry->files, entry->parsetime, entry->hits);
+	ast_cli(fd, "%d cached config%s\n", count, (count == 1) ? "" : "s");
+	ast_mutex_unlock(&config_cache_lock);
+
+	return RESULT_SUCCESS;
+}
+
 static char show_config_help[] =
 	"Usage: show config mappings\n"
 	"	Shows the filenames to config engines.\n";
 
+static char show_config_cache_help[] =
+	"Usage: show config cache\n"
+	"	Shows the parsed config files kept for reuse, how long\n"
+	"	each took to load and how often the cached copy was used.\n";
+
 static struct ast_cli_entry config_command_struct = {
 	{ "show", "config", "mappings", NULL }, config_command, "Show Config mappings (file names to config engines)", show_config_help, NULL
 };
 
+static struct ast_cli_entry config_cache_command_struct = {
+	{ "show", "config", "cache", NULL }, config_cache_command, "Show cached config files", show_config_cache_help, NULL
+};
+
 int register_config_cli() 
 {
+	ast_cli_register(&config_cache_command_struct);
 	return ast_cli_register(&config_command_struct);
 }
@@ -63,6 +63,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/ulaw.h"
 #include "asterisk/alaw.h"
 #include "asterisk/utils.h"
+#include "asterisk/simd.h"
 
 /*! Number of goertzels for progress detect */
 enum gsamp_size {
@@ -329,6 +330,101 @@ static inline void goertzel_reset(goertzel_state_t *s)
 	s->v2 = s->v3 = 0.0;
 }
 
+/*
+ * Goertzel banks: all the tones of a detector are updated together, one
+ * filter per vector lane.  Every lane does exactly the float operations
+ * of the unrolled scalar loops, in the same order, so the energies and
+ * hence the detection results are bit for bit the same.  That only holds
+ * when scalar float math is done in SSE registers too, not on the x87.
+ */
+#if defined(AST_X86_SIMD) && defined(__SSE_MATH__) && !defined(OLD_DSP_ROUTINES) && !defined(USE_3DNOW)
+#define GOERTZEL_BANK
+
+#define GOERTZEL_BANK_SIZE 8
+
+typedef void (*goertzel_bank_fn)(float *v2, float *v3, const float *fac, const int16_t *amp, int count);
+
+static AST_TARGET_SSE2 void goertzel_bank_sse2(float *v2, float *v3, const float *fac, const int16_t *amp, int count)
+{
+	__m128 a2 = _mm_load_ps(v2), b2 = _mm_load_ps(v2 + 4);
+	__m128 a3 = _mm_load_ps(v3), b3 = _mm_load_ps(v3 + 4);
+	__m128 af = _mm_load_ps(fac), bf = _mm_load_ps(fac + 4);
+	__m128 famp, a1, b1;
+	int j;
+
+	for (j = 0; j < count; j++) {
+		famp = _mm_set1_ps((float) amp[j]);
+		a1 = a2;
+		b1 = b2;
+		a2 = a3;
+		b2 = b3;
+		a3 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(af, a2), a1), famp);
+		b3 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(bf, b2), b1), famp);
+	}
+	_mm_store_ps(v2, a2);
+	_mm_store_ps(v2 + 4, b2);
+	_mm_store_ps(v3, a3);
+	_mm_store_ps(v3 + 4, b3);
+}
+
+static AST_TARGET_AVX2 void goertzel_bank_avx2(float *v2, float *v3, const float *fac, const int16_t *amp, int count)
+{
+	__m256 r2 = _mm256_load_ps(v2);
+	__m256 r3 = _mm256_load_ps(v3);
+	__m256 rf = _mm256_load_ps(fac);
+	__m256 famp, r1;
+	int j;
+
+	for (j = 0; j < count; j++) {
+		famp = _mm256_set1_ps((float) amp[j]);
+		r1 = r2;
+		r2 = r3;
+		/* separate mul and sub, a fused multiply-add would round differently */
+		r3 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(rf, r2), r1), famp);
+	}
+	_mm256_store_ps(v2, r2);
+	_mm256_store_ps(v3, r3);
+}
+
+static goertzel_bank_fn goertzel_bank;
+
+/*! \brief Update two groups of goertzel filters (at most 8 in total)
+ * over count samples. */
+static void goertzel_bank_update(goertzel_state_t *a, int na, goertzel_state_t *b, int nb, int16_t *amp, int count)
+{
+	float v2[GOERTZEL_BANK_SIZE] __attribute__((aligned(32)));
+	float v3[GOERTZEL_BANK_SIZE] __attribute__((aligned(32)));
+	float fac[GOERTZEL_BANK_SIZE] __attribute__((aligned(32)));
+	int i;
+
+	if (!goertzel_bank)
+		goertzel_bank = ast_cpu_has_avx2() ? goertzel_bank_avx2 : goertzel_bank_sse2;
+
+	memset(v2, 0, sizeof(v2));
+	memset(v3, 0, sizeof(v3));
+	memset(fac, 0, sizeof(fac));
+	for (i = 0; i < na; i++) {
+		v2[i] = a[i].v2;
+		v3[i] = a[i].v3;
+		fac[i] = a[i].fac;
+	}
+	for (i = 0; i < nb; i++) {
+		v2[na + i] = b[i].v2;
+		v3[na + i] = b[i].v3;
+		fac[na + i] = b[i].fac;
+	}
+	goertzel_bank(v2, v3, fac, amp, count);
+	for (i = 0; i < na; i++) {
+		a[i].v2 = v2[i];
+		a[i].v3 = v3[i];
+	}
+	for (i = 0; i < nb; i++) {
+		b[i].v2 = v2[na + i];
+		b[i].v3 = v3[na + i];
+	}
+}
+#endif /* GOERTZEL_BANK */
+
 struct ast_dsp {
 	struct ast_frame f;
 	int threshold;
@@ -459,6 +555,18 @@ static int dtmf_detect (dtmf_detect_state_t *s, int16_t amp[], int samples,
 #endif		
 		/* XXX Need to fax detect for 3dnow too XXX */
 		#warning "Fax Support Broken"
+#elif defined(GOERTZEL_BANK)
+		goertzel_bank_update(s->row_out, 4, s->col_out, 4, amp + sample, limit - sample);
+		for (j=sample;j<limit;j++) {
+			famp = amp[j];
+			s->energy += famp*famp;
+#ifdef FAX_DETECT
+			/* Update fax tone */
+			v1 = s->fax_tone.v2;
+			s->fax_tone.v2 = s->fax_tone.v3;
+			s->fax_tone.v3 = s->fax_tone.fac*s->fax_tone.v2 - v1 + famp;
+#endif /* FAX_DETECT */
+		}
 #else
 		/* The following unrolled loop takes only 35% (rough estimate) of the 
 		   time of a rolled loop on the machine on which it was developed */
@@ -707,10 +815,12 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 	int best;
 	int second_best;
 #endif
+#ifndef GOERTZEL_BANK
 	float famp;
 	float v1;
-	int i;
 	int j;
+#endif
+	int i;
 	int sample;
 	int hit;
 	int limit;
@@ -731,6 +841,8 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 #endif
 		/* XXX Need to fax detect for 3dnow too XXX */
 		#warning "Fax Support Broken"
+#elif defined(GOERTZEL_BANK)
+		goertzel_bank_update(s->tone_out, 6, NULL, 0, amp + sample, limit - sample);
 #else
 		/* The following unrolled loop takes only 35% (rough estimate) of the 
 		   time of a rolled loop on the machine on which it was developed */
@@ -1063,11 +1175,17 @@ static int __ast_dsp_call_progress(struct ast_dsp *dsp, short *s, int len)
 		pass = len;
 		if (pass > dsp->gsamp_size - dsp->gsamps) 
 			pass = dsp->gsamp_size - dsp->gsamps;
+#ifdef GOERTZEL_BANK
+		goertzel_bank_update(dsp->freqs, dsp->freqcount, NULL, 0, s, pass);
+		for (x=0;x<pass;x++)
+			dsp->genergy += s[x] * s[x];
+#else
 		for (x=0;x<pass;x++) {
 			for (y=0;y<dsp->freqcount;y++) 
 				goertzel_sample(&dsp->freqs[y], s[x]);
 			dsp->genergy += s[x] * s[x];
 		}
+#endif
 		s += pass;
 		dsp->gsamps += pass;
 		len -= pass;
@@ -1201,18 +1319,23 @@ int ast_dsp_call_progress(struct ast_dsp *dsp, struct ast_frame *inf)
 	return __ast_dsp_call_progress(dsp, inf->data, inf->datalen / 2);
 }
 
-static int __ast_dsp_silence(struct ast_dsp *dsp, short *s, int len, int *totalsilence)
+/*! \brief mean sample magnitude, the energy measure used for silence detection */
+static inline int dsp_energy(short *s, int len)
 {
-	int accum;
+	int accum = 0;
 	int x;
-	int res = 0;
 
-	if (!len)
-		return 0;
-	accum = 0;
 	for (x=0;x<len; x++) 
 		accum += abs(s[x]);
-	accum /= len;
+	return accum / len;
+}
+
+/*! \brief update silence/noise run lengths and busy history for a frame
+ * of len samples with mean magnitude accum */
+static int dsp_silence_update(struct ast_dsp *dsp, int accum, int len, int *totalsilence)
+{
+	int res = 0;
+
 	if (accum < dsp->threshold) {
 		/* Silent */
 		dsp->totalsilence += len/8;
@@ -1256,6 +1379,13 @@ static int __ast_dsp_silence(struct ast_dsp *dsp, short *s, int len, int *totals
 	return res;
 }
 
+static int __ast_dsp_silence(struct ast_dsp *dsp, short *s, int len, int *totalsilence)
+{
+	if (!len)
+		return 0;
+	return dsp_silence_update(dsp, dsp_energy(s, len), len, totalsilence);
+}
+
 #ifdef BUSYDETECT_MARTIN
 int ast_dsp_busydetect(struct ast_dsp *dsp)
 {
@@ -1407,6 +1537,109 @@ int ast_dsp_silence(struct ast_dsp *dsp, struct ast_frame *f, int *totalsilence)
 	return __ast_dsp_silence(dsp, s, len, totalsilence);
 }
 
+int ast_dsp_silence_chan(struct ast_dsp *dsp, struct ast_channel *chan, struct ast_frame *f, int *totalsilence)
+{
+	struct ast_dsp_analysis *a = chan->analysis;
+
+	/* reuse the energy computed by ast_read(), if this is that frame */
+	if (a && a->users && a->frame == f && a->data == f->data && a->len == f->datalen / 2
+	    && f->frametype == AST_FRAME_VOICE && f->subclass == AST_FORMAT_SLINEAR) {
+		if (!a->len)
+			return 0;
+		return dsp_silence_update(dsp, a->energy, a->len, totalsilence);
+	}
+	return ast_dsp_silence(dsp, f, totalsilence);
+}
+
+int ast_dsp_analysis_attach(struct ast_channel *chan)
+{
+	int res = 0;
+
+	ast_channel_lock(chan);
+	if (!chan->analysis && !(chan->analysis = ast_calloc(1, sizeof(*chan->analysis))))
+		res = -1;
+	else if (!chan->analysis->users++) {
+		/* start afresh, the channel may have been talking meanwhile */
+		chan->analysis->frame = NULL;
+		chan->analysis->data = NULL;
+		chan->analysis->totalsilence = 0;
+		chan->analysis->totalnoise = 0;
+		chan->analysis->talking = 0;
+	}
+	ast_channel_unlock(chan);
+	return res;
+}
+
+void ast_dsp_analysis_detach(struct ast_channel *chan)
+{
+	ast_channel_lock(chan);
+	/* the state is kept until the channel goes away, ast_read() and
+	 * ast_dsp_silence_chan() do not take the lock to look at it */
+	if (chan->analysis && chan->analysis->users > 0)
+		chan->analysis->users--;
+	ast_channel_unlock(chan);
+}
+
+int ast_dsp_analysis_get(struct ast_channel *chan, struct ast_dsp_analysis *res)
+{
+	int ret = -1;
+
+	ast_channel_lock(chan);
+	if (chan->analysis && chan->analysis->users) {
+		*res = *chan->analysis;
+		ret = 0;
+	}
+	ast_channel_unlock(chan);
+	return ret;
+}
+
+void ast_dsp_analyze_frame(struct ast_dsp_analysis *a, struct ast_frame *f)
+{
+	int len, x, accum = 0;
+
+	a->frame = f;
+	a->data = f->data;
+	switch (f->subclass) {
+	case AST_FORMAT_SLINEAR:
+		len = f->datalen / 2;
+		accum = len ? dsp_energy(f->data, len) : 0;
+		break;
+	case AST_FORMAT_ULAW:
+		len = f->datalen;
+		for (x = 0; x < len; x++)
+			accum += abs(AST_MULAW(((unsigned char *) f->data)[x]));
+		if (len)
+			accum /= len;
+		break;
+	case AST_FORMAT_ALAW:
+		len = f->datalen;
+		for (x = 0; x < len; x++)
+			accum += abs(AST_ALAW(((unsigned char *) f->data)[x]));
+		if (len)
+			accum /= len;
+		break;
+	default:
+		/* compressed audio, nothing to measure */
+		a->frame = NULL;
+		a->data = NULL;
+		return;
+	}
+	a->len = len;
+	a->energy = accum;
+	a->frames++;
+	if (!len)
+		return;
+	if (accum < DEFAULT_THRESHOLD) {
+		a->totalsilence += len / 8;
+		a->totalnoise = 0;
+		a->talking = 0;
+	} else {
+		a->totalnoise += len / 8;
+		a->totalsilence = 0;
+		a->talking = 1;
+	}
+}
+
 struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp, struct ast_frame *af)
 {
 	int silence;
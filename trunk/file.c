@@ -55,6 +55,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/app.h"
 #include "asterisk/pbx.h"
 #include "asterisk/linkedlists.h"
+#include "asterisk/config.h"
 #define	MOD_LOADER
 #include "asterisk/module.h"
 
@@ -70,6 +71,252 @@ int ast_language_is_prefix;
 
 static AST_LIST_HEAD_STATIC(formats, ast_format);
 
+/*! \brief A prompt held in memory.
+ * Streams opened on a cached file read it through fmemopen(), so the
+ * format modules work unchanged and playback does no file I/O.  Only
+ * files under the sounds directory are cached; they are shared by all
+ * the streams playing them.
+ */
+struct ast_prompt {
+	char *path;			/*!< full file name */
+	char *data;			/*!< file contents */
+	size_t size;			/*!< file size */
+	time_t mtime;			/*!< modification time when loaded */
+	int refs;			/*!< streams reading from data */
+	int stale;			/*!< removed from the cache, free on last release */
+	unsigned int hits;		/*!< streams served from memory */
+	AST_LIST_ENTRY(ast_prompt) list;	/*!< in LRU order, most recent first */
+};
+
+/*! \brief the prompt cache, also protects the counters below */
+static AST_LIST_HEAD_STATIC(prompts, ast_prompt);
+
+#define PROMPT_CACHE_SIZE	(16 * 1024 * 1024)	/*!< default cache size, in bytes */
+#define PROMPT_MAX_FILE		(1024 * 1024)		/*!< default largest cached file */
+
+static int prompt_cache_enabled = 1;
+static size_t prompt_cache_max = PROMPT_CACHE_SIZE;
+static size_t prompt_max_file = PROMPT_MAX_FILE;
+static size_t prompt_cache_used;
+static int prompt_count;
+static unsigned int prompt_hits;
+static unsigned int prompt_misses;
+static unsigned int prompt_evictions;
+
+static char *build_filename(const char *filename, const char *ext);
+
+/*! \brief free a prompt, must be unlinked and unused */
+static void prompt_free(struct ast_prompt *p)
+{
+	free(p->data);
+	free(p->path);
+	free(p);
+}
+
+/*! \brief take a prompt out of the cache.
+ * \note Call with the prompts list locked */
+static void prompt_unlink(struct ast_prompt *p)
+{
+	AST_LIST_REMOVE(&prompts, p, list);
+	prompt_cache_used -= p->size;
+	prompt_count--;
+	if (p->refs)
+		p->stale = 1;
+	else
+		prompt_free(p);
+}
+
+/*! \brief evict least recently used prompts until size more bytes fit.
+ * Prompts being played are skipped.
+ * \note Call with the prompts list locked */
+static void prompt_make_room(size_t size)
+{
+	struct ast_prompt *p, *victim;
+
+	while (prompt_cache_used + size > prompt_cache_max) {
+		victim = NULL;
+		AST_LIST_TRAVERSE(&prompts, p, list) {
+			if (!p->refs)
+				victim = p;
+		}
+		if (!victim)
+			break;
+		prompt_unlink(victim);
+		prompt_evictions++;
+	}
+}
+
+/*!
+ * \brief get the cached contents of a file, loading it if needed.
+ * \param fn full file name
+ * \param st result of stat() on fn, used to check the cached copy
+ * \return a referenced prompt, or NULL if the file is not cached
+ */
+static struct ast_prompt *prompt_get(const char *fn, struct stat *st)
+{
+	struct ast_prompt *p;
+	char *data;
+	int fd;
+	ssize_t len;
+
+	if (!prompt_cache_enabled || st->st_size <= 0 || st->st_size > prompt_max_file)
+		return NULL;
+
+	AST_LIST_LOCK(&prompts);
+	AST_LIST_TRAVERSE(&prompts, p, list) {
+		if (!strcmp(p->path, fn))
+			break;
+	}
+	if (p && (p->mtime != st->st_mtime || p->size != st->st_size)) {
+		/* changed on disk */
+		prompt_unlink(p);
+		p = NULL;
+	}
+	if (p) {
+		/* move to the front of the LRU list */
+		AST_LIST_REMOVE(&prompts, p, list);
+		AST_LIST_INSERT_HEAD(&prompts, p, list);
+		p->refs++;
+		p->hits++;
+		prompt_hits++;
+		AST_LIST_UNLOCK(&prompts);
+		return p;
+	}
+	prompt_misses++;
+	AST_LIST_UNLOCK(&prompts);
+
+	/* read the file without holding the lock */
+	if ((fd = open(fn, O_RDONLY)) < 0)
+		return NULL;
+	if (!(data = ast_malloc(st->st_size))) {
+		close(fd);
+		return NULL;
+	}
+	len = read(fd, data, st->st_size);
+	close(fd);
+	if (len != st->st_size || !(p = ast_calloc(1, sizeof(*p))) || !(p->path = ast_strdup(fn))) {
+		if (p)
+			free(p);
+		free(data);
+		return NULL;
+	}
+	p->data = data;
+	p->size = st->st_size;
+	p->mtime = st->st_mtime;
+	p->refs = 1;
+
+	AST_LIST_LOCK(&prompts);
+	prompt_make_room(p->size);
+	if (prompt_cache_used + p->size > prompt_cache_max) {
+		/* everything left is in use, serve this stream only */
+		p->stale = 1;
+	} else {
+		struct ast_prompt *cur;
+
+		/* another stream may have loaded it meanwhile */
+		AST_LIST_TRAVERSE(&prompts, cur, list) {
+			if (!strcmp(cur->path, fn)) {
+				prompt_unlink(cur);
+				break;
+			}
+		}
+		AST_LIST_INSERT_HEAD(&prompts, p, list);
+		prompt_cache_used += p->size;
+		prompt_count++;
+	}
+	AST_LIST_UNLOCK(&prompts);
+	return p;
+}
+
+/*! \brief drop a reference taken with prompt_get() */
+static void prompt_release(struct ast_prompt *p)
+{
+	AST_LIST_LOCK(&prompts);
+	if (!--p->refs && p->stale)
+		prompt_free(p);
+	AST_LIST_UNLOCK(&prompts);
+}
+
+/*! \brief a prompt to load as soon as a format for it is registered */
+struct prompt_preload {
+	AST_LIST_ENTRY(prompt_preload) list;
+	char name[0];
+};
+
+static AST_LIST_HEAD_STATIC(preloads, prompt_preload);
+
+/*! \brief load the preload list into the cache for the extensions of one format */
+static void prompt_preload_exts(const char *exts)
+{
+	struct prompt_preload *pl;
+	struct ast_prompt *p;
+	struct stat st;
+	char *stringp, *ext, *fn;
+
+	AST_LIST_LOCK(&preloads);
+	AST_LIST_TRAVERSE(&preloads, pl, list) {
+		stringp = ast_strdupa(exts);
+		while ((ext = strsep(&stringp, "|"))) {
+			if (!(fn = build_filename(pl->name, ext)))
+				continue;
+			if (!stat(fn, &st) && (p = prompt_get(fn, &st)))
+				prompt_release(p);
+			free(fn);
+		}
+	}
+	AST_LIST_UNLOCK(&preloads);
+}
+
+int ast_prompt_cache_reload(void)
+{
+	struct ast_config *cfg;
+	struct ast_variable *v;
+	struct prompt_preload *pl;
+	struct ast_format *f;
+	const char *val;
+	int enabled = 1;
+	size_t max = PROMPT_CACHE_SIZE, maxfile = PROMPT_MAX_FILE;
+
+	AST_LIST_LOCK(&preloads);
+	while ((pl = AST_LIST_REMOVE_HEAD(&preloads, list)))
+		free(pl);
+	if ((cfg = ast_config_load("prompts.conf"))) {
+		if ((val = ast_variable_retrieve(cfg, "general", "enabled")))
+			enabled = ast_true(val);
+		if ((val = ast_variable_retrieve(cfg, "general", "cachesize")) && atoi(val) >= 0)
+			max = (size_t) atoi(val) * 1024;
+		if ((val = ast_variable_retrieve(cfg, "general", "maxfilesize")) && atoi(val) >= 0)
+			maxfile = (size_t) atoi(val) * 1024;
+		for (v = ast_variable_browse(cfg, "preload"); v; v = v->next) {
+			if (!strcasecmp(v->name, "file") && !ast_strlen_zero(v->value) &&
+			    (pl = ast_calloc(1, sizeof(*pl) + strlen(v->value) + 1))) {
+				strcpy(pl->name, v->value);
+				AST_LIST_INSERT_TAIL(&preloads, pl, list);
+			}
+		}
+		ast_config_destroy(cfg);
+	}
+	AST_LIST_UNLOCK(&preloads);
+
+	AST_LIST_LOCK(&prompts);
+	prompt_cache_enabled = enabled;
+	prompt_cache_max = enabled ? max : 0;
+	prompt_max_file = maxfile;
+	/* drop whatever no longer fits, or everything if disabled */
+	prompt_make_room(0);
+	AST_LIST_UNLOCK(&prompts);
+
+	if (enabled) {
+		AST_LIST_LOCK(&formats);
+		AST_LIST_TRAVERSE(&formats, f, list) {
+			if (f->format < AST_FORMAT_MAX_AUDIO)
+				prompt_preload_exts(f->exts);
+		}
+		AST_LIST_UNLOCK(&formats);
+	}
+	return 0;
+}
+
 int ast_format_register(const struct ast_format *f)
 {
 	struct ast_format *tmp;
@@ -111,6 +358,8 @@ int ast_format_register(const struct ast_format *f)
 	AST_LIST_UNLOCK(&formats);
 	if (option_verbose > 1)
 		ast_verbose( VERBOSE_PREFIX_2 "Registered file format %s, extension(s) %s\n", f->name, f->exts);
+	if (f->format < AST_FORMAT_MAX_AUDIO)
+		prompt_preload_exts(f->exts);
 	return 0;
 }
 
@@ -154,7 +403,187 @@ int ast_stopstream(struct ast_channel *tmp)
 	return 0;
 }
 
+/*! \brief Asynchronous writer state of a recording.
+ * Frames handed to ast_writestream() are queued here and written by
+ * one of the recording writer threads, so a slow disk never blocks the
+ * thread producing the audio.
+ */
+struct fs_writer {
+	struct ast_filestream *fs;
+	struct ast_frame *head;		/*!< queued frames, linked through next */
+	struct ast_frame *tail;
+	int queued;			/*!< frames in the queue */
+	int busy;			/*!< a writer thread is writing a batch */
+	struct timeval oldest;		/*!< when the first queued frame arrived */
+	struct timeval writing;		/*!< same, for the batch being written */
+	unsigned int written;		/*!< frames written */
+	unsigned int overruns;		/*!< frames dropped on a full queue */
+	int maxqueued;			/*!< highest queue length seen */
+	AST_LIST_ENTRY(fs_writer) list;
+};
+
+#define RECORDING_WRITERS	2	/*!< writer threads */
+#define RECORDING_QUEUE		500	/*!< frames queued per recording, 10 seconds of 20ms frames */
+#define RECORDING_BUFSIZE	(64 * 1024)	/*!< stdio buffer of recordings */
+
+/*! \brief async recordings, the lock also protects their queues */
+static AST_LIST_HEAD_STATIC(recordings, fs_writer);
+static ast_cond_t recording_work;	/*!< signalled when frames are queued */
+static ast_cond_t recording_done;	/*!< signalled when a batch is written */
+static int recording_threads;
+
+static int writestream_sync(struct ast_filestream *fs, struct ast_frame *f);
+
+/*! \brief recording writer thread: take a whole queue at a time and write it */
+static void *recording_writer(void *data)
+{
+	struct fs_writer *w;
+	struct ast_frame *f, *next;
+	int n;
+
+	for (;;) {
+		AST_LIST_LOCK(&recordings);
+		for (;;) {
+			AST_LIST_TRAVERSE(&recordings, w, list) {
+				if (w->head && !w->busy)
+					break;
+			}
+			if (w)
+				break;
+			ast_cond_wait(&recording_work, &recordings.lock);
+		}
+		w->busy = 1;
+		f = w->head;
+		n = w->queued;
+		w->writing = w->oldest;
+		w->head = w->tail = NULL;
+		w->queued = 0;
+		AST_LIST_UNLOCK(&recordings);
+
+		for (; f; f = next) {
+			next = f->next;
+			f->next = NULL;
+			writestream_sync(w->fs, f);
+			ast_frfree(f);
+		}
+
+		AST_LIST_LOCK(&recordings);
+		w->busy = 0;
+		w->written += n;
+		ast_cond_broadcast(&recording_done);
+		AST_LIST_UNLOCK(&recordings);
+	}
+	return NULL;
+}
+
+/*! \brief wait until all frames queued on a recording are written */
+static void writer_drain(struct ast_filestream *fs)
+{
+	struct fs_writer *w = fs->writer;
+
+	if (!w)
+		return;
+	AST_LIST_LOCK(&recordings);
+	while (w->head || w->busy)
+		ast_cond_wait(&recording_done, &recordings.lock);
+	AST_LIST_UNLOCK(&recordings);
+}
+
+int ast_filestream_set_async(struct ast_filestream *fs)
+{
+	struct fs_writer *w;
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	if (fs->writer)
+		return 0;
+	if (!(w = ast_calloc(1, sizeof(*w))))
+		return -1;
+	w->fs = fs;
+
+	AST_LIST_LOCK(&recordings);
+	if (!recording_threads) {
+		ast_cond_init(&recording_work, NULL);
+		ast_cond_init(&recording_done, NULL);
+	}
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while (recording_threads < RECORDING_WRITERS) {
+		if (ast_pthread_create(&thread, &attr, recording_writer, NULL)) {
+			ast_log(LOG_WARNING, "Unable to start recording writer thread\n");
+			break;
+		}
+		recording_threads++;
+	}
+	pthread_attr_destroy(&attr);
+	if (!recording_threads) {
+		AST_LIST_UNLOCK(&recordings);
+		free(w);
+		return -1;
+	}
+	AST_LIST_INSERT_TAIL(&recordings, w, list);
+	fs->writer = w;
+	AST_LIST_UNLOCK(&recordings);
+	return 0;
+}
+
+/*! \brief queue a frame on an async recording */
+static int writer_queue(struct ast_filestream *fs, struct ast_frame *f)
+{
+	struct fs_writer *w = fs->writer;
+	struct ast_frame *dup;
+
+	if (!(dup = ast_frdup(f)))
+		return -1;
+	dup->next = NULL;
+	AST_LIST_LOCK(&recordings);
+	if (w->queued >= RECORDING_QUEUE) {
+		/* the disk is not keeping up; losing audio beats stalling the call */
+		w->overruns++;
+		AST_LIST_UNLOCK(&recordings);
+		ast_frfree(dup);
+		return 0;
+	}
+	if (w->tail)
+		w->tail->next = dup;
+	else {
+		w->head = dup;
+		w->oldest = ast_tvnow();
+	}
+	w->tail = dup;
+	if (++w->queued > w->maxqueued)
+		w->maxqueued = w->queued;
+	ast_cond_signal(&recording_work);
+	AST_LIST_UNLOCK(&recordings);
+	return 0;
+}
+
+/*! \brief stop writing a recording asynchronously, writing what is queued */
+static void writer_stop(struct ast_filestream *fs)
+{
+	struct fs_writer *w = fs->writer;
+
+	if (!w)
+		return;
+	writer_drain(fs);
+	AST_LIST_LOCK(&recordings);
+	AST_LIST_REMOVE(&recordings, w, list);
+	AST_LIST_UNLOCK(&recordings);
+	fs->writer = NULL;
+	if (w->overruns)
+		ast_log(LOG_WARNING, "Recording %s dropped %u frames, the disk did not keep up\n",
+			fs->filename ? fs->filename : "<unknown>", w->overruns);
+	free(w);
+}
+
 int ast_writestream(struct ast_filestream *fs, struct ast_frame *f)
+{
+	if (fs->writer && (f->frametype == AST_FRAME_VOICE || f->frametype == AST_FRAME_VIDEO))
+		return writer_queue(fs, f);
+	return writestream_sync(fs, f);
+}
+
+static int writestream_sync(struct ast_filestream *fs, struct ast_frame *f)
 {
 	int res = -1;
 	int alt = 0;
@@ -394,28 +823,41 @@ static int ast_filehelper(const char *filename, const void *arg2, const char *fm
 				struct ast_channel *chan = (struct ast_channel *)arg2;
 				FILE *bfile;
 				struct ast_filestream *s;
+				struct ast_prompt *prompt = NULL;
 
 				if ( !(chan->writeformat & f->format) &&
 				     !(f->format >= AST_FORMAT_MAX_AUDIO && fmt)) {
 					free(fn);
 					continue;	/* not a supported format */
 				}
-				if ( (bfile = fopen(fn, "r")) == NULL) {
+				/* prompts from the sounds directory are read from memory */
+				if (filename[0] != '/' && f->format < AST_FORMAT_MAX_AUDIO &&
+				    (prompt = prompt_get(fn, &st)) &&
+				    !(bfile = fmemopen(prompt->data, prompt->size, "r"))) {
+					prompt_release(prompt);
+					prompt = NULL;
+				}
+				if (!prompt && (bfile = fopen(fn, "r")) == NULL) {
 					free(fn);
 					continue;	/* cannot open file */
 				}
 				s = get_filestream(f, bfile);
 				if (!s) {
 					fclose(bfile);
+					if (prompt)
+						prompt_release(prompt);
 					free(fn);	/* cannot allocate descriptor */
 					continue;
 				}
 				if (open_wrapper(s)) {
 					fclose(bfile);
+					if (prompt)
+						prompt_release(prompt);
 					free(fn);
 					free(s);
 					continue;	/* cannot run open on file */
 				}
+				s->prompt = prompt;
 				/* ok this is good for OPEN */
 				res = 1;	/* found */
 				s->lasttimeout = -1;
@@ -623,18 +1065,12 @@ static int ast_readaudio_callback(void *data)
 			if (fr)
 				ast_log(LOG_WARNING, "Failed to write frame\n");
 			s->owner->streamid = -1;
-#ifdef HAVE_ZAPTEL
 			ast_settimeout(s->owner, 0, NULL, NULL);
-#endif			
 			return 0;
 		}
 	}
 	if (whennext != s->lasttimeout) {
-#ifdef HAVE_ZAPTEL
-		if (s->owner->timingfd > -1)
-			ast_settimeout(s->owner, whennext, ast_readaudio_callback, s);
-		else
-#endif		
+		if (ast_settimeout(s->owner, whennext, ast_readaudio_callback, s))
 			s->owner->streamid = ast_sched_add(s->owner->sched, whennext/8, ast_readaudio_callback, s);
 		s->lasttimeout = whennext;
 		return 0;
@@ -681,16 +1117,19 @@ int ast_playstream(struct ast_filestream *s)
 
 int ast_seekstream(struct ast_filestream *fs, off_t sample_offset, int whence)
 {
+	writer_drain(fs);
 	return fs->fmt->seek(fs, sample_offset, whence);
 }
 
 int ast_truncstream(struct ast_filestream *fs)
 {
+	writer_drain(fs);
 	return fs->fmt->trunc(fs);
 }
 
 off_t ast_tellstream(struct ast_filestream *fs)
 {
+	writer_drain(fs);
 	return fs->fmt->tell(fs);
 }
 
@@ -708,6 +1147,10 @@ int ast_closestream(struct ast_filestream *f)
 {
 	char *cmd = NULL;
 	size_t size = 0;
+	int async = f->writer ? 1 : 0;
+
+	/* finish pending writes before the format updates headers */
+	writer_stop(f);
 	/* Stop a running stream if there is one */
 	if (f->owner) {
 		if (f->fmt->format < AST_FORMAT_MAX_AUDIO) {
@@ -715,9 +1158,7 @@ int ast_closestream(struct ast_filestream *f)
 			if (f->owner->streamid > -1)
 				ast_sched_del(f->owner->sched, f->owner->streamid);
 			f->owner->streamid = -1;
-#ifdef HAVE_ZAPTEL
 			ast_settimeout(f->owner, 0, NULL, NULL);
-#endif			
 		} else {
 			f->owner->vstream = NULL;
 			if (f->owner->vstreamid > -1)
@@ -743,7 +1184,18 @@ int ast_closestream(struct ast_filestream *f)
 		free(f->realfilename);
 	if (f->fmt->close)
 		f->fmt->close(f);
+#if defined(POSIX_FADV_DONTNEED)
+	/* a finished recording will not be read soon, keep it out of the page cache */
+	if (async) {
+		fflush(f->f);
+		posix_fadvise(fileno(f->f), 0, 0, POSIX_FADV_DONTNEED);
+	}
+#endif
 	fclose(f->f);
+	if (f->wbuf)
+		free(f->wbuf);
+	if (f->prompt)
+		prompt_release(f->prompt);
 	if (f->vfs)
 		ast_closestream(f->vfs);
 	ast_atomic_fetchadd_int(&f->fmt->module->usecnt, -1);
@@ -946,6 +1398,10 @@ struct ast_filestream *ast_writefile(const char *filename, const char *type, con
 		if (fd > -1) {
 			errno = 0;
 			fs = get_filestream(f, bfile);
+			/* let stdio gather frames into large writes; setvbuf() has
+			   to come before the header is written */
+			if (fs && (fs->wbuf = ast_malloc(RECORDING_BUFSIZE)))
+				setvbuf(bfile, fs->wbuf, _IOFBF, RECORDING_BUFSIZE);
 			if (!fs || rewrite_wrapper(fs, comment)) {
 				ast_log(LOG_WARNING, "Unable to rewrite %s\n", fn);
 				close(fd);
@@ -953,8 +1409,11 @@ struct ast_filestream *ast_writefile(const char *filename, const char *type, con
 					unlink(fn);
 					unlink(orig_fn);
 				}
-				if (fs)
+				if (fs) {
+					if (fs->wbuf)
+						free(fs->wbuf);
 					free(fs);
+				}
 			}
 			fs->trans = NULL;
 			fs->fmt = f;
@@ -1164,8 +1623,92 @@ struct ast_cli_entry show_file =
 	"       displays currently registered file formats (if any)\n"
 };
 
+static int show_prompt_cache(int fd, int argc, char *argv[])
+{
+#define FORMAT "%-50.50s %9s %8s %5s\n"
+#define FORMAT2 "%-50.50s %9lu %8u %5d\n"
+	struct ast_prompt *p;
+	unsigned int lookups;
+
+	if (argc != 3)
+		return RESULT_SHOWUSAGE;
+	AST_LIST_LOCK(&prompts);
+	ast_cli(fd, FORMAT, "File", "Size", "Hits", "Users");
+	AST_LIST_TRAVERSE(&prompts, p, list)
+		ast_cli(fd, FORMAT2, p->path, (unsigned long) p->size, p->hits, p->refs);
+	lookups = prompt_hits + prompt_misses;
+	ast_cli(fd, "Prompt cache %s, %d prompts, %lu of %lu kbytes used, files up to %lu kbytes\n",
+		prompt_cache_enabled ? "enabled" : "disabled", prompt_count,
+		(unsigned long) prompt_cache_used / 1024, (unsigned long) prompt_cache_max / 1024,
+		(unsigned long) prompt_max_file / 1024);
+	ast_cli(fd, "%u hits, %u misses (%u%% hit rate), %u evictions\n",
+		prompt_hits, prompt_misses, lookups ? (unsigned int) ((prompt_hits * 100ULL) / lookups) : 0,
+		prompt_evictions);
+	AST_LIST_UNLOCK(&prompts);
+	return RESULT_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+static int show_recordings(int fd, int argc, char *argv[])
+{
+#define FORMAT "%-40.40s %6s %6s %8s %10s %8s\n"
+#define FORMAT2 "%-40.40s %6d %6d %8ld %10u %8u\n"
+	struct fs_writer *w;
+	struct timeval now = ast_tvnow();
+	int count = 0;
+
+	if (argc != 2)
+		return RESULT_SHOWUSAGE;
+	ast_cli(fd, FORMAT, "File", "Queued", "Peak", "Lag(ms)", "Written", "Dropped");
+	AST_LIST_LOCK(&recordings);
+	AST_LIST_TRAVERSE(&recordings, w, list) {
+		long lag = 0;
+
+		if (w->busy)
+			lag = ast_tvdiff_ms(now, w->writing);
+		else if (w->head)
+			lag = ast_tvdiff_ms(now, w->oldest);
+		ast_cli(fd, FORMAT2, w->fs->filename ? w->fs->filename : "<unknown>",
+			w->queued, w->maxqueued, lag, w->written, w->overruns);
+		count++;
+	}
+	AST_LIST_UNLOCK(&recordings);
+	ast_cli(fd, "%d active recording%s, %d writer thread%s\n", count, count == 1 ? "" : "s",
+		recording_threads, recording_threads == 1 ? "" : "s");
+	return RESULT_SUCCESS;
+#undef FORMAT
+#undef FORMAT2
+}
+
+static struct ast_cli_entry show_recs =
+{
+	{ "show", "recordings", NULL },
+	show_recordings,
+	"Displays active recordings",
+	"Usage: show recordings\n"
+	"       Lists the recordings written by the background writer threads,\n"
+	"with the frames waiting to be written (now and at most), how long the\n"
+	"oldest of them has been waiting, and the frames written and dropped\n"
+	"because the disk did not keep up.\n"
+};
+
+static struct ast_cli_entry show_prompts =
+{
+	{ "show", "prompt", "cache" },
+	show_prompt_cache,
+	"Displays the prompt cache",
+	"Usage: show prompt cache\n"
+	"       Lists the sound files held in memory, most recently used\n"
+	"first, with how often each was played from memory and how many\n"
+	"streams are playing it now, followed by the cache statistics.\n"
+};
+
 int ast_file_init(void)
 {
 	ast_cli_register(&show_file);
+	ast_cli_register(&show_prompts);
+	ast_cli_register(&show_recs);
+	ast_prompt_cache_reload();
 	return 0;
 }
@@ -64,6 +64,8 @@ void ast_builtins_init(void);			/*!< Provided by cli.c */
 int dnsmgr_init(void);				/*!< Provided by dnsmgr.c */ 
 void dnsmgr_start_refresh(void);		/*!< Provided by dnsmgr.c */
 int dnsmgr_reload(void);			/*!< Provided by dnsmgr.c */
+int ast_timing_init(void);			/*!< Provided by timing.c */
+int ast_prompt_cache_reload(void);		/*!< Provided by file.c */
 
 /*!
  * \brief Reload asterisk modules.
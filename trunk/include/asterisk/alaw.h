@@ -40,4 +40,13 @@ extern short __ast_alaw[256];
 #define AST_LIN2A(a) (__ast_lin2a[((unsigned short)(a)) >> 3])
 #define AST_ALAW(a) (__ast_alaw[(int)(a)])
 
+/*! \brief Convert a block of A-law samples to signed linear.
+ * Gives the same result as AST_ALAW() on each sample, using the
+ * widest vector unit the CPU has. */
+void ast_alaw_decode(short *dst, const unsigned char *src, int samples);
+
+/*! \brief Convert a block of signed linear samples to A-law.
+ * Gives the same result as AST_LIN2A() on each sample. */
+void ast_alaw_encode(unsigned char *dst, const short *src, int samples);
+
 #endif /* _ASTERISK_ALAW_H */
@@ -104,6 +104,13 @@ int ast_cdr_copy_vars(struct ast_cdr *to_cdr, struct ast_cdr *from_cdr);
 
 typedef int (*ast_cdrbe)(struct ast_cdr *cdr);
 
+/*! \brief Batch CDR handler
+ * \param cdrs array of records from one batch, chained CDRs already flattened
+ * \param count number of entries in cdrs
+ * Called once per submitted batch instead of once per record.
+ */
+typedef int (*ast_cdrbe_batch)(struct ast_cdr **cdrs, int count);
+
 /*! \brief Allocate a CDR record 
  * Returns a malloc'd ast_cdr structure, returns NULL on error (malloc failure)
  */
@@ -147,6 +154,19 @@ int ast_cdr_setcid(struct ast_cdr *cdr, struct ast_channel *chan);
  */
 int ast_cdr_register(char *name, char *desc, ast_cdrbe be);
 
+/*! Register a CDR handling engine that can also post whole batches */
+/*!
+ * \param name name associated with the particular CDR handler
+ * \param desc description of the CDR handler
+ * \param be function pointer to a CDR handler, used outside of batch mode
+ * \param batch_be function pointer to a batch CDR handler, may be NULL
+ * When CDRs are batched, batch_be receives every record of a submitted batch
+ * in a single call, so the backend can write them with one statement or
+ * transaction.
+ * Returns -1 on error, 0 on success.
+ */
+int ast_cdr_register_batch(char *name, char *desc, ast_cdrbe be, ast_cdrbe_batch batch_be);
+
 /*! Unregister a CDR handling engine */
 /*!
  * \param name name of CDR handler to unregister
@@ -270,7 +270,7 @@ struct ast_channel_tech {
 struct ast_channel_spy_list;
 
 #define	DEBUGCHAN_FLAG  0x80000000
-#define	FRAMECOUNT_INC(x)	( ((x) & DEBUGCHAN_FLAG) | ((x++) & ~DEBUGCHAN_FLAG) )
+#define	FRAMECOUNT_INC(x)	( ((x) & DEBUGCHAN_FLAG) | (((x) + 1) & ~DEBUGCHAN_FLAG) )
 
 
 /*! \brief Main Channel structure associated with a channel. 
@@ -384,6 +384,10 @@ struct ast_channel {
 	struct ast_channel_spy_list *spies;		/*!< Chan Spy stuff */
 	AST_LIST_ENTRY(ast_channel) chan_list;		/*!< For easy linking */
 	struct ast_jb *jb;				/*!< The jitterbuffer state  */
+	struct ast_dsp_analysis *analysis;		/*!< Shared frame analysis, if ever attached */
+	struct ast_timing_entry *timingentry;		/*!< Core timing service registration, without a timingfd */
+	unsigned int bridge_direct;			/*!< Frames the generic bridge passed straight to the peer's driver */
+	unsigned int bridge_full;			/*!< Frames the generic bridge passed through ast_read()/ast_write() */
 
 	/*! \brief Data stores on the channel */
 	AST_LIST_HEAD_NOLOCK(datastores, ast_datastore) datastores;
@@ -48,10 +48,23 @@ enum chanspy_flags {
 	CHANSPY_TRIGGER_FLUSH = (1 << 6),
 };
 
+/*! \brief Signed linear samples passed from the channel to a spy without locking.
+ * The channel thread is the only writer of tail and the spy thread the only
+ * writer of head; both only ever grow, and head == tail means empty.
+ */
+struct ast_channel_spy_ring {
+	short *buf;
+	unsigned int size;		/*!< samples in buf, a power of two */
+	volatile int head;		/*!< samples consumed by the spy */
+	volatile int tail;		/*!< samples produced by the channel */
+	unsigned int overruns;		/*!< samples lost because the ring was full */
+};
+
 struct ast_channel_spy_queue {
 	struct ast_frame *head;
 	unsigned int samples;
 	unsigned int format;
+	struct ast_channel_spy_ring ring;	/*!< used instead of head for SLINEAR queues */
 };
 
 struct ast_channel_spy {
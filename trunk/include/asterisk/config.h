@@ -62,6 +62,8 @@ struct ast_config_engine {
 /*! \brief Load a config file 
  * \param filename path of file to open.  If no preceding '/' character, path is considered relative to AST_CONFIG_DIR
  * Create a config structure from a given configuration file.
+ * If neither the file nor anything it includes changed since the last
+ * load, a copy of the previously parsed config is returned instead.
  *
  * Returns NULL on error, or an ast_config data structure on success
  */
@@ -74,6 +76,37 @@ struct ast_config *ast_config_load(const char *filename);
  */
 void ast_config_destroy(struct ast_config *config);
 
+/*! \brief How a category differs between two loads of a config */
+enum ast_config_change {
+	AST_CONFIG_CATEGORY_ADDED,
+	AST_CONFIG_CATEGORY_REMOVED,
+	AST_CONFIG_CATEGORY_CHANGED,
+};
+
+typedef void ast_config_diff_cb(const char *category, enum ast_config_change change, void *data);
+
+/*! \brief Check whether a category differs between two loads of a config
+ * \param oldcfg the config from the previous load
+ * \param newcfg the config just loaded
+ * \param category name of the category
+ * Lets a module reload only the objects whose category actually changed.
+ *
+ * Returns non-zero if the category was added, removed, or any of its
+ * variables (or its template flag) changed
+ */
+int ast_category_changed(const struct ast_config *oldcfg, const struct ast_config *newcfg, const char *category);
+
+/*! \brief Report the categories that differ between two loads of a config
+ * \param oldcfg the config from the previous load
+ * \param newcfg the config just loaded
+ * \param cb called once per added, removed or changed category
+ * \param data passed to cb
+ * Where several categories share a name, only the first of each is compared.
+ *
+ * Returns the number of differences reported
+ */
+int ast_config_diff(const struct ast_config *oldcfg, const struct ast_config *newcfg, ast_config_diff_cb *cb, void *data);
+
 /*! \brief Goes through categories 
  * \param config Which config structure you wish to "browse"
  * \param prev A pointer to a previous category.
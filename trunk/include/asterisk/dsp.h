@@ -80,6 +80,44 @@ struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp,
    number of seconds of silence  */
 int ast_dsp_silence(struct ast_dsp *dsp, struct ast_frame *f, int *totalsilence);
 
+/*! \brief Shared analysis of the voice frames read from a channel.
+ * Once a consumer has attached, ast_read() measures every voice frame
+ * once, so several silence/talk detectors watching the same channel do
+ * not each scan the samples.  Silence and talk state use the default
+ * dsp threshold.
+ */
+struct ast_dsp_analysis {
+	int users;			/*!< number of attached consumers */
+	struct ast_frame *frame;	/*!< last analyzed frame */
+	void *data;			/*!< its data, to recognize the frame */
+	int len;			/*!< its length in samples */
+	int energy;			/*!< its mean sample magnitude */
+	int totalsilence;		/*!< ms of silence up to this frame */
+	int totalnoise;			/*!< ms of sound up to this frame */
+	int talking;			/*!< non-zero if this frame was not silent */
+	unsigned int frames;		/*!< voice frames analyzed */
+};
+
+/*! \brief Start the shared analysis on a channel, or join it if already running.
+ * \return 0 on success, -1 on allocation failure */
+int ast_dsp_analysis_attach(struct ast_channel *chan);
+
+/*! \brief Leave the shared analysis; it stops when the last consumer leaves */
+void ast_dsp_analysis_detach(struct ast_channel *chan);
+
+/*! \brief Copy the current analysis state of a channel.
+ * \return 0 on success, -1 if no analysis is attached */
+int ast_dsp_analysis_get(struct ast_channel *chan, struct ast_dsp_analysis *res);
+
+/*! \brief Analyze a voice frame read from a channel. Called by ast_read(). */
+void ast_dsp_analyze_frame(struct ast_dsp_analysis *a, struct ast_frame *f);
+
+/*! \brief Like ast_dsp_silence(), for a frame just read from chan.
+ * If the channel has the shared analysis attached, the energy of the
+ * frame is taken from there instead of being computed again.  The
+ * silence threshold and history of dsp are still applied. */
+int ast_dsp_silence_chan(struct ast_dsp *dsp, struct ast_channel *chan, struct ast_frame *f, int *totalsilence);
+
 /*! \brief Return non-zero if historically this should be a busy, request that
   ast_dsp_silence has already been called */
 int ast_dsp_busydetect(struct ast_dsp *dsp);
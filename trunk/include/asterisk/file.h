@@ -133,6 +133,9 @@ struct ast_filestream {
 	struct ast_frame fr;	/* frame produced by read, typically */
 	char *buf;		/* buffer pointed to by ast_frame; */
 	void *private;	/* pointer to private buffer */
+	struct ast_prompt *prompt;	/* cached file contents read through f, if any */
+	struct fs_writer *writer;	/* asynchronous writer state, if any */
+	char *wbuf;		/* stdio buffer of a recording, freed after f is closed */
 };
 
 #define SEEK_FORCECUR	10
@@ -293,6 +296,17 @@ struct ast_filestream *ast_writefile(const char *filename, const char *type, con
  */
 int ast_writestream(struct ast_filestream *fs, struct ast_frame *f);
 
+/*! Writes a recording from a background thread */
+/*!
+ * \param fs filestream opened with ast_writefile
+ * Voice and video frames passed to ast_writestream are queued and written
+ * by a shared writer thread, so disk stalls do not delay the caller.  If
+ * the disk falls too far behind, frames are dropped rather than queued.
+ * Seeking, truncating, telling and closing wait for queued frames first.
+ * Returns 0 on success, -1 on failure (the stream stays synchronous).
+ */
+int ast_filestream_set_async(struct ast_filestream *fs);
+
 /*! Closes a stream */
 /*!
  * \param f filestream to close
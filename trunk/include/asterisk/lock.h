@@ -735,6 +735,7 @@ static inline int ast_cond_timedwait(ast_cond_t *cond, ast_mutex_t *t, const str
  */
 
 int ast_atomic_fetchadd_int_slow(volatile int *p, int v);
+int ast_atomic_cas_ptr_slow(void * volatile *p, void *oldval, void *newval);
 
 #include "asterisk/inline_api.h"
 
@@ -765,6 +766,22 @@ AST_INLINE_API(int ast_atomic_fetchadd_int(volatile int *p, int v),
 })
 #endif
 
+/*! \brief Atomically replace *p with newval if it still equals oldval.
+ * Returns non-zero if the swap took place.  This is the building block for
+ * lock-free lists, see the asynchronous logger for an example.
+ */
+#if defined(HAVE_GCC_ATOMICS)
+AST_INLINE_API(int ast_atomic_cas_ptr(void * volatile *p, void *oldval, void *newval),
+{
+	return __sync_bool_compare_and_swap(p, oldval, newval);
+})
+#else   /* low performance version in utils.c */
+AST_INLINE_API(int ast_atomic_cas_ptr(void * volatile *p, void *oldval, void *newval),
+{
+	return ast_atomic_cas_ptr_slow(p, oldval, newval);
+})
+#endif
+
 /*! \brief decrement *p by 1 and return true if the variable has reached 0.
  * Useful e.g. to check if a refcount has reached 0.
  */
@@ -112,6 +112,9 @@ extern struct ast_flags ast_options;
 extern int option_verbose;
 extern int option_debug;		/*!< Debugging */
 extern int option_maxcalls;		/*!< Maximum number of simultaneous channels */
+extern int option_pbxpool;		/*!< Maximum PBX pool workers, 0 for a thread per call */
+extern int option_pbxstacksize;		/*!< Stack size of PBX threads, in bytes */
+#define PBX_STACKSIZE_MIN	(256 * 1024)	/*!< Smallest pbxstacksize accepted, AST_STACKSIZE until smaller stacks are measured safe */
 extern double option_maxload;
 extern char defaultlanguage[];
 
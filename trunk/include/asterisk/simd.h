@@ -0,0 +1,153 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief x86 vector helpers shared by the sample conversion kernels
+ *
+ * Kernels are compiled for SSE2 and AVX2 with function target attributes
+ * and picked at runtime, so one binary runs on any x86 CPU.  Elsewhere
+ * AST_X86_SIMD is not defined and only the scalar code is built.
+ */
+
+#ifndef _ASTERISK_SIMD_H
+#define _ASTERISK_SIMD_H
+
+#if defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))) && (defined(__i386__) || defined(__x86_64__))
+#define AST_X86_SIMD 1
+#endif
+
+#ifdef AST_X86_SIMD
+#include <immintrin.h>
+#include <sys/time.h>
+
+#define AST_TARGET_SSE2 __attribute__((target("sse2")))
+#define AST_TARGET_AVX2 __attribute__((target("avx2")))
+
+static inline int ast_cpu_has_sse2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static inline int ast_cpu_has_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/*! \brief 2^k in each 16-bit lane, for 0 <= k <= 15.
+ * Built as 2^(k&1) * 2^(k&2) * 2^(k&4) * 2^(k&8) since SSE2 has no
+ * per-lane shifts.  Multiplying by the result is a per-lane left shift,
+ * and _mm_mulhi_epu16() by 2^(16-n) a per-lane right shift by n. */
+static inline AST_TARGET_SSE2 __m128i ast_pow2_epi16(__m128i k)
+{
+	__m128i one = _mm_set1_epi16(1);
+	__m128i b, p, t;
+
+	p = _mm_add_epi16(one, _mm_and_si128(k, one));
+	b = _mm_and_si128(_mm_srli_epi16(k, 1), one);
+	t = _mm_add_epi16(one, _mm_add_epi16(b, _mm_slli_epi16(b, 1)));
+	p = _mm_mullo_epi16(p, t);
+	b = _mm_and_si128(_mm_srli_epi16(k, 2), one);
+	t = _mm_add_epi16(one, _mm_sub_epi16(_mm_slli_epi16(b, 4), b));
+	p = _mm_mullo_epi16(p, t);
+	b = _mm_and_si128(_mm_srli_epi16(k, 3), one);
+	t = _mm_add_epi16(one, _mm_sub_epi16(_mm_slli_epi16(b, 8), b));
+
+	return _mm_mullo_epi16(p, t);
+}
+
+/*! \brief Number of 2^8 .. 2^14 thresholds each (non-negative) lane reaches */
+static inline AST_TARGET_SSE2 __m128i ast_segment_epi16(__m128i v)
+{
+	__m128i seg = _mm_setzero_si128();
+	int k;
+
+	for (k = 8; k <= 14; k++)
+		seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(v, _mm_set1_epi16((1 << k) - 1)));
+
+	return seg;
+}
+
+/*! \brief AVX2 version of ast_pow2_epi16() */
+static inline AST_TARGET_AVX2 __m256i ast_pow2_epi16_avx2(__m256i k)
+{
+	__m256i one = _mm256_set1_epi16(1);
+	__m256i b, p, t;
+
+	p = _mm256_add_epi16(one, _mm256_and_si256(k, one));
+	b = _mm256_and_si256(_mm256_srli_epi16(k, 1), one);
+	t = _mm256_add_epi16(one, _mm256_add_epi16(b, _mm256_slli_epi16(b, 1)));
+	p = _mm256_mullo_epi16(p, t);
+	b = _mm256_and_si256(_mm256_srli_epi16(k, 2), one);
+	t = _mm256_add_epi16(one, _mm256_sub_epi16(_mm256_slli_epi16(b, 4), b));
+	p = _mm256_mullo_epi16(p, t);
+	b = _mm256_and_si256(_mm256_srli_epi16(k, 3), one);
+	t = _mm256_add_epi16(one, _mm256_sub_epi16(_mm256_slli_epi16(b, 8), b));
+
+	return _mm256_mullo_epi16(p, t);
+}
+
+/*! \brief AVX2 version of ast_segment_epi16() */
+static inline AST_TARGET_AVX2 __m256i ast_segment_epi16_avx2(__m256i v)
+{
+	__m256i seg = _mm256_setzero_si256();
+	int k;
+
+	for (k = 8; k <= 14; k++)
+		seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(v, _mm256_set1_epi16((1 << k) - 1)));
+
+	return seg;
+}
+
+/*! \brief Narrow 16 16-bit lanes (each 0..255) to bytes, in order */
+static inline AST_TARGET_AVX2 void ast_store_epu8_avx2(unsigned char *dst, __m256i v)
+{
+	_mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+
+/*! \brief Whether a block encoder is faster than the table loop it replaces.
+ * The G.711 encoders need a segment search per sample that the table lookup
+ * does not, and on many CPUs they lose to it, so they are only used where
+ * they win.  Each is timed over 20 ms frames, best of five runs. */
+static inline int ast_encoder_faster(void (*vec)(unsigned char *, const short *, int),
+	void (*table)(unsigned char *, const short *, int))
+{
+	short in[160];
+	unsigned char out[160];
+	void (*fn)(unsigned char *, const short *, int);
+	struct timeval start, end;
+	long best[2] = { -1, -1 }, t;
+	int run, x;
+
+	for (x = 0; x < 160; x++)
+		in[x] = (short) (x * 409);
+	for (run = 0; run < 10; run++) {
+		fn = (run & 1) ? table : vec;
+		gettimeofday(&start, NULL);
+		for (x = 0; x < 2000; x++)
+			fn(out, in, 160);
+		gettimeofday(&end, NULL);
+		t = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+		if ((best[run & 1] < 0) || (t < best[run & 1]))
+			best[run & 1] = t;
+	}
+	/* a clear win only, not noise */
+	return best[0] * 10 < best[1] * 9;
+}
+#endif /* AST_X86_SIMD */
+
+#endif /* _ASTERISK_SIMD_H */
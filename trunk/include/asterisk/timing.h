@@ -0,0 +1,61 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief Core timing service
+ *
+ * Stands in for a Zaptel timer on channels that do not have one.  A single
+ * thread ticks every 20 ms and wakes up the channels whose timeout (as set
+ * with ast_settimeout()) is due, through their alert pipe.  The channel's
+ * own thread then runs its timing function from ast_read(), just as it
+ * would for a Zaptel timer expiry.
+ */
+
+#ifndef _ASTERISK_TIMING_H
+#define _ASTERISK_TIMING_H
+
+#if defined(__cplusplus) || defined(c_plusplus)
+extern "C" {
+#endif
+
+struct ast_channel;
+
+/*! \brief Start the timing service.  Called once at startup. */
+int ast_timing_init(void);
+
+/*! \brief Whether a channel can be timed by the service */
+int ast_timing_available(struct ast_channel *chan);
+
+/*!
+ * \brief Wake a channel up every \a samples samples (at 8 kHz)
+ * \param chan the channel, locked
+ * \param samples the interval, or 0 to stop
+ * \return 0 on success, -1 if the channel cannot be timed
+ */
+int ast_timing_set(struct ast_channel *chan, int samples);
+
+/*!
+ * \brief Check for and clear a pending tick
+ * \param chan the channel, locked, after reading its alert pipe
+ * \return non-zero if the channel's timeout expired
+ */
+int ast_timing_ack(struct ast_channel *chan);
+
+#if defined(__cplusplus) || defined(c_plusplus)
+}
+#endif
+
+#endif /* _ASTERISK_TIMING_H */
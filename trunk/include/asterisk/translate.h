@@ -87,6 +87,13 @@ struct ast_translator {
 					/*!< cleanup private data, if needed 
 						(often unnecessary). */
 
+	void (*reset)(struct ast_trans_pvt *pvt);
+					/*!< reinitialize the private data of a
+					     pooled descriptor, keeping whatever
+					     newpvt allocated. If missing, pooled
+					     descriptors are destroyed and built
+					     again with newpvt. */
+
 	struct ast_frame * (*sample)(void);	/*!< Generate an example frame */
 
 	/*! \brief size of outbuf, in samples. Leave it 0 if you want the framein
@@ -107,8 +114,15 @@ struct ast_translator {
 
 	void *module;		/*!< opaque reference to the parent module */
 
-	int cost;		/*!< Cost in milliseconds for encoding/decoding 1 second of sound */
+	int cost;		/*!< Cost in microseconds for encoding/decoding 1 second of sound */
 	AST_LIST_ENTRY(ast_translator) list;	/*!< link field */
+
+	/* the fields below are managed by translate.c */
+	struct ast_trans_pvt *pool;	/*!< idle descriptors ready for reuse */
+	int poolsize;			/*!< number of descriptors in pool */
+	int active;			/*!< descriptors currently part of a path */
+	unsigned int allocs;		/*!< descriptors allocated for paths */
+	unsigned int reuses;		/*!< descriptors taken from the pool */
 };
 
 /*! \brief
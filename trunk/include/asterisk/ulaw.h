@@ -40,4 +40,13 @@ extern short __ast_mulaw[256];
 #define AST_LIN2MU(a) (__ast_lin2mu[((unsigned short)(a)) >> 2])
 #define AST_MULAW(a) (__ast_mulaw[(a)])
 
+/*! \brief Convert a block of mu-law samples to signed linear.
+ * Gives the same result as AST_MULAW() on each sample, using the
+ * widest vector unit the CPU has. */
+void ast_ulaw_decode(short *dst, const unsigned char *src, int samples);
+
+/*! \brief Convert a block of signed linear samples to mu-law.
+ * Gives the same result as AST_LIN2MU() on each sample. */
+void ast_ulaw_encode(unsigned char *dst, const short *src, int samples);
+
 #endif /* _ASTERISK_ULAW_H */
@@ -471,6 +471,7 @@ static struct reload_classes_t {
 	{ "manager",	reload_manager },
 	{ "rtp",	ast_rtp_reload },
 	{ "http",	ast_http_reload },
+	{ "prompts",	ast_prompt_cache_reload },
 	{ NULL, NULL }
 };
 
@@ -585,6 +586,7 @@ int ast_module_reload(const char *name)
 	struct module *cur;
 	int res = 0; /* return value. 0 = not found, others, see below */
 	int i, oldversion;
+	struct timeval start;
 
 	if (ast_mutex_trylock(&reloadlock)) {
 		ast_verbose("The previous reload command didn't finish yet\n");
@@ -615,7 +617,10 @@ int ast_module_reload(const char *name)
 		res = 2;
 		if (option_verbose > 2) 
 			ast_verbose(VERBOSE_PREFIX_3 "Reloading module '%s' (%s)\n", cur->resource, m->description());
+		start = ast_tvnow();
 		m->reload(m);
+		if (option_verbose > 2)
+			ast_verbose(VERBOSE_PREFIX_3 "Reloaded module '%s' in %d ms\n", cur->resource, ast_tvdiff_ms(ast_tvnow(), start));
 		AST_LIST_LOCK(&module_list);
 		if (oldversion != modlistver) /* something changed, abort */
 			break;
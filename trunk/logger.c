@@ -128,6 +128,41 @@ static int msgcnt = 0;
 static FILE *eventlog = NULL;
 static FILE *qlog = NULL;
 
+/*! \brief A preformatted log record waiting for the logger thread */
+struct log_record {
+	struct log_record *next;
+	int level;
+	long tid;
+	int line;
+	char date[64];
+	char file[64];
+	char function[64];
+	char msg[0];
+};
+
+/*! Asynchronous logging settings, from the [general] section of logger.conf */
+static int async_enabled = 0;
+static int async_queue_max = 10000;
+static int async_sync_errors = 1;
+
+/*! Levels wanted by any file or syslog channel, and by any console channel */
+static int async_logmask = 0;
+static int console_logmask = 0;
+
+/*! Lock-free stack of pending records, newest first; producers push with a
+ *  compare and swap, the logger thread takes the whole stack at once */
+static struct log_record * volatile async_pending = NULL;
+static volatile int async_queued = 0;
+static volatile int async_dropped = 0;
+static int async_dropped_reported = 0;
+static unsigned int async_written = 0;
+static unsigned int async_batches = 0;
+
+static pthread_t logthread = AST_PTHREADT_NULL;
+AST_MUTEX_DEFINE_STATIC(logthread_lock);
+static ast_cond_t logthread_cond;
+static int logthread_stop = 0;
+
 static char *levels[] = {
 	"DEBUG",
 	"EVENT",
@@ -325,6 +360,8 @@ static void init_logger_chain(void)
 		chan->next = logchannels;
 		logchannels = chan;
 		global_logmask |= chan->logmask;
+		console_logmask = chan->logmask;
+		async_logmask = 0;
 		return;
 	}
 	
@@ -349,7 +386,24 @@ static void init_logger_chain(void)
 	if ((s = ast_variable_retrieve(cfg, "general", "event_log"))) {
 		logfiles.event_log = ast_true(s);
 	}
+	async_enabled = 0;
+	if ((s = ast_variable_retrieve(cfg, "general", "asynchronous"))) {
+		async_enabled = ast_true(s);
+	}
+	async_queue_max = 10000;
+	if ((s = ast_variable_retrieve(cfg, "general", "asyncqueuesize"))) {
+		if (sscanf(s, "%d", &async_queue_max) != 1 || async_queue_max < 1) {
+			fprintf(stderr, "Logger Warning: invalid asyncqueuesize '%s', using 10000\n", s);
+			async_queue_max = 10000;
+		}
+	}
+	async_sync_errors = 1;
+	if ((s = ast_variable_retrieve(cfg, "general", "syncerrors"))) {
+		async_sync_errors = ast_true(s);
+	}
 
+	async_logmask = 0;
+	console_logmask = 0;
 	var = ast_variable_browse(cfg, "logfiles");
 	while(var) {
 		chan = make_logchannel(var->name, var->value, var->lineno);
@@ -357,6 +411,10 @@ static void init_logger_chain(void)
 			chan->next = logchannels;
 			logchannels = chan;
 			global_logmask |= chan->logmask;
+			if (chan->type == LOGTYPE_CONSOLE)
+				console_logmask |= chan->logmask;
+			else
+				async_logmask |= chan->logmask;
 		}
 		var = var->next;
 	}
@@ -365,6 +423,181 @@ static void init_logger_chain(void)
 	ast_mutex_unlock(&loglock);
 }
 
+/*! \brief Disable a file channel after a failed write
+ * \note Don't call without loglock
+ */
+static void logchannel_write_failed(struct logchannel *chan)
+{
+	fprintf(stderr,"**** Asterisk Logging Error: ***********\n");
+	if (errno == ENOMEM || errno == ENOSPC) {
+		fprintf(stderr, "Asterisk logging error: Out of disk space, can't log to log file %s\n", chan->filename);
+	} else
+		fprintf(stderr, "Logger Warning: Unable to write to log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
+	manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
+	chan->disabled = 1;	
+}
+
+static void log_record_to_syslog(struct log_record *rec)
+{
+	if (rec->level >= SYSLOG_NLEVELS)
+		return;
+	if (rec->level == __LOG_VERBOSE)
+		syslog(syslog_level_map[__LOG_DEBUG], "VERBOSE[%ld]: %s", rec->tid, rec->msg);
+	else if (rec->level == __LOG_DTMF)
+		syslog(syslog_level_map[__LOG_DEBUG], "DTMF[%ld]: %s", rec->tid, rec->msg);
+	else
+		syslog(syslog_level_map[rec->level], "%s[%ld]: %s:%d in %s: %s",
+		       levels[rec->level], rec->tid, rec->file, rec->line, rec->function, rec->msg);
+}
+
+/*! \brief Write one record to a file channel, leaving the flush to the caller
+ * \note Don't call without loglock
+ */
+static int log_record_to_file(struct logchannel *chan, struct log_record *rec)
+{
+	int res;
+
+	if (ast_opt_timestamp)
+		res = fprintf(chan->fileptr, "[%s] %s[%ld]: %s", rec->date, levels[rec->level], rec->tid, rec->msg);
+	else
+		res = fprintf(chan->fileptr, "%s %s[%ld] %s: %s", rec->date, levels[rec->level], rec->tid, rec->file, rec->msg);
+	if (res <= 0) {
+		logchannel_write_failed(chan);
+		return -1;
+	}
+	return 0;
+}
+
+/*! \brief Write out every pending record, flushing each file once per batch
+ * \note Don't call without loglock
+ */
+static void logger_drain(void)
+{
+	struct log_record *rec, *next, *ordered = NULL;
+	struct logchannel *chan;
+	int count = 0, dropped;
+
+	/* Take the whole stack, then reverse it back into arrival order */
+	do {
+		rec = async_pending;
+	} while (rec && !ast_atomic_cas_ptr((void * volatile *) &async_pending, rec, NULL));
+	for (; rec; rec = next) {
+		next = rec->next;
+		rec->next = ordered;
+		ordered = rec;
+		count++;
+	}
+	if (count)
+		ast_atomic_fetchadd_int(&async_queued, -count);
+
+	dropped = async_dropped;
+	if (!ordered && dropped == async_dropped_reported)
+		return;
+
+	for (chan = logchannels; chan; chan = chan->next) {
+		if (chan->disabled || chan->type == LOGTYPE_CONSOLE)
+			continue;
+		if (dropped != async_dropped_reported && (chan->logmask & (1 << __LOG_WARNING))) {
+			if (chan->type == LOGTYPE_SYSLOG)
+				syslog(syslog_level_map[__LOG_WARNING], "Logger queue full, dropped %d messages", dropped - async_dropped_reported);
+			else if (chan->fileptr)
+				fprintf(chan->fileptr, "Logger queue full, dropped %d messages\n", dropped - async_dropped_reported);
+		}
+		for (rec = ordered; rec; rec = rec->next) {
+			if (!(chan->logmask & (1 << rec->level)))
+				continue;
+			if (chan->type == LOGTYPE_SYSLOG)
+				log_record_to_syslog(rec);
+			else if (!chan->fileptr || log_record_to_file(chan, rec))
+				break;
+		}
+		if (chan->type == LOGTYPE_FILE && chan->fileptr && !chan->disabled)
+			fflush(chan->fileptr);
+	}
+	async_dropped_reported = dropped;
+
+	for (rec = ordered; rec; rec = next) {
+		next = rec->next;
+		free(rec);
+	}
+	if (count) {
+		async_written += count;
+		async_batches++;
+	}
+}
+
+/*! \brief Hand a formatted message to the logger thread without taking any lock */
+static void logger_enqueue(int level, const char *file, int line, const char *function, const char *date, const char *msg)
+{
+	struct log_record *rec, *head;
+	size_t len = strlen(msg);
+
+	if (ast_atomic_fetchadd_int(&async_queued, 1) >= async_queue_max) {
+		ast_atomic_fetchadd_int(&async_queued, -1);
+		ast_atomic_fetchadd_int(&async_dropped, 1);
+		return;
+	}
+
+	/* not ast_malloc(), which would log on failure */
+	if (!(rec = malloc(sizeof(*rec) + len + 1))) {
+		ast_atomic_fetchadd_int(&async_queued, -1);
+		ast_atomic_fetchadd_int(&async_dropped, 1);
+		return;
+	}
+	rec->level = level;
+	rec->tid = (long)GETTID();
+	rec->line = line;
+	ast_copy_string(rec->date, date, sizeof(rec->date));
+	/* copy these, the module they point into may be unloaded before we write */
+	ast_copy_string(rec->file, file, sizeof(rec->file));
+	ast_copy_string(rec->function, function, sizeof(rec->function));
+	memcpy(rec->msg, msg, len + 1);
+
+	do {
+		head = async_pending;
+		rec->next = head;
+	} while (!ast_atomic_cas_ptr((void * volatile *) &async_pending, head, rec));
+
+	/* Only wake the logger thread on the first record of a batch; it polls anyway */
+	if (!head)
+		ast_cond_signal(&logthread_cond);
+}
+
+static void *logger_thread(void *data)
+{
+	struct timeval tv;
+	struct timespec ts;
+
+	ast_mutex_lock(&logthread_lock);
+	while (!logthread_stop) {
+		tv = ast_tvadd(ast_tvnow(), ast_samp2tv(100, 1000));
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = tv.tv_usec * 1000;
+		ast_cond_timedwait(&logthread_cond, &logthread_lock, &ts);
+		ast_mutex_unlock(&logthread_lock);
+
+		ast_mutex_lock(&loglock);
+		logger_drain();
+		ast_mutex_unlock(&loglock);
+
+		ast_mutex_lock(&logthread_lock);
+	}
+	ast_mutex_unlock(&logthread_lock);
+
+	return NULL;
+}
+
+static void logger_start_thread(void)
+{
+	if (!async_enabled || logthread != AST_PTHREADT_NULL)
+		return;
+	logthread_stop = 0;
+	if (ast_pthread_create(&logthread, NULL, logger_thread, NULL)) {
+		fprintf(stderr, "Logger Warning: unable to start logger thread, logging synchronously\n");
+		logthread = AST_PTHREADT_NULL;
+	}
+}
+
 void ast_queue_log(const char *queuename, const char *callid, const char *agent, const char *event, const char *fmt, ...)
 {
 	va_list ap;
@@ -391,6 +624,8 @@ int reload_logger(int rotate)
 
 	ast_mutex_lock(&msglist_lock);	/* to avoid deadlock */
 	ast_mutex_lock(&loglock);
+	/* write out anything queued for the files we are about to close */
+	logger_drain();
 	if (eventlog) 
 		fclose(eventlog);
 	else 
@@ -498,6 +733,8 @@ int reload_logger(int rotate)
 	ast_mutex_unlock(&loglock);
 	ast_mutex_unlock(&msglist_lock);
 
+	logger_start_thread();
+
 	return res;
 }
 
@@ -554,6 +791,13 @@ static int handle_logger_show_channels(int fd, int argc, char *argv[])
 		chan = chan->next;
 	}
 	ast_cli(fd, "\n");
+	if (async_enabled || async_written) {
+		ast_cli(fd, "Asynchronous logging: %s%s\n", async_enabled ? "enabled" : "disabled",
+			async_sync_errors ? ", errors written synchronously" : "");
+		ast_cli(fd, "Queued: %d of %d, written: %u in %u batches, dropped: %d\n",
+			async_queued, async_queue_max, async_written, async_batches, async_dropped);
+		ast_cli(fd, "\n");
+	}
 
 	ast_mutex_unlock(&loglock);
  		
@@ -616,7 +860,9 @@ int init_logger(void)
 	mkdir((char *)ast_config_AST_LOG_DIR, 0755);
   
 	/* create log channels */
+	ast_cond_init(&logthread_cond, NULL);
 	init_logger_chain();
+	logger_start_thread();
 
 	/* create the eventlog */
 	if (logfiles.event_log) {
@@ -645,6 +891,18 @@ void close_logger(void)
 {
 	struct msglist *m, *tmp;
 
+	if (logthread != AST_PTHREADT_NULL) {
+		ast_mutex_lock(&logthread_lock);
+		logthread_stop = 1;
+		ast_cond_signal(&logthread_cond);
+		ast_mutex_unlock(&logthread_lock);
+		pthread_join(logthread, NULL);
+		logthread = AST_PTHREADT_NULL;
+	}
+	ast_mutex_lock(&loglock);
+	logger_drain();
+	ast_mutex_unlock(&loglock);
+
 	ast_mutex_lock(&msglist_lock);
 	m = list;
 	while(m) {
@@ -697,6 +955,7 @@ void ast_log(int level, const char *file, int line, const char *function, const
 	time_t t;
 	struct tm tm;
 	char date[256];
+	int queued = 0;
 
 	va_list ap;
 	
@@ -718,13 +977,32 @@ void ast_log(int level, const char *file, int line, const char *function, const
 	if ((level == __LOG_DEBUG) && !ast_strlen_zero(debug_filename) && strcasecmp(debug_filename, file))
 		return;
 
-	/* begin critical section */
-	ast_mutex_lock(&loglock);
-
 	time(&t);
 	localtime_r(&t, &tm);
 	strftime(date, sizeof(date), dateformat, &tm);
 
+	/* In asynchronous mode, file and syslog output is formatted here and
+	   written by the logger thread, so we never wait on the disk */
+	if (async_enabled && (logthread != AST_PTHREADT_NULL) && (async_logmask & (1 << level)) &&
+	    !(async_sync_errors && level == __LOG_ERROR) && !(logfiles.event_log && level == __LOG_EVENT)) {
+		va_start(ap, fmt);
+		vsnprintf(buf, sizeof(buf), fmt, ap);
+		va_end(ap);
+		term_strip(buf, buf, sizeof(buf));
+		logger_enqueue(level, file, line, function, date, buf);
+		queued = 1;
+		/* Nothing left to do unless a console wants this too */
+		if (!(console_logmask & (1 << level)))
+			goto done;
+	}
+
+	/* begin critical section */
+	ast_mutex_lock(&loglock);
+
+	/* Keep synchronous messages in order with anything still queued */
+	if (!queued && async_pending)
+		logger_drain();
+
 	if (logfiles.event_log && level == __LOG_EVENT) {
 		va_start(ap, fmt);
 
@@ -740,6 +1018,11 @@ void ast_log(int level, const char *file, int line, const char *function, const
 	if (logchannels) {
 		chan = logchannels;
 		while(chan && !chan->disabled) {
+			/* Already handed to the logger thread */
+			if (queued && chan->type != LOGTYPE_CONSOLE) {
+				chan = chan->next;
+				continue;
+			}
 			/* Check syslog channels */
 			if (chan->type == LOGTYPE_SYSLOG && (chan->logmask & (1 << level))) {
 				va_start(ap, fmt);
@@ -773,13 +1056,7 @@ void ast_log(int level, const char *file, int line, const char *function, const
 					levels[level], (long)GETTID(), file);
 				res = fprintf(chan->fileptr, buf);
 				if (res <= 0 && buf[0] != '\0') {	/* Error, no characters printed */
-					fprintf(stderr,"**** Asterisk Logging Error: ***********\n");
-					if (errno == ENOMEM || errno == ENOSPC) {
-						fprintf(stderr, "Asterisk logging error: Out of disk space, can't log to log file %s\n", chan->filename);
-					} else
-						fprintf(stderr, "Logger Warning: Unable to write to log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
-					manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
-					chan->disabled = 1;	
+					logchannel_write_failed(chan);
 				} else {
 					/* No error message, continue printing */
 					va_start(ap, fmt);
@@ -807,6 +1084,7 @@ void ast_log(int level, const char *file, int line, const char *function, const
 
 	ast_mutex_unlock(&loglock);
 	/* end critical section */
+done:
 	if (filesize_reload_needed) {
 		reload_logger(1);
 		ast_log(LOG_EVENT,"Rotated Logs Per SIGXFSZ (Exceeded file size limit)\n");
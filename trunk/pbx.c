@@ -36,6 +36,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <errno.h>
 #include <time.h>
 #include <sys/time.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#define PBX_STACK_MEASURE	/* see how deep PBX thread stacks go, with mincore() */
+#endif
 
 #include "asterisk.h"
 
@@ -2181,13 +2185,96 @@ static int collect_digits(struct ast_channel *c, int waittime, char *buf, int bu
 	return 0;
 }
 
-static int __ast_pbx_run(struct ast_channel *c)
+/*!
+ * \brief A channel running the dialplan.  Calls start on a pool worker, which
+ * runs the applications that never wait on the channel (see pbx_pool_apps
+ * and pbx_pool_funcs),
+ * and are handed to a thread of their own the first time one that might wait
+ * comes up.  This holds what __ast_pbx_run() needs to carry on from there.
+ */
+struct pbx_run {
+	struct ast_channel *c;
+	int started;		/*!< pbx_run_setup() done */
+	int found;		/*!< set if we find at least one match */
+	int res;
+	int autoloopflag;	/*!< AST_FLAG_IN_AUTOLOOP to restore at the end */
+	int hangup;		/*!< running the 'h' extension */
+	AST_LIST_ENTRY(pbx_run) list;
+};
+
+/*! \brief Applications that never wait on the channel, so they can run on a
+ * pool worker.  Answer only counts when it is not given a delay. */
+static const char *pbx_pool_apps[] = {
+	"Answer", "Goto", "GotoIf", "GotoIfTime", "Gosub", "GosubIf", "Hangup",
+	"ImportVar", "Log", "NoCDR", "NoOp", "Progress", "ResetCDR", "Return",
+	"Ringing", "Set", "SetAMAFlags", "SetCallerID", "SetCallerPres",
+	"SetGlobalVar", "Verbose", NULL
+};
+
+/*! \brief Dialplan functions that never block, so an application can stay on
+ * a pool worker when its arguments call them.  Anything else, like CURL,
+ * ENUMLOOKUP, SHELL, DB or the ODBC_ ones, may wait on the network or disk. */
+static const char *pbx_pool_funcs[] = {
+	"ARRAY", "BASE64_DECODE", "BASE64_ENCODE", "CALLERID", "CDR", "CHANNEL",
+	"CUT", "EXISTS", "FIELDQTY", "FILTER", "GLOBAL", "IF", "IFTIME", "ISNULL",
+	"KEYPADHASH", "LANGUAGE", "LEN", "MATH", "MD5", "QUOTE", "RAND", "REGEX",
+	"SET", "SHA1", "SORT", "SPRINTF", "STRFTIME", "STRPTIME", "TIMEOUT",
+	"URIDECODE", "URIENCODE", NULL
+};
+
+/*! \brief Whether the function calls in application data, if any, are all
+ * in pbx_pool_funcs.  Expressions in $[] cannot call functions themselves,
+ * only through the ${} substitutions inside them, which are checked here. */
+static int pbx_data_pooled(const char *data)
+{
+	const char *name;
+	int x;
+
+	while (data && (data = strstr(data, "${"))) {
+		data += 2;
+		for (name = data; isalnum(*data) || (*data == '_'); data++)
+			;
+		if ((*data == '}') || (*data == ':'))
+			continue;	/* a variable */
+		if ((*data != '(') || (data == name))
+			return 0;	/* a name that is only known when substituted */
+		for (x = 0; pbx_pool_funcs[x]; x++) {
+			if ((strlen(pbx_pool_funcs[x]) == data - name) && !strncasecmp(name, pbx_pool_funcs[x], data - name))
+				break;
+		}
+		if (!pbx_pool_funcs[x])
+			return 0;
+	}
+	return 1;
+}
+
+/*! \brief Whether the application at the channel's current priority can run on a pool worker */
+static int pbx_app_pooled(struct ast_channel *c)
 {
-	int found = 0;	/* set if we find at least one match */
+	struct ast_exten *e;
+	struct pbx_find_info q = { .stacklen = 0 };
 	int res = 0;
-	int autoloopflag;
-	int error = 0;		/* set an error conditions */
+	int x;
 
+	ast_mutex_lock(&conlock);
+	e = pbx_find_extension(c, NULL, &q, c->context, c->exten, c->priority, NULL, c->cid.cid_num, E_SPAWN);
+	if (e) {
+		for (x = 0; pbx_pool_apps[x]; x++) {
+			if (!strcasecmp(e->app, pbx_pool_apps[x])) {
+				res = (strcasecmp(e->app, "Answer") || ast_strlen_zero(e->data)) && pbx_data_pooled(e->data);
+				break;
+			}
+		}
+	}
+	ast_mutex_unlock(&conlock);
+	return res;
+}
+
+static int pbx_run_setup(struct pbx_run *run)
+{
+	struct ast_channel *c = run->c;
+
+	run->started = 1;
 	/* A little initial setup here */
 	if (c->pbx) {
 		ast_log(LOG_WARNING, "%s already has PBX structure??\n", c->name);
@@ -2211,7 +2298,7 @@ static int __ast_pbx_run(struct ast_channel *c)
 	c->pbx->rtimeout = 10;
 	c->pbx->dtimeout = 5;
 
-	autoloopflag = ast_test_flag(c, AST_FLAG_IN_AUTOLOOP);	/* save value to restore at the end */
+	run->autoloopflag = ast_test_flag(c, AST_FLAG_IN_AUTOLOOP);	/* save value to restore at the end */
 	ast_set_flag(c, AST_FLAG_IN_AUTOLOOP);
 
 	/* Start by trying whatever the channel is set to */
@@ -2233,6 +2320,26 @@ static int __ast_pbx_run(struct ast_channel *c)
 	}
 	if (c->cdr && ast_tvzero(c->cdr->start))
 		ast_cdr_start(c->cdr);
+	return 0;
+}
+
+static int pbx_run_hangup(struct pbx_run *run, int pooled);
+
+/*!
+ * \brief Run the dialplan on a channel until it hangs up
+ * \param run the channel, after pbx_run_setup()
+ * \param pooled stop before anything that could wait on the channel
+ * \return 1 if it stopped for that reason, 0 when done with the channel
+ */
+static int pbx_run_loop(struct pbx_run *run, int pooled)
+{
+	struct ast_channel *c = run->c;
+	int found = run->found;	/* set if we find at least one match */
+	int res = run->res;
+	int error = 0;		/* set an error conditions */
+
+	if (run->hangup)
+		return pbx_run_hangup(run, pooled);
 	for (;;) {
 		char dst_exten[256];	/* buffer to accumulate digits */
 		int pos = 0;		/* XXX should check bounds */
@@ -2241,6 +2348,8 @@ static int __ast_pbx_run(struct ast_channel *c)
 		/* loop on priorities in this context/exten */
 		while (ast_exists_extension(c, c->context, c->exten, c->priority, c->cid.cid_num)) {
 			found = 1;
+			if (pooled && !pbx_app_pooled(c))
+				goto handoff;
 			if ((res = ast_spawn_extension(c, c->context, c->exten, c->priority, c->cid.cid_num))) {
 				/* Something bad happened, or a hangup has been requested. */
 				if (strchr("0123456789ABCDEF*#", res)) {
@@ -2311,6 +2420,10 @@ static int __ast_pbx_run(struct ast_channel *c)
 			c->_softhangup = 0;
 		} else {	/* keypress received, get more digits for a full extension */
 			int waittime = 0;
+			/* Either way we are about to wait on the channel.  Nothing that
+			   runs on the pool returns a digit, so this is easily redone. */
+			if (pooled)
+				goto handoff;
 			if (digit)
 				waittime = c->pbx->dtimeout;
 			else if (!autofallthrough)
@@ -2371,11 +2484,34 @@ static int __ast_pbx_run(struct ast_channel *c)
 	}
 	if (!found && !error)
 		ast_log(LOG_WARNING, "Don't know what to do with '%s'\n", c->name);
-	if ((res != AST_PBX_KEEPALIVE) && ast_exists_extension(c, c->context, "h", 1, c->cid.cid_num)) {
+	run->res = res;
+	return pbx_run_hangup(run, pooled);
+
+handoff:
+	run->found = found;
+	run->res = res;
+	return 1;
+}
+
+/*! \brief Run the 'h' extension if there is one, and finish with the channel.
+ * Returns like pbx_run_loop(). */
+static int pbx_run_hangup(struct pbx_run *run, int pooled)
+{
+	struct ast_channel *c = run->c;
+	int res = run->res;
+
+	if (!run->hangup && (res != AST_PBX_KEEPALIVE) && ast_exists_extension(c, c->context, "h", 1, c->cid.cid_num)) {
 		if (c->cdr && ast_opt_end_cdr_before_h_exten)
 			ast_cdr_end(c->cdr);
 		set_ext_pri(c, "h", 1);
+		run->hangup = 1;
+	}
+	if (run->hangup) {
 		while(ast_exists_extension(c, c->context, c->exten, c->priority, c->cid.cid_num)) {
+			if (pooled && !pbx_app_pooled(c)) {
+				run->res = res;
+				return 1;
+			}
 			if ((res = ast_spawn_extension(c, c->context, c->exten, c->priority, c->cid.cid_num))) {
 				/* Something bad happened, or a hangup has been requested. */
 				if (option_debug)
@@ -2387,7 +2523,7 @@ static int __ast_pbx_run(struct ast_channel *c)
 			c->priority++;
 		}
 	}
-	ast_set2_flag(c, autoloopflag, AST_FLAG_IN_AUTOLOOP);
+	ast_set2_flag(c, run->autoloopflag, AST_FLAG_IN_AUTOLOOP);
 
 	pbx_destroy(c->pbx);
 	c->pbx = NULL;
@@ -2396,6 +2532,16 @@ static int __ast_pbx_run(struct ast_channel *c)
 	return 0;
 }
 
+static int __ast_pbx_run(struct ast_channel *c)
+{
+	struct pbx_run run = { .c = c, };
+
+	if (pbx_run_setup(&run))
+		return -1;
+	pbx_run_loop(&run, 0);
+	return 0;
+}
+
 /* Returns 0 on success, non-zero if call limit was reached */
 static int increase_call_count(const struct ast_channel *c)
 {
@@ -2440,6 +2586,50 @@ static void destroy_exten(struct ast_exten *e)
 	free(e);
 }
 
+/*! \brief PBX pool and thread accounting, for "show pbx threads" */
+static AST_LIST_HEAD_NOLOCK_STATIC(pbx_runq, pbx_run);	/*!< Calls waiting for a pool worker */
+AST_MUTEX_DEFINE_STATIC(pbx_pool_lock);
+static ast_cond_t pbx_pool_cond;
+static int pbx_pool_workers;		/*!< Pool workers started */
+static int pbx_pool_busy;		/*!< Pool workers running a call */
+static int pbx_pool_queued;		/*!< Calls on pbx_runq */
+static int pbx_threads;			/*!< Calls on a thread of their own */
+static int pbx_pool_calls;		/*!< Calls started on the pool */
+static int pbx_pool_finished;		/*!< ... and finished there */
+static int pbx_pool_handoffs;		/*!< ... and handed to a thread of their own */
+static size_t pbx_stack_max;		/*!< Deepest stack use seen on a PBX thread */
+
+#ifdef PBX_STACK_MEASURE
+/*! \brief Note how much of its stack the calling thread has touched.  Stack
+ * pages only become resident when used, so the lowest resident page shows
+ * how deep the stack has been. */
+static void pbx_stack_measure(void)
+{
+	pthread_attr_t attr;
+	void *addr;
+	size_t size, pages, x;
+	size_t page = getpagesize();
+	unsigned char *vec;
+
+	if (pthread_getattr_np(pthread_self(), &attr))
+		return;
+	if (!pthread_attr_getstack(&attr, &addr, &size) && (pages = size / page) && (vec = ast_malloc(pages))) {
+		if (!mincore(addr, pages * page, vec)) {
+			for (x = 0; (x < pages) && !(vec[x] & 1); x++)
+				;
+			ast_mutex_lock(&pbx_pool_lock);
+			if ((pages - x) * page > pbx_stack_max)
+				pbx_stack_max = (pages - x) * page;
+			ast_mutex_unlock(&pbx_pool_lock);
+		}
+		free(vec);
+	}
+	pthread_attr_destroy(&attr);
+}
+#else
+#define pbx_stack_measure()
+#endif
+
 static void *pbx_thread(void *data)
 {
 	/* Oh joyeous kernel, we're a new thread, with nothing to do but
@@ -2450,20 +2640,78 @@ static void *pbx_thread(void *data)
 	   before invoking the function; it will be decremented when the
 	   PBX has finished running on the channel
 	 */
-	struct ast_channel *c = data;
+	struct pbx_run *run = data;
 
-	__ast_pbx_run(c);
+	ast_atomic_fetchadd_int(&pbx_threads, 1);
+	if (run->started || !pbx_run_setup(run))
+		pbx_run_loop(run, 0);
 	decrease_call_count();
+	free(run);
+	pbx_stack_measure();
+	ast_atomic_fetchadd_int(&pbx_threads, -1);
 
 	pthread_exit(NULL);
 
 	return NULL;
 }
 
-enum ast_pbx_result ast_pbx_start(struct ast_channel *c)
+/*! \brief Start a detached PBX thread with the configured stack size */
+static int pbx_thread_start(void *(*func)(void *), void *data)
 {
 	pthread_t t;
 	pthread_attr_t attr;
+	int res;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	res = ast_pthread_create_stack(&t, &attr, func, data, option_pbxstacksize, __FILE__, __FUNCTION__, __LINE__, "pbx_thread");
+	pthread_attr_destroy(&attr);
+	return res;
+}
+
+/*! \brief Run a call on a pool worker until it finishes or might wait */
+static void pbx_pool_run(struct pbx_run *run)
+{
+	if (!pbx_run_setup(run)) {
+		if (pbx_run_loop(run, 1)) {
+			/* Something that may wait on the channel is next, give the
+			   call a thread of its own */
+			ast_atomic_fetchadd_int(&pbx_pool_handoffs, 1);
+			if (!pbx_thread_start(pbx_thread, run))
+				return;
+			ast_log(LOG_WARNING, "Failed to create new channel thread, running '%s' on the pool\n", run->c->name);
+			pbx_run_loop(run, 0);
+		} else
+			ast_atomic_fetchadd_int(&pbx_pool_finished, 1);
+	}
+	decrease_call_count();
+	free(run);
+}
+
+static void *pbx_pool_worker(void *data)
+{
+	struct pbx_run *run;
+
+	ast_mutex_lock(&pbx_pool_lock);
+	for (;;) {
+		while (!(run = AST_LIST_REMOVE_HEAD(&pbx_runq, list)))
+			ast_cond_wait(&pbx_pool_cond, &pbx_pool_lock);
+		pbx_pool_queued--;
+		pbx_pool_busy++;
+		ast_mutex_unlock(&pbx_pool_lock);
+
+		pbx_pool_run(run);
+		pbx_stack_measure();
+
+		ast_mutex_lock(&pbx_pool_lock);
+		pbx_pool_busy--;
+	}
+	return NULL;
+}
+
+enum ast_pbx_result ast_pbx_start(struct ast_channel *c)
+{
+	struct pbx_run *run;
 
 	if (!c) {
 		ast_log(LOG_WARNING, "Asked to start thread on NULL channel?\n");
@@ -2473,11 +2721,41 @@ enum ast_pbx_result ast_pbx_start(struct ast_channel *c)
 	if (increase_call_count(c))
 		return AST_PBX_CALL_LIMIT;
 
+	if (!(run = ast_calloc(1, sizeof(*run)))) {
+		decrease_call_count();
+		return AST_PBX_FAILED;
+	}
+	run->c = c;
+
+	if (option_pbxpool > 0) {
+		/* Queue it for the pool, starting another worker if they are all busy */
+		ast_mutex_lock(&pbx_pool_lock);
+		AST_LIST_INSERT_TAIL(&pbx_runq, run, list);
+		pbx_pool_queued++;
+		pbx_pool_calls++;
+		if ((pbx_pool_workers < option_pbxpool) && (pbx_pool_queued > pbx_pool_workers - pbx_pool_busy)) {
+			if (pbx_thread_start(pbx_pool_worker, NULL))
+				ast_log(LOG_WARNING, "Failed to create PBX pool thread\n");
+			else
+				pbx_pool_workers++;
+		}
+		if (pbx_pool_workers) {
+			ast_cond_signal(&pbx_pool_cond);
+			ast_mutex_unlock(&pbx_pool_lock);
+			return AST_PBX_SUCCESS;
+		}
+		/* No pool at all, fall back to a thread of its own */
+		AST_LIST_REMOVE(&pbx_runq, run, list);
+		pbx_pool_queued--;
+		pbx_pool_calls--;
+		ast_mutex_unlock(&pbx_pool_lock);
+	}
+
 	/* Start a new thread, and get something handling this channel. */
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	if (ast_pthread_create(&t, &attr, pbx_thread, c)) {
+	if (pbx_thread_start(pbx_thread, run)) {
 		ast_log(LOG_WARNING, "Failed to create new channel thread\n");
+		free(run);
+		decrease_call_count();
 		return AST_PBX_FAILED;
 	}
 
@@ -2842,6 +3120,11 @@ static char show_globals_help[] =
 "Usage: show globals\n"
 "       Show current global dialplan variables and their values\n";
 
+static char show_pbx_threads_help[] =
+"Usage: show pbx threads\n"
+"       Show how many calls are running the dialplan on threads of their own\n"
+"       and on the PBX worker pool, and how deep PBX thread stacks have gone.\n";
+
 static char set_global_help[] =
 "Usage: set global <name> <value>\n"
 "       Set global dialplan variable <name> to <value>\n";
@@ -3373,6 +3656,41 @@ static int handle_set_global(int fd, int argc, char *argv[])
 
 
 
+/*! \brief CLI support for listing PBX thread and pool usage */
+static int handle_show_pbx_threads(int fd, int argc, char *argv[])
+{
+	int workers, busy, queued, calls, finished, handoffs;
+	size_t stack_max;
+
+	if (argc != 3)
+		return RESULT_SHOWUSAGE;
+
+	ast_mutex_lock(&pbx_pool_lock);
+	workers = pbx_pool_workers;
+	busy = pbx_pool_busy;
+	queued = pbx_pool_queued;
+	calls = pbx_pool_calls;
+	finished = pbx_pool_finished;
+	handoffs = pbx_pool_handoffs;
+	stack_max = pbx_stack_max;
+	ast_mutex_unlock(&pbx_pool_lock);
+
+	ast_cli(fd, "Calls on their own thread: %d\n", pbx_threads);
+	if (option_pbxpool > 0) {
+		ast_cli(fd, "Pool workers: %d of %d, %d busy, %d calls queued\n", workers, option_pbxpool, busy, queued);
+		ast_cli(fd, "Calls started on the pool: %d, finished there: %d, moved to their own thread: %d\n", calls, finished, handoffs);
+	} else
+		ast_cli(fd, "Pool disabled, every call gets a thread of its own\n");
+	ast_cli(fd, "PBX thread stack size: %d KB", option_pbxstacksize / 1024);
+#ifdef PBX_STACK_MEASURE
+	if (stack_max)
+		ast_cli(fd, ", deepest use seen: %d KB", (int) (stack_max / 1024));
+#endif
+	ast_cli(fd, "\n");
+
+	return RESULT_SUCCESS;
+}
+
 /*
  * CLI entries for upper commands ...
  */
@@ -3395,6 +3713,8 @@ static struct ast_cli_entry pbx_cli[] = {
 	  "Show global dialplan variables", show_globals_help },
 	{ { "set", "global", NULL }, handle_set_global,
 	  "Set global dialplan variable", set_global_help },
+	{ { "show", "pbx", "threads", NULL }, handle_show_pbx_threads,
+	  "Show PBX thread and pool usage", show_pbx_threads_help },
 };
 
 int ast_unregister_application(const char *app)
@@ -5611,6 +5931,7 @@ int load_pbx(void)
 		ast_verbose( "Registering builtin applications:\n");
 	}
 	AST_LIST_HEAD_INIT_NOLOCK(&globals);
+	ast_cond_init(&pbx_pool_cond, NULL);
 	ast_cli_register_multiple(pbx_cli, sizeof(pbx_cli) / sizeof(pbx_cli[0]));
 
 	/* Register builtin applications */
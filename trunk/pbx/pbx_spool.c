@@ -37,6 +37,12 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/poll.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#define SPOOL_INOTIFY	/* learn about new call files from the kernel */
+#endif
 
 #include "asterisk.h"
 
@@ -51,6 +57,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/module.h"
 #include "asterisk/options.h"
 #include "asterisk/utils.h"
+#include "asterisk/config.h"
 
 /*
  * pbx_spool is similar in spirit to qcall, but with substantially enhanced functionality...
@@ -328,10 +335,12 @@ static int remove_from_queue(struct outgoing *o, const char *status)
 		return 0;
 }
 
-static void *attempt_thread(void *data)
+/*! \brief Place one call.
+ * \return the time of the next attempt, or 0 if the file is finished with */
+static time_t attempt_call(struct outgoing *o)
 {
-	struct outgoing *o = data;
 	int res, reason;
+	time_t next = 0, now;
 	if (!ast_strlen_zero(o->app)) {
 		if (option_verbose > 2)
 			ast_verbose(VERBOSE_PREFIX_3 "Attempting call on %s/%s for application %s(%s) (Retry %d)\n", o->tech, o->dest, o->app, o->data, o->retries);
@@ -349,7 +358,9 @@ static void *attempt_thread(void *data)
 			remove_from_queue(o, "Expired");
 		} else {
 			/* Notate that the call is still active */
-			safe_append(o, time(NULL), "EndRetry");
+			now = time(NULL);
+			safe_append(o, now, "EndRetry");
+			next = now + o->retrytime;
 		}
 	} else {
 		ast_log(LOG_NOTICE, "Call completed to %s/%s\n", o->tech, o->dest);
@@ -357,22 +368,215 @@ static void *attempt_thread(void *data)
 		remove_from_queue(o, "Completed");
 	}
 	free_outgoing(o);
+	return next;
+}
+
+/*!
+ * \brief Call files are tracked in memory once they have been seen, so
+ * the spool directory is only read at startup (and when inotify loses
+ * events).  Each file is either waiting for its modification time on
+ * spool_timers, waiting for a worker on spool_ready, or being called.
+ */
+struct spool_file {
+	struct spool_file *next;		/*!< Next in its spool_files bucket */
+	AST_LIST_ENTRY(spool_file) list;	/*!< On spool_timers or spool_ready */
+	time_t when;				/*!< When to look at the file again */
+	struct outgoing *o;			/*!< The call to place, while on spool_ready */
+	unsigned int queued:1;			/*!< On spool_timers or spool_ready */
+	unsigned int running:1;			/*!< A worker is placing the call */
+	char fn[256];
+};
+
+#define SPOOL_BUCKETS	1024
+
+static struct spool_file *spool_files[SPOOL_BUCKETS];
+/*! Files waiting for their modification time, soonest first */
+static AST_LIST_HEAD_NOLOCK_STATIC(spool_timers, spool_file);
+/*! Calls waiting for a worker */
+static AST_LIST_HEAD_NOLOCK_STATIC(spool_ready, spool_file);
+AST_MUTEX_DEFINE_STATIC(spool_lock);
+static ast_cond_t spool_cond;		/*!< Signalled when a call is ready */
+static int spool_nready;		/*!< Calls on spool_ready */
+static int spool_workers;		/*!< Worker threads started */
+static int spool_idle;			/*!< Workers waiting on spool_cond */
+static int spool_pipe[2] = { -1, -1 };	/*!< Wakes up scan_thread */
+static int spool_notify = -1;		/*!< inotify descriptor watching qdir */
+
+static int maxworkers = 100;		/*!< Calls placed at once */
+static int maxrate = 0;			/*!< Calls started per second, 0 for no limit */
+
+static unsigned int spool_hash(const char *fn)
+{
+	unsigned int h = 0;
+
+	while (*fn)
+		h = h * 31 + (unsigned char) *fn++;
+	return h % SPOOL_BUCKETS;
+}
+
+static struct spool_file *spool_find(const char *fn)
+{
+	struct spool_file *sf;
+
+	for (sf = spool_files[spool_hash(fn)]; sf; sf = sf->next) {
+		if (!strcmp(sf->fn, fn))
+			break;
+	}
+	return sf;
+}
+
+static struct spool_file *spool_new(const char *fn)
+{
+	struct spool_file *sf;
+	unsigned int h = spool_hash(fn);
+
+	if (!(sf = ast_calloc(1, sizeof(*sf))))
+		return NULL;
+	ast_copy_string(sf->fn, fn, sizeof(sf->fn));
+	sf->next = spool_files[h];
+	spool_files[h] = sf;
+	return sf;
+}
+
+/*! \brief Take a file off the list it is waiting on.  Call with spool_lock held. */
+static void spool_unqueue(struct spool_file *sf)
+{
+	if (!sf->queued)
+		return;
+	if (sf->o) {
+		AST_LIST_REMOVE(&spool_ready, sf, list);
+		spool_nready--;
+	} else
+		AST_LIST_REMOVE(&spool_timers, sf, list);
+	sf->queued = 0;
+}
+
+/*! \brief Stop tracking a file.  Call with spool_lock held. */
+static void spool_forget(struct spool_file *sf)
+{
+	struct spool_file **prev;
+
+	spool_unqueue(sf);
+	for (prev = &spool_files[spool_hash(sf->fn)]; *prev; prev = &(*prev)->next) {
+		if (*prev == sf) {
+			*prev = sf->next;
+			break;
+		}
+	}
+	if (sf->o)
+		free_outgoing(sf->o);
+	free(sf);
+}
+
+/*! \brief Look at a file again at \a when.  Call with spool_lock held. */
+static void spool_schedule(struct spool_file *sf, time_t when)
+{
+	struct spool_file *cur;
+
+	spool_unqueue(sf);
+	sf->when = when;
+	/* Retries are mostly scheduled a fixed time from now, so check the end first */
+	if (!AST_LIST_LAST(&spool_timers) || AST_LIST_LAST(&spool_timers)->when <= when) {
+		AST_LIST_INSERT_TAIL(&spool_timers, sf, list);
+		sf->queued = 1;
+		return;
+	}
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&spool_timers, cur, list) {
+		if (cur->when > when) {
+			AST_LIST_INSERT_BEFORE_CURRENT(&spool_timers, sf, list);
+			break;
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END;
+	sf->queued = 1;
+}
+
+/*! \brief A file has been called or given up on.  If it is still there and
+ * dated in the future, come back to it then.  Call with spool_lock held. */
+static void spool_done(struct spool_file *sf, time_t now)
+{
+	struct stat st;
+
+	if (!stat(sf->fn, &st) && (st.st_mtime > now))
+		spool_schedule(sf, st.st_mtime);
+	else
+		spool_forget(sf);
+}
+
+static void spool_wake(void)
+{
+	if ((write(spool_pipe[1], "", 1) < 0) && (errno != EAGAIN))
+		ast_log(LOG_WARNING, "Unable to wake up spool thread: %s\n", strerror(errno));
+}
+
+static void *spool_worker(void *unused)
+{
+	struct spool_file *sf;
+	struct outgoing *o;
+	time_t next;
+
+	ast_mutex_lock(&spool_lock);
+	for (;;) {
+		while (!(sf = AST_LIST_REMOVE_HEAD(&spool_ready, list))) {
+			spool_idle++;
+			ast_cond_wait(&spool_cond, &spool_lock);
+			spool_idle--;
+		}
+		spool_nready--;
+		o = sf->o;
+		sf->o = NULL;
+		sf->queued = 0;
+		sf->running = 1;
+		ast_mutex_unlock(&spool_lock);
+
+		next = attempt_call(o);
+
+		ast_mutex_lock(&spool_lock);
+		sf->running = 0;
+		if (next)
+			spool_schedule(sf, next);
+		else
+			spool_done(sf, time(NULL));
+		/* scan_thread may be sleeping past the new timer */
+		spool_wake();
+	}
 	return NULL;
 }
 
+/*! \brief Hand a call to the workers, starting one if they are all busy and
+ * there are fewer than maxworkers.  Call with spool_lock held. */
 static void launch_service(struct outgoing *o)
 {
+	struct spool_file *sf;
 	pthread_t t;
 	pthread_attr_t attr;
 	int ret;
-	pthread_attr_init(&attr);
- 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	if ((ret = ast_pthread_create(&t,&attr,attempt_thread, o)) != 0) {
-		ast_log(LOG_WARNING, "Unable to create thread :( (returned error: %d)\n", ret);
+
+	if (!(sf = spool_find(o->fn)) && !(sf = spool_new(o->fn))) {
 		free_outgoing(o);
+		return;
+	}
+	spool_unqueue(sf);
+	sf->o = o;
+	AST_LIST_INSERT_TAIL(&spool_ready, sf, list);
+	sf->queued = 1;
+	spool_nready++;
+
+	if ((spool_nready > spool_idle) && (spool_workers < maxworkers)) {
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if ((ret = ast_pthread_create(&t, &attr, spool_worker, NULL)) != 0)
+			ast_log(LOG_WARNING, "Unable to create thread :( (returned error: %d)\n", ret);
+		else
+			spool_workers++;
+		pthread_attr_destroy(&attr);
 	}
+	if (spool_idle)
+		ast_cond_signal(&spool_cond);
 }
 
+/*! \brief Read a call file that is due and either launch it or work out when to
+ * look at it again.  Call with spool_lock held. */
 static int scan_service(char *fn, time_t now, time_t atime)
 {
 	struct outgoing *o;
@@ -391,8 +595,8 @@ static int scan_service(char *fn, time_t now, time_t atime)
 					now += o->retrytime;
 					if (o->callingpid && (o->callingpid == ast_mainpid)) {
 						safe_append(o, time(NULL), "DelayedRetry");
-						free_outgoing(o);
 						ast_log(LOG_DEBUG, "Delaying retry since we're currently running '%s'\n", o->fn);
+						free_outgoing(o);
 					} else {
 						/* Increment retries */
 						o->retries++;
@@ -407,80 +611,219 @@ static int scan_service(char *fn, time_t now, time_t atime)
 					return now;
 				} else {
 					ast_log(LOG_EVENT, "Queued call to %s/%s expired without completion after %d attempt%s\n", o->tech, o->dest, o->retries - 1, ((o->retries - 1) != 1) ? "s" : "");
-					free_outgoing(o);
 					remove_from_queue(o, "Expired");
+					free_outgoing(o);
 					return 0;
 				}
 			} else {
-				free_outgoing(o);
 				ast_log(LOG_WARNING, "Invalid file contents in %s, deleting\n", fn);
 				fclose(f);
 				remove_from_queue(o, "Failed");
+				free_outgoing(o);
 			}
 		} else {
-			free_outgoing(o);
 			ast_log(LOG_WARNING, "Unable to open %s: %s, deleting\n", fn, strerror(errno));
+			/* remove_from_queue() only needs the file name and options */
+			ast_copy_string(o->fn, fn, sizeof(o->fn));
 			remove_from_queue(o, "Failed");
+			free_outgoing(o);
 		}
 	} else
 		ast_log(LOG_WARNING, "Out of memory :(\n");
 	return -1;
 }
 
-static void *scan_thread(void *unused)
+/*! \brief Start tracking a file in qdir, or reschedule one that changed.
+ * Files already waiting for or being called are left alone.  With \a new_only
+ * every file we already know about is skipped without a stat().
+ * Call with spool_lock held. */
+static void spool_consider(const char *name, int new_only)
 {
+	struct spool_file *sf;
 	struct stat st;
+	char fn[256];
+
+	snprintf(fn, sizeof(fn), "%s/%s", qdir, name);
+	if ((sf = spool_find(fn)) && (new_only || sf->running || sf->o))
+		return;
+	if (stat(fn, &st)) {
+		/* Moved away again before we got to it */
+		if (option_debug)
+			ast_log(LOG_DEBUG, "Unable to stat %s: %s\n", fn, strerror(errno));
+		return;
+	}
+	if (!S_ISREG(st.st_mode))
+		return;
+	if (!sf && !(sf = spool_new(fn)))
+		return;
+	spool_schedule(sf, st.st_mtime);
+}
+
+static void spool_scan(int new_only)
+{
 	DIR *dir;
 	struct dirent *de;
-	char fn[256];
-	int res;
-	time_t last = 0, next = 0, now;
-	for(;;) {
-		/* Wait a sec */
-		sleep(1);
-		time(&now);
-		if (!stat(qdir, &st)) {
-			if ((st.st_mtime != last) || (next && (now > next))) {
-#if 0
-				printf("atime: %ld, mtime: %ld, ctime: %ld\n", st.st_atime, st.st_mtime, st.st_ctime);
-				printf("Ooh, something changed / timeout\n");
-#endif				
-				next = 0;
-				last = st.st_mtime;
-				dir = opendir(qdir);
-				if (dir) {
-					while((de = readdir(dir))) {
-						snprintf(fn, sizeof(fn), "%s/%s", qdir, de->d_name);
-						if (!stat(fn, &st)) {
-							if (S_ISREG(st.st_mode)) {
-								if (st.st_mtime <= now) {
-									res = scan_service(fn, now, st.st_atime);
-									if (res > 0) {
-										/* Update next service time */
-										if (!next || (res < next)) {
-											next = res;
-										}
-									} else if (res)
-										ast_log(LOG_WARNING, "Failed to scan service '%s'\n", fn);
-								} else {
-									/* Update "next" update if necessary */
-									if (!next || (st.st_mtime < next))
-										next = st.st_mtime;
-								}
-							}
-						} else
-							ast_log(LOG_WARNING, "Unable to stat %s: %s\n", fn, strerror(errno));
-					}
-					closedir(dir);
-				} else
-					ast_log(LOG_WARNING, "Unable to open directory %s: %s\n", qdir, strerror(errno));
+
+	if (!(dir = opendir(qdir))) {
+		ast_log(LOG_WARNING, "Unable to open directory %s: %s\n", qdir, strerror(errno));
+		return;
+	}
+	ast_mutex_lock(&spool_lock);
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] != '.')
+			spool_consider(de->d_name, new_only);
+	}
+	ast_mutex_unlock(&spool_lock);
+	closedir(dir);
+}
+
+#ifdef SPOOL_INOTIFY
+static void spool_read_events(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *ev;
+	char *p;
+	ssize_t len;
+	int overflow = 0;
+
+	while ((len = read(spool_notify, buf, sizeof(buf))) > 0) {
+		ast_mutex_lock(&spool_lock);
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *) p;
+			if (ev->mask & IN_Q_OVERFLOW)
+				overflow = 1;
+			else if (ev->len && (ev->name[0] != '.'))
+				spool_consider(ev->name, 0);
+		}
+		ast_mutex_unlock(&spool_lock);
+	}
+	if (overflow) {
+		ast_log(LOG_NOTICE, "Lost track of %s, rescanning\n", qdir);
+		spool_scan(0);
+	}
+}
+#endif
+
+/*!
+ * \brief Start the calls whose files are due, at most maxrate a second, then
+ * sleep until the next one is due or a new file shows up.  Without inotify
+ * the directory is checked for new files once a second.
+ */
+static void *scan_thread(void *unused)
+{
+	struct spool_file *sf;
+	struct stat st;
+	struct timeval tv;
+	struct pollfd fds[2];
+	time_t last = 0, second = 0, now;
+	int started = 0, timeout, nfds, res;
+	char buf[64];
+
+	if (!stat(qdir, &st))
+		last = st.st_mtime;
+	spool_scan(0);
+	for (;;) {
+		tv = ast_tvnow();
+		now = tv.tv_sec;
+		if (now != second) {
+			second = now;
+			started = 0;
+		}
+		timeout = -1;
+		ast_mutex_lock(&spool_lock);
+		while ((sf = AST_LIST_FIRST(&spool_timers))) {
+			if (sf->when > now) {
+				timeout = (sf->when - now > 60) ? 60000 : (sf->when - now) * 1000 - tv.tv_usec / 1000;
+				break;
 			}
-		} else
-			ast_log(LOG_WARNING, "Unable to stat %s\n", qdir);
+			if (maxrate && (started >= maxrate)) {
+				timeout = 1000 - tv.tv_usec / 1000;
+				break;
+			}
+			AST_LIST_REMOVE_HEAD(&spool_timers, list);
+			sf->queued = 0;
+			/* Someone may have removed or postponed it meanwhile */
+			if (stat(sf->fn, &st)) {
+				spool_forget(sf);
+				continue;
+			}
+			if (st.st_mtime > now) {
+				spool_schedule(sf, st.st_mtime);
+				continue;
+			}
+			started++;
+			res = scan_service(sf->fn, now, st.st_atime);
+			if (sf->o)
+				continue;
+			if (res > 0)
+				spool_schedule(sf, res);
+			else {
+				if (res)
+					ast_log(LOG_WARNING, "Failed to scan service '%s'\n", sf->fn);
+				spool_done(sf, now);
+			}
+		}
+		ast_mutex_unlock(&spool_lock);
+
+		fds[0].fd = spool_pipe[0];
+		fds[0].events = POLLIN;
+		nfds = 1;
+		if (spool_notify > -1) {
+			fds[1].fd = spool_notify;
+			fds[1].events = POLLIN;
+			nfds = 2;
+		} else if ((timeout < 0) || (timeout > 1000))
+			timeout = 1000;
+
+		res = poll(fds, nfds, timeout);
+		if (res < 0) {
+			if (errno != EINTR)
+				ast_log(LOG_WARNING, "poll() failed: %s\n", strerror(errno));
+			continue;
+		}
+		if (fds[0].revents & POLLIN) {
+			while (read(spool_pipe[0], buf, sizeof(buf)) > 0)
+				;
+		}
+#ifdef SPOOL_INOTIFY
+		if ((nfds > 1) && (fds[1].revents & POLLIN))
+			spool_read_events();
+#endif
+		if (spool_notify < 0) {
+			if (!stat(qdir, &st)) {
+				if (st.st_mtime != last) {
+					last = st.st_mtime;
+					spool_scan(1);
+				}
+			} else
+				ast_log(LOG_WARNING, "Unable to stat %s\n", qdir);
+		}
 	}
 	return NULL;
 }
 
+static void load_config(void)
+{
+	struct ast_config *cfg;
+	const char *s;
+
+	if (!(cfg = ast_config_load("pbx_spool.conf")))
+		return;
+	if ((s = ast_variable_retrieve(cfg, "general", "maxworkers"))) {
+		if ((sscanf(s, "%d", &maxworkers) != 1) || (maxworkers < 1)) {
+			ast_log(LOG_WARNING, "Invalid maxworkers '%s' in pbx_spool.conf\n", s);
+			maxworkers = 100;
+		}
+	}
+	if ((s = ast_variable_retrieve(cfg, "general", "maxrate"))) {
+		if ((sscanf(s, "%d", &maxrate) != 1) || (maxrate < 0)) {
+			ast_log(LOG_WARNING, "Invalid maxrate '%s' in pbx_spool.conf\n", s);
+			maxrate = 0;
+		}
+	}
+	ast_config_destroy(cfg);
+}
+
 static int unload_module(void *mod)
 {
 	return -1;
@@ -497,6 +840,25 @@ static int load_module(void *mod)
 		return 0;
 	}
 	snprintf(qdonedir, sizeof(qdir), "%s/%s", ast_config_AST_SPOOL_DIR, "outgoing_done");
+	load_config();
+	ast_cond_init(&spool_cond, NULL);
+	if (pipe(spool_pipe)) {
+		ast_log(LOG_WARNING, "Unable to create pipe: %s\n", strerror(errno));
+		return -1;
+	}
+	fcntl(spool_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(spool_pipe[1], F_SETFL, O_NONBLOCK);
+#ifdef SPOOL_INOTIFY
+	if ((spool_notify = inotify_init()) > -1) {
+		fcntl(spool_notify, F_SETFL, O_NONBLOCK);
+		if (inotify_add_watch(spool_notify, qdir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+			ast_log(LOG_WARNING, "Unable to watch %s, checking it every second: %s\n", qdir, strerror(errno));
+			close(spool_notify);
+			spool_notify = -1;
+		}
+	} else
+		ast_log(LOG_WARNING, "Unable to initialize inotify, checking %s every second: %s\n", qdir, strerror(errno));
+#endif
 	pthread_attr_init(&attr);
  	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 	if ((ret = ast_pthread_create(&thread,&attr,scan_thread, NULL)) != 0) {
@@ -37,6 +37,13 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <sys/time.h>
 #include <sys/signal.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define PARKING_EPOLL	/*!< watch parked channels with a persistent epoll set */
+#else
+#include <sys/poll.h>
+#endif
 
 #include "asterisk.h"
 
@@ -139,14 +146,344 @@ struct parkeduser {
 	int notquiteyet;
 	char peername[1024];
 	unsigned char moh_trys;
-	struct parkeduser *next;
+	struct timeval expire;                      /*!< When the parking time runs out */
+	unsigned int generation;                    /*!< Tells reuses of a parking space apart */
+	int timer;                                  /*!< Position in parking_timers, -1 if not there */
+	int watched[AST_MAX_FDS];                   /*!< Channel descriptors being watched */
 };
 
-static struct parkeduser *parkinglot;
+/*! \brief Parked calls, indexed by parking space number - parkinglot_first */
+static struct parkeduser **parkinglot;
+static int parkinglot_first;
+static int parkinglot_size;
+static int parkinglot_count;				/*!< calls parked */
+
+/*! \brief Parked calls waiting to time out, a binary heap ordered by expiry */
+static struct parkeduser **parking_timers;
+static int parking_timers_count;
+static int parking_timers_alloc;
+
+static unsigned int parking_generation;
 
 AST_MUTEX_DEFINE_STATIC(parking_lock);	/*!< protects all static variables above */
 
 static pthread_t parking_thread;
+static int parking_pipe[2] = { -1, -1 };		/*!< wakes up the parking thread */
+#ifdef PARKING_EPOLL
+static int parking_epfd = -1;
+#endif
+
+#define PARKING_EVENTS 64				/*!< descriptor events handled per wakeup */
+#define PARKING_WAKE ((uint64_t) 0xff)			/*!< event key of parking_pipe */
+
+/*! \brief A ready descriptor of a parked channel */
+struct park_event {
+	uint64_t key;		/*!< generation, parking space and fd index, see park_key() */
+	int exception;
+};
+
+/*! \brief Find the call parked on a space, parking_lock held */
+static struct parkeduser *park_find(int num)
+{
+	if (num < parkinglot_first || num >= parkinglot_first + parkinglot_size)
+		return NULL;
+	return parkinglot[num - parkinglot_first];
+}
+
+/*! \brief Size the parking space index for the configured spaces and the
+ * calls still parked outside of them, parking_lock held */
+static int parkinglot_resize(void)
+{
+	struct parkeduser **lot;
+	int first = parking_start, last = parking_stop;
+	int x;
+
+	for (x = 0; x < parkinglot_size; x++) {
+		if (!parkinglot[x])
+			continue;
+		if (parkinglot[x]->parkingnum < first)
+			first = parkinglot[x]->parkingnum;
+		if (parkinglot[x]->parkingnum > last)
+			last = parkinglot[x]->parkingnum;
+	}
+	if (last < first)
+		last = first;
+	if (!(lot = ast_calloc(last - first + 1, sizeof(*lot))))
+		return -1;
+	for (x = 0; x < parkinglot_size; x++) {
+		if (parkinglot[x])
+			lot[parkinglot[x]->parkingnum - first] = parkinglot[x];
+	}
+	if (parkinglot)
+		free(parkinglot);
+	parkinglot = lot;
+	parkinglot_first = first;
+	parkinglot_size = last - first + 1;
+	return 0;
+}
+
+static void timer_set(int i, struct parkeduser *pu)
+{
+	parking_timers[i] = pu;
+	pu->timer = i;
+}
+
+static void timer_up(int i)
+{
+	struct parkeduser *pu = parking_timers[i];
+
+	while (i > 0 && ast_tvcmp(pu->expire, parking_timers[(i - 1) / 2]->expire) < 0) {
+		timer_set(i, parking_timers[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	timer_set(i, pu);
+}
+
+static void timer_down(int i)
+{
+	struct parkeduser *pu = parking_timers[i];
+	int c;
+
+	while ((c = 2 * i + 1) < parking_timers_count) {
+		if (c + 1 < parking_timers_count && ast_tvcmp(parking_timers[c + 1]->expire, parking_timers[c]->expire) < 0)
+			c++;
+		if (ast_tvcmp(parking_timers[c]->expire, pu->expire) >= 0)
+			break;
+		timer_set(i, parking_timers[c]);
+		i = c;
+	}
+	timer_set(i, pu);
+}
+
+/*! \brief Make room in the heap for every parked call, so adding never fails */
+static int timer_reserve(int count)
+{
+	struct parkeduser **timers;
+	int alloc;
+
+	if (count <= parking_timers_alloc)
+		return 0;
+	alloc = parking_timers_alloc ? parking_timers_alloc * 2 : 64;
+	while (alloc < count)
+		alloc *= 2;
+	if (!(timers = ast_realloc(parking_timers, alloc * sizeof(*timers))))
+		return -1;
+	parking_timers = timers;
+	parking_timers_alloc = alloc;
+	return 0;
+}
+
+static void timer_add(struct parkeduser *pu)
+{
+	timer_set(parking_timers_count++, pu);
+	timer_up(pu->timer);
+}
+
+static void timer_del(struct parkeduser *pu)
+{
+	struct parkeduser *last;
+	int i = pu->timer;
+
+	if (i < 0)
+		return;
+	pu->timer = -1;
+	last = parking_timers[--parking_timers_count];
+	if (i < parking_timers_count) {
+		timer_set(i, last);
+		timer_up(i);
+		timer_down(last->timer);
+	}
+}
+
+static uint64_t park_key(struct parkeduser *pu, int x)
+{
+	return ((uint64_t) pu->generation << 32) | ((uint64_t) (pu->parkingnum & 0xffffff) << 8) | x;
+}
+
+/*! \brief Map an event back to its parked call; events for calls that have
+ * left the parking space since are ignored */
+static struct parkeduser *park_from_key(uint64_t key, int *x)
+{
+	struct parkeduser *pu = park_find((key >> 8) & 0xffffff);
+
+	*x = key & 0xff;
+	if (!pu || (pu->generation != (unsigned int) (key >> 32)) || (*x >= AST_MAX_FDS) || (pu->watched[*x] < 0))
+		return NULL;
+	return pu;
+}
+
+/*! \brief Bring the watched descriptors of a parked call in line with its channel */
+static void park_watch_sync(struct parkeduser *pu)
+{
+	int fds[AST_MAX_FDS];
+	int x, y;
+#ifdef PARKING_EPOLL
+	struct epoll_event ev;
+#endif
+
+	for (x = 0; x < AST_MAX_FDS; x++) {
+		fds[x] = pu->chan ? pu->chan->fds[x] : -1;
+		/* a descriptor listed twice is watched once */
+		for (y = 0; y < x && fds[x] > -1; y++) {
+			if (fds[y] == fds[x])
+				fds[x] = -1;
+		}
+	}
+#ifdef PARKING_EPOLL
+	memset(&ev, 0, sizeof(ev));
+	/* remove first, in case descriptors moved between slots */
+	for (x = 0; x < AST_MAX_FDS; x++) {
+		if ((pu->watched[x] > -1) && (pu->watched[x] != fds[x]))
+			epoll_ctl(parking_epfd, EPOLL_CTL_DEL, pu->watched[x], &ev);
+	}
+	for (x = 0; x < AST_MAX_FDS; x++) {
+		if ((fds[x] > -1) && (pu->watched[x] != fds[x])) {
+			ev.events = EPOLLIN | EPOLLPRI;
+			ev.data.u64 = park_key(pu, x);
+			if (epoll_ctl(parking_epfd, EPOLL_CTL_ADD, fds[x], &ev)) {
+				ast_log(LOG_WARNING, "Unable to watch descriptor %d of parked %s: %s\n", fds[x], pu->chan->name, strerror(errno));
+				fds[x] = -1;
+			}
+		}
+	}
+#endif
+	memcpy(pu->watched, fds, sizeof(pu->watched));
+}
+
+/*! \brief Start the parking time and watching the channel of a parked call */
+static void park_arm(struct parkeduser *pu)
+{
+	pu->expire = ast_tvadd(pu->start, ast_samp2tv(pu->parkingtime, 1000));
+	timer_add(pu);
+	park_watch_sync(pu);
+}
+
+/*! \brief Take a call out of the parking lot, parking_lock held */
+static void park_remove(struct parkeduser *pu)
+{
+	struct ast_channel *chan = pu->chan;
+
+	if (park_find(pu->parkingnum) == pu) {
+		parkinglot[pu->parkingnum - parkinglot_first] = NULL;
+		parkinglot_count--;
+	}
+	timer_del(pu);
+	pu->chan = NULL;
+	park_watch_sync(pu);
+	pu->chan = chan;
+}
+
+static void park_wake(void)
+{
+	/* a full pipe already has a wakeup pending */
+	if ((write(parking_pipe[1], "", 1) < 0) && (errno != EAGAIN))
+		ast_log(LOG_WARNING, "Unable to wake up the parking thread: %s\n", strerror(errno));
+}
+
+/*! \brief Wait for parked channels with something to read */
+static int park_wait(struct park_event *events, int max, int ms)
+{
+	char buf[32];
+	int res = 0;
+	int i, n;
+#ifdef PARKING_EPOLL
+	struct epoll_event ev[PARKING_EVENTS];
+
+	if (max > PARKING_EVENTS)
+		max = PARKING_EVENTS;
+	n = epoll_wait(parking_epfd, ev, max, ms);
+	for (i = 0; i < n; i++) {
+		if (ev[i].data.u64 == PARKING_WAKE) {
+			while (read(parking_pipe[0], buf, sizeof(buf)) > 0)
+				;
+			continue;
+		}
+		events[res].key = ev[i].data.u64;
+		events[res].exception = (ev[i].events & EPOLLPRI) ? 1 : 0;
+		res++;
+	}
+#else
+	/* without epoll, gather the descriptors on every wakeup */
+	static struct pollfd *pfds;
+	static uint64_t *keys;
+	static int alloc;
+	struct parkeduser *pu;
+	int x, count = 1;
+
+	ast_mutex_lock(&parking_lock);
+	if (alloc < parkinglot_count * AST_MAX_FDS + 1) {
+		alloc = parkinglot_count * AST_MAX_FDS + 1;
+		pfds = ast_realloc(pfds, alloc * sizeof(*pfds));
+		keys = ast_realloc(keys, alloc * sizeof(*keys));
+		if (!pfds || !keys) {
+			alloc = 0;
+			ast_mutex_unlock(&parking_lock);
+			usleep(ms < 0 || ms > 1000 ? 1000000 : ms * 1000);
+			return 0;
+		}
+	}
+	pfds[0].fd = parking_pipe[0];
+	pfds[0].events = POLLIN;
+	keys[0] = PARKING_WAKE;
+	for (i = 0; i < parkinglot_size; i++) {
+		if (!(pu = parkinglot[i]))
+			continue;
+		for (x = 0; x < AST_MAX_FDS; x++) {
+			if (pu->watched[x] < 0)
+				continue;
+			pfds[count].fd = pu->watched[x];
+			pfds[count].events = POLLIN | POLLPRI;
+			keys[count] = park_key(pu, x);
+			count++;
+		}
+	}
+	ast_mutex_unlock(&parking_lock);
+	n = poll(pfds, count, ms);
+	for (i = 0; i < count && n > 0 && res < max; i++) {
+		if (!pfds[i].revents)
+			continue;
+		n--;
+		if (keys[i] == PARKING_WAKE) {
+			while (read(parking_pipe[0], buf, sizeof(buf)) > 0)
+				;
+			continue;
+		}
+		events[res].key = keys[i];
+		events[res].exception = (pfds[i].revents & POLLPRI) ? 1 : 0;
+		res++;
+	}
+#endif
+	return res;
+}
+
+static int parking_init(void)
+{
+	int x;
+#ifdef PARKING_EPOLL
+	struct epoll_event ev;
+#endif
+
+	if (pipe(parking_pipe)) {
+		ast_log(LOG_ERROR, "Unable to create parking wakeup pipe: %s\n", strerror(errno));
+		return -1;
+	}
+	for (x = 0; x < 2; x++)
+		fcntl(parking_pipe[x], F_SETFL, fcntl(parking_pipe[x], F_GETFL) | O_NONBLOCK);
+#ifdef PARKING_EPOLL
+	if ((parking_epfd = epoll_create(PARKING_EVENTS)) < 0) {
+		ast_log(LOG_ERROR, "Unable to create parking epoll set: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = PARKING_WAKE;
+	if (epoll_ctl(parking_epfd, EPOLL_CTL_ADD, parking_pipe[0], &ev)) {
+		ast_log(LOG_ERROR, "Unable to watch parking wakeup pipe: %s\n", strerror(errno));
+		return -1;
+	}
+#endif
+	return 0;
+}
 
 char *ast_parking_ext(void)
 {
@@ -272,29 +609,26 @@ static int adsi_announce_park(struct ast_channel *chan, int parkingnum)
 	after these channels too */
 int ast_park_call(struct ast_channel *chan, struct ast_channel *peer, int timeout, int *extout)
 {
-	struct parkeduser *pu, *cur;
+	struct parkeduser *pu;
 	int i,x,parking_range;
 	char exten[AST_MAX_EXTENSION];
 	struct ast_context *con;
 	
 	if (!(pu = ast_calloc(1, sizeof(*pu)))) 
 		return -1;
+	pu->timer = -1;
+	for (i = 0; i < AST_MAX_FDS; i++)
+		pu->watched[i] = -1;
 
 	ast_mutex_lock(&parking_lock);
 	parking_range = parking_stop - parking_start+1;
 	for (i = 0; i < parking_range; i++) {
 		x = (i + parking_offset) % parking_range + parking_start;
-		cur = parkinglot;
-		while(cur) {
-			if (cur->parkingnum == x) 
-				break;
-			cur = cur->next;
-		}
-		if (!cur)
+		if (!park_find(x))
 			break;
 	}
 
-	if (!(i < parking_range)) {
+	if (!(i < parking_range) || (x - parkinglot_first >= parkinglot_size) || timer_reserve(parkinglot_count + 1)) {
 		ast_log(LOG_WARNING, "No more parking spaces\n");
 		free(pu);
 		ast_mutex_unlock(&parking_lock);
@@ -324,14 +658,19 @@ int ast_park_call(struct ast_channel *chan, struct ast_channel *peer, int timeou
 	ast_copy_string(pu->context, S_OR(chan->macrocontext, chan->context), sizeof(pu->context));
 	ast_copy_string(pu->exten, S_OR(chan->macroexten, chan->exten), sizeof(pu->exten));
 	pu->priority = chan->macropriority ? chan->macropriority : chan->priority;
-	pu->next = parkinglot;
-	parkinglot = pu;
+	if (!++parking_generation)
+		parking_generation++;
+	pu->generation = parking_generation;
+	parkinglot[x - parkinglot_first] = pu;
+	parkinglot_count++;
 	/* If parking a channel directly, don't quiet yet get parking running on it */
 	if (peer == chan) 
 		pu->notquiteyet = 1;
+	else
+		park_arm(pu);
 	ast_mutex_unlock(&parking_lock);
-	/* Wake up the (presumably select()ing) thread */
-	pthread_kill(parking_thread, SIGURG);
+	/* Wake up the parking thread to recompute its timeout */
+	park_wake();
 	if (option_verbose > 1) 
 		ast_verbose(VERBOSE_PREFIX_2 "Parked %s on %d. Will timeout back to extension [%s] %s, %d in %d seconds\n", pu->chan->name, pu->parkingnum, pu->context, pu->exten, pu->priority, (pu->parkingtime/1000));
 
@@ -365,11 +704,16 @@ int ast_park_call(struct ast_channel *chan, struct ast_channel *peer, int timeou
 	/* Tell the peer channel the number of the parking space */
 	if (peer) 
 		ast_say_digits(peer, pu->parkingnum, "", peer->language);
-	if (pu->notquiteyet) {
+	if (peer == chan) {
 		/* Wake up parking thread if we're really done */
-		ast_moh_start(pu->chan, NULL);
-		pu->notquiteyet = 0;
-		pthread_kill(parking_thread, SIGURG);
+		ast_moh_start(chan, NULL);
+		ast_mutex_lock(&parking_lock);
+		if (park_find(x) == pu) {
+			pu->notquiteyet = 0;
+			park_arm(pu);
+		}
+		ast_mutex_unlock(&parking_lock);
+		park_wake();
 	}
 	return 0;
 }
@@ -1429,169 +1773,140 @@ static void post_manager_event(const char *s, int num, struct ast_channel *chan)
 		);
 }
 
-/*! \brief Take care of parked calls and unpark them if needed */
-static void *do_parking_thread(void *ignore)
+/*! \brief Remove the dialplan extension of a parking space */
+static void park_remove_exten(int num)
 {
-	fd_set rfds, efds;	/* results from previous select, to be preserved across loops. */
-	FD_ZERO(&rfds);
-	FD_ZERO(&efds);
+	struct ast_context *con;
+	char exten[AST_MAX_EXTENSION];
 
-	for (;;) {
-		struct parkeduser *pu, *pl, *pt = NULL;
-		int ms = -1;	/* select timeout, uninitialized */
-		int max = -1;	/* max fd, none there yet */
-		fd_set nrfds, nefds;	/* args for the next select */
-		FD_ZERO(&nrfds);
-		FD_ZERO(&nefds);
+	if ((con = ast_context_find(parking_con))) {
+		snprintf(exten, sizeof(exten), "%d", num);
+		if (ast_context_remove_extension2(con, exten, 1, NULL))
+			ast_log(LOG_WARNING, "Whoa, failed to remove the extension!\n");
+	} else
+		ast_log(LOG_WARNING, "Whoa, no parking context?\n");
+}
 
-		ast_mutex_lock(&parking_lock);
-		pl = NULL;
-		pu = parkinglot;
-		/* navigate the list with prev-cur pointers to support removals */
-		while(pu) {
-			struct ast_channel *chan = pu->chan;	/* shorthand */
-			int tms;        /* timeout for this item */
-			int x;          /* fd index in channel */
-			struct ast_context *con;
-
-			if (pu->notquiteyet) { /* Pretend this one isn't here yet */
-				pl = pu;
-				pu = pu->next;
-				continue;
+/*! \brief A parked call ran out of parking time, send it back */
+static void park_timeout(struct parkeduser *pu)
+{
+	struct ast_channel *chan = pu->chan;	/* shorthand */
+	struct ast_context *con;
+
+	/* Stop watching, the PBX is going to read the channel */
+	park_remove(pu);
+	/* Stop music on hold */
+	ast_moh_stop(chan);
+	ast_indicate(chan, AST_CONTROL_UNHOLD);
+	/* Get chan, exten from derived kludge */
+	if (pu->peername[0]) {
+		char *peername = ast_strdupa(pu->peername);
+		char *cp = strrchr(peername, '-');
+		if (cp) 
+			*cp = 0;
+		con = ast_context_find(parking_con_dial);
+		if (!con) {
+			con = ast_context_create(NULL, parking_con_dial, registrar);
+			if (!con) {
+				ast_log(LOG_ERROR, "Parking dial context '%s' does not exist and unable to create\n", parking_con_dial);
 			}
-			tms = ast_tvdiff_ms(ast_tvnow(), pu->start);
-			if (tms > pu->parkingtime) {
-				/* Stop music on hold */
-				ast_moh_stop(chan);
-				ast_indicate(chan, AST_CONTROL_UNHOLD);
-				/* Get chan, exten from derived kludge */
-				if (pu->peername[0]) {
-					char *peername = ast_strdupa(pu->peername);
-					char *cp = strrchr(peername, '-');
-					if (cp) 
-						*cp = 0;
-					con = ast_context_find(parking_con_dial);
-					if (!con) {
-						con = ast_context_create(NULL, parking_con_dial, registrar);
-						if (!con) {
-							ast_log(LOG_ERROR, "Parking dial context '%s' does not exist and unable to create\n", parking_con_dial);
-						}
-					}
-					if (con) {
-						char returnexten[AST_MAX_EXTENSION];
-						snprintf(returnexten, sizeof(returnexten), "%s||t", peername);
-						ast_add_extension2(con, 1, peername, 1, NULL, NULL, "Dial", strdup(returnexten), FREE, registrar);
-					}
-					set_c_e_p(chan, parking_con_dial, peername, 1);
-				} else {
-					/* They've been waiting too long, send them back to where they came.  Theoretically they
-					   should have their original extensions and such, but we copy to be on the safe side */
-					set_c_e_p(chan, pu->context, pu->exten, pu->priority);
-				}
+		}
+		if (con) {
+			char returnexten[AST_MAX_EXTENSION];
+			snprintf(returnexten, sizeof(returnexten), "%s||t", peername);
+			ast_add_extension2(con, 1, peername, 1, NULL, NULL, "Dial", strdup(returnexten), FREE, registrar);
+		}
+		set_c_e_p(chan, parking_con_dial, peername, 1);
+	} else {
+		/* They've been waiting too long, send them back to where they came.  Theoretically they
+		   should have their original extensions and such, but we copy to be on the safe side */
+		set_c_e_p(chan, pu->context, pu->exten, pu->priority);
+	}
 
-				post_manager_event("ParkedCallTimeOut", pu->parkingnum, chan);
+	post_manager_event("ParkedCallTimeOut", pu->parkingnum, chan);
 
-				if (option_verbose > 1) 
-					ast_verbose(VERBOSE_PREFIX_2 "Timeout for %s parked on %d. Returning to %s,%s,%d\n", chan->name, pu->parkingnum, chan->context, chan->exten, chan->priority);
-				/* Start up the PBX, or hang them up */
-				if (ast_pbx_start(chan))  {
-					ast_log(LOG_WARNING, "Unable to restart the PBX for user on '%s', hanging them up...\n", chan->name);
-					ast_hangup(chan);
-				}
-				/* And take them out of the parking lot */
-				if (pl) 
-					pl->next = pu->next;
-				else
-					parkinglot = pu->next;
-				pt = pu;
-				pu = pu->next;
-				con = ast_context_find(parking_con);
-				if (con) {
-					char exten[AST_MAX_EXTENSION];
-					snprintf(exten, sizeof(exten), "%d", pt->parkingnum);
-					if (ast_context_remove_extension2(con, exten, 1, NULL))
-						ast_log(LOG_WARNING, "Whoa, failed to remove the extension!\n");
-				} else
-					ast_log(LOG_WARNING, "Whoa, no parking context?\n");
-				free(pt);
-			} else {	/* still within parking time, process descriptors */
-				for (x = 0; x < AST_MAX_FDS; x++) {
-					struct ast_frame *f;
+	if (option_verbose > 1) 
+		ast_verbose(VERBOSE_PREFIX_2 "Timeout for %s parked on %d. Returning to %s,%s,%d\n", chan->name, pu->parkingnum, chan->context, chan->exten, chan->priority);
+	/* Start up the PBX, or hang them up */
+	if (ast_pbx_start(chan))  {
+		ast_log(LOG_WARNING, "Unable to restart the PBX for user on '%s', hanging them up...\n", chan->name);
+		ast_hangup(chan);
+	}
+	park_remove_exten(pu->parkingnum);
+	free(pu);
+}
 
-					if (chan->fds[x] == -1 || (!FD_ISSET(chan->fds[x], &rfds) && !FD_ISSET(chan->fds[x], &efds)))
-						continue;	/* nothing on this descriptor */
+/*! \brief Read what arrived on a descriptor of a parked channel */
+static void park_service(struct parkeduser *pu, int x, int exception)
+{
+	struct ast_channel *chan = pu->chan;	/* shorthand */
+	struct ast_frame *f;
 
-					if (FD_ISSET(chan->fds[x], &efds))
-						ast_set_flag(chan, AST_FLAG_EXCEPTION);
-					else
-						ast_clear_flag(chan, AST_FLAG_EXCEPTION);
-					chan->fdno = x;
-					/* See if they need servicing */
-					f = ast_read(chan);
-					if (!f || (f->frametype == AST_FRAME_CONTROL && f->subclass ==  AST_CONTROL_HANGUP)) {
-						if (f)
-							ast_frfree(f);
-						post_manager_event("ParkedCallGiveUp", pu->parkingnum, chan);
-
-						/* There's a problem, hang them up*/
-						if (option_verbose > 1) 
-							ast_verbose(VERBOSE_PREFIX_2 "%s got tired of being parked\n", chan->name);
-						ast_hangup(chan);
-						/* And take them out of the parking lot */
-						if (pl) 
-							pl->next = pu->next;
-						else
-							parkinglot = pu->next;
-						pt = pu;
-						pu = pu->next;
-						con = ast_context_find(parking_con);
-						if (con) {
-							char exten[AST_MAX_EXTENSION];
-							snprintf(exten, sizeof(exten), "%d", pt->parkingnum);
-							if (ast_context_remove_extension2(con, exten, 1, NULL))
-								ast_log(LOG_WARNING, "Whoa, failed to remove the extension!\n");
-						} else
-							ast_log(LOG_WARNING, "Whoa, no parking context?\n");
-						free(pt);
-						break;
-					} else {
-						/*! \todo XXX Maybe we could do something with packets, like dial "0" for operator or something XXX */
-						ast_frfree(f);
-						if (pu->moh_trys < 3 && !chan->generatordata) {
-							if (option_debug)
-								ast_log(LOG_DEBUG, "MOH on parked call stopped by outside source.  Restarting.\n");
-							ast_moh_start(chan, NULL);
-							pu->moh_trys++;
-						}
-						goto std;	/*! \todo XXX Ick: jumping into an else statement??? XXX */
-					}
+	if (exception)
+		ast_set_flag(chan, AST_FLAG_EXCEPTION);
+	else
+		ast_clear_flag(chan, AST_FLAG_EXCEPTION);
+	chan->fdno = x;
+	/* See if they need servicing */
+	f = ast_read(chan);
+	if (!f || (f->frametype == AST_FRAME_CONTROL && f->subclass ==  AST_CONTROL_HANGUP)) {
+		if (f)
+			ast_frfree(f);
+		post_manager_event("ParkedCallGiveUp", pu->parkingnum, chan);
 
-				} /* end for */
-				if (x >= AST_MAX_FDS) {
-std:					for (x=0; x<AST_MAX_FDS; x++) {	/* mark fds for next round */
-						if (chan->fds[x] > -1) {
-							FD_SET(chan->fds[x], &nrfds);
-							FD_SET(chan->fds[x], &nefds);
-							if (chan->fds[x] > max)
-								max = chan->fds[x];
-						}
-					}
-					/* Keep track of our shortest wait */
-					if (tms < ms || ms < 0)
-						ms = tms;
-					pl = pu;
-					pu = pu->next;
-				}
-			}
-		} /* end while */
+		/* There's a problem, hang them up*/
+		if (option_verbose > 1) 
+			ast_verbose(VERBOSE_PREFIX_2 "%s got tired of being parked\n", chan->name);
+		/* And take them out of the parking lot */
+		park_remove(pu);
+		ast_hangup(chan);
+		park_remove_exten(pu->parkingnum);
+		free(pu);
+		return;
+	}
+	/*! \todo XXX Maybe we could do something with packets, like dial "0" for operator or something XXX */
+	ast_frfree(f);
+	if (pu->moh_trys < 3 && !chan->generatordata) {
+		if (option_debug)
+			ast_log(LOG_DEBUG, "MOH on parked call stopped by outside source.  Restarting.\n");
+		ast_moh_start(chan, NULL);
+		pu->moh_trys++;
+	}
+	/* reading may have masqueraded the channel or changed its descriptors */
+	park_watch_sync(pu);
+}
+
+/*! \brief Take care of parked calls and unpark them if needed.
+ * Parked channels stay in the watch set while parked, and parking timeouts
+ * are kept in a heap, so a wakeup costs only the calls that need attention.
+ */
+static void *do_parking_thread(void *ignore)
+{
+	struct park_event events[PARKING_EVENTS];
+	struct parkeduser *pu;
+	struct timeval now;
+	int i, n, x, ms;
+
+	for (;;) {
+		ast_mutex_lock(&parking_lock);
+		if (!parking_timers_count)
+			ms = -1;
+		else if ((ms = ast_tvdiff_ms(parking_timers[0]->expire, ast_tvnow()) + 1) < 0)
+			ms = 0;
 		ast_mutex_unlock(&parking_lock);
-		rfds = nrfds;
-		efds = nefds;
-		{
-			struct timeval tv = ast_samp2tv(ms, 1000);
-			/* Wait for something to happen */
-			ast_select(max + 1, &rfds, NULL, &efds, (ms > -1) ? &tv : NULL);
+
+		/* Wait for something to happen */
+		n = park_wait(events, PARKING_EVENTS, ms);
+
+		ast_mutex_lock(&parking_lock);
+		for (i = 0; i < n; i++) {
+			if ((pu = park_from_key(events[i].key, &x)) && !pu->notquiteyet)
+				park_service(pu, x, events[i].exception);
 		}
+		now = ast_tvnow();
+		while (parking_timers_count && ast_tvcmp(parking_timers[0]->expire, now) <= 0)
+			park_timeout(parking_timers[0]);
+		ast_mutex_unlock(&parking_lock);
 		pthread_testcancel();
 	}
 	return NULL;	/* Never reached */
@@ -1625,8 +1940,7 @@ static int park_exec(struct ast_channel *chan, void *data)
 	int res=0;
 	struct localuser *u;
 	struct ast_channel *peer=NULL;
-	struct parkeduser *pu, *pl=NULL;
-	struct ast_context *con;
+	struct parkeduser *pu;
 	int park;
 	struct ast_bridge_config config;
 
@@ -1637,29 +1951,12 @@ static int park_exec(struct ast_channel *chan, void *data)
 	LOCAL_USER_ADD(u);
 	park = atoi((char *)data);
 	ast_mutex_lock(&parking_lock);
-	pu = parkinglot;
-	while(pu) {
-		if (pu->parkingnum == park) {
-			if (pl)
-				pl->next = pu->next;
-			else
-				parkinglot = pu->next;
-			break;
-		}
-		pl = pu;
-		pu = pu->next;
-	}
+	if ((pu = park_find(park)))
+		park_remove(pu);
 	ast_mutex_unlock(&parking_lock);
 	if (pu) {
 		peer = pu->chan;
-		con = ast_context_find(parking_con);
-		if (con) {
-			char exten[AST_MAX_EXTENSION];
-			snprintf(exten, sizeof(exten), "%d", pu->parkingnum);
-			if (ast_context_remove_extension2(con, exten, 1, NULL))
-				ast_log(LOG_WARNING, "Whoa, failed to remove the extension!\n");
-		} else
-			ast_log(LOG_WARNING, "Whoa, no parking context?\n");
+		park_remove_exten(pu->parkingnum);
 
 		manager_event(EVENT_FLAG_CALL, "UnParkedCall",
 			"Exten: %d\r\n"
@@ -1798,13 +2095,16 @@ static int handle_parkedcalls(int fd, int argc, char *argv[])
 {
 	struct parkeduser *cur;
 	int numparked = 0;
+	int x;
 
 	ast_cli(fd, "%4s %25s (%-15s %-12s %-4s) %-6s \n", "Num", "Channel"
 		, "Context", "Extension", "Pri", "Timeout");
 
 	ast_mutex_lock(&parking_lock);
 
-	for (cur = parkinglot; cur; cur = cur->next) {
+	for (x = 0; x < parkinglot_size; x++) {
+		if (!(cur = parkinglot[x]))
+			continue;
 		ast_cli(fd, "%4d %25s (%-15s %-12s %-4d) %6lds\n"
 			,cur->parkingnum, cur->chan->name, cur->context, cur->exten
 			,cur->priority, cur->start.tv_sec + (cur->parkingtime/1000) - time(NULL));
@@ -1831,6 +2131,7 @@ static int manager_parking_status( struct mansession *s, struct message *m )
 	struct parkeduser *cur;
 	char *id = astman_get_header(m,"ActionID");
 	char idText[256] = "";
+	int x;
 
 	if (!ast_strlen_zero(id))
 		snprintf(idText,256,"ActionID: %s\r\n",id);
@@ -1839,7 +2140,9 @@ static int manager_parking_status( struct mansession *s, struct message *m )
 
         ast_mutex_lock(&parking_lock);
 
-	for (cur=parkinglot; cur; cur = cur->next) {
+	for (x = 0; x < parkinglot_size; x++) {
+		if (!(cur = parkinglot[x]))
+			continue;
 		astman_append(s, "Event: ParkedCall\r\n"
 			"Exten: %d\r\n"
 			"Channel: %s\r\n"
@@ -2133,6 +2436,11 @@ static int load_config(void)
 	}
 	ast_config_destroy(cfg);
 
+	ast_mutex_lock(&parking_lock);
+	if (parkinglot_resize())
+		ast_log(LOG_WARNING, "Unable to resize the parking lot to %d-%d\n", parking_start, parking_stop);
+	ast_mutex_unlock(&parking_lock);
+
 	/* Remove the old parking extension */
 	if (!ast_strlen_zero(old_parking_con) && (con = ast_context_find(old_parking_con)))	{
 		ast_context_remove_extension2(con, old_parking_ext, 1, registrar);
@@ -2162,6 +2470,8 @@ static int load_module(void *mod)
 
 	if ((res = load_config()))
 		return res;
+	if (parking_init())
+		return -1;
 	ast_cli_register(&showparked);
 	ast_cli_register(&showfeatures);
 	ast_pthread_create(&parking_thread, NULL, do_parking_thread, NULL);
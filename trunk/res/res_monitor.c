@@ -216,6 +216,9 @@ int ast_monitor_start(	struct ast_channel *chan, const char *format_spec,
 			ast_channel_unlock(chan);
 			return -1;
 		}
+		/* keep disk writes out of the channel's frame path */
+		ast_filestream_set_async(monitor->read_stream);
+		ast_filestream_set_async(monitor->write_stream);
 		chan->monitor = monitor;
 		ast_monitor_set_state(chan, AST_MONITOR_RUNNING);
 		/* so we know this call has been monitored in case we need to bill for it or something */
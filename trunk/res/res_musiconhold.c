@@ -130,6 +130,25 @@ struct moh_files_state {
 #define MOH_SINGLE		(1 << 1)
 #define MOH_CUSTOM		(1 << 2)
 #define MOH_RANDOMIZE		(1 << 3)
+#define MOH_SHARED		(1 << 4)
+
+#define MOH_FORMAT_BITS		32	/*!< Number of audio format bits a shared stream can serve */
+#define MOH_RING_SIZE		64	/*!< Frames kept in a shared stream */
+#define MOH_FRAME_SAMPLES	160	/*!< Samples per frame produced for a shared stream */
+
+/*! One frame of a shared stream, translated into every format a listener needs */
+struct moh_chunk {
+	int refs;
+	struct ast_frame *f[MOH_FORMAT_BITS];
+};
+
+struct moh_shared_state {
+	struct mohclass *class;
+	int origwfmt;
+	int index;				/*!< Bit index of the format we write */
+	unsigned int pos;			/*!< Sequence number of the next chunk to play */
+	int sample_queue;
+};
 
 struct mohclass {
 	char name[MAX_MUSICCLASS];
@@ -142,6 +161,8 @@ struct mohclass {
 	int allowed_files;
 	/*! The current number of files loaded into the filearray */
 	int total_files;
+	/*! The file extension to read each entry of filearray from (shared mode) */
+	char **extarray;
 	unsigned int flags;
 	/*! The format from the MOH source, not applicable to "files" mode */
 	int format;
@@ -153,6 +174,20 @@ struct mohclass {
 	int srcfd;
 	/*! FD for timing source */
 	int pseudofd;
+	/*! Shared stream: frames are produced once and referenced by all listeners */
+	ast_mutex_t ringlock;
+	struct moh_chunk *ring[MOH_RING_SIZE];
+	/*! Sequence number of the next chunk produced */
+	unsigned int ringseq;
+	/*! The format frames are produced in */
+	int srcformat;
+	/*! Number of shared stream listeners */
+	int listeners;
+	/*! Set to ask the shared stream producer to exit */
+	int stop;
+	/*! Number of shared stream listeners per output format */
+	int fmtusers[MOH_FORMAT_BITS];
+	struct ast_trans_pvt *transpath[MOH_FORMAT_BITS];
 	AST_LIST_HEAD_NOLOCK(, mohdata) members;
 	AST_LIST_ENTRY(mohclass) list;
 };
@@ -171,6 +206,19 @@ AST_LIST_HEAD_STATIC(mohclasses, mohclass);
 #define MPG_123 "/usr/bin/mpg123"
 #define MAX_MP3S 256
 
+static void moh_chunk_unref(struct moh_chunk *chunk)
+{
+	int x;
+
+	if (!ast_atomic_dec_and_test(&chunk->refs))
+		return;
+
+	for (x = 0; x < MOH_FORMAT_BITS; x++) {
+		if (chunk->f[x])
+			ast_frfree(chunk->f[x]);
+	}
+	free(chunk);
+}
 
 static void ast_moh_free_class(struct mohclass **mohclass) 
 {
@@ -182,15 +230,34 @@ static void ast_moh_free_class(struct mohclass **mohclass)
 		free(member);
 	
 	if (class->thread) {
-		pthread_cancel(class->thread);
+		if (ast_test_flag(class, MOH_SHARED)) {
+			/* Shared stream producers never take the class list lock, so
+			   we can wait for them before freeing the ring they write to */
+			class->stop = 1;
+			pthread_join(class->thread, NULL);
+		} else
+			pthread_cancel(class->thread);
 		class->thread = 0;
 	}
 
 	if (class->filearray) {
-		for (i = 0; i < class->total_files; i++)
+		for (i = 0; i < class->total_files; i++) {
 			free(class->filearray[i]);
+			free(class->extarray[i]);
+		}
 		free(class->filearray);
+		free(class->extarray);
+	}
+
+	for (i = 0; i < MOH_RING_SIZE; i++) {
+		if (class->ring[i])
+			moh_chunk_unref(class->ring[i]);
+	}
+	for (i = 0; i < MOH_FORMAT_BITS; i++) {
+		if (class->transpath[i])
+			ast_translator_free_path(class->transpath[i]);
 	}
+	ast_mutex_destroy(&class->ringlock);
 
 	free(class);
 	*mohclass = NULL;
@@ -332,6 +399,272 @@ static struct ast_generator moh_file_stream =
 	generate: moh_files_generator,
 };
 
+static int moh_format_index(int format)
+{
+	int x;
+
+	for (x = 0; x < MOH_FORMAT_BITS - 1; x++) {
+		if (format & (1 << x))
+			break;
+	}
+
+	return x;
+}
+
+/*! \brief Publish one frame of a shared stream
+ *
+ * The frame is translated once into every format that currently has a
+ * listener; listeners then only take a reference to the chunk.
+ */
+static void moh_shared_push(struct mohclass *class, struct ast_frame *f)
+{
+	struct moh_chunk *chunk;
+	struct moh_chunk *old;
+	struct ast_frame *out;
+	int x;
+
+	if ((chunk = ast_calloc(1, sizeof(*chunk)))) {
+		chunk->refs = 1;
+
+		ast_mutex_lock(&class->ringlock);
+		for (x = 0; x < MOH_FORMAT_BITS; x++) {
+			if (!class->fmtusers[x])
+				continue;
+			if ((1 << x) == f->subclass)
+				chunk->f[x] = ast_frdup(f);
+			else if (class->transpath[x] && (out = ast_translate(class->transpath[x], f, 0)))
+				chunk->f[x] = ast_frdup(out);
+		}
+		old = class->ring[class->ringseq % MOH_RING_SIZE];
+		class->ring[class->ringseq % MOH_RING_SIZE] = chunk;
+		class->ringseq++;
+		ast_mutex_unlock(&class->ringlock);
+
+		if (old)
+			moh_chunk_unref(old);
+	}
+}
+
+/*! \brief Open the next playable file of a shared "files" class */
+static struct ast_filestream *moh_files_shared_next(struct mohclass *class, int *pos)
+{
+	struct ast_filestream *fs = NULL;
+	char filename[PATH_MAX];
+	char ext[16];
+	int tries;
+
+	for (tries = 0; !fs && tries < 20; tries++) {
+		ast_mutex_lock(&class->ringlock);
+		if (!class->total_files) {
+			ast_mutex_unlock(&class->ringlock);
+			break;
+		}
+		if (ast_test_flag(class, MOH_RANDOMIZE))
+			*pos = ast_random() % class->total_files;
+		else
+			*pos = (*pos + 1) % class->total_files;
+		ast_copy_string(filename, class->filearray[*pos], sizeof(filename));
+		ast_copy_string(ext, class->extarray[*pos], sizeof(ext));
+		ast_mutex_unlock(&class->ringlock);
+
+		fs = ast_readfile(filename, ext, NULL, O_RDONLY, 0, 0);
+		if (fs && option_debug)
+			ast_log(LOG_DEBUG, "Class '%s' opened file %d '%s.%s'\n", class->name, *pos, filename, ext);
+	}
+
+	return fs;
+}
+
+/*! Decoding state of a shared "files" class producer */
+struct moh_files_producer {
+	struct ast_filestream *fs;
+	struct ast_trans_pvt *trans;
+	int transformat;
+};
+
+static void moh_files_shared_cleanup(void *data)
+{
+	struct moh_files_producer *p = data;
+
+	if (p->fs)
+		ast_closestream(p->fs);
+	if (p->trans)
+		ast_translator_free_path(p->trans);
+}
+
+/*! \brief Producer thread for a shared "files" class
+ *
+ * Reads the class files in real time, decodes them to signed linear and
+ * publishes them on the class ring.  Idles while nobody is listening.
+ */
+static void *moh_files_shared_thread(void *data)
+{
+	struct mohclass *class = data;
+	struct moh_files_producer p = { NULL, NULL, 0 };
+	struct ast_frame *f;
+	struct ast_frame *out;
+	struct timeval next;
+	int pos = -1;
+	int samples;
+	int ms;
+
+	next = ast_tvnow();
+	for (;;) {
+		ms = ast_tvdiff_ms(next, ast_tvnow());
+		if (ms > 0)
+			usleep(ms * 1000);
+		else if (ms < -1000)
+			next = ast_tvnow();	/* we fell far behind, don't try to catch up */
+		if (class->stop)
+			break;
+
+		if (!class->listeners) {
+			next = ast_tvadd(ast_tvnow(), ast_samp2tv(100, 1000));
+			continue;
+		}
+
+		if (!p.fs || !(f = ast_readframe(p.fs))) {
+			if (p.fs) {
+				ast_closestream(p.fs);
+				p.fs = NULL;
+			}
+			if (!(p.fs = moh_files_shared_next(class, &pos)) || !(f = ast_readframe(p.fs))) {
+				/* Nothing playable right now, try again in a second */
+				next = ast_tvadd(ast_tvnow(), ast_samp2tv(1000, 1000));
+				continue;
+			}
+		}
+
+		samples = f->samples;
+		out = f;
+		if ((f->frametype == AST_FRAME_VOICE) && (f->subclass != AST_FORMAT_SLINEAR)) {
+			if (f->subclass != p.transformat) {
+				if (p.trans)
+					ast_translator_free_path(p.trans);
+				p.trans = ast_translator_build_path(AST_FORMAT_SLINEAR, f->subclass);
+				p.transformat = f->subclass;
+			}
+			out = p.trans ? ast_translate(p.trans, f, 0) : NULL;
+		}
+		if (out && (out->frametype == AST_FRAME_VOICE))
+			moh_shared_push(class, out);
+		ast_frfree(f);
+
+		next = ast_tvadd(next, ast_samp2tv(samples ? samples : MOH_FRAME_SAMPLES, 8000));
+	}
+
+	moh_files_shared_cleanup(&p);
+
+	return NULL;
+}
+
+static void moh_shared_release(struct ast_channel *chan, void *data)
+{
+	struct moh_shared_state *state = data;
+	struct mohclass *class = state->class;
+
+	ast_mutex_lock(&class->ringlock);
+	class->fmtusers[state->index]--;
+	class->listeners--;
+	ast_mutex_unlock(&class->ringlock);
+
+	if (chan) {
+		if (state->origwfmt && ast_set_write_format(chan, state->origwfmt))
+			ast_log(LOG_WARNING, "Unable to restore channel '%s' to format '%d'\n", chan->name, state->origwfmt);
+		if (option_verbose > 2)
+			ast_verbose(VERBOSE_PREFIX_3 "Stopped music on hold on %s\n", chan->name);
+	}
+	free(state);
+}
+
+static void *moh_shared_alloc(struct ast_channel *chan, void *params)
+{
+	struct moh_shared_state *state;
+	struct mohclass *class = params;
+	int format;
+
+	if (!(state = ast_calloc(1, sizeof(*state))))
+		return NULL;
+
+	state->class = class;
+	state->origwfmt = chan->writeformat;
+
+	/* Write in the channel's native format, so nothing is translated per channel */
+	if (!(format = ast_best_codec(chan->nativeformats)))
+		format = class->srcformat;
+
+	ast_mutex_lock(&class->ringlock);
+	if ((format != class->srcformat) && !class->transpath[moh_format_index(format)]) {
+		if (!(class->transpath[moh_format_index(format)] = ast_translator_build_path(format, class->srcformat)))
+			format = class->srcformat;
+	}
+	state->index = moh_format_index(format);
+	class->fmtusers[state->index]++;
+	class->listeners++;
+	/* join the stream live, starting with the next chunk produced */
+	state->pos = class->ringseq;
+	ast_mutex_unlock(&class->ringlock);
+
+	if (ast_set_write_format(chan, format)) {
+		ast_log(LOG_WARNING, "Unable to set channel '%s' to format '%s'\n", chan->name, ast_codec2str(format));
+		moh_shared_release(NULL, state);
+		return NULL;
+	}
+
+	if (option_verbose > 2)
+		ast_verbose(VERBOSE_PREFIX_3 "Started music on hold, class '%s', on %s (shared)\n", class->name, chan->name);
+
+	return state;
+}
+
+static int moh_shared_generator(struct ast_channel *chan, void *data, int len, int samples)
+{
+	struct moh_shared_state *state = data;
+	struct mohclass *class = state->class;
+	struct moh_chunk *chunk;
+	struct ast_frame *f;
+	int res = 0;
+
+	state->sample_queue += samples;
+
+	while (state->sample_queue > 0) {
+		ast_mutex_lock(&class->ringlock);
+		if (class->ringseq - state->pos > MOH_RING_SIZE / 2) {
+			/* We fell behind the producer, skip ahead */
+			state->pos = class->ringseq - 1;
+		}
+		if (state->pos == class->ringseq) {
+			/* caught up with the producer; don't save up for a burst later */
+			ast_mutex_unlock(&class->ringlock);
+			state->sample_queue = 0;
+			break;
+		}
+		chunk = class->ring[state->pos % MOH_RING_SIZE];
+		state->pos++;
+		ast_atomic_fetchadd_int(&chunk->refs, 1);
+		ast_mutex_unlock(&class->ringlock);
+
+		if ((f = chunk->f[state->index])) {
+			state->sample_queue -= f->samples;
+			res = ast_write(chan, f);
+		}
+		moh_chunk_unref(chunk);
+		if (res < 0) {
+			ast_log(LOG_WARNING, "Failed to write frame to '%s': %s\n", chan->name, strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static struct ast_generator moh_shared_stream = 
+{
+	alloc: moh_shared_alloc,
+	release: moh_shared_release,
+	generate: moh_shared_generator,
+};
+
 static int spawn_mp3(struct mohclass *class)
 {
 	int fds[2];
@@ -478,6 +811,7 @@ static void *monmp3thread(void *data)
 
 	struct mohclass *class = data;
 	struct mohdata *moh;
+	struct ast_frame f;
 	char buf[8192];
 	short sbuf[8192];
 	int res, res2;
@@ -488,6 +822,8 @@ static void *monmp3thread(void *data)
 	tv.tv_usec = 0;
 	for(;/* ever */;) {
 		pthread_testcancel();
+		if (class->stop)
+			break;
 		/* Spawn mp3 player if it's not there */
 		if (class->srcfd < 0) {
 			if ((class->srcfd = spawn_mp3(class)) < 0) {
@@ -518,7 +854,9 @@ static void *monmp3thread(void *data)
 			}
 			res = 8 * MOH_MS_INTERVAL;	/* 8 samples per millisecond */
 		}
-		if (AST_LIST_EMPTY(&class->members))
+		if (class->stop)
+			break;
+		if (ast_test_flag(class, MOH_SHARED) ? !class->listeners : AST_LIST_EMPTY(&class->members))
 			continue;
 		/* Read mp3 audio */
 		len = ast_codec_get_len(class->format, res);
@@ -541,6 +879,20 @@ static void *monmp3thread(void *data)
 			continue;
 		}
 		pthread_testcancel();
+		if (ast_test_flag(class, MOH_SHARED)) {
+			/* Publish the audio as frames on the shared ring */
+			len = ast_codec_get_len(class->format, MOH_FRAME_SAMPLES);
+			for (res = 0; res < res2; res += len) {
+				memset(&f, 0, sizeof(f));
+				f.frametype = AST_FRAME_VOICE;
+				f.subclass = class->format;
+				f.data = (char *) sbuf + res;
+				f.datalen = (res2 - res < len) ? res2 - res : len;
+				f.samples = ast_codec_get_samples(&f);
+				moh_shared_push(class, &f);
+			}
+			continue;
+		}
 		AST_LIST_LOCK(&mohclasses);
 		AST_LIST_TRAVERSE(&class->members, moh, list) {
 			/* Write data */
@@ -729,14 +1081,20 @@ static struct ast_generator mohgen =
 	generate: moh_generate,
 };
 
-static int moh_add_file(struct mohclass *class, const char *filepath)
+static int moh_add_file(struct mohclass *class, const char *filepath, const char *ext)
 {
 	if (!class->allowed_files) {
 		if (!(class->filearray = ast_calloc(1, INITIAL_NUM_FILES * sizeof(*class->filearray))))
 			return -1;
+		if (!(class->extarray = ast_calloc(1, INITIAL_NUM_FILES * sizeof(*class->extarray)))) {
+			free(class->filearray);
+			class->filearray = NULL;
+			return -1;
+		}
 		class->allowed_files = INITIAL_NUM_FILES;
 	} else if (class->total_files == class->allowed_files) {
-		if (!(class->filearray = ast_realloc(class->filearray, class->allowed_files * sizeof(*class->filearray) * 2))) {
+		if (!(class->filearray = ast_realloc(class->filearray, class->allowed_files * sizeof(*class->filearray) * 2)) ||
+		    !(class->extarray = ast_realloc(class->extarray, class->allowed_files * sizeof(*class->extarray) * 2))) {
 			class->allowed_files = 0;
 			class->total_files = 0;
 			return -1;
@@ -746,12 +1104,30 @@ static int moh_add_file(struct mohclass *class, const char *filepath)
 
 	if (!(class->filearray[class->total_files] = ast_strdup(filepath)))
 		return -1;
+	if (!(class->extarray[class->total_files] = ast_strdup(S_OR(ext, "")))) {
+		free(class->filearray[class->total_files]);
+		return -1;
+	}
 
 	class->total_files++;
 
 	return 0;
 }
 
+static int moh_file_readable(const char *filepath, const char *ext)
+{
+	struct ast_filestream *fs;
+
+	/* Ask quietly first, the directory may hold files of no format at all */
+	if (ast_strlen_zero(ext) || !(ast_fileexists(filepath, ext, NULL) & AST_FORMAT_AUDIO_MASK))
+		return 0;
+	if (!(fs = ast_readfile(filepath, ext, NULL, O_RDONLY, 0, 0)))
+		return 0;
+	ast_closestream(fs);
+
+	return 1;
+}
+
 static int moh_scan_files(struct mohclass *class) {
 
 	DIR *files_DIR;
@@ -762,6 +1138,7 @@ static int moh_scan_files(struct mohclass *class) {
 	struct stat statbuf;
 	int dirnamelen;
 	int i;
+	int res;
 	
 	files_DIR = opendir(class->dir);
 	if (!files_DIR) {
@@ -769,10 +1146,14 @@ static int moh_scan_files(struct mohclass *class) {
 		return -1;
 	}
 
-	for (i = 0; i < class->total_files; i++)
+	ast_mutex_lock(&class->ringlock);
+	for (i = 0; i < class->total_files; i++) {
 		free(class->filearray[i]);
-
+		free(class->extarray[i]);
+	}
 	class->total_files = 0;
+	ast_mutex_unlock(&class->ringlock);
+
 	dirnamelen = strlen(class->dir) + 2;
 	getcwd(path, sizeof(path));
 	chdir(class->dir);
@@ -800,7 +1181,13 @@ static int moh_scan_files(struct mohclass *class) {
 				break;
 
 		if (i == class->total_files) {
-			if (moh_add_file(class, filepath))
+			/* a shared stream reads one specific format, make sure we can */
+			if (ast_test_flag(class, MOH_SHARED) && !moh_file_readable(filepath, ext))
+				continue;
+			ast_mutex_lock(&class->ringlock);
+			res = moh_add_file(class, filepath, ext);
+			ast_mutex_unlock(&class->ringlock);
+			if (res)
 				break;
 		}
 	}
@@ -838,6 +1225,14 @@ static int moh_register(struct mohclass *moh, int reload)
 		}
 		if (strchr(moh->args, 'r'))
 			ast_set_flag(moh, MOH_RANDOMIZE);
+		if (ast_test_flag(moh, MOH_SHARED)) {
+			moh->srcformat = AST_FORMAT_SLINEAR;
+			if (ast_pthread_create(&moh->thread, NULL, moh_files_shared_thread, moh)) {
+				ast_log(LOG_WARNING, "Unable to create moh...\n");
+				ast_moh_free_class(&moh);
+				return -1;
+			}
+		}
 	} else if (!strcasecmp(moh->mode, "mp3") || !strcasecmp(moh->mode, "mp3nb") || !strcasecmp(moh->mode, "quietmp3") || !strcasecmp(moh->mode, "quietmp3nb") || !strcasecmp(moh->mode, "httpmp3") || !strcasecmp(moh->mode, "custom")) {
 
 		if (!strcasecmp(moh->mode, "custom"))
@@ -850,6 +1245,7 @@ static int moh_register(struct mohclass *moh, int reload)
 			ast_set_flag(moh, MOH_QUIET);
 		
 		moh->srcfd = -1;
+		moh->srcformat = moh->format;
 #ifdef HAVE_ZAPTEL
 		/* Open /dev/zap/pseudo for timing...  Is
 		   there a better, yet reliable way to do this? */
@@ -909,7 +1305,9 @@ static int local_ast_moh_start(struct ast_channel *chan, const char *class)
 	}
 
 	ast_set_flag(chan, AST_FLAG_MOH);
-	if (mohclass->total_files) {
+	if (ast_test_flag(mohclass, MOH_SHARED)) {
+		return ast_activate_generator(chan, &moh_shared_stream, mohclass);
+	} else if (mohclass->total_files) {
 		return ast_activate_generator(chan, &moh_file_stream, mohclass);
 	} else
 		return ast_activate_generator(chan, &mohgen, mohclass);
@@ -932,8 +1330,10 @@ static struct mohclass *moh_class_malloc(void)
 {
 	struct mohclass *class;
 
-	if ((class = ast_calloc(1, sizeof(*class))))		
+	if ((class = ast_calloc(1, sizeof(*class)))) {
 		class->format = AST_FORMAT_SLINEAR;
+		ast_mutex_init(&class->ringlock);
+	}
 
 	return class;
 }
@@ -971,6 +1371,8 @@ static int load_moh_classes(int reload)
 					ast_copy_string(class->args, var->value, sizeof(class->args));
 				else if (!strcasecmp(var->name, "random"))
 					ast_set2_flag(class, ast_true(var->value), MOH_RANDOMIZE);
+				else if (!strcasecmp(var->name, "shared"))
+					ast_set2_flag(class, ast_true(var->value), MOH_SHARED);
 				else if (!strcasecmp(var->name, "format")) {
 					class->format = ast_getformatbyname(var->value);
 					if (!class->format) {
@@ -1163,6 +1565,8 @@ static int moh_classes_show(int fd, int argc, char *argv[])
 			ast_cli(fd, "\tApplication: %s\n", S_OR(class->args, "<none>"));
 		if (strcasecmp(class->mode, "files"))
 			ast_cli(fd, "\tFormat: %s\n", ast_getformatname(class->format));
+		if (ast_test_flag(class, MOH_SHARED))
+			ast_cli(fd, "\tShared: yes (%d listeners)\n", class->listeners);
 	}
 	AST_LIST_UNLOCK(&mohclasses);
 
@@ -0,0 +1,323 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Core timing service, for channels without a Zaptel timer
+ *
+ * One thread ticks every 20 ms.  Each tick it walks the timed channels and
+ * wakes up the ones whose timeout is due by writing to their alert pipe, so
+ * generators and file playback run at a steady rate on their own channel's
+ * thread instead of being driven by incoming frames or the channel's
+ * scheduler.  Due times are kept in samples from when the service started,
+ * and a channel that rearms its timeout with ast_settimeout() continues
+ * from its last due time, so a channel's rate does not drift with tick
+ * lateness.
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#define TIMING_TIMERFD	/* tick from a timerfd instead of sleeping */
+#endif
+
+#include "asterisk/timing.h"
+#include "asterisk/channel.h"
+#include "asterisk/linkedlists.h"
+#include "asterisk/lock.h"
+#include "asterisk/logger.h"
+#include "asterisk/cli.h"
+#include "asterisk/utils.h"
+
+#define TIMING_TICK	20			/*!< Milliseconds between ticks */
+#define TIMING_SAMPLES	(TIMING_TICK * 8)	/*!< Samples between ticks */
+#define TIMING_BURST	3			/*!< Most expirations delivered at once */
+#define TIMING_REWAKE	(200 * 8)		/*!< Wake an unresponsive channel again after this many samples */
+
+/*! \brief A channel registered with the timing service */
+struct ast_timing_entry {
+	struct ast_channel *chan;
+	int interval;				/*!< Samples between expirations */
+	int64_t next;				/*!< When the next expiration is due */
+	int64_t last;				/*!< When the last one was due */
+	int pending;				/*!< Expirations not yet acknowledged */
+	int64_t woken;				/*!< When the channel was last woken up */
+	AST_LIST_ENTRY(ast_timing_entry) list;
+};
+
+static AST_LIST_HEAD_STATIC(timed, ast_timing_entry);
+
+static int timing_running;
+static int timing_fd = -1;
+static int64_t timing_start;		/*!< Monotonic microseconds when the service started */
+static int64_t timing_ticks;		/*!< Ticks so far */
+static int timing_channels;		/*!< Entries on the timed list */
+
+/* Statistics for "show timing" */
+static unsigned int timing_missed;	/*!< Ticks that passed while we were busy */
+static unsigned int timing_wakeups;	/*!< Alert pipe writes */
+static int64_t timing_late_total;	/*!< Sum of tick lateness, in microseconds */
+static int timing_late_max;
+static unsigned int timing_late[6];	/*!< Lateness histogram, see timing_late_bounds */
+static const int timing_late_bounds[5] = { 1000, 2000, 5000, 10000, 20000 };
+
+static int64_t timing_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+		return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	{
+		struct timeval tv = ast_tvnow();
+		return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+	}
+}
+
+/*! \brief Current time in samples since the service started */
+static int64_t timing_clock(void)
+{
+	return (timing_now() - timing_start) / 125;
+}
+
+/*! \brief Sleep until the next tick is due */
+static void timing_wait(void)
+{
+	int64_t next, now;
+
+#ifdef TIMING_TIMERFD
+	uint64_t expirations;
+
+	if (timing_fd > -1) {
+		if ((read(timing_fd, &expirations, sizeof(expirations)) < 0) && (errno != EINTR))
+			ast_log(LOG_WARNING, "Unable to read timing fd: %s\n", strerror(errno));
+		return;
+	}
+#endif
+	next = timing_start + (timing_ticks + 1) * TIMING_TICK * 1000;
+	now = timing_now();
+	if (next > now)
+		usleep(next - now);
+}
+
+/*! \brief Wake up every channel that is due at \a clock.  Call with the list locked. */
+static void timing_service(int64_t clock)
+{
+	struct ast_timing_entry *e;
+	int expired, unread, x = 0;
+
+	AST_LIST_TRAVERSE(&timed, e, list) {
+		if (e->next > clock)
+			continue;
+		for (expired = 0; (e->next <= clock) && (expired < TIMING_BURST); expired++) {
+			e->last = e->next;
+			e->next += e->interval;
+		}
+		if (e->next <= clock) {
+			/* Too far behind to catch up, start again from here */
+			e->last = clock;
+			e->next = clock + e->interval;
+		}
+		unread = e->pending;
+		if ((e->pending += expired) > TIMING_BURST)
+			e->pending = TIMING_BURST;
+		/* One wakeup in the alert pipe is enough, unless it seems lost */
+		if (unread && (clock - e->woken < TIMING_REWAKE))
+			continue;
+		e->woken = clock;
+		if ((e->chan->alertpipe[1] > -1) && (write(e->chan->alertpipe[1], &x, sizeof(x)) == sizeof(x)))
+			timing_wakeups++;
+	}
+}
+
+static void *timing_thread(void *data)
+{
+	int64_t ticks, late;
+	int x;
+
+	for (;;) {
+		timing_wait();
+		late = timing_now() - timing_start;
+		ticks = late / (TIMING_TICK * 1000);
+		if (ticks <= timing_ticks)
+			continue;
+		late -= ticks * TIMING_TICK * 1000;
+
+		AST_LIST_LOCK(&timed);
+		timing_missed += ticks - timing_ticks - 1;
+		timing_ticks = ticks;
+		timing_late_total += late;
+		if (late > timing_late_max)
+			timing_late_max = late;
+		for (x = 0; (x < 5) && (late >= timing_late_bounds[x]); x++)
+			;
+		timing_late[x]++;
+		timing_service(ticks * TIMING_SAMPLES);
+		AST_LIST_UNLOCK(&timed);
+	}
+	return NULL;
+}
+
+int ast_timing_available(struct ast_channel *chan)
+{
+	return timing_running && (chan->alertpipe[1] > -1);
+}
+
+int ast_timing_set(struct ast_channel *chan, int samples)
+{
+	struct ast_timing_entry *e;
+	int64_t now;
+
+	if (!ast_timing_available(chan))
+		return -1;
+
+	AST_LIST_LOCK(&timed);
+	e = chan->timingentry;
+	if (samples <= 0) {
+		if (e) {
+			AST_LIST_REMOVE(&timed, e, list);
+			timing_channels--;
+			chan->timingentry = NULL;
+			free(e);
+		}
+		AST_LIST_UNLOCK(&timed);
+		return 0;
+	}
+	now = timing_clock();
+	if (!e) {
+		if (!(e = ast_calloc(1, sizeof(*e)))) {
+			AST_LIST_UNLOCK(&timed);
+			return -1;
+		}
+		e->chan = chan;
+		e->last = now;
+		AST_LIST_INSERT_TAIL(&timed, e, list);
+		timing_channels++;
+		chan->timingentry = e;
+	} else if (e->last + 2 * TIMING_SAMPLES < now) {
+		/* Not rearmed in time for the next expiry, so count from now */
+		e->last = now;
+	}
+	e->interval = samples;
+	e->next = e->last + samples;
+	AST_LIST_UNLOCK(&timed);
+	return 0;
+}
+
+int ast_timing_ack(struct ast_channel *chan)
+{
+	int res;
+
+	if (!chan->timingentry)
+		return 0;
+	AST_LIST_LOCK(&timed);
+	res = chan->timingentry->pending;
+	chan->timingentry->pending = 0;
+	AST_LIST_UNLOCK(&timed);
+	return res;
+}
+
+static int handle_show_timing(int fd, int argc, char *argv[])
+{
+	unsigned int hist[6];
+	unsigned int missed, wakeups;
+	int64_t ticks, total;
+	int channels, max, x;
+	static const char *labels[6] = { "< 1 ms", "1-2 ms", "2-5 ms", "5-10 ms", "10-20 ms", ">= 20 ms" };
+
+	if (argc != 2)
+		return RESULT_SHOWUSAGE;
+
+	AST_LIST_LOCK(&timed);
+	ticks = timing_ticks;
+	channels = timing_channels;
+	missed = timing_missed;
+	wakeups = timing_wakeups;
+	total = timing_late_total;
+	max = timing_late_max;
+	memcpy(hist, timing_late, sizeof(hist));
+	AST_LIST_UNLOCK(&timed);
+
+	ast_cli(fd, "Timing service: %s, %d ms ticks\n", !timing_running ? "not running" : (timing_fd > -1) ? "timerfd" : "sleep", TIMING_TICK);
+	ast_cli(fd, "Channels timed: %d\n", channels);
+	ast_cli(fd, "Ticks: %lld, missed: %u\n", (long long) ticks, missed);
+	ast_cli(fd, "Channel wakeups: %u\n", wakeups);
+	ast_cli(fd, "Tick lateness: average %lld us, max %d us\n", ticks ? (long long) (total / ticks) : 0LL, max);
+	for (x = 0; x < 6; x++)
+		ast_cli(fd, "  %-9s %u\n", labels[x], hist[x]);
+
+	return RESULT_SUCCESS;
+}
+
+static struct ast_cli_entry cli_show_timing = {
+	.cmda = { "show", "timing", NULL },
+	.handler = handle_show_timing,
+	.summary = "Display the core timing service status",
+	.usage =
+	"Usage: show timing\n"
+	"       Shows how many channels the core timing service is waking up\n"
+	"       and how late its ticks have been.\n"
+};
+
+int ast_timing_init(void)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	timing_start = timing_now();
+#ifdef TIMING_TIMERFD
+	if ((timing_fd = timerfd_create(CLOCK_MONOTONIC, 0)) > -1) {
+		struct itimerspec its;
+		int64_t first = timing_start + TIMING_TICK * 1000;
+
+		/* Expire on the tick boundaries counted from timing_start */
+		its.it_interval.tv_sec = 0;
+		its.it_interval.tv_nsec = TIMING_TICK * 1000000;
+		its.it_value.tv_sec = first / 1000000;
+		its.it_value.tv_nsec = (first % 1000000) * 1000;
+		if (timerfd_settime(timing_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+			ast_log(LOG_WARNING, "Unable to set timerfd, timing service will sleep instead: %s\n", strerror(errno));
+			close(timing_fd);
+			timing_fd = -1;
+		}
+	} else
+		ast_log(LOG_WARNING, "Unable to create timerfd, timing service will sleep instead: %s\n", strerror(errno));
+#endif
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (ast_pthread_create(&thread, &attr, timing_thread, NULL)) {
+		ast_log(LOG_ERROR, "Unable to start timing thread.\n");
+		pthread_attr_destroy(&attr);
+		return -1;
+	}
+	pthread_attr_destroy(&attr);
+	timing_running = 1;
+	ast_cli_register(&cli_show_timing);
+	return 0;
+}
@@ -35,6 +35,8 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <errno.h>
 
 #define MOD_LOADER	/* not really a module */
 #include "asterisk.h"
@@ -53,14 +55,36 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/term.h"
 
 #define MAX_RECALC 200 /* max sample recalc */
+#define MIN_COST_RUNS 3	/*!< calc_cost() keeps the best of at least this many runs */
+#define BROKEN_COST 99999000	/*!< cost of translators that cannot be measured */
+#define COST_FILE "translator_costs"	/*!< costs saved by "show translation recalc" */
+#define MAX_TRANS_STEPS 8	/*!< longest translation path kept in the matrix */
+#define MAX_TRANS_POOL 8	/*!< idle descriptors kept per translator */
 
 /*! \brief the list of translators */
 static AST_LIST_HEAD_STATIC(translators, ast_translator);
 
+/*! \brief a cost saved by a previous recalc */
+struct translator_cost {
+	char name[80];
+	int cost;
+	AST_LIST_ENTRY(translator_cost) list;
+};
+
+/*! \brief saved costs, read on first registration.
+ * \note Protected by the translators lock. */
+static AST_LIST_HEAD_NOLOCK_STATIC(saved_costs, translator_cost);
+static int saved_costs_loaded;
+
+/*! \brief protects the descriptor pools and counters in each translator */
+AST_MUTEX_DEFINE_STATIC(pool_lock);
+
 struct translator_path {
 	struct ast_translator *step;	/*!< Next step translator */
 	unsigned int cost;		/*!< Complete cost to destination */
 	unsigned int multistep;		/*!< Multiple conversions required for this translation */
+	int steps;			/*!< Number of entries in path[], 0 if not resolved */
+	struct ast_translator *path[MAX_TRANS_STEPS];	/*!< All steps to destination */
 };
 
 /*! \brief a matrix that, for any pair of supported formats,
@@ -153,6 +177,119 @@ static void destroy(struct ast_trans_pvt *pvt)
 	ast_update_use_count();
 }
 
+/*!
+ * \brief Get a descriptor for a new path, from the translator pool
+ * if possible, otherwise freshly allocated.
+ */
+static struct ast_trans_pvt *pool_get(struct ast_translator *t)
+{
+	struct ast_trans_pvt *pvt;
+	int useplc = t->plc_samples > 0 && t->useplc;
+	struct module_symbols *ms = t->module;
+
+	ast_mutex_lock(&pool_lock);
+	/* drop descriptors built with a different plc setting */
+	while ((pvt = t->pool) && (pvt->plc != NULL) != useplc) {
+		t->pool = pvt->next;
+		t->poolsize--;
+		ast_mutex_unlock(&pool_lock);
+		if (t->reset && t->destroy)
+			t->destroy(pvt);
+		free(pvt);
+		ast_mutex_lock(&pool_lock);
+	}
+	if (pvt) {
+		t->pool = pvt->next;
+		t->poolsize--;
+	}
+	ast_mutex_unlock(&pool_lock);
+
+	if (pvt) {
+		/* clear the per-path state, keep the layout */
+		memset(&pvt->f, 0, sizeof(pvt->f));
+		pvt->samples = 0;
+		pvt->datalen = 0;
+		pvt->next = NULL;
+		if (pvt->plc)
+			memset(pvt->plc, 0, sizeof(*pvt->plc));
+		if (t->reset)
+			t->reset(pvt);
+		else {
+			if (t->desc_size)
+				memset(pvt->pvt, 0, t->desc_size);
+			if (t->newpvt && t->newpvt(pvt) == NULL) {
+				free(pvt);
+				pvt = NULL;
+			}
+		}
+		if (pvt) {
+			ast_atomic_fetchadd_int(&ms->usecnt, +1);
+			ast_update_use_count();
+		}
+	}
+	if (!pvt) {
+		if (!(pvt = newpvt(t)))
+			return NULL;
+		ast_mutex_lock(&pool_lock);
+		t->allocs++;
+		t->active++;
+		ast_mutex_unlock(&pool_lock);
+	} else {
+		ast_mutex_lock(&pool_lock);
+		t->reuses++;
+		t->active++;
+		ast_mutex_unlock(&pool_lock);
+	}
+	return pvt;
+}
+
+/*!
+ * \brief Return a descriptor to the translator pool, or destroy it
+ * if the pool is full.  Translators with a reset hook keep their
+ * private data while pooled, the others release it here.
+ */
+static void pool_put(struct ast_trans_pvt *pvt)
+{
+	struct ast_translator *t = pvt->t;
+	struct module_symbols *ms = t->module;
+	int pooled = 0;
+
+	ast_mutex_lock(&pool_lock);
+	t->active--;
+	if (t->poolsize < MAX_TRANS_POOL) {
+		if (!t->reset && t->destroy)
+			t->destroy(pvt);
+		pvt->next = t->pool;
+		t->pool = pvt;
+		t->poolsize++;
+		pooled = 1;
+	}
+	ast_mutex_unlock(&pool_lock);
+
+	if (!pooled) {
+		destroy(pvt);
+		return;
+	}
+	ast_atomic_fetchadd_int(&ms->usecnt, -1);
+	ast_update_use_count();
+}
+
+/*! \brief Free all idle descriptors of a translator */
+static void pool_flush(struct ast_translator *t)
+{
+	struct ast_trans_pvt *pvt;
+
+	ast_mutex_lock(&pool_lock);
+	while ((pvt = t->pool)) {
+		t->pool = pvt->next;
+		if (t->reset && t->destroy)
+			t->destroy(pvt);
+		free(pvt);
+	}
+	t->poolsize = 0;
+	ast_mutex_unlock(&pool_lock);
+}
+
 /*! \brief framein wrapper, deals with plc and bound checks.  */
 static int framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 {
@@ -251,7 +388,7 @@ void ast_translator_free_path(struct ast_trans_pvt *p)
 	struct ast_trans_pvt *pn = p;
 	while ( (p = pn) ) {
 		pn = p->next;
-		destroy(p);
+		pool_put(p);
 	}
 }
 
@@ -259,20 +396,26 @@ void ast_translator_free_path(struct ast_trans_pvt *p)
 struct ast_trans_pvt *ast_translator_build_path(int dest, int source)
 {
 	struct ast_trans_pvt *head = NULL, *tail = NULL;
+	struct ast_translator *path[MAX_TRANS_STEPS];
+	int steps, i;
 	
 	source = powerof(source);
 	dest = powerof(dest);
 	
-	while (source != dest) {
+	/* take a copy of the resolved steps, the matrix may be rebuilt */
+	steps = tr_matrix[source][dest].steps;
+	memcpy(path, tr_matrix[source][dest].path, sizeof(path));
+	if (source != dest && !steps) {
+		ast_log(LOG_WARNING, "No translator path from %s to %s\n", 
+			ast_getformatname(source), ast_getformatname(dest));
+		return NULL;
+	}
+
+	for (i = 0; i < steps; i++) {
 		struct ast_trans_pvt *cur;
-		struct ast_translator *t = tr_matrix[source][dest].step;
-		if (!t) {
-			ast_log(LOG_WARNING, "No translator path from %s to %s\n", 
-				ast_getformatname(source), ast_getformatname(dest));
-			return NULL;
-		}
-		if (!(cur = newpvt(t))) {
-			ast_log(LOG_WARNING, "Failed to build translator step from %d to %d\n", source, dest);
+
+		if (!(cur = pool_get(path[i]))) {
+			ast_log(LOG_WARNING, "Failed to build translator step from %d to %d\n", path[i]->srcfmt, path[i]->dstfmt);
 			if (head)
 				ast_translator_free_path(head);	
 			return NULL;
@@ -283,8 +426,6 @@ struct ast_trans_pvt *ast_translator_build_path(int dest, int source)
 			tail->next = cur;
 		tail = cur;
 		cur->nextin = cur->nextout = ast_tv(0, 0);
-		/* Keep going if this isn't the final destination */
-		source = cur->t->dstfmt;
 	}
 	return head;
 }
@@ -363,53 +504,173 @@ struct ast_frame *ast_translate(struct ast_trans_pvt *path, struct ast_frame *f,
 	return out;
 }
 
-/*! \brief compute the cost of a single translation step */
+/*! \brief CPU time used by this thread, in microseconds.
+ * Unlike wall clock time, this does not depend on the system load. */
+static int64_t cpu_time_us(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+#endif
+	struct timeval tv;
+
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	tv = ast_tvnow();
+	return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*! \brief compute the cost of a single translation step.
+ * The translator is run over its sample frames one second of audio at
+ * a time, and the cheapest run is kept, so a busy system only makes
+ * single runs slower.  The cost is in microseconds per second of audio.
+ */
 static void calc_cost(struct ast_translator *t, int seconds)
 {
-	int sofar=0;
 	struct ast_trans_pvt *pvt;
-	struct timeval start;
-	int cost;
+	int64_t start, cost, best = -1;
+	int run, runs;
 
 	if (!seconds)
 		seconds = 1;
+	runs = seconds < MIN_COST_RUNS ? MIN_COST_RUNS : seconds;
 	
 	/* If they don't make samples, give them a terrible score */
 	if (!t->sample) {
 		ast_log(LOG_WARNING, "Translator '%s' does not produce sample frames.\n", t->name);
-		t->cost = 99999;
+		t->cost = BROKEN_COST;
 		return;
 	}
 	pvt = newpvt(t);
 	if (!pvt) {
 		ast_log(LOG_WARNING, "Translator '%s' appears to be broken and will probably fail.\n", t->name);
-		t->cost = 99999;
+		t->cost = BROKEN_COST;
 		return;
 	}
-	start = ast_tvnow();
-	/* Call the encoder until we've processed the required number of samples */
-	while (sofar < seconds * 8000) {
-		struct ast_frame *f = t->sample();
-		if (!f) {
-			ast_log(LOG_WARNING, "Translator '%s' failed to produce a sample frame.\n", t->name);
-			destroy(pvt);
-			t->cost = 99999;
-			return;
-		}
-		framein(pvt, f);
-		ast_frfree(f);
-		while( (f = t->frameout(pvt))) {
-			sofar += f->samples;
+	for (run = 0; run < runs; run++) {
+		int sofar = 0;
+
+		start = cpu_time_us();
+		/* Call the encoder until we've processed one second of samples */
+		while (sofar < 8000) {
+			struct ast_frame *f = t->sample();
+			if (!f) {
+				ast_log(LOG_WARNING, "Translator '%s' failed to produce a sample frame.\n", t->name);
+				destroy(pvt);
+				t->cost = BROKEN_COST;
+				return;
+			}
+			framein(pvt, f);
 			ast_frfree(f);
+			while( (f = t->frameout(pvt))) {
+				sofar += f->samples;
+				ast_frfree(f);
+			}
 		}
+		/* scale to exactly one second, frames may overshoot */
+		cost = (cpu_time_us() - start) * 8000 / sofar;
+		if (best < 0 || cost < best)
+			best = cost;
 	}
-	cost = ast_tvdiff_ms(ast_tvnow(), start);
 	destroy(pvt);
-	t->cost = cost / seconds;
+	t->cost = best;
 	if (!t->cost)
 		t->cost = 1;
 }
 
+/*! \brief Read the costs saved by a previous recalc.
+ * \note This function expects the list of translators to be locked
+ */
+static void load_saved_costs(void)
+{
+	char fn[PATH_MAX];
+	char buf[256];
+	FILE *f;
+
+	saved_costs_loaded = 1;
+	if ((snprintf(fn, sizeof(fn), "%s/%s", ast_config_AST_VAR_DIR, COST_FILE) >= sizeof(fn)) || !(f = fopen(fn, "r")))
+		return;
+	while (fgets(buf, sizeof(buf), f)) {
+		struct translator_cost *c;
+		char name[80];
+		int cost;
+
+		if (buf[0] == ';' || sscanf(buf, "%79s %d", name, &cost) != 2 || cost <= 0)
+			continue;
+		if (!(c = ast_calloc(1, sizeof(*c))))
+			break;
+		ast_copy_string(c->name, name, sizeof(c->name));
+		c->cost = cost;
+		AST_LIST_INSERT_TAIL(&saved_costs, c, list);
+	}
+	fclose(f);
+}
+
+/*! \brief Replace the saved costs with the current ones and write them out.
+ * \note This function expects the list of translators to be locked
+ */
+static int save_costs(void)
+{
+	struct translator_cost *c;
+	struct ast_translator *t;
+	char fn[PATH_MAX];
+	FILE *f;
+
+	while ((c = AST_LIST_REMOVE_HEAD(&saved_costs, list)))
+		free(c);
+	AST_LIST_TRAVERSE(&translators, t, list) {
+		if (t->cost >= BROKEN_COST || !(c = ast_calloc(1, sizeof(*c))))
+			continue;
+		ast_copy_string(c->name, t->name, sizeof(c->name));
+		c->cost = t->cost;
+		AST_LIST_INSERT_TAIL(&saved_costs, c, list);
+	}
+
+	if (snprintf(fn, sizeof(fn), "%s/%s", ast_config_AST_VAR_DIR, COST_FILE) >= sizeof(fn)) {
+		ast_log(LOG_WARNING, "Translator cost file name is too long\n");
+		return -1;
+	}
+	if (!(f = fopen(fn, "w"))) {
+		ast_log(LOG_WARNING, "Unable to write translator costs to %s: %s\n", fn, strerror(errno));
+		return -1;
+	}
+	fprintf(f, "; Translator costs in microseconds per second of audio.\n");
+	fprintf(f, "; Written by 'show translation recalc', used instead of measuring at startup.\n");
+	AST_LIST_TRAVERSE(&saved_costs, c, list)
+		fprintf(f, "%s %d\n", c->name, c->cost);
+	fclose(f);
+	return 0;
+}
+
+/*! \brief Set the cost of a new translator, from the saved costs if
+ * available, otherwise by measuring it.
+ * \return 1 if the saved cost was used
+ */
+static int set_cost(struct ast_translator *t)
+{
+	struct translator_cost *c;
+	int cost = 0;
+
+	AST_LIST_LOCK(&translators);
+	if (!saved_costs_loaded)
+		load_saved_costs();
+	AST_LIST_TRAVERSE(&saved_costs, c, list) {
+		if (!strcmp(c->name, t->name)) {
+			cost = c->cost;
+			break;
+		}
+	}
+	AST_LIST_UNLOCK(&translators);
+
+	if (cost) {
+		t->cost = cost;
+		return 1;
+	}
+	calc_cost(t, 1);
+	return 0;
+}
+
 /*!
  * \brief rebuild a translation matrix.
  * \note This function expects the list of translators to be locked
@@ -482,6 +743,24 @@ static void rebuild_matrix(int samples)
 		if (!changed)
 			break;
 	}
+
+	/* resolve the step sequence of every path once, so building
+	 * a path does not have to walk the matrix */
+	for (x = 0; x < MAX_FORMAT; x++) {
+		for (z = 0; z < MAX_FORMAT; z++) {
+			struct translator_path *tp = &tr_matrix[x][z];
+
+			for (y = x; tp->step && y != z; y = tr_matrix[y][z].step->dstfmt) {
+				if (!tr_matrix[y][z].step || tp->steps == MAX_TRANS_STEPS) {
+					ast_log(LOG_WARNING, "Cannot resolve translation path from %s to %s\n",
+						ast_getformatname(1 << x), ast_getformatname(1 << z));
+					tp->steps = 0;
+					break;
+				}
+				tp->path[tp->steps++] = tr_matrix[y][z].step;
+			}
+		}
+	}
 }
 
 /*! \brief CLI "show translation" command handler */
@@ -489,6 +768,7 @@ static int show_translation(int fd, int argc, char *argv[])
 {
 #define SHOW_TRANS 11
 	int x, y, z;
+	struct ast_translator *t;
 
 	if (argc > 4) 
 		return RESULT_SHOWUSAGE;
@@ -507,33 +787,46 @@ static int show_translation(int fd, int argc, char *argv[])
 			ast_cli(fd,"         Maximum limit of recalc exceeded by %d, truncating value to %d\n",z-MAX_RECALC,MAX_RECALC);
 			z = MAX_RECALC;
 		}
-		ast_cli(fd,"         Recalculating Codec Translation (number of sample seconds: %d)\n\n",z);
+		ast_cli(fd,"         Recalculating Codec Translation (number of sample seconds: %d)\n",z);
 		rebuild_matrix(z);
+		if (!save_costs())
+			ast_cli(fd,"         Saved translator costs to %s/%s\n", ast_config_AST_VAR_DIR, COST_FILE);
+		ast_cli(fd, "\n");
 	}
 
-	ast_cli(fd, "         Translation times between formats (in milliseconds)\n");
+	ast_cli(fd, "         Translation times between formats (in microseconds per second of audio)\n");
 	ast_cli(fd, "          Source Format (Rows) Destination Format(Columns)\n\n");
 	for (x = -1; x < SHOW_TRANS; x++) {
-		char line[80];
+		char line[120];
 		char *buf = line;
 		size_t left = sizeof(line) - 1;	/* one initial space */
 		/* next 2 lines run faster than using ast_build_string() */
 		*buf++ = ' ';
 		*buf = '\0';
 		for (y=-1;y<SHOW_TRANS;y++) {
-			if (x >= 0 && y >= 0 && tr_matrix[x][y].step)	/* XXX what is 99999 ? */
-				ast_build_string(&buf, &left, " %5d", tr_matrix[x][y].cost >= 99999 ? 0 : tr_matrix[x][y].cost);
+			if (x >= 0 && y >= 0 && tr_matrix[x][y].step)
+				ast_build_string(&buf, &left, " %7d", tr_matrix[x][y].cost >= BROKEN_COST ? 0 : tr_matrix[x][y].cost);
 			else if (((x == -1 && y >= 0) || (y == -1 && x >= 0))) {
-				ast_build_string(&buf, &left, " %5s", ast_getformatname(1<<(x+y+1)) );
+				ast_build_string(&buf, &left, " %7s", ast_getformatname(1<<(x+y+1)) );
 			} else if (x != -1 && y != -1) {
-				ast_build_string(&buf, &left, "     -");
+				ast_build_string(&buf, &left, "       -");
 			} else {
-				ast_build_string(&buf, &left, "      ");
+				ast_build_string(&buf, &left, "        ");
 			}
 		}
 		ast_build_string(&buf, &left, "\n");
 		ast_cli(fd, line);			
 	}
+
+	ast_cli(fd, "\n%-20s %10s %10s %7s %7s %7s\n", "Translator", "Allocated", "Reused", "Reuse%", "Active", "Pooled");
+	ast_mutex_lock(&pool_lock);
+	AST_LIST_TRAVERSE(&translators, t, list) {
+		unsigned int total = t->allocs + t->reuses;
+
+		ast_cli(fd, "%-20s %10u %10u %6u%% %7d %7d\n", t->name, t->allocs, t->reuses,
+			total ? (unsigned int) ((t->reuses * 100ULL) / total) : 0, t->active, t->poolsize);
+	}
+	ast_mutex_unlock(&pool_lock);
 	AST_LIST_UNLOCK(&translators);
 	return RESULT_SUCCESS;
 }
@@ -544,7 +837,12 @@ static char show_trans_usage[] =
 "       Displays known codec translators and the cost associated\n"
 "with each conversion.  If the argument 'recalc' is supplied along\n"
 "with optional number of seconds to test a new test will be performed\n"
-"as the chart is being displayed.\n";
+"as the chart is being displayed.  The new costs are saved and used\n"
+"instead of measuring translators when they are registered, so the\n"
+"chosen paths do not depend on the load at startup.  Below the chart,\n"
+"each translator lists how many descriptors were allocated for paths,\n"
+"how many were reused from its pool, and how many are active or idle\n"
+"right now.\n";
 
 static struct ast_cli_entry show_trans =
 { { "show", "translation", NULL }, show_translation, "Display translation matrix", show_trans_usage };
@@ -553,6 +851,7 @@ static struct ast_cli_entry show_trans =
 int ast_register_translator(struct ast_translator *t, void *module)
 {
 	static int added_cli = 0;
+	int saved;
 
 	if (module == NULL) {
 		ast_log(LOG_WARNING, "Missing module pointer, you need to supply one\n");
@@ -596,12 +895,13 @@ int ast_register_translator(struct ast_translator *t, void *module)
 	if (t->frameout == NULL)
 		t->frameout = default_frameout;
   
-	calc_cost(t,1);
+	saved = set_cost(t);
 	if (option_verbose > 1) {
 		char tmp[80];
-		ast_verbose(VERBOSE_PREFIX_2 "Registered translator '%s' from format %s to %s, cost %d\n",
+		ast_verbose(VERBOSE_PREFIX_2 "Registered translator '%s' from format %s to %s, cost %d%s\n",
 			term_color(tmp, t->name, COLOR_MAGENTA, COLOR_BLACK, sizeof(tmp)),
-			ast_getformatname(1 << t->srcfmt), ast_getformatname(1 << t->dstfmt), t->cost);
+			ast_getformatname(1 << t->srcfmt), ast_getformatname(1 << t->dstfmt), t->cost,
+			saved ? " (saved)" : "");
 	}
 	AST_LIST_LOCK(&translators);
 	if (!added_cli) {
@@ -631,6 +931,8 @@ int ast_unregister_translator(struct ast_translator *t)
 	AST_LIST_TRAVERSE_SAFE_END
 	rebuild_matrix(0);
 	AST_LIST_UNLOCK(&translators);
+	if (u)
+		pool_flush(u);
 	return (u ? 0 : -1);
 }
 
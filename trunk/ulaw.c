@@ -28,6 +28,7 @@
 ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #include "asterisk/ulaw.h"
+#include "asterisk/simd.h"
 
 #define ZEROTRAP    /*!< turn on the trap as per the MIL-STD */
 #define BIAS 0x84   /*!< define the add-in bias for 16 bit samples */
@@ -79,6 +80,119 @@ static unsigned char linear2ulaw(short sample)
 	return ulawbyte;
 }
 
+static void ulaw_decode_scalar(short *dst, const unsigned char *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_MULAW(*src++);
+}
+
+static void ulaw_encode_scalar(unsigned char *dst, const short *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_LIN2MU(*src++);
+}
+
+#ifdef AST_X86_SIMD
+/*
+ * The vector kernels compute the same values as the tables rather than
+ * looking them up.  The encode tables hold linear2ulaw(sample | 3) for each
+ * group of four samples, since the last of the four written wins.
+ */
+
+static AST_TARGET_SSE2 void ulaw_decode_sse2(short *dst, const unsigned char *src, int samples)
+{
+	__m128i mu, e, y, neg;
+
+	for (; samples >= 8; samples -= 8, src += 8, dst += 8) {
+		mu = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) src), _mm_setzero_si128());
+		mu = _mm_xor_si128(mu, _mm_set1_epi16(0xff));
+		e = _mm_and_si128(_mm_srli_epi16(mu, 4), _mm_set1_epi16(7));
+		/* ((mantissa << 3) + BIAS) << exponent, less the bias */
+		y = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(mu, _mm_set1_epi16(0x0f)), 3), _mm_set1_epi16(BIAS));
+		y = _mm_sub_epi16(_mm_mullo_epi16(y, ast_pow2_epi16(e)), _mm_set1_epi16(BIAS));
+		neg = _mm_cmpgt_epi16(_mm_and_si128(mu, _mm_set1_epi16(0x80)), _mm_setzero_si128());
+		y = _mm_sub_epi16(_mm_xor_si128(y, neg), neg);
+		_mm_storeu_si128((__m128i *) dst, y);
+	}
+	ulaw_decode_scalar(dst, src, samples);
+}
+
+static AST_TARGET_SSE2 void ulaw_encode_sse2(unsigned char *dst, const short *src, int samples)
+{
+	__m128i x, neg, mag, e, mant, b;
+
+	for (; samples >= 8; samples -= 8, src += 8, dst += 8) {
+		x = _mm_or_si128(_mm_loadu_si128((const __m128i *) src), _mm_set1_epi16(3));
+		neg = _mm_srai_epi16(x, 15);
+		mag = _mm_sub_epi16(_mm_xor_si128(x, neg), neg);
+		mag = _mm_add_epi16(_mm_min_epi16(mag, _mm_set1_epi16(CLIP)), _mm_set1_epi16(BIAS));
+		e = ast_segment_epi16(mag);
+		/* mag >> (e + 3) */
+		mant = _mm_mulhi_epu16(mag, ast_pow2_epi16(_mm_sub_epi16(_mm_set1_epi16(13), e)));
+		b = _mm_or_si128(_mm_and_si128(neg, _mm_set1_epi16(0x80)), _mm_slli_epi16(e, 4));
+		b = _mm_or_si128(b, _mm_and_si128(mant, _mm_set1_epi16(0x0f)));
+		b = _mm_xor_si128(b, _mm_set1_epi16(0xff));
+#ifdef ZEROTRAP
+		b = _mm_or_si128(b, _mm_and_si128(_mm_cmpeq_epi16(b, _mm_setzero_si128()), _mm_set1_epi16(0x02)));
+#endif
+		_mm_storel_epi64((__m128i *) dst, _mm_packus_epi16(b, b));
+	}
+	ulaw_encode_scalar(dst, src, samples);
+}
+
+static AST_TARGET_AVX2 void ulaw_decode_avx2(short *dst, const unsigned char *src, int samples)
+{
+	__m256i mu, e, y, neg;
+
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		mu = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) src));
+		mu = _mm256_xor_si256(mu, _mm256_set1_epi16(0xff));
+		e = _mm256_and_si256(_mm256_srli_epi16(mu, 4), _mm256_set1_epi16(7));
+		y = _mm256_add_epi16(_mm256_slli_epi16(_mm256_and_si256(mu, _mm256_set1_epi16(0x0f)), 3), _mm256_set1_epi16(BIAS));
+		y = _mm256_sub_epi16(_mm256_mullo_epi16(y, ast_pow2_epi16_avx2(e)), _mm256_set1_epi16(BIAS));
+		neg = _mm256_cmpgt_epi16(_mm256_and_si256(mu, _mm256_set1_epi16(0x80)), _mm256_setzero_si256());
+		y = _mm256_sub_epi16(_mm256_xor_si256(y, neg), neg);
+		_mm256_storeu_si256((__m256i *) dst, y);
+	}
+	ulaw_decode_sse2(dst, src, samples);
+}
+
+static AST_TARGET_AVX2 void ulaw_encode_avx2(unsigned char *dst, const short *src, int samples)
+{
+	__m256i x, neg, mag, e, mant, b;
+
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		x = _mm256_or_si256(_mm256_loadu_si256((const __m256i *) src), _mm256_set1_epi16(3));
+		neg = _mm256_srai_epi16(x, 15);
+		mag = _mm256_sub_epi16(_mm256_xor_si256(x, neg), neg);
+		mag = _mm256_add_epi16(_mm256_min_epi16(mag, _mm256_set1_epi16(CLIP)), _mm256_set1_epi16(BIAS));
+		e = ast_segment_epi16_avx2(mag);
+		mant = _mm256_mulhi_epu16(mag, ast_pow2_epi16_avx2(_mm256_sub_epi16(_mm256_set1_epi16(13), e)));
+		b = _mm256_or_si256(_mm256_and_si256(neg, _mm256_set1_epi16(0x80)), _mm256_slli_epi16(e, 4));
+		b = _mm256_or_si256(b, _mm256_and_si256(mant, _mm256_set1_epi16(0x0f)));
+		b = _mm256_xor_si256(b, _mm256_set1_epi16(0xff));
+#ifdef ZEROTRAP
+		b = _mm256_or_si256(b, _mm256_and_si256(_mm256_cmpeq_epi16(b, _mm256_setzero_si256()), _mm256_set1_epi16(0x02)));
+#endif
+		ast_store_epu8_avx2(dst, b);
+	}
+	ulaw_encode_sse2(dst, src, samples);
+}
+#endif /* AST_X86_SIMD */
+
+static void (*ulaw_decode)(short *dst, const unsigned char *src, int samples) = ulaw_decode_scalar;
+static void (*ulaw_encode)(unsigned char *dst, const short *src, int samples) = ulaw_encode_scalar;
+
+void ast_ulaw_decode(short *dst, const unsigned char *src, int samples)
+{
+	ulaw_decode(dst, src, samples);
+}
+
+void ast_ulaw_encode(unsigned char *dst, const short *src, int samples)
+{
+	ulaw_encode(dst, src, samples);
+}
+
 /*!
  * \brief  Set up mu-law conversion table
  */
@@ -102,5 +216,17 @@ void ast_ulaw_init(void)
 		__ast_lin2mu[((unsigned short)i) >> 2] = linear2ulaw(i);
 	}
 
+#ifdef AST_X86_SIMD
+	if (ast_cpu_has_avx2()) {
+		ulaw_decode = ulaw_decode_avx2;
+		if (ast_encoder_faster(ulaw_encode_avx2, ulaw_encode_scalar))
+			ulaw_encode = ulaw_encode_avx2;
+	} else if (ast_cpu_has_sse2()) {
+		ulaw_decode = ulaw_decode_sse2;
+		if (ast_encoder_faster(ulaw_encode_sse2, ulaw_encode_scalar))
+			ulaw_encode = ulaw_encode_sse2;
+	}
+#endif
+
 }
 
@@ -1170,6 +1170,18 @@ int ast_atomic_fetchadd_int_slow(volatile int *p, int v)
         return ret;
 }
 
+int ast_atomic_cas_ptr_slow(void * volatile *p, void *oldval, void *newval)
+{
+        int ret = 0;
+        ast_mutex_lock(&fetchadd_m);
+        if (*p == oldval) {
+                *p = newval;
+                ret = 1;
+        }
+        ast_mutex_unlock(&fetchadd_m);
+        return ret;
+}
+
 /*! \brief
  * get values from config variables.
  */
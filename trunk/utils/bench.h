@@ -0,0 +1,36 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief For the benchmarks and tests that build a module into a driver.
+ *
+ * A driver includes this, then the source of the module it drives, then
+ * defines whatever of the rest of Asterisk the part it drives calls.
+ * bench_stubs.c defines what they all need, and everything else the
+ * modules refer to, which aborts if it is ever called.
+ */
+
+#ifndef _ASTERISK_UTILS_BENCH_H
+#define _ASTERISK_UTILS_BENCH_H
+
+#include "asterisk.h"
+
+/* Most module sources carry their version stamp twice, and a driver has
+   no list of file versions to put it in anyway */
+#undef ASTERISK_FILE_VERSION
+#define ASTERISK_FILE_VERSION(file, version)
+
+#endif /* _ASTERISK_UTILS_BENCH_H */
@@ -0,0 +1,293 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * The rest of Asterisk, as far as the drivers in this directory that build
+ * a module in (see bench.h) are concerned.  The first part is what they
+ * all use.  The second is every other function the modules they build in
+ * refer to.  None of those is expected to be called, so each one says
+ * which it is and aborts.  They are weak, so a driver that does call one
+ * defines it itself.
+ */
+
+#include "asterisk.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "asterisk/logger.h"
+#include "asterisk/options.h"
+#include "asterisk/utils.h"
+#include "asterisk/manager.h"
+
+int option_verbose = 0;
+int option_debug = 0;
+struct ast_flags ast_options = { 0 };
+char ast_config_AST_CONFIG_DIR[PATH_MAX] = "/etc/asterisk";
+char ast_config_AST_SPOOL_DIR[PATH_MAX] = "/var/spool/asterisk";
+
+void ast_register_file_version(const char *file, const char *version)
+{
+}
+
+void ast_unregister_file_version(const char *file)
+{
+}
+
+void ast_register_thread(char *name)
+{
+}
+
+void ast_unregister_thread(void *id)
+{
+}
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (level == __LOG_DEBUG)
+		return;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+void ast_verbose(const char *fmt, ...)
+{
+}
+
+int manager_event(int category, const char *event, const char *contents, ...)
+{
+	return 0;
+}
+
+static void bench_unused(const char *name)
+{
+	fprintf(stderr, "%s() was called, the drivers do not expect that\n", name);
+	abort();
+}
+
+/* The ones the headers above declare, with the declared type */
+__attribute__((weak)) int ast_manager_register2(const char *action, int authority,
+	int (*func)(struct mansession *s, struct message *m), const char *synopsis, const char *description)
+{
+	bench_unused(__FUNCTION__);
+	return -1;
+}
+
+__attribute__((weak)) int ast_manager_unregister(char *action)
+{
+	bench_unused(__FUNCTION__);
+	return -1;
+}
+
+__attribute__((weak)) void astman_append(struct mansession *s, const char *fmt, ...)
+{
+	bench_unused(__FUNCTION__);
+}
+
+__attribute__((weak)) char *astman_get_header(struct message *m, char *var)
+{
+	bench_unused(__FUNCTION__);
+	return NULL;
+}
+
+__attribute__((weak)) void astman_send_ack(struct mansession *s, struct message *m, char *msg)
+{
+	bench_unused(__FUNCTION__);
+}
+
+__attribute__((weak)) void astman_send_error(struct mansession *s, struct message *m, char *error)
+{
+	bench_unused(__FUNCTION__);
+}
+
+__attribute__((weak)) void ast_queue_log(const char *queuename, const char *callid, const char *agent, const char *event, const char *fmt, ...)
+{
+	bench_unused(__FUNCTION__);
+}
+
+/* The rest are not declared here, so their type does not matter to the
+   linker */
+#define BENCH_UNUSED(name) \
+	void name(void) __attribute__((weak)); \
+	void name(void) { bench_unused(#name); }
+
+BENCH_UNUSED(adsi_available)
+BENCH_UNUSED(adsi_begin_download)
+BENCH_UNUSED(adsi_data_mode)
+BENCH_UNUSED(adsi_display)
+BENCH_UNUSED(adsi_download_disconnect)
+BENCH_UNUSED(adsi_end_download)
+BENCH_UNUSED(adsi_input_control)
+BENCH_UNUSED(adsi_input_format)
+BENCH_UNUSED(adsi_load_session)
+BENCH_UNUSED(adsi_load_soft_key)
+BENCH_UNUSED(adsi_print)
+BENCH_UNUSED(adsi_set_keys)
+BENCH_UNUSED(adsi_set_line)
+BENCH_UNUSED(adsi_transmit_message)
+BENCH_UNUSED(adsi_unload_session)
+BENCH_UNUSED(adsi_voice_mode)
+BENCH_UNUSED(ast_answer)
+BENCH_UNUSED(ast_app_dtget)
+BENCH_UNUSED(ast_app_getdata)
+BENCH_UNUSED(ast_app_has_voicemail)
+BENCH_UNUSED(ast_app_inboxcount)
+BENCH_UNUSED(ast_app_parse_options)
+BENCH_UNUSED(ast_app_separate_args)
+BENCH_UNUSED(ast_async_goto)
+BENCH_UNUSED(ast_autoservice_start)
+BENCH_UNUSED(ast_autoservice_stop)
+BENCH_UNUSED(ast_best_codec)
+BENCH_UNUSED(ast_bridge_call)
+BENCH_UNUSED(ast_call)
+BENCH_UNUSED(ast_callerid_merge)
+BENCH_UNUSED(ast_callerid_parse)
+BENCH_UNUSED(ast_canmatch_extension)
+BENCH_UNUSED(ast_category_browse)
+BENCH_UNUSED(ast_category_changed)
+BENCH_UNUSED(ast_cdr_alloc)
+BENCH_UNUSED(ast_cdr_appenduserfield)
+BENCH_UNUSED(ast_cdr_busy)
+BENCH_UNUSED(ast_cdr_disposition)
+BENCH_UNUSED(ast_cdr_end)
+BENCH_UNUSED(ast_cdr_failed)
+BENCH_UNUSED(ast_cdr_init)
+BENCH_UNUSED(ast_cdr_reset)
+BENCH_UNUSED(ast_cdr_setapp)
+BENCH_UNUSED(ast_cdr_setdestchan)
+BENCH_UNUSED(ast_cdr_setuserfield)
+BENCH_UNUSED(ast_cdr_start)
+BENCH_UNUSED(ast_cdr_update)
+BENCH_UNUSED(ast_channel_alloc)
+BENCH_UNUSED(ast_channel_bridge)
+BENCH_UNUSED(ast_channel_free)
+BENCH_UNUSED(ast_channel_inherit_variables)
+BENCH_UNUSED(ast_channel_make_compatible)
+BENCH_UNUSED(ast_channel_masquerade)
+BENCH_UNUSED(ast_channel_sendurl)
+BENCH_UNUSED(ast_channel_setoption)
+BENCH_UNUSED(ast_channel_supports_html)
+BENCH_UNUSED(ast_channel_walk_locked)
+BENCH_UNUSED(ast_check_hangup)
+BENCH_UNUSED(ast_cli)
+BENCH_UNUSED(ast_cli_complete)
+BENCH_UNUSED(ast_cli_register)
+BENCH_UNUSED(ast_cli_unregister)
+BENCH_UNUSED(ast_closestream)
+BENCH_UNUSED(ast_config_destroy)
+BENCH_UNUSED(ast_config_load)
+BENCH_UNUSED(ast_control_streamfile)
+BENCH_UNUSED(ast_custom_function_register)
+BENCH_UNUSED(ast_custom_function_unregister)
+BENCH_UNUSED(ast_db_del)
+BENCH_UNUSED(ast_db_freetree)
+BENCH_UNUSED(ast_db_get)
+BENCH_UNUSED(ast_db_gettree)
+BENCH_UNUSED(ast_db_put)
+BENCH_UNUSED(ast_devstate_add)
+BENCH_UNUSED(ast_devstate_del)
+BENCH_UNUSED(ast_dsp_analysis_attach)
+BENCH_UNUSED(ast_dsp_analysis_detach)
+BENCH_UNUSED(ast_dsp_free)
+BENCH_UNUSED(ast_dsp_new)
+BENCH_UNUSED(ast_dsp_silence)
+BENCH_UNUSED(ast_dsp_silence_chan)
+BENCH_UNUSED(ast_dtmf_stream)
+BENCH_UNUSED(ast_exists_extension)
+BENCH_UNUSED(ast_explicit_goto)
+BENCH_UNUSED(ast_filecopy)
+BENCH_UNUSED(ast_filedelete)
+BENCH_UNUSED(ast_fileexists)
+BENCH_UNUSED(ast_filerename)
+BENCH_UNUSED(ast_frame_adjust_volume)
+BENCH_UNUSED(ast_frfree)
+BENCH_UNUSED(ast_get_channel_by_name_locked)
+BENCH_UNUSED(ast_getformatname)
+BENCH_UNUSED(ast_goto_if_exists)
+BENCH_UNUSED(ast_hangup)
+BENCH_UNUSED(ast_hangup_localusers)
+BENCH_UNUSED(ast_indicate)
+BENCH_UNUSED(ast_install_vm_functions)
+BENCH_UNUSED(ast_load_realtime)
+BENCH_UNUSED(ast_localtime)
+BENCH_UNUSED(ast_localuser_add)
+BENCH_UNUSED(ast_localuser_remove)
+BENCH_UNUSED(ast_lock_path)
+BENCH_UNUSED(ast_moh_start)
+BENCH_UNUSED(ast_moh_stop)
+BENCH_UNUSED(ast_monitor_setjoinfiles)
+BENCH_UNUSED(ast_monitor_start)
+BENCH_UNUSED(ast_monitor_stop)
+BENCH_UNUSED(ast_parseable_goto)
+BENCH_UNUSED(ast_play_and_prepend)
+BENCH_UNUSED(ast_play_and_record)
+BENCH_UNUSED(ast_play_and_record_full)
+BENCH_UNUSED(ast_play_and_wait)
+BENCH_UNUSED(ast_queue_control)
+BENCH_UNUSED(ast_queue_frame)
+BENCH_UNUSED(ast_read)
+BENCH_UNUSED(ast_read_noaudio)
+BENCH_UNUSED(ast_readstring)
+BENCH_UNUSED(ast_record_review)
+BENCH_UNUSED(ast_register_application)
+BENCH_UNUSED(ast_request)
+BENCH_UNUSED(ast_safe_sleep)
+BENCH_UNUSED(ast_safe_system)
+BENCH_UNUSED(ast_say_date_with_format)
+BENCH_UNUSED(ast_say_digit_str)
+BENCH_UNUSED(ast_say_digits)
+BENCH_UNUSED(ast_say_number)
+BENCH_UNUSED(ast_set_callerid)
+BENCH_UNUSED(ast_set_read_format)
+BENCH_UNUSED(ast_set_write_format)
+BENCH_UNUSED(ast_smdi_interface_find)
+BENCH_UNUSED(ast_smdi_mwi_message_destroy)
+BENCH_UNUSED(ast_smdi_mwi_message_wait)
+BENCH_UNUSED(ast_smdi_mwi_set)
+BENCH_UNUSED(ast_smdi_mwi_unset)
+BENCH_UNUSED(ast_softhangup)
+BENCH_UNUSED(ast_stopstream)
+BENCH_UNUSED(ast_stream_and_wait)
+BENCH_UNUSED(ast_streamfile)
+BENCH_UNUSED(ast_translate)
+BENCH_UNUSED(ast_translator_build_path)
+BENCH_UNUSED(ast_translator_free_path)
+BENCH_UNUSED(ast_uninstall_vm_functions)
+BENCH_UNUSED(ast_unlock_path)
+BENCH_UNUSED(ast_unregister_application)
+BENCH_UNUSED(ast_update_realtime)
+BENCH_UNUSED(ast_variable_browse)
+BENCH_UNUSED(ast_variable_retrieve)
+BENCH_UNUSED(ast_variables_destroy)
+BENCH_UNUSED(ast_waitfor)
+BENCH_UNUSED(ast_waitfor_n)
+BENCH_UNUSED(ast_waitfor_nandfds)
+BENCH_UNUSED(ast_waitfordigit)
+BENCH_UNUSED(ast_waitstream)
+BENCH_UNUSED(ast_write)
+BENCH_UNUSED(ast_writefile)
+BENCH_UNUSED(ast_writestream)
+BENCH_UNUSED(devstate2str)
+BENCH_UNUSED(pbx_builtin_getvar_helper)
+BENCH_UNUSED(pbx_builtin_serialize_variables)
+BENCH_UNUSED(pbx_builtin_setvar_helper)
+BENCH_UNUSED(pbx_exec)
+BENCH_UNUSED(pbx_findapp)
+BENCH_UNUSED(pbx_substitute_variables_helper)
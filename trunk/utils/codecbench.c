@@ -0,0 +1,372 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Loads codec modules outside Asterisk, on top of the real translate.o and
+ * frame.o, and runs each translator they register over a second of
+ * synthetic speech, over and over.  For each one it reports the CPU time
+ * per second of audio (the unit "show translation" uses), cycles per
+ * sample where the TSC is available, and memory allocations per frame.
+ *
+ * With -o the costs are also written, one "translator cost" line each, in
+ * the format translate.c reads from translator_costs in the var directory
+ * at startup, so Asterisk can use them instead of measuring each
+ * translator as it registers.  The modules loaded here do the same with
+ * a translator_costs in the current directory, if there is one.
+ *
+ * usage: codecbench [-f frames] [-o costfile] ../codecs/codec_gsm.so ...
+ */
+
+#include "asterisk.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include <dlfcn.h>
+
+#include "asterisk/frame.h"
+#include "asterisk/translate.h"
+#include "asterisk/module.h"
+#include "asterisk/logger.h"
+#include "asterisk/cli.h"
+#include "asterisk/config.h"
+#include "asterisk/channel.h"
+#include "asterisk/options.h"
+#include "asterisk/term.h"
+
+#define CORPUS_FRAMES	50	/* one second of 20 ms frames */
+#define FRAME_SAMPLES	160
+#define MAX_COSTS	256	/* a translator for every pair of audio formats */
+
+/* What translate.o, frame.o and the codec modules need from the rest of
+   Asterisk.  Nothing here is used for anything that matters. */
+struct ast_flags ast_options = { 0 };
+int option_verbose = 0;
+int option_debug = 0;
+char ast_config_AST_VAR_DIR[PATH_MAX] = ".";
+
+void ast_register_file_version(const char *file, const char *version)
+{
+}
+
+void ast_unregister_file_version(const char *file)
+{
+}
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (level == __LOG_DEBUG || level == __LOG_DTMF)
+		return;
+	va_start(ap, fmt);
+	fprintf(stderr, "%s: ", function);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+void ast_verbose(const char *fmt, ...)
+{
+}
+
+void ast_cli(int fd, char *fmt, ...)
+{
+}
+
+int ast_cli_register(struct ast_cli_entry *e)
+{
+	return 0;
+}
+
+void ast_cli_register_multiple(struct ast_cli_entry *e, int len)
+{
+}
+
+int ast_best_codec(int fmts)
+{
+	return fmts & -fmts;
+}
+
+void ast_register_thread(char *name)
+{
+}
+
+void ast_unregister_thread(void *id)
+{
+}
+
+void ast_update_use_count(void)
+{
+}
+
+char *term_color(char *outbuf, const char *inbuf, int fgcolor, int bgcolor, int maxout)
+{
+	ast_copy_string(outbuf, inbuf, maxout);
+	return outbuf;
+}
+
+/* No codecs.conf, so every codec runs with its defaults */
+struct ast_config *ast_config_load(const char *filename)
+{
+	return NULL;
+}
+
+void ast_config_destroy(struct ast_config *config)
+{
+}
+
+struct ast_variable *ast_variable_browse(const struct ast_config *config, const char *category)
+{
+	return NULL;
+}
+
+#ifdef __GLIBC__
+/* Count what the translators allocate */
+static unsigned long allocs;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static double cpu_usec(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec * 1000000.0 + tv.tv_usec;
+	}
+}
+
+static unsigned long long cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int lo, hi;
+
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long) hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+/*! \brief A second of something speech-like: three wandering tones and some noise */
+static void make_speech(short *buf, int samples)
+{
+	unsigned int seed = 12345;
+	double env;
+	int x;
+
+	for (x = 0; x < samples; x++) {
+		seed = seed * 1103515245 + 12345;
+		env = 0.5 + 0.5 * sin(2 * M_PI * 3.0 * x / 8000.0);
+		buf[x] = (short) (env * (6000 * sin(2 * M_PI * (300 + 40 * sin(x / 900.0)) * x / 8000.0) +
+			3000 * sin(2 * M_PI * 1100 * x / 8000.0) + 1500 * sin(2 * M_PI * 2300 * x / 8000.0)) +
+			(int) ((seed >> 16) & 0x3ff) - 512);
+	}
+}
+
+/*! \brief Fill \a corpus with one second of audio in \a format
+ * \return the number of frames, 0 if there is no way to produce \a format
+ */
+static int make_corpus(struct ast_frame **corpus, int format, short *speech)
+{
+	struct ast_trans_pvt *enc = NULL;
+	struct ast_frame f, *out;
+	int x, n = 0;
+
+	if ((format != AST_FORMAT_SLINEAR) && !(enc = ast_translator_build_path(format, AST_FORMAT_SLINEAR)))
+		return 0;
+	for (x = 0; x < CORPUS_FRAMES; x++) {
+		memset(&f, 0, sizeof(f));
+		f.frametype = AST_FRAME_VOICE;
+		f.subclass = AST_FORMAT_SLINEAR;
+		f.data = speech + x * FRAME_SAMPLES;
+		f.datalen = FRAME_SAMPLES * 2;
+		f.samples = FRAME_SAMPLES;
+		f.src = "codecbench";
+		if (!enc)
+			out = &f;
+		else if (!(out = ast_translate(enc, &f, 0)))
+			continue;
+		if ((corpus[n] = ast_frdup(out)))
+			n++;
+	}
+	if (enc)
+		ast_translator_free_path(enc);
+	return n;
+}
+
+/* Measured costs, for -o */
+static struct {
+	char name[80];
+	int cost;
+} costs[MAX_COSTS];
+static int ncosts;
+
+static void bench(int dst, int src, int frames, short *speech)
+{
+	struct ast_frame *corpus[CORPUS_FRAMES];
+	struct ast_trans_pvt *path;
+	struct ast_frame *out;
+	unsigned long long c0, c1;
+	unsigned long a0 = 0, a1 = 0;
+	double t0, t1;
+	long samples = 0;
+	int n, x;
+
+	if (!(n = make_corpus(corpus, src, speech))) {
+		printf("%-24s no way to produce %s input\n", "", ast_getformatname(src));
+		return;
+	}
+	if (!(path = ast_translator_build_path(dst, src))) {
+		printf("%-24s unable to build %s -> %s\n", "", ast_getformatname(src), ast_getformatname(dst));
+		goto done;
+	}
+#ifdef __GLIBC__
+	a0 = allocs;
+#endif
+	t0 = cpu_usec();
+	c0 = cycles();
+	for (x = 0; x < frames; x++) {
+		samples += corpus[x % n]->samples;
+		if ((out = ast_translate(path, corpus[x % n], 0)))
+			ast_frfree(out);
+	}
+	c1 = cycles();
+	t1 = cpu_usec();
+#ifdef __GLIBC__
+	a1 = allocs;
+#endif
+	printf("%-24s %-8s -> %-8s %9.0f", path->t->name, ast_getformatname(src), ast_getformatname(dst),
+		(t1 - t0) * 8000.0 / samples);
+	if (ncosts < MAX_COSTS) {
+		ast_copy_string(costs[ncosts].name, path->t->name, sizeof(costs[ncosts].name));
+		/* a cost of 0 is not accepted back, see load_saved_costs() */
+		costs[ncosts].cost = (t1 - t0) * 8000.0 / samples + 0.5;
+		if (costs[ncosts].cost < 1)
+			costs[ncosts].cost = 1;
+		ncosts++;
+	}
+	if (c1 > c0)
+		printf(" %12.1f", (double) (c1 - c0) / samples);
+	else
+		printf(" %12s", "n/a");
+#ifdef __GLIBC__
+	printf(" %12.2f\n", (double) (a1 - a0) / frames);
+#else
+	printf(" %12s\n", "n/a");
+#endif
+	ast_translator_free_path(path);
+done:
+	for (x = 0; x < n; x++)
+		ast_frfree(corpus[x]);
+}
+
+int main(int argc, char *argv[])
+{
+	static short speech[CORPUS_FRAMES * FRAME_SAMPLES];
+	struct module_symbols *mod;
+	const char *costfile = NULL;
+	FILE *f;
+	void *lib;
+	double t;
+	int frames = 50 * 60;
+	int src, dst, x;
+	int loaded = 0;
+
+	t = cpu_usec();
+	for (x = 1; x < argc; x++) {
+		if (!strcmp(argv[x], "-f") && (x + 1 < argc)) {
+			frames = atoi(argv[++x]);
+			continue;
+		}
+		if (!strcmp(argv[x], "-o") && (x + 1 < argc)) {
+			costfile = argv[++x];
+			continue;
+		}
+		if (!(lib = dlopen(argv[x], RTLD_NOW | RTLD_GLOBAL))) {
+			fprintf(stderr, "Unable to load %s: %s\n", argv[x], dlerror());
+			continue;
+		}
+		if (!(mod = dlsym(lib, "mod_data")) || !mod->load_module || mod->load_module(mod)) {
+			fprintf(stderr, "Unable to start %s\n", argv[x]);
+			continue;
+		}
+		loaded++;
+	}
+	if (!loaded || (frames <= 0)) {
+		fprintf(stderr, "usage: codecbench [-f frames] [-o costfile] codec_module.so ...\n");
+		return 1;
+	}
+	printf("Modules loaded in %.0f ms of CPU time\n",
+		(cpu_usec() - t) / 1000.0);
+
+	make_speech(speech, CORPUS_FRAMES * FRAME_SAMPLES);
+	printf("%d frames of 20 ms through each translator\n\n", frames);
+	printf("%-24s %-20s %9s %12s %12s\n", "Translator", "", "us/s", "cycles/samp", "allocs/frame");
+	for (src = 1; src <= AST_FORMAT_MAX_AUDIO; src <<= 1) {
+		for (dst = 1; dst <= AST_FORMAT_MAX_AUDIO; dst <<= 1) {
+			if ((src != dst) && (ast_translate_path_steps(dst, src) == 1))
+				bench(dst, src, frames, speech);
+		}
+	}
+
+	if (costfile) {
+		if (!(f = fopen(costfile, "w"))) {
+			fprintf(stderr, "Unable to write %s: %s\n", costfile, strerror(errno));
+			return 1;
+		}
+		fprintf(f, "; Translator costs in microseconds per second of audio.\n");
+		fprintf(f, "; Written by codecbench, used instead of measuring at startup.\n");
+		for (x = 0; x < ncosts; x++)
+			fprintf(f, "%s %d\n", costs[x].name, costs[x].cost);
+		fclose(f);
+		printf("\n%d costs written to %s\n", ncosts, costfile);
+	}
+
+	return 0;
+}
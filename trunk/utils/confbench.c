@@ -0,0 +1,146 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Times app_meetme's software conference mixer.  Every participant talks
+ * and listens, which is the worst case: the mixer has to sum everybody and
+ * build a separate mix-minus for each of them.  For each conference size
+ * it reports the time taken by the channel side (queueing 20 ms of audio
+ * per participant) and by the mixer for one 20 ms interval, and how many
+ * conferences of that size one core could keep up with.
+ *
+ * usage: confbench [intervals [participants ...]]
+ *        default 2000 intervals of 8, 64 and 256 participants
+ */
+
+#include "bench.h"
+
+#include "../apps/app_meetme.c"
+
+#include <sys/time.h>
+
+/* What the mixer uses from the rest of Asterisk, beyond bench_stubs.c */
+struct ast_frame ast_null_frame = { AST_FRAME_NULL, };
+
+struct ast_frame *ast_frdup(struct ast_frame *f)
+{
+	struct ast_frame *out;
+
+	if (!(out = malloc(sizeof(*out) + f->datalen)))
+		return NULL;
+	*out = *f;
+	out->data = out + 1;
+	memcpy(out->data, f->data, f->datalen);
+	out->mallocd = 0;
+	return out;
+}
+
+void ast_frfree(struct ast_frame *f)
+{
+	free(f);
+}
+
+static double now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static void bench(int participants, int intervals)
+{
+	struct ast_conference *conf;
+	struct ast_conf_user *users;
+	short audio[CONF_SAMPLES];
+	char drain[CONF_SIZE];
+	double t, feed = 0, mix = 0;
+	int i, x;
+
+	if (!(conf = calloc(1, sizeof(*conf))) || !(users = calloc(participants, sizeof(*users)))) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	ast_mutex_init(&conf->listenlock);
+	ast_mutex_init(&conf->mixlock);
+	conf->softmix = 1;
+	for (x = 0; x < participants; x++) {
+		if (softmix_join(conf, &users[x])) {
+			fprintf(stderr, "Unable to add participant %d\n", x + 1);
+			exit(1);
+		}
+		users[x].mixmode = ZT_CONF_TALKER | ZT_CONF_LISTENER;
+	}
+
+	for (i = 0; i < intervals; i++) {
+		t = now_usec();
+		for (x = 0; x < participants; x++) {
+			int s;
+
+			/* A different tone from everybody */
+			for (s = 0; s < CONF_SAMPLES; s++)
+				audio[s] = (short) (((i * CONF_SAMPLES + s) * (x + 3) * 37) & 0x1fff) - 0x1000;
+			softmix_write(conf, &users[x], audio, CONF_SAMPLES);
+		}
+		feed += now_usec() - t;
+
+		t = now_usec();
+		softmix_mix(conf);
+		mix += now_usec() - t;
+
+		/* What conf_run() would read, outside the timing */
+		for (x = 0; x < participants; x++)
+			while (read(users[x].mixfds[0], drain, sizeof(drain)) > 0)
+				;
+	}
+
+	printf("%5d participants: feed %8.1f us  mix %8.1f us  per 20 ms, %6.1f conferences per core\n",
+		participants, feed / intervals, mix / intervals, 20000.0 / ((feed + mix) / intervals));
+
+	for (x = 0; x < participants; x++)
+		softmix_leave(conf, &users[x]);
+	if (conf->origframe)
+		ast_frfree(conf->origframe);
+	ast_mutex_destroy(&conf->mixlock);
+	ast_mutex_destroy(&conf->listenlock);
+	free(users);
+	free(conf);
+}
+
+int main(int argc, char *argv[])
+{
+	static const int sizes[] = { 8, 64, 256 };
+	int intervals = 2000;
+	int x;
+
+	if (argc > 1)
+		intervals = atoi(argv[1]);
+	if (intervals <= 0)
+		intervals = 2000;
+	audio_buffers = DEFAULT_AUDIO_BUFFERS;
+
+	printf("%d mixing intervals, everybody talking\n", intervals);
+	if (argc > 2) {
+		for (x = 2; x < argc; x++)
+			if (atoi(argv[x]) > 0)
+				bench(atoi(argv[x]), intervals);
+	} else {
+		for (x = 0; x < sizeof(sizes) / sizeof(sizes[0]); x++)
+			bench(sizes[x], intervals);
+	}
+
+	return 0;
+}
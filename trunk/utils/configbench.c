@@ -0,0 +1,163 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Writes a sip.conf style file with one category per peer, loads it with
+ * config.c and times what a channel driver does on reload: browse every
+ * category and look up its settings by name, then look up peers by name
+ * in random order, as realtime and users.conf lookups do.
+ *
+ * Build with -DCONFIG_INDEX_MIN=2147483647 to time the same run without
+ * the category and variable indexes.
+ *
+ * usage: configbench [categories]
+ *        default 50000 categories
+ */
+
+#include "bench.h"
+
+#include "../config.c"
+
+#include <sys/time.h>
+
+/* The settings of each peer, some of them looked up by name */
+static const char *peer_settings[][2] = {
+	{ "type", "friend" },
+	{ "host", "dynamic" },
+	{ "context", "from-internal" },
+	{ "disallow", "all" },
+	{ "allow", "ulaw" },
+	{ "allow", "alaw" },
+	{ "dtmfmode", "rfc2833" },
+	{ "nat", "no" },
+	{ "canreinvite", "no" },
+	{ "qualify", "yes" },
+	{ "mailbox", NULL },
+	{ "callerid", NULL },
+	{ "secret", NULL },
+	{ "username", NULL },
+	{ "callgroup", "1" },
+	{ "pickupgroup", "1" },
+	{ "language", "en" },
+	{ "call-limit", "2" },
+};
+
+static const char *lookups[] = { "type", "host", "secret", "username", "context", "mailbox", "callerid", "nat", "qualify", "call-limit" };
+
+static double now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static int write_config(const char *fn, int categories)
+{
+	FILE *f;
+	int x, y;
+
+	if (!(f = fopen(fn, "w")))
+		return -1;
+	fprintf(f, "[general]\ncontext=default\nbindport=5060\n\n");
+	for (x = 0; x < categories; x++) {
+		fprintf(f, "[%d]\n", 100000 + x);
+		for (y = 0; y < sizeof(peer_settings) / sizeof(peer_settings[0]); y++) {
+			if (peer_settings[y][1])
+				fprintf(f, "%s=%s\n", peer_settings[y][0], peer_settings[y][1]);
+			else if (!strcmp(peer_settings[y][0], "callerid"))
+				fprintf(f, "callerid=\"Peer %d\" <%d>\n", x, 100000 + x);
+			else
+				fprintf(f, "%s=%d%s\n", peer_settings[y][0], 100000 + x, strcmp(peer_settings[y][0], "mailbox") ? "" : "@default");
+		}
+		fprintf(f, "\n");
+	}
+
+	return fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ast_config *cfg;
+	struct ast_variable *v;
+	char fn[] = "/tmp/configbench.XXXXXX";
+	char name[32];
+	const char *cat;
+	double t0, t1, t2, t3;
+	long found = 0, vars = 0;
+	int categories = 50000;
+	int fd, x, y;
+
+	if (argc > 1)
+		categories = atoi(argv[1]);
+	if (categories <= 0) {
+		fprintf(stderr, "usage: configbench [categories]\n");
+		return 1;
+	}
+
+	if ((fd = mkstemp(fn)) < 0) {
+		fprintf(stderr, "Unable to create a temporary file: %s\n", strerror(errno));
+		return 1;
+	}
+	close(fd);
+	if (write_config(fn, categories)) {
+		fprintf(stderr, "Unable to write %s: %s\n", fn, strerror(errno));
+		unlink(fn);
+		return 1;
+	}
+
+	t0 = now_usec();
+	cfg = ast_config_load(fn);
+	t1 = now_usec();
+	unlink(fn);
+	if (!cfg) {
+		fprintf(stderr, "Unable to load the generated config\n");
+		return 1;
+	}
+
+	/* What a reload does: walk every peer, pick out a few settings by
+	   name, then go through all of them */
+	for (cat = ast_category_browse(cfg, NULL); cat; cat = ast_category_browse(cfg, cat)) {
+		if (!strcasecmp(cat, "general"))
+			continue;
+		for (y = 0; y < 3; y++) {
+			if (ast_variable_retrieve(cfg, cat, lookups[y]))
+				found++;
+		}
+		for (v = ast_variable_browse(cfg, cat); v; v = v->next)
+			vars++;
+	}
+	t2 = now_usec();
+
+	/* Peers looked up one by one, as they register or call */
+	srand(1);
+	for (x = 0; x < categories; x++) {
+		snprintf(name, sizeof(name), "%d", 100000 + rand() % categories);
+		if (ast_variable_retrieve(cfg, name, lookups[x % (sizeof(lookups) / sizeof(lookups[0]))]))
+			found++;
+	}
+	t3 = now_usec();
+
+	printf("%d categories, %ld variables, %ld lookups found (index from %d entries)\n",
+		categories, vars, found, CONFIG_INDEX_MIN);
+	printf("load          %10.1f ms\n", (t1 - t0) / 1000.0);
+	printf("reload walk   %10.1f ms\n", (t2 - t1) / 1000.0);
+	printf("random lookup %10.1f ms  (%.2f us each)\n", (t3 - t2) / 1000.0, (t3 - t2) / categories);
+
+	ast_config_destroy(cfg);
+
+	return 0;
+}
@@ -0,0 +1,309 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Regression corpus and benchmark for DTMF and MF detection in dsp.c.
+ *
+ * Synthesizes every DTMF digit and every MF digit at a range of levels,
+ * twists and tone lengths over noise, runs the corpus through
+ * ast_dsp_digitdetect() in 20 ms frames, and checks that exactly the
+ * generated digits come out.  Where dsp.c runs its goertzel filters as a
+ * vector bank, the corpus is run once per kernel and once with a plain C
+ * bank doing the scalar operations, and the filter states of every
+ * kernel are compared bit for bit with the plain C ones.  Then it reports
+ * how many channels' worth of detection one core keeps up with.
+ *
+ * usage: dspbench [seconds of audio per timing run]
+ *        default 3600
+ */
+
+#include "bench.h"
+
+#include "../dsp.c"
+
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define FRAME_SAMPLES	160
+#define MAX_CORPUS	(8000 * 60)
+#define MAX_DIGITS	2048
+
+struct corpus {
+	int16_t audio[MAX_CORPUS];
+	int samples;
+	char digits[MAX_DIGITS];
+	int count;
+};
+
+static struct corpus dtmf_corpus;
+static struct corpus mf_corpus;
+static unsigned int seed = 1;
+
+static int noise(int level)
+{
+	seed = seed * 1103515245 + 12345;
+	return (int) ((seed >> 16) % (2 * level + 1)) - level;
+}
+
+static void add_silence(struct corpus *c, int ms)
+{
+	int x;
+
+	for (x = 0; (x < ms * 8) && (c->samples < MAX_CORPUS); x++)
+		c->audio[c->samples++] = noise(100);
+}
+
+static void add_tone(struct corpus *c, char digit, float f1, int a1, float f2, int a2, int ms)
+{
+	int x;
+
+	for (x = 0; (x < ms * 8) && (c->samples < MAX_CORPUS); x++) {
+		c->audio[c->samples++] = (int16_t) (a1 * sin(2 * M_PI * f1 * x / 8000.0) +
+			a2 * sin(2 * M_PI * f2 * x / 8000.0)) + noise(100);
+	}
+	if (c->count < MAX_DIGITS - 1)
+		c->digits[c->count++] = digit;
+}
+
+/*! \brief Every DTMF digit at several levels, twists and lengths */
+static void make_dtmf(struct corpus *c)
+{
+	static const int levels[] = { 1500, 3000, 6000, 10000 };
+	static const float twists[] = { 1.0, 0.7, 1.4 };
+	static const int lengths[] = { 60, 100 };
+	int l, t, n, d;
+
+	add_silence(c, 200);
+	for (l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		for (t = 0; t < sizeof(twists) / sizeof(twists[0]); t++) {
+			for (n = 0; n < sizeof(lengths) / sizeof(lengths[0]); n++) {
+				for (d = 0; d < 16; d++) {
+					add_tone(c, dtmf_positions[d], dtmf_row[d / 4], levels[l], dtmf_col[d % 4],
+						levels[l] * twists[t], lengths[n]);
+					add_silence(c, 60);
+				}
+			}
+		}
+	}
+	add_silence(c, 200);
+	c->digits[c->count] = '\0';
+}
+
+/*! \brief Every MF digit, KP long as it is sent, at several levels and twists */
+static void make_mf(struct corpus *c)
+{
+	static const int levels[] = { 3000, 6000, 10000 };
+	static const float twists[] = { 1.0, 0.7, 1.4 };
+	int l, t, i, j;
+
+	add_silence(c, 200);
+	for (l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		for (t = 0; t < sizeof(twists) / sizeof(twists[0]); t++) {
+			for (i = 0; i < 6; i++) {
+				for (j = i + 1; j < 6; j++) {
+					char digit = bell_mf_positions[i * 5 + j - 1];
+
+					add_tone(c, digit, mf_tones[i], levels[l], mf_tones[j], levels[l] * twists[t],
+						(digit == '*') ? 100 : 68);
+					add_silence(c, 68);
+				}
+			}
+		}
+	}
+	add_silence(c, 200);
+	c->digits[c->count] = '\0';
+}
+
+/*! \brief Run a corpus through a detector
+ * \param out the digits detected, may be NULL
+ * \param states where to store the goertzel states after each frame, may be NULL
+ * \return the number of frames processed
+ */
+static int run_corpus(struct corpus *c, int mf, char *out, float *states)
+{
+	struct ast_dsp *dsp;
+	struct ast_frame f;
+	int16_t buf[FRAME_SAMPLES];
+	char digits[MAX_DIGITS];
+	int pos, frames = 0, len = 0, x;
+
+	if (!(dsp = ast_dsp_new())) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	ast_dsp_set_features(dsp, DSP_FEATURE_DTMF_DETECT);
+	ast_dsp_digitmode(dsp, (mf ? DSP_DIGITMODE_MF : DSP_DIGITMODE_DTMF) | DSP_DIGITMODE_RELAXDTMF);
+
+	memset(&f, 0, sizeof(f));
+	f.frametype = AST_FRAME_VOICE;
+	f.subclass = AST_FORMAT_SLINEAR;
+	f.data = buf;
+	f.datalen = sizeof(buf);
+	f.samples = FRAME_SAMPLES;
+	for (pos = 0; pos + FRAME_SAMPLES <= c->samples; pos += FRAME_SAMPLES, frames++) {
+		/* Detection mutes the tone in the frame it is given */
+		memcpy(buf, c->audio + pos, sizeof(buf));
+		ast_dsp_digitdetect(dsp, &f);
+		if (out)
+			len += ast_dsp_getdigits(dsp, digits, sizeof(digits) - 1) ? sprintf(out + len, "%s", digits) : 0;
+		if (!states)
+			continue;
+		for (x = 0; x < 6; x++) {
+			goertzel_state_t *g = mf ? &dsp->td.mf.tone_out[x] : (x < 4) ? &dsp->td.dtmf.row_out[x] : &dsp->td.dtmf.col_out[x - 4];
+
+			*states++ = g->v2;
+			*states++ = g->v3;
+		}
+	}
+	if (out)
+		out[len] = '\0';
+	ast_dsp_free(dsp);
+
+	return frames;
+}
+
+static double cpu_usec(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+#endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec * 1000000.0 + tv.tv_usec;
+	}
+}
+
+/*! \brief Channels one core could run detection on, over at least \a seconds of audio */
+static double channels_per_core(struct corpus *c, int mf, int seconds)
+{
+	double start = cpu_usec();
+	double audio = 0;
+
+	while (audio < seconds)
+		audio += run_corpus(c, mf, NULL, NULL) * FRAME_SAMPLES / 8000.0;
+
+	return audio * 1000000.0 / (cpu_usec() - start);
+}
+
+static int check_digits(const char *what, struct corpus *c, const char *got)
+{
+	if (!strcmp(got, c->digits)) {
+		printf("  %-6s %d of %d digits detected\n", what, c->count, c->count);
+		return 0;
+	}
+	printf("  %-6s FAILED\n    sent %s\n    got  %s\n", what, c->digits, got);
+	return 1;
+}
+
+struct kernel {
+	const char *name;
+#ifdef GOERTZEL_BANK
+	goertzel_bank_fn fn;
+#endif
+};
+
+#ifdef GOERTZEL_BANK
+/*! \brief The filter bank in plain C, the operations of the scalar loops */
+static void goertzel_bank_c(float *v2, float *v3, const float *fac, const int16_t *amp, int count)
+{
+	float famp, v1;
+	int i, j;
+
+	for (j = 0; j < count; j++) {
+		famp = amp[j];
+		for (i = 0; i < GOERTZEL_BANK_SIZE; i++) {
+			v1 = v2[i];
+			v2[i] = v3[i];
+			v3[i] = fac[i] * v2[i] - v1 + famp;
+		}
+	}
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	static char got[MAX_DIGITS * 2];
+	struct kernel kernels[3];
+	float *ref[2] = { NULL, NULL }, *states[2] = { NULL, NULL };
+	struct corpus *corpus[2] = { &dtmf_corpus, &mf_corpus };
+	int seconds = 3600;
+	int nkernels = 0;
+	int failed = 0;
+	int frames[2];
+	int k, mf;
+
+	if (argc > 1)
+		seconds = atoi(argv[1]);
+	if (seconds <= 0)
+		seconds = 3600;
+
+	make_dtmf(&dtmf_corpus);
+	make_mf(&mf_corpus);
+	frames[0] = dtmf_corpus.samples / FRAME_SAMPLES;
+	frames[1] = mf_corpus.samples / FRAME_SAMPLES;
+	printf("Corpus: %d DTMF digits in %.1f s, %d MF digits in %.1f s\n",
+		dtmf_corpus.count, dtmf_corpus.samples / 8000.0, mf_corpus.count, mf_corpus.samples / 8000.0);
+
+#ifdef GOERTZEL_BANK
+	kernels[nkernels].name = "C";
+	kernels[nkernels++].fn = goertzel_bank_c;
+	kernels[nkernels].name = "SSE2";
+	kernels[nkernels++].fn = goertzel_bank_sse2;
+	if (ast_cpu_has_avx2()) {
+		kernels[nkernels].name = "AVX2";
+		kernels[nkernels++].fn = goertzel_bank_avx2;
+	}
+	for (mf = 0; mf < 2; mf++) {
+		if (!(ref[mf] = malloc(frames[mf] * 12 * sizeof(float))) || !(states[mf] = malloc(frames[mf] * 12 * sizeof(float)))) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+	}
+#else
+	kernels[nkernels++].name = "scalar";
+#endif
+
+	for (k = 0; k < nkernels; k++) {
+#ifdef GOERTZEL_BANK
+		goertzel_bank = kernels[k].fn;
+#endif
+		printf("%s goertzels:\n", kernels[k].name);
+		for (mf = 0; mf < 2; mf++) {
+			run_corpus(corpus[mf], mf, got, k ? states[mf] : ref[mf]);
+			failed += check_digits(mf ? "MF" : "DTMF", corpus[mf], got);
+			if (k && memcmp(states[mf], ref[mf], frames[mf] * 12 * sizeof(float))) {
+				printf("  %-6s filter states differ from the C bank\n", mf ? "MF" : "DTMF");
+				failed++;
+			} else if (k)
+				printf("  %-6s filter states identical to the C bank after every frame\n", mf ? "MF" : "DTMF");
+		}
+		printf("  channels per core: %.0f DTMF, %.0f MF\n",
+			channels_per_core(&dtmf_corpus, 0, seconds), channels_per_core(&mf_corpus, 1, seconds));
+	}
+
+	for (mf = 0; mf < 2; mf++) {
+		free(ref[mf]);
+		free(states[mf]);
+	}
+
+	return failed ? 1 : 0;
+}
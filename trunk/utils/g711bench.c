@@ -0,0 +1,170 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Checks the block G.711 conversions in ulaw.c and alaw.c against the
+ * lookup tables for every input, then times them against the per-sample
+ * table loops the codecs used before, on 20 ms frames.  The block encoders
+ * only use the vector kernels where ast_ulaw_init() and ast_alaw_init()
+ * timed them faster than the table loop, so on other CPUs encode runs
+ * the table loop both ways.
+ *
+ * usage: g711bench [frames]
+ */
+
+#include "asterisk/autoconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "asterisk/ulaw.h"
+#include "asterisk/alaw.h"
+#include "asterisk/simd.h"
+
+#define FRAME_SAMPLES 160
+
+void ast_register_file_version(const char *file, const char *version);
+void ast_unregister_file_version(const char *file);
+
+/* The core objects register their versions; we don't care. */
+void ast_register_file_version(const char *file, const char *version)
+{
+}
+
+void ast_unregister_file_version(const char *file)
+{
+}
+
+static short lin[65536];
+static unsigned char codes[65536];
+static short out_lin[65536];
+static unsigned char out_codes[65536];
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int check(void)
+{
+	int x;
+	int bad = 0;
+
+	ast_ulaw_decode(out_lin, codes, 256);
+	for (x = 0; x < 256; x++)
+		bad += out_lin[x] != AST_MULAW(codes[x]);
+	ast_alaw_decode(out_lin, codes, 256);
+	for (x = 0; x < 256; x++)
+		bad += out_lin[x] != AST_ALAW(codes[x]);
+	ast_ulaw_encode(out_codes, lin, 65536);
+	for (x = 0; x < 65536; x++)
+		bad += out_codes[x] != AST_LIN2MU(lin[x]);
+	ast_alaw_encode(out_codes, lin, 65536);
+	for (x = 0; x < 65536; x++)
+		bad += out_codes[x] != AST_LIN2A(lin[x]);
+
+	return bad;
+}
+
+static void report(const char *what, double table, double block, int frames)
+{
+	double samples = (double) frames * FRAME_SAMPLES;
+
+	printf("%-14s table %8.1f Msamples/s   block %8.1f Msamples/s   %5.2fx\n",
+		what, samples / table / 1e6, samples / block / 1e6, table / block);
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = 1000000;
+	int f, x, pos;
+	double start, table, block;
+
+	if (argc > 1)
+		frames = atoi(argv[1]);
+	if (frames <= 0)
+		frames = 1000000;
+
+	ast_ulaw_init();
+	ast_alaw_init();
+
+	for (x = 0; x < 65536; x++) {
+		lin[x] = (short) x;
+		codes[x] = x;
+	}
+
+#ifdef AST_X86_SIMD
+	printf("Kernels: %s\n", ast_cpu_has_avx2() ? "AVX2" : ast_cpu_has_sse2() ? "SSE2" : "scalar");
+#else
+	printf("Kernels: scalar\n");
+#endif
+	if ((x = check())) {
+		printf("FAILED: %d conversions differ from the tables\n", x);
+		return 1;
+	}
+	printf("All conversions match the tables\n");
+
+	/* Walk through the input so the frames aren't all the same */
+	start = now();
+	for (f = 0, pos = 0; f < frames; f++, pos = (pos + FRAME_SAMPLES) % 65280)
+		for (x = 0; x < FRAME_SAMPLES; x++)
+			out_lin[pos + x] = AST_MULAW(codes[pos + x]);
+	table = now() - start;
+	start = now();
+	for (f = 0, pos = 0; f < frames; f++, pos = (pos + FRAME_SAMPLES) % 65280)
+		ast_ulaw_decode(out_lin + pos, codes + pos, FRAME_SAMPLES);
+	block = now() - start;
+	report("ulaw decode", table, block, frames);
+
+	start = now();
+	for (f = 0, pos = 0; f < frames; f++, pos = (pos + FRAME_SAMPLES) % 65280)
+		for (x = 0; x < FRAME_SAMPLES; x++)
+			out_codes[pos + x] = AST_LIN2MU(lin[pos + x]);
+	table = now() - start;
+	start = now();
+	for (f = 0, pos = 0; f < frames; f++, pos = (pos + FRAME_SAMPLES) % 65280)
+		ast_ulaw_encode(out_codes + pos, lin + pos, FRAME_SAMPLES);
+	block = now() - start;
+	report("ulaw encode", table, block, frames);
+
+	start = now();
+	for (f = 0, pos = 0; f < frames; f++, pos = (pos + FRAME_SAMPLES) % 65280)
+		for (x = 0; x < FRAME_SAMPLES; x++)
+			out_lin[pos + x] = AST_ALAW(codes[pos + x]);
+	table = now() - start;
+	start = now();
+	for (f = 0, pos = 0; f < frames; f++, pos = (pos + FRAME_SAMPLES) % 65280)
+		ast_alaw_decode(out_lin + pos, codes + pos, FRAME_SAMPLES);
+	block = now() - start;
+	report("alaw decode", table, block, frames);
+
+	start = now();
+	for (f = 0, pos = 0; f < frames; f++, pos = (pos + FRAME_SAMPLES) % 65280)
+		for (x = 0; x < FRAME_SAMPLES; x++)
+			out_codes[pos + x] = AST_LIN2A(lin[pos + x]);
+	table = now() - start;
+	start = now();
+	for (f = 0, pos = 0; f < frames; f++, pos = (pos + FRAME_SAMPLES) % 65280)
+		ast_alaw_encode(out_codes + pos, lin + pos, FRAME_SAMPLES);
+	block = now() - start;
+	report("alaw encode", table, block, frames);
+
+	return 0;
+}
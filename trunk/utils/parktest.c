@@ -0,0 +1,305 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Regression test for the parking lot in res_features.c.  Parks calls on
+ * channels backed by pipes, with the real parking thread watching them,
+ * enough of them that their descriptors go well past FD_SETSIZE when the
+ * descriptor limit allows it.  A quarter of the calls get audio, which
+ * must be read without unparking them, a quarter hang up, which must
+ * take them out of the lot, and a quarter have a short parking time,
+ * which must send them back to where they were parked from, and not
+ * before it runs out.  Then it checks the space index and the timeout
+ * heap, that a reused space ignores events meant for the call parked
+ * there before, and that freed spaces are handed out again.
+ *
+ * usage: parktest [calls]
+ *        default 2000 calls
+ */
+
+#include "bench.h"
+
+#include "../res/res_features.c"
+
+#include <sys/resource.h>
+
+/* Counted by the parking thread with parking_lock held */
+static int reads, hangups, pbxstarts, extensions;
+static struct ast_frame voice = { AST_FRAME_VOICE, };
+static char context;
+
+/* What parking uses from the rest of Asterisk, beyond bench_stubs.c */
+int ast_moh_start(struct ast_channel *chan, const char *mclass)
+{
+	return 0;
+}
+
+void ast_moh_stop(struct ast_channel *chan)
+{
+}
+
+int ast_indicate(struct ast_channel *chan, int condition)
+{
+	return 0;
+}
+
+struct ast_context *ast_context_find(const char *name)
+{
+	return (struct ast_context *) &context;
+}
+
+int ast_add_extension2(struct ast_context *con, int replace, const char *extension,
+	int priority, const char *label, const char *callerid,
+	const char *application, void *data, void (*datad)(void *), const char *registrar)
+{
+	extensions++;
+	if (datad)
+		datad(data);
+	return 0;
+}
+
+int ast_context_remove_extension2(struct ast_context *con, const char *extension,
+	int priority, const char *registrar)
+{
+	extensions--;
+	return 0;
+}
+
+/* A byte on the pipe is a voice frame, end of file is a hangup */
+struct ast_frame *ast_read(struct ast_channel *chan)
+{
+	char c;
+
+	reads++;
+	if (read(chan->fds[0], &c, 1) != 1)
+		return NULL;
+	return &voice;
+}
+
+void ast_frfree(struct ast_frame *f)
+{
+}
+
+int ast_hangup(struct ast_channel *chan)
+{
+	hangups++;
+	close(chan->fds[0]);
+	chan->fds[0] = -1;
+	return 0;
+}
+
+int ast_pbx_start(struct ast_channel *chan)
+{
+	pbxstarts++;
+	return 0;
+}
+
+enum call_kind {
+	CALL_IDLE,	/* stays parked throughout */
+	CALL_AUDIO,	/* sends audio, stays parked */
+	CALL_HANGUP,	/* hangs up while parked */
+	CALL_TIMEOUT,	/* runs out of parking time */
+};
+
+#define SHORT_PARKINGTIME	2000	/* ms, long enough to park every call first */
+
+struct test_call {
+	struct ast_channel chan;
+	int wfd;
+	int space;
+};
+
+static int failures;
+
+static void check(int ok, const char *what)
+{
+	if (!ok) {
+		printf("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/*! \brief Wait up to \a ms for the parking thread to bring \a counter to \a value */
+static int wait_for(int *counter, int value, int ms)
+{
+	int res;
+
+	for (;;) {
+		ast_mutex_lock(&parking_lock);
+		res = *counter;
+		ast_mutex_unlock(&parking_lock);
+		if ((res >= value) || (ms <= 0))
+			return res;
+		usleep(10000);
+		ms -= 10;
+	}
+}
+
+static int open_channel(struct test_call *c, int n)
+{
+	int p[2], x;
+
+	memset(c, 0, sizeof(*c));
+	if (pipe(p))
+		return -1;
+	for (x = 0; x < AST_MAX_FDS; x++)
+		c->chan.fds[x] = -1;
+	c->chan.fds[0] = p[0];
+	c->wfd = p[1];
+	if (ast_string_field_init(&c->chan, 64))
+		return -1;
+	ast_string_field_build(&c->chan, name, "Test/park-%d", n);
+	ast_copy_string(c->chan.context, "parktest", sizeof(c->chan.context));
+	snprintf(c->chan.exten, sizeof(c->chan.exten), "%d", 1000 + n);
+	c->chan.priority = 1;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct test_call *calls, extra;
+	struct parkeduser *pu;
+	struct rlimit rl;
+	uint64_t oldkey;
+	int ncalls = 2000;
+	int counts[4] = { 0, };
+	int x, y, space, maxfd = 0;
+
+	if (argc > 1)
+		ncalls = atoi(argv[1]);
+	if (ncalls < 8) {
+		fprintf(stderr, "usage: parktest [calls (at least 8)]\n");
+		return 1;
+	}
+
+	/* two descriptors a call, and some to spare */
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && (rl.rlim_cur < 2 * ncalls + 64)) {
+		rl.rlim_cur = (rl.rlim_max < 2 * ncalls + 64) ? rl.rlim_max : 2 * ncalls + 64;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		if ((rl.rlim_cur - 64) / 2 < ncalls) {
+			ncalls = (rl.rlim_cur - 64) / 2;
+			printf("Descriptor limit allows only %d calls\n", ncalls);
+		}
+	}
+	if (!(calls = calloc(ncalls, sizeof(*calls)))) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	ast_copy_string(parking_con, "parkedcalls", sizeof(parking_con));
+	parking_start = 701;
+	parking_stop = 700 + ncalls + 10;
+	parkingtime = 60000;
+	if (parkinglot_resize() || parking_init() ||
+	    pthread_create(&parking_thread, NULL, do_parking_thread, NULL)) {
+		fprintf(stderr, "Unable to start parking\n");
+		return 1;
+	}
+
+	for (x = 0; x < ncalls; x++) {
+		if (open_channel(&calls[x], x)) {
+			fprintf(stderr, "Unable to open call %d: %s\n", x, strerror(errno));
+			return 1;
+		}
+		if (calls[x].chan.fds[0] > maxfd)
+			maxfd = calls[x].chan.fds[0];
+		if (ast_park_call(&calls[x].chan, NULL, ((x % 4) == CALL_TIMEOUT) ? SHORT_PARKINGTIME : 0, &calls[x].space)) {
+			fprintf(stderr, "Unable to park call %d\n", x);
+			return 1;
+		}
+		counts[x % 4]++;
+		check(calls[x].space == parking_start + x, "spaces are handed out in order");
+	}
+	printf("Parked %d calls on %d-%d, highest descriptor %d (FD_SETSIZE %d)\n",
+		ncalls, calls[0].space, calls[ncalls - 1].space, maxfd, FD_SETSIZE);
+
+	for (x = 0; x < ncalls; x++) {
+		if ((x % 4) == CALL_AUDIO)
+			check(write(calls[x].wfd, "x", 1) == 1, "sending audio");
+		else if ((x % 4) == CALL_HANGUP) {
+			close(calls[x].wfd);
+			calls[x].wfd = -1;
+		}
+	}
+
+	/* audio and hangups are handled, and nothing timed out early */
+	wait_for(&hangups, counts[CALL_HANGUP], 5000);
+	wait_for(&reads, counts[CALL_AUDIO] + counts[CALL_HANGUP], 5000);
+	ast_mutex_lock(&parking_lock);
+	printf("After audio and hangups: %d reads, %d hung up, %d timed out, %d parked\n",
+		reads, hangups, pbxstarts, parkinglot_count);
+	check(reads == counts[CALL_AUDIO] + counts[CALL_HANGUP], "every frame read once");
+	check(hangups == counts[CALL_HANGUP], "every hangup noticed");
+	check(!pbxstarts, "no parking time runs out early");
+	ast_mutex_unlock(&parking_lock);
+	wait_for(&pbxstarts, counts[CALL_TIMEOUT], SHORT_PARKINGTIME * 3);
+	ast_mutex_lock(&parking_lock);
+
+	printf("After the short parking time: %d timed out, %d parked, %d timers\n",
+		pbxstarts, parkinglot_count, parking_timers_count);
+	check(pbxstarts == counts[CALL_TIMEOUT], "every short parking time runs out");
+	check(parkinglot_count == counts[CALL_IDLE] + counts[CALL_AUDIO], "the rest stay parked");
+	check(parking_timers_count == parkinglot_count, "one timer per parked call");
+	check(extensions == parkinglot_count, "one extension per parked call");
+	for (x = 0; x < ncalls; x++) {
+		pu = park_find(calls[x].space);
+		switch (x % 4) {
+		case CALL_IDLE:
+		case CALL_AUDIO:
+			check(pu && (pu->chan == &calls[x].chan) && (pu->timer >= 0), "parked call indexed by its space");
+			break;
+		case CALL_HANGUP:
+			check(!pu, "hung up call out of the index");
+			break;
+		case CALL_TIMEOUT:
+			check(!pu, "timed out call out of the index");
+			check((atoi(calls[x].chan.exten) == 1000 + x) && !strcmp(calls[x].chan.context, "parktest"),
+				"timed out call sent back where it came from");
+			break;
+		}
+	}
+	for (x = 1; x < parking_timers_count; x++)
+		check(ast_tvcmp(parking_timers[(x - 1) / 2]->expire, parking_timers[x]->expire) <= 0, "timer heap order");
+
+	/* pick a call up, the way ParkedCall() does */
+	space = calls[0].space;
+	pu = park_find(space);
+	oldkey = park_key(pu, 0);
+	park_remove(pu);
+	park_remove_exten(space);
+	free(pu);
+	check(!park_find(space) && (parking_timers_count == parkinglot_count), "picked up call out of the lot");
+	ast_mutex_unlock(&parking_lock);
+
+	/* the freed spaces are handed out again, lowest first */
+	if (open_channel(&extra, ncalls)) {
+		fprintf(stderr, "Unable to open a channel: %s\n", strerror(errno));
+		return 1;
+	}
+	check(!ast_park_call(&extra.chan, NULL, 0, &y), "parking again");
+	check(y == space, "a freed space is reused");
+	ast_mutex_lock(&parking_lock);
+	check(!park_from_key(oldkey, &x), "events for the call parked before are ignored");
+	check((pu = park_from_key(park_key(park_find(y), 0), &x)) && (pu->chan == &extra.chan), "events for the new call are not");
+	ast_mutex_unlock(&parking_lock);
+
+	if (failures)
+		printf("%d checks FAILED\n", failures);
+	else
+		printf("All checks passed\n");
+
+	return failures ? 1 : 0;
+}
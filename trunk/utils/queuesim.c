@@ -0,0 +1,298 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Drives app_queue's waiting loop and dispatcher with synthetic callers
+ * and members.  Every caller is a thread that joins the queue and then
+ * does what wait_our_turn() does: check is_our_turn(), sleep in
+ * queue_wait() for queue_wait_time(), repeat.  When it is its turn it
+ * takes a free member and leaves, as the rrmemory strategy would.
+ * Members stay on a call for a random 100-300 ms, then hang up through
+ * update_queue() and update_status().
+ *
+ * The run is done once with the dispatcher waking callers and once with
+ * callers polling every RECHECK seconds the way they used to, and reports
+ * the time from a member becoming free to a caller ringing it, how long
+ * callers were held, and how often each of them woke up while waiting.
+ *
+ * usage: queuesim [callers [members [autofill [wrapuptime]]]]
+ *        default 200 callers, 20 members, autofill off, no wrapup
+ */
+
+#include "bench.h"
+
+#include "../apps/app_queue.c"
+
+#include <poll.h>
+#include <sys/time.h>
+
+/* The parts of Asterisk the waiting loop and dispatcher use, beyond
+   bench_stubs.c */
+int ast_device_state(const char *device)
+{
+	return AST_DEVICE_NOT_INUSE;
+}
+
+struct ast_variable *ast_load_realtime(const char *family, ...)
+{
+	return NULL;
+}
+
+int ast_waitfordigit(struct ast_channel *c, int ms)
+{
+	usleep(ms * 1000);
+	return 0;
+}
+
+int ast_waitfordigit_full(struct ast_channel *c, int ms, int audiofd, int cmdfd)
+{
+	struct pollfd pfd = { cmdfd, POLLIN, 0 };
+
+	return (poll(&pfd, 1, ms) > 0) ? 1 : 0;
+}
+
+#define MAX_MEMBERS	256
+
+struct sim_caller {
+	struct queue_ent qe;
+	struct ast_channel chan;
+	pthread_t thread;
+	int wakeups;
+	double joined;
+	double waited;
+	double latency;
+};
+
+static struct call_queue *simq;
+static struct member *members[MAX_MEMBERS];
+static int nmembers = 20;
+/* When each member became available, and when its current call ends.
+   Both are protected by the queue lock. */
+static double avail[MAX_MEMBERS];
+static double callend[MAX_MEMBERS];
+static int served;
+
+static double now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/*! \brief Ring the first free member, as try_calling() would */
+static int take_member(struct sim_caller *c)
+{
+	struct member *m;
+	time_t t = time(NULL);
+	double now = now_ms();
+	int x;
+
+	ast_mutex_lock(&simq->lock);
+	for (x = 0; x < nmembers; x++) {
+		m = members[x];
+		if ((m->status != AST_DEVICE_NOT_INUSE) || m->paused)
+			continue;
+		if (simq->wrapuptime && (t - m->lastcall < simq->wrapuptime))
+			continue;
+		m->status = AST_DEVICE_INUSE;
+		c->latency = now - ((avail[x] > c->joined) ? avail[x] : c->joined);
+		if (c->latency < 0)
+			c->latency = 0;
+		callend[x] = now + 100 + rand() % 200;
+		served++;
+		break;
+	}
+	ast_mutex_unlock(&simq->lock);
+
+	return x < nmembers;
+}
+
+static void *caller_thread(void *data)
+{
+	struct sim_caller *c = data;
+	enum queue_result reason;
+
+	c->joined = now_ms();
+	if (join_queue(simq->name, &c->qe, &reason)) {
+		fprintf(stderr, "Unable to join the queue\n");
+		exit(1);
+	}
+	for (;;) {
+		if (is_our_turn(&c->qe) && take_member(c))
+			break;
+		queue_wait(&c->qe, queue_wait_time(&c->qe));
+		c->wakeups++;
+	}
+	c->waited = now_ms() - c->joined;
+	leave_queue(&c->qe);
+
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void run(int ncallers, int dispatch)
+{
+	struct sim_caller *callers;
+	double *lat;
+	double sum = 0, waited = 0, now;
+	long wakeups = 0;
+	int x;
+
+	if (!(callers = calloc(ncallers, sizeof(*callers))) || !(lat = calloc(ncallers, sizeof(*lat)))) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	served = 0;
+	now = now_ms();
+	for (x = 0; x < nmembers; x++) {
+		members[x]->status = AST_DEVICE_NOT_INUSE;
+		members[x]->lastcall = 0;
+		avail[x] = now;
+		callend[x] = 0;
+	}
+
+	for (x = 0; x < ncallers; x++) {
+		struct sim_caller *c = &callers[x];
+
+		if (ast_string_field_init(&c->chan, 128)) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		ast_string_field_build(&c->chan, name, "Sim/caller-%d", x);
+		ast_string_field_set(&c->chan, uniqueid, c->chan.name);
+		c->qe.chan = &c->chan;
+		c->qe.last_periodic_announce_time = time(NULL);
+		c->qe.wakefd[0] = c->qe.wakefd[1] = -1;
+		if (dispatch) {
+			if (pipe(c->qe.wakefd)) {
+				fprintf(stderr, "Unable to create wakeup pipe: %s\n", strerror(errno));
+				exit(1);
+			}
+			fcntl(c->qe.wakefd[0], F_SETFL, fcntl(c->qe.wakefd[0], F_GETFL) | O_NONBLOCK);
+			fcntl(c->qe.wakefd[1], F_SETFL, fcntl(c->qe.wakefd[1], F_GETFL) | O_NONBLOCK);
+		}
+		if (pthread_create(&c->thread, NULL, caller_thread, c)) {
+			fprintf(stderr, "Unable to start caller %d\n", x);
+			exit(1);
+		}
+	}
+
+	/* Hang up calls as they end, the way the bridge and the device state
+	   changes would */
+	for (;;) {
+		usleep(1000);
+		now = now_ms();
+		for (x = 0; x < nmembers; x++) {
+			ast_mutex_lock(&simq->lock);
+			if (!callend[x] || (callend[x] > now)) {
+				ast_mutex_unlock(&simq->lock);
+				continue;
+			}
+			callend[x] = 0;
+			ast_mutex_unlock(&simq->lock);
+			update_queue(simq, members[x]);
+			ast_mutex_lock(&simq->lock);
+			avail[x] = simq->wrapuptime ? (members[x]->lastcall + simq->wrapuptime) * 1000.0 : now;
+			ast_mutex_unlock(&simq->lock);
+			update_status(simq, members[x], AST_DEVICE_NOT_INUSE);
+		}
+		ast_mutex_lock(&simq->lock);
+		x = served;
+		ast_mutex_unlock(&simq->lock);
+		if (x == ncallers)
+			break;
+	}
+
+	for (x = 0; x < ncallers; x++) {
+		pthread_join(callers[x].thread, NULL);
+		lat[x] = callers[x].latency;
+		sum += lat[x];
+		wakeups += callers[x].wakeups;
+		waited += callers[x].waited;
+		ast_string_field_free_all(&callers[x].chan);
+		if (callers[x].qe.wakefd[0] > -1) {
+			close(callers[x].qe.wakefd[0]);
+			close(callers[x].qe.wakefd[1]);
+		}
+	}
+	qsort(lat, ncallers, sizeof(*lat), cmp_double);
+
+	printf("%-8s  time to ring: mean %7.1f ms  95%% %7.1f ms  max %8.1f ms   held %6.0f ms  wakeups %5.1f per caller\n",
+		dispatch ? "dispatch" : "polling", sum / ncallers, lat[ncallers * 95 / 100], lat[ncallers - 1],
+		waited / ncallers, (double) wakeups / ncallers);
+
+	free(lat);
+	free(callers);
+}
+
+int main(int argc, char *argv[])
+{
+	struct member *prev = NULL;
+	int ncallers = 200;
+	char interface[80];
+	int x;
+
+	if (argc > 1)
+		ncallers = atoi(argv[1]);
+	if (argc > 2)
+		nmembers = atoi(argv[2]);
+	if ((ncallers <= 0) || (nmembers <= 0) || (nmembers > MAX_MEMBERS)) {
+		fprintf(stderr, "usage: queuesim [callers [members (1-%d) [autofill [wrapuptime]]]]\n", MAX_MEMBERS);
+		return 1;
+	}
+
+	if (!(simq = alloc_queue("sim"))) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	init_queue(simq);
+	clear_queue(simq);
+	/* Callers ring one member each, as with any strategy but ringall */
+	simq->strategy = QUEUE_STRATEGY_RRMEMORY;
+	if (argc > 3)
+		simq->autofill = atoi(argv[3]);
+	if (argc > 4)
+		simq->wrapuptime = atoi(argv[4]);
+	for (x = 0; x < nmembers; x++) {
+		snprintf(interface, sizeof(interface), "Sim/member-%d", x);
+		if (!(members[x] = create_queue_member(interface, 0, 0))) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+		members[x]->parent = simq;
+		if (prev)
+			prev->next = members[x];
+		else
+			simq->members = members[x];
+		prev = members[x];
+	}
+	link_queue(simq);
+
+	srand(1);
+	printf("%d callers, %d members, autofill %s, wrapuptime %d\n", ncallers, nmembers,
+		simq->autofill ? "on" : "off", simq->wrapuptime);
+	run(ncallers, 1);
+	run(ncallers, 0);
+
+	return 0;
+}
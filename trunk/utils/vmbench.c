@@ -0,0 +1,256 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2006, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*
+ * Builds a voicemail spool with many mailboxes under /tmp and times what
+ * app_voicemail does to it while the mailboxes are idle: the new and old
+ * message counts MWI and the manager ask for, and finding the next free
+ * message number when a message is left.  Each is timed through the
+ * folder index in app_voicemail.c, once while the index is being filled
+ * and once it is, and against the directory scans and per number probing
+ * the index replaced.  Then it leaves a message and checks the counts see
+ * it.
+ *
+ * usage: vmbench [mailboxes [messages]]
+ *        default 50000 mailboxes with 3 new and 1 old message each
+ */
+
+#include "bench.h"
+
+#include "../apps/app_voicemail.c"
+
+#include <utime.h>
+#include <sys/time.h>
+
+/* Messages are recorded as wav and gsm, the formats file.c would find */
+static const char *formats[] = { "wav", "gsm" };
+
+/* What the message counts use from the rest of Asterisk, beyond bench_stubs.c */
+int ast_fileexists(const char *filename, const char *fmt, const char *preflang)
+{
+	char fn[256];
+	struct stat st;
+	int x;
+
+	for (x = 0; x < sizeof(formats) / sizeof(formats[0]); x++) {
+		if (fmt && strcmp(fmt, formats[x]))
+			continue;
+		snprintf(fn, sizeof(fn), "%s.%s", filename, formats[x]);
+		if (!stat(fn, &st))
+			return 1;
+	}
+	return 0;
+}
+
+static char spool[] = "/tmp/vmbench.XXXXXX";
+
+static double now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static int touch(const char *fn)
+{
+	FILE *f;
+
+	if (!(f = fopen(fn, "w")))
+		return -1;
+	return fclose(f);
+}
+
+/*! \brief A folder with \a messages messages, last changed an hour ago like an idle mailbox */
+static int make_folder(int mailbox, const char *folder, int messages)
+{
+	struct utimbuf ut = { time(NULL) - 3600, time(NULL) - 3600 };
+	char dir[256], fn[256];
+	int x, y;
+
+	snprintf(dir, sizeof(dir), "%sdefault/%d", VM_SPOOL_DIR, mailbox);
+	if (mkdir(dir, 0755) && (errno != EEXIST))
+		return -1;
+	snprintf(dir, sizeof(dir), "%sdefault/%d/%s", VM_SPOOL_DIR, mailbox, folder);
+	if (mkdir(dir, 0755))
+		return -1;
+	for (x = 0; x < messages; x++) {
+		for (y = 0; y < sizeof(formats) / sizeof(formats[0]); y++) {
+			snprintf(fn, sizeof(fn), "%s/msg%04d.%s", dir, x, formats[y]);
+			if (touch(fn))
+				return -1;
+		}
+		snprintf(fn, sizeof(fn), "%s/msg%04d.txt", dir, x);
+		if (touch(fn))
+			return -1;
+	}
+	return utime(dir, &ut);
+}
+
+/*! \brief What count_messages() did for each folder before the index */
+static int scan_count(const char *dir)
+{
+	DIR *vmdir;
+	struct dirent *vment;
+	int vmcount = 0;
+
+	if ((vmdir = opendir(dir))) {
+		while ((vment = readdir(vmdir))) {
+			if (strlen(vment->d_name) > 7 && !strncmp(vment->d_name + 7, ".txt", 4))
+				vmcount++;
+		}
+		closedir(vmdir);
+	}
+	return vmcount;
+}
+
+/*! \brief What finding the next message number did before the index */
+static int probe_next(char *dir, int max)
+{
+	char fn[256];
+	int x;
+
+	for (x = 0; x < max; x++) {
+		make_file(fn, sizeof(fn), dir, x);
+		if (ast_fileexists(fn, NULL, NULL) < 1)
+			break;
+	}
+	return x;
+}
+
+static double index_memory(void)
+{
+	struct vm_index *idx;
+	double bytes = 0;
+	int x;
+
+	for (x = 0; x < VM_INDEX_BUCKETS; x++) {
+		for (idx = vm_indexes[x]; idx; idx = idx->next)
+			bytes += sizeof(*idx) + strlen(idx->dir) + idx->size;
+	}
+	return bytes + sizeof(vm_indexes);
+}
+
+int main(int argc, char *argv[])
+{
+	char mailbox[32], dir[256], fn[256], cmd[64];
+	double t;
+	long total;
+	int mailboxes = 50000, messages = 3;
+	int newmsgs, oldmsgs, failed = 0;
+	int pass, x;
+
+	if (argc > 1)
+		mailboxes = atoi(argv[1]);
+	if (argc > 2)
+		messages = atoi(argv[2]);
+	if ((mailboxes <= 0) || (messages <= 0) || (messages > MAXMSGLIMIT)) {
+		fprintf(stderr, "usage: vmbench [mailboxes [messages (1-%d)]]\n", MAXMSGLIMIT);
+		return 1;
+	}
+
+	if (!mkdtemp(spool)) {
+		fprintf(stderr, "Unable to create a spool: %s\n", strerror(errno));
+		return 1;
+	}
+	snprintf(VM_SPOOL_DIR, sizeof(VM_SPOOL_DIR), "%s/", spool);
+	snprintf(dir, sizeof(dir), "%sdefault", VM_SPOOL_DIR);
+	mkdir(dir, 0755);
+	t = now_usec();
+	for (x = 0; x < mailboxes; x++) {
+		if (make_folder(x, "INBOX", messages) || make_folder(x, "Old", 1)) {
+			fprintf(stderr, "Unable to fill the spool: %s\n", strerror(errno));
+			failed = 1;
+			goto done;
+		}
+	}
+	printf("%d mailboxes with %d new and 1 old message each, spool built in %.1f s\n",
+		mailboxes, messages, (now_usec() - t) / 1000000.0);
+
+	/* MWI and the manager asking for everybody's counts */
+	for (pass = 0; pass < 2; pass++) {
+		t = now_usec();
+		for (x = 0, total = 0; x < mailboxes; x++) {
+			snprintf(mailbox, sizeof(mailbox), "%d@default", x);
+			inboxcount(mailbox, &newmsgs, &oldmsgs);
+			total += newmsgs + oldmsgs;
+		}
+		printf("counts, %-14s %9.1f ms  (%.2f us a mailbox)\n", pass ? "indexed" : "filling index",
+			(now_usec() - t) / 1000.0, (now_usec() - t) / mailboxes);
+		if (total != (long) mailboxes * (messages + 1)) {
+			printf("FAILED: counted %ld messages\n", total);
+			failed = 1;
+		}
+	}
+	t = now_usec();
+	for (x = 0, total = 0; x < mailboxes; x++) {
+		snprintf(dir, sizeof(dir), "%sdefault/%d/INBOX", VM_SPOOL_DIR, x);
+		total += scan_count(dir);
+		snprintf(dir, sizeof(dir), "%sdefault/%d/Old", VM_SPOOL_DIR, x);
+		total += scan_count(dir);
+	}
+	printf("counts, %-14s %9.1f ms  (%.2f us a mailbox)\n", "scanning",
+		(now_usec() - t) / 1000.0, (now_usec() - t) / mailboxes);
+
+	/* Leaving a message in every mailbox, as far as the number goes */
+	t = now_usec();
+	for (x = 0; x < mailboxes; x++) {
+		snprintf(dir, sizeof(dir), "%sdefault/%d/INBOX", VM_SPOOL_DIR, x);
+		if (next_message(dir, MAXMSG) != messages) {
+			printf("FAILED: next message in %s is not %d\n", dir, messages);
+			failed = 1;
+			break;
+		}
+	}
+	printf("next message, %-8s %9.1f ms  (%.2f us a mailbox)\n", "indexed",
+		(now_usec() - t) / 1000.0, (now_usec() - t) / mailboxes);
+	t = now_usec();
+	for (x = 0; x < mailboxes; x++) {
+		snprintf(dir, sizeof(dir), "%sdefault/%d/INBOX", VM_SPOOL_DIR, x);
+		probe_next(dir, MAXMSG);
+	}
+	printf("next message, %-8s %9.1f ms  (%.2f us a mailbox)\n", "probing",
+		(now_usec() - t) / 1000.0, (now_usec() - t) / mailboxes);
+	printf("index memory %.1f MB\n", index_memory() / (1024 * 1024));
+
+	/* A new message, and a stray file that is not one */
+	snprintf(dir, sizeof(dir), "%sdefault/0/INBOX", VM_SPOOL_DIR);
+	snprintf(fn, sizeof(fn), "%s/msg%04d.bak", dir, messages);
+	touch(fn);
+	if (next_message(dir, MAXMSG) != messages) {
+		printf("FAILED: a file in no known format took a message number\n");
+		failed = 1;
+	}
+	snprintf(fn, sizeof(fn), "%s/msg%04d.wav", dir, messages);
+	touch(fn);
+	snprintf(fn, sizeof(fn), "%s/msg%04d.txt", dir, messages);
+	touch(fn);
+	inboxcount("0@default", &newmsgs, &oldmsgs);
+	if ((newmsgs != messages + 1) || (next_message(dir, MAXMSG) != messages + 1)) {
+		printf("FAILED: a new message was not seen\n");
+		failed = 1;
+	}
+
+	vm_index_free_all();
+	if (!failed)
+		printf("All checks passed\n");
+done:
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", spool);
+	if (system(cmd))
+		fprintf(stderr, "Unable to remove %s\n", spool);
+
+	return failed;
+}